@@ -0,0 +1,11 @@
+#!/bin/sh
+# Usage: bench/codegen.sh [functions] [threads] [cache]
+# Reports the time spent generating code for a program of many functions
+# from bench/generate.sh, each calling the next two.
+# With a cache directory, the code is taken from it after the first round.
+set -e
+cd "$(dirname "$0")/.."
+source=$(mktemp /tmp/flexul-bench-XXXXXX.fx)
+trap 'rm -f "$source"' EXIT
+bench/generate.sh "${1:-5000}" calls > "$source"
+./fx "$source" --bench=codegen --threads="${2:-0}" ${3:+--cache="$3"}
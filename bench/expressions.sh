@@ -0,0 +1,24 @@
+#!/bin/sh
+# Usage: bench/expressions.sh [terms] [functions]
+# Reports the time spent parsing and resolving names in a program of
+# functions that each return one long expression over every binary operator
+set -e
+cd "$(dirname "$0")/.."
+source=$(mktemp /tmp/flexul-bench-XXXXXX.fx)
+trap 'rm -f "$source"' EXIT
+awk -v terms="${1:-2000}" -v n="${2:-200}" 'BEGIN {
+    split("+ - * / % << >> & | ^ < > <= >= == != && ||", ops, " ")
+    print "include core;"
+    for (f = 0; f < n; f++) {
+        print "\nfn expression_" f "(x, y) {"
+        line = "    return x"
+        for (t = 1; t < terms; t++) {
+            line = line " " ops[(f + t) % 18 + 1] " "
+            line = line (t % 3 == 0 ? "-y" : t % 97 + 1)
+        }
+        print line ";"
+        print "}"
+    }
+    print "\nfn main() {\n    return expression_0(3, 4) & 255;\n}"
+}' > "$source"
+./fx "$source" --bench=frontend
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Usage: bench/generate.sh [functions] [calls] > program.fx
+# Writes a program of many similar functions, as large as needed for the
+# front-end benchmarks. With calls, each function also calls the next two,
+# so that all of them are reachable from main and get code generated.
+awk -v n="${1:-20000}" -v calls="${2:-}" 'BEGIN {
+    print "include core;\n\nvar table[64];"
+    for (i = 0; i < n; i++) {
+        print "\n# Function " i
+        print "fn step_" i "(count, scale) {"
+        print "    var i;"
+        print "    var total = " i ";"
+        print "    for (i = 0; i < count; i = i + 1) {"
+        print "        table[i % 64] = table[i % 64] + i * (scale + " i ");"
+        print "        if (total > 1000 && i != 7 || scale == \047x\047) {"
+        print "            total = total - table[i % 64] / 2 + (scale << 1);"
+        print "        } else {"
+        print "            total = total + step_" i "(count - 1, scale) % 3;"
+        print "        }"
+        print "    }"
+        for (c = 2 * i + 1; calls && c <= 2 * i + 2 && c < n; c++) {
+            print "    total = total + step_" c "(count, total);"
+        }
+        print "    return total;"
+        print "}"
+    }
+    print "\nfn main() {\n    return step_0(4, 2);\n}"
+}'
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Usage: bench/includes.sh [files] [functions] [threads]
+# Reports the time spent parsing and resolving names in a program split
+# into many library files of many functions, all included by its main file
+set -e
+cd "$(dirname "$0")/.."
+root=$(pwd)
+dir=$(mktemp -d /tmp/flexul-bench-XXXXXX)
+trap 'rm -rf "$dir"' EXIT
+ln -s "$root/std" "$dir/std"
+awk -v files="${1:-32}" -v n="${2:-500}" -v dir="$dir" 'BEGIN {
+    main = dir "/main.fx"
+    print "include core;" > main
+    for (f = 0; f < files; f++) {
+        lib = dir "/lib_" f
+        print "include lib_" f ";" > main
+        print "include core;" > lib
+        for (i = 0; i < n; i++) {
+            print "\nfn step_" f "_" i "(count, scale) {" > lib
+            print "    var i;" > lib
+            print "    var total = " i ";" > lib
+            print "    for (i = 0; i < count; i = i + 1) {" > lib
+            print "        total = total + i * (scale + " i ") % 7;" > lib
+            print "        if (total > 1000 && i != 7 || scale == 3) {" > lib
+            print "            total = total - (scale << 1);" > lib
+            print "        }" > lib
+            print "    }" > lib
+            print "    return total;" > lib
+            print "}" > lib
+        }
+        close(lib)
+    }
+    print "\nfn main() {\n    return step_0_0(4, 2);\n}" > main
+}'
+cd "$dir"
+"$root/fx" main.fx --bench=frontend --threads="${3:-0}"
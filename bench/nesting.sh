@@ -0,0 +1,30 @@
+#!/bin/sh
+# Usage: bench/nesting.sh [depth] [globals]
+# Reports the time spent parsing and resolving names in a program of many
+# globals and functions of deeply nested blocks
+set -e
+cd "$(dirname "$0")/.."
+source=$(mktemp /tmp/flexul-bench-XXXXXX.fx)
+trap 'rm -f "$source"' EXIT
+awk -v depth="${1:-200}" -v n="${2:-2000}" 'BEGIN {
+    print "include core;\n"
+    for (i = 0; i < n; i++) {
+        print "var global_" i ";"
+    }
+    for (f = 0; f < 20; f++) {
+        print "\nfn nested_" f "(x) {"
+        print "    var v0 = x;"
+        for (d = 1; d <= depth; d++) {
+            print "    {"
+            print "        var v" d " = v" d - 1 " + global_" d % n ";"
+            print "        var x = v" d ";"
+        }
+        for (d = depth; d >= 1; d--) {
+            print "    }"
+        }
+        print "    return v0;"
+        print "}"
+    }
+    print "\nfn main() {\n    return nested_0(1);\n}"
+}' > "$source"
+./fx "$source" --bench=frontend
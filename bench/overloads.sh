@@ -0,0 +1,32 @@
+#!/bin/sh
+# Usage: bench/overloads.sh [functions] [types] [threads]
+# Reports the time spent resolving a program of many calls to a function
+# overloaded on every pair of a number of types
+set -e
+cd "$(dirname "$0")/.."
+source=$(mktemp /tmp/flexul-bench-XXXXXX.fx)
+trap 'rm -f "$source"' EXIT
+awk -v n="${1:-4000}" -v t="${2:-8}" 'BEGIN {
+    print "include core;\n"
+    for (i = 0; i < t; i++) {
+        print "typedef T" i ";"
+    }
+    for (i = 0; i < t; i++) {
+        for (j = 0; j < t; j++) {
+            print "\nfn mix(a: T" i ", b: T" j ") -> T" i " {"
+            print "    return a;"
+            print "}"
+        }
+    }
+    for (k = 0; k < n; k++) {
+        i = k % t
+        j = int(k / t) % t
+        print "\nfn use_" k "(a: T" i ", b: T" j ") {"
+        print "    var x: T" i " = mix(a, b);"
+        print "    var y: T" j " = mix(b, x);"
+        print "    return mix(mix(x, y), mix(y, a));"
+        print "}"
+    }
+    print "\nfn main() {\n    return 0;\n}"
+}' > "$source"
+./fx "$source" --bench=frontend --threads="${3:-0}"
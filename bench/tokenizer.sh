@@ -0,0 +1,9 @@
+#!/bin/sh
+# Usage: bench/tokenizer.sh [functions]
+# Reports the throughput of the tokenizer on a generated program
+set -e
+cd "$(dirname "$0")/.."
+source=$(mktemp /tmp/flexul-bench-XXXXXX.fx)
+trap 'rm -f "$source"' EXIT
+bench/generate.sh "${1:-20000}" > "$source"
+./fx "$source" --bench=tokenizer
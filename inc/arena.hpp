@@ -0,0 +1,63 @@
+#ifndef FLEXUL_ARENA_HPP
+#define FLEXUL_ARENA_HPP
+
+#include <memory_resource>
+#include <memory>
+#include <vector>
+#include <span>
+#include <new>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+
+// Memory for the nodes of a compilation, taken in large blocks and freed
+// all at once with the arena. Objects in it are never destroyed, so they
+// may only own memory of the same arena.
+class Arena {
+public:
+    Arena();
+    Arena(Arena const &) = delete;
+    Arena &operator =(Arena const &) = delete;
+
+    // An arena freed with this one, for another thread to make objects in
+    Arena &branch();
+
+    template<typename T, typename... Args>
+    T *make(Args &&...args) {
+        static_assert(std::is_trivially_destructible_v<T>, 
+                "objects in an arena are never destroyed");
+        void *memory = m_memory.allocate(sizeof(T), alignof(T));
+        return new (memory) T(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    std::span<T const> copy(std::span<T const> items) {
+        static_assert(std::is_trivially_destructible_v<T>, 
+                "objects in an arena are never destroyed");
+        if (items.empty()) {
+            return {};
+        }
+        T *data = static_cast<T *>(m_memory.allocate(
+                items.size() * sizeof(T), alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), data);
+        return {data, items.size()};
+    }
+
+    template<typename T>
+    std::span<T const> copy(std::vector<T> const &items) {
+        return copy(std::span<T const>(items));
+    }
+private:
+    static constexpr std::size_t initial_size = 64 * 1024;
+
+    std::pmr::monotonic_buffer_resource m_memory;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<Arena>> m_branches;
+};
+
+// Nodes made in an arena, like the children of a tree node
+template<typename T>
+using NodeList = std::span<T *const>;
+
+#endif
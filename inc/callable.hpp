@@ -2,6 +2,7 @@
 #define FLEXUL_CALLABLE_HPP
 
 #include "symbol.hpp"
+#include "arena.hpp"
 #include <vector>
 #include <unordered_map>
 #include <stack>
@@ -33,7 +34,7 @@ class InlineFrames {
 public:
     InlineFrames(Serializer &serializer);
 
-    void open_call(std::vector<std::unique_ptr<ExpressionNode>> const &args, 
+    void open_call(NodeList<ExpressionNode> args, 
             std::vector<SymbolId> const &param_ids, bool writeback);
     void use(Serializer &serializer, SymbolId id);
     void use_address(Serializer &serializer, SymbolId id);
@@ -0,0 +1,87 @@
+#ifndef FLEXUL_CODECACHE_HPP
+#define FLEXUL_CODECACHE_HPP
+
+#include "serializer.hpp"
+#include "symbol.hpp"
+#include "source.hpp"
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <cstdint>
+
+enum class Relocation : uint8_t {
+    None, Label, Symbol
+};
+
+// Code of a function apart from the program it was generated for. The
+// data of relocated entries is the index of a label taken by the function,
+// or the id of a symbol, which is stored by name.
+struct CodeObject {
+    CodeObject();
+
+    std::vector<StackEntry> code;
+    std::vector<Relocation> relocations;
+    uint32_t n_labels;
+    std::vector<SymbolId> jobs;
+    std::vector<std::string> remarks;
+    bool address_taken;
+};
+
+// Code objects kept across builds in a directory, in one module per source
+// file, which holds those of the functions defined in it. An object is
+// reused when the function, every symbol it refers to, directly or through
+// other functions, and the options are unchanged.
+// Symbols are named by their name, type and rank among the symbols alike,
+// so that objects do not depend on the ids given to them.
+class CodeCache {
+public:
+    CodeCache(std::string directory, SymbolTable const &symbol_table,
+            SourceManager const &sources, std::string const &options);
+
+    std::optional<CodeObject> load(SymbolId id);
+    void store(SymbolId id, CodeObject const &object);
+    // Writes the modules that objects were stored in
+    void save() const;
+private:
+    static constexpr uint64_t version = 1;
+
+    // Encoded objects of the functions of a file, by name
+    struct Module {
+        struct Entry {
+            uint64_t key;
+            std::shared_ptr<std::string const> data;
+        };
+
+        bool loaded = false;
+        bool changed = false;
+        std::unordered_map<std::string, Entry> objects;
+    };
+
+    bool is_global(SymbolId id) const;
+    void name_symbols();
+    void hash_symbols();
+    uint64_t hash_definition(SymbolId id, std::vector<SymbolId> &refs);
+    std::string path(FileId file) const;
+    Module *module(SymbolId id);
+    std::string encode(CodeObject const &object) const;
+    std::optional<CodeObject> decode(std::string const &data) const;
+
+    std::string m_directory;
+    SymbolTable const &m_symbol_table;
+    SourceManager const &m_sources;
+    // Modules made with other options are kept apart
+    uint64_t m_options;
+    std::vector<std::string> m_names;
+    StringMap<SymbolId> m_ids;
+    // Hash of everything the code of each symbol may depend on
+    std::vector<uint64_t> m_keys;
+    // File that each symbol is defined in
+    std::vector<FileId> m_files;
+    std::vector<Module> m_modules;
+    std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef FLEXUL_INTERNER_HPP
+#define FLEXUL_INTERNER_HPP
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <deque>
+#include <shared_mutex>
+#include <mutex>
+#include <cstdint>
+
+// Dense id of an interned name
+using Atom = uint32_t;
+
+constexpr Atom no_atom = UINT32_MAX;
+
+// Gives each distinct name an atom, numbered from 0, so that names are
+// compared and looked up as integers. Files tokenized on several threads
+// share one interner, so the atoms of names first seen in different files
+// are numbered in no particular order.
+class Interner {
+public:
+    Interner();
+
+    Atom intern(std::string_view name);
+    // The atom of a name, or no_atom if it was never interned
+    Atom find(std::string_view name) const;
+    std::string_view name(Atom atom) const;
+    std::size_t size() const;
+private:
+    // Views of the names, which the deque never moves
+    std::unordered_map<std::string_view, Atom> m_atoms;
+    std::deque<std::string> m_names;
+    mutable std::shared_mutex m_mutex;
+};
+
+// The atoms one thread has looked up, so that it finds names it has seen
+// before without locking the interner they came from
+class AtomCache {
+public:
+    AtomCache(Interner &interner);
+
+    Atom intern(std::string_view name);
+private:
+    Interner &m_interner;
+    // Views of the names held by the interner
+    std::unordered_map<std::string_view, Atom> m_atoms;
+};
+
+#endif
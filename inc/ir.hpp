@@ -0,0 +1,126 @@
+#ifndef FLEXUL_IR_HPP
+#define FLEXUL_IR_HPP
+
+#include "opcodes.hpp"
+#include "symbol.hpp"
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+class FunctionNode;
+
+struct IrBlock;
+
+// Instructions of the mid-level IR. Values are in SSA form: every
+// instruction producing a value defines it exactly once, and values
+// merging at a block are chosen by its phis, one argument per predecessor.
+enum class IrOp {
+    Const,      // imm
+    Param,      // parameter at frame offset imm, never written
+    FrameAddr,  // bp + imm
+    GlobalAddr, // address of global symbol imm
+    FuncAddr,   // address of function symbol imm
+    Load,       // mem[a0]
+    Store,      // mem[a0] = a1
+    Unary,      // func a0
+    Binary,     // a0 func a1
+    Select,     // a0 ? a1 : a2, without branching
+    Call,       // call function symbol imm with arguments a0 ..
+    CallDyn,    // call the last argument with the others
+    SysCall,    // func a0 ..
+    Phi,        // a0 .. by predecessor
+    Jump,       // goto t0
+    Branch,     // if a0 goto t0 else t1
+    Switch,     // goto the target after t0 of the case equal to a0, else t0
+    Return      // return a0
+};
+
+struct IrInstr {
+    IrInstr(IrOp op, FuncCode funccode, int32_t imm,
+            std::vector<IrInstr *> args);
+
+    bool has_value() const;
+    bool has_side_effects() const;
+    bool is_terminator() const;
+    // Cheap to compute wherever needed, so never kept in a frame slot
+    bool is_rematerializable() const;
+    bool is_commutative() const;
+
+    IrOp op;
+    FuncCode funccode;
+    int32_t imm;
+    std::vector<IrInstr *> args;
+    std::vector<IrBlock *> targets;
+    // Values of a Switch, one for each target after the first
+    std::vector<int32_t> cases;
+    IrBlock *block;
+    uint32_t id;
+};
+
+struct IrBlock {
+    IrBlock(uint32_t id);
+
+    IrInstr *terminator() const;
+    std::vector<IrBlock *> successors() const;
+    std::size_t first_non_phi() const;
+
+    uint32_t id;
+    std::vector<std::unique_ptr<IrInstr>> instrs;
+    std::vector<IrBlock *> preds;
+};
+
+// A function in SSA form, the first block being its entry
+struct IrFunction {
+    IrFunction(FunctionNode const *node, std::string name);
+
+    IrBlock *add_block();
+    IrInstr *append(IrBlock *block, IrOp op, FuncCode funccode = FuncCode::Nop,
+            int32_t imm = 0, std::vector<IrInstr *> args = {});
+    IrInstr *insert(IrBlock *block, std::size_t index, IrOp op,
+            FuncCode funccode = FuncCode::Nop, int32_t imm = 0,
+            std::vector<IrInstr *> args = {});
+    void add_edge(IrBlock *from, IrBlock *to);
+    void remove_edge(IrBlock *from, IrBlock *to);
+    void replace_uses(IrInstr *from, IrInstr *to);
+    bool remove_unreachable();
+    void split_critical_edges();
+
+    std::vector<IrBlock *> reverse_postorder() const;
+    std::unordered_map<IrBlock *, IrBlock *> immediate_dominators() const;
+    std::unordered_map<IrInstr *, uint32_t> use_counts() const;
+    std::size_t size() const;
+    void verify() const;
+    void dump() const;
+
+    FunctionNode const *node;
+    std::string name;
+    std::vector<std::unique_ptr<IrBlock>> blocks;
+    uint32_t next_value;
+    uint32_t next_block;
+};
+
+// Functions of a program lowered to the IR. Functions using constructs the
+// IR does not cover are left to the tree serializer.
+class IrModule {
+public:
+    IrModule();
+
+    void add(std::unique_ptr<IrFunction> function);
+    void add_unlowered(FunctionNode const *node, std::string const &name,
+            std::string const &reason);
+    IrFunction *find(SymbolId id) const;
+    std::vector<std::unique_ptr<IrFunction>> const &functions() const;
+
+    void add_remark(std::string const &remark);
+    std::vector<std::string> const &remarks() const;
+    void dump() const;
+private:
+    std::vector<std::unique_ptr<IrFunction>> m_functions;
+    std::unordered_map<SymbolId, IrFunction *> m_by_id;
+    std::vector<std::pair<std::string, std::string>> m_unlowered;
+    std::vector<std::string> m_remarks;
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef FLEXUL_IRBUILDER_HPP
+#define FLEXUL_IRBUILDER_HPP
+
+#include "ir.hpp"
+#include "symbol.hpp"
+#include "passes.hpp"
+#include "arena.hpp"
+#include <vector>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+class ExpressionNode;
+
+// Target of an assignment: a local kept as SSA value, or a memory address
+struct IrLvalue {
+    SymbolId variable;
+    IrInstr *address;
+};
+
+struct IrEnvironment;
+
+// Argument of an inline call, lowered where the parameter is used, in the
+// environment of the call. The first argument of a writeback call is
+// accessed through its lvalue instead.
+struct IrBinding {
+    ExpressionNode const *node;
+    std::shared_ptr<IrEnvironment> environment;
+    std::optional<IrLvalue> writeback;
+    bool used;
+};
+
+struct IrEnvironment {
+    std::unordered_map<SymbolId, IrBinding> params;
+};
+
+// Lowers function bodies of a resolved tree to the IR. Scalar locals whose
+// address is never needed become SSA values, with phis placed while the
+// blocks are built: a block is sealed once all its predecessors are known,
+// and reads in unsealed blocks get phis completed when it is sealed.
+class IrBuilder {
+public:
+    IrBuilder(SymbolTable const &symbol_table, PassSet const &passes);
+
+    IrModule build();
+    std::unique_ptr<IrFunction> lower_function(FunctionNode const *node);
+
+    SymbolTable const &symbol_table() const;
+    PassSet const &passes() const;
+    IrFunction &function();
+    IrBlock *block() const;
+    IrBlock *new_block();
+    void set_block(IrBlock *block);
+    void seal(IrBlock *block);
+
+    IrInstr *emit(IrOp op, FuncCode funccode = FuncCode::Nop, int32_t imm = 0,
+            std::vector<IrInstr *> args = {});
+    IrInstr *constant(int32_t value);
+    void jump(IrBlock *target);
+    void branch(IrInstr *cond, IrBlock *case_true, IrBlock *case_false);
+    void switch_on(IrInstr *value, IrBlock *otherwise, 
+            std::vector<std::pair<int32_t, IrBlock *>> const &cases);
+    void ret(IrInstr *value);
+    IrInstr *phi(IrBlock *block, std::vector<IrInstr *> args);
+
+    IrLvalue variable_lvalue(SymbolId id);
+    IrInstr *load(IrLvalue const &lvalue);
+    void store(IrLvalue const &lvalue, IrInstr *value);
+    IrInstr *address_of(IrLvalue const &lvalue);
+
+    IrInstr *lower_param(SymbolId id);
+    IrLvalue lower_param_lvalue(SymbolId id);
+    std::shared_ptr<IrEnvironment> open_inline_call(
+            NodeList<ExpressionNode> args,
+            std::vector<SymbolId> const &param_ids,
+            std::optional<IrLvalue> writeback);
+    void close_inline_call(std::shared_ptr<IrEnvironment> saved);
+private:
+    // Thrown when a local promoted to an SSA value turns out to need an
+    // address, so that the function is lowered again with it in memory
+    struct Restart {};
+
+    IrBinding &binding(SymbolId id);
+    IrInstr *read_variable(SymbolId id, IrBlock *block);
+    IrInstr *read_variable_recursive(SymbolId id, IrBlock *block);
+    void write_variable(SymbolId id, IrBlock *block, IrInstr *value);
+    IrInstr *add_phi_operands(SymbolId id, IrInstr *phi);
+    IrInstr *remove_trivial_phi(IrInstr *phi);
+    IrInstr *resolve(IrInstr *value) const;
+    IrInstr *undefined();
+    void finish();
+
+    SymbolTable const &m_symbol_table;
+    PassSet m_passes;
+    std::unique_ptr<IrFunction> m_function;
+    IrBlock *m_block;
+    std::unordered_set<SymbolId> m_in_memory;
+    std::unordered_map<IrBlock *,
+            std::unordered_map<SymbolId, IrInstr *>> m_definitions;
+    std::unordered_map<IrBlock *,
+            std::vector<std::pair<SymbolId, IrInstr *>>> m_incomplete;
+    std::unordered_set<IrBlock *> m_sealed;
+    // Phis found trivial, by the value replacing them
+    std::unordered_map<IrInstr *, IrInstr *> m_replaced;
+    std::shared_ptr<IrEnvironment> m_environment;
+};
+
+#endif
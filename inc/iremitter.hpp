@@ -0,0 +1,40 @@
+#ifndef FLEXUL_IREMITTER_HPP
+#define FLEXUL_IREMITTER_HPP
+
+#include "ir.hpp"
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+
+class Serializer;
+
+// Emits a function in SSA form as stack code. A value used once, right
+// after it is computed, stays on the stack for its user; other values are
+// kept in frame slots after the locals, and phis by copies at the end of
+// their predecessors.
+class IrEmitter {
+public:
+    IrEmitter(Serializer &serializer, IrFunction &function);
+
+    void emit();
+private:
+    void stackify(IrInstr *user, std::vector<IrInstr *> const &operands,
+            std::ptrdiff_t &cursor);
+    std::vector<IrInstr *> operands(IrInstr *instr) const;
+    void emit_block(IrBlock *block, IrBlock *next);
+    void emit_value(IrInstr *instr);
+    void emit_operand(IrInstr *instr);
+    void emit_instr(IrInstr *instr);
+    void emit_terminator(IrInstr *instr, IrBlock *next);
+
+    Serializer &m_serializer;
+    IrFunction &m_function;
+    std::unordered_map<IrInstr *, uint32_t> m_uses;
+    // Values computed on the stack by their user
+    std::unordered_set<IrInstr *> m_stacked;
+    std::unordered_map<IrInstr *, uint32_t> m_slots;
+    std::unordered_map<IrBlock *, uint32_t> m_labels;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef FLEXUL_IRPASSES_HPP
+#define FLEXUL_IRPASSES_HPP
+
+#include "ir.hpp"
+#include <vector>
+#include <string>
+#include <memory>
+#include <optional>
+#include <cstdint>
+
+// A transformation of IR functions, returning the number of changes made
+class IrPass {
+public:
+    virtual ~IrPass();
+
+    virtual std::string name() const = 0;
+    virtual uint32_t run(IrFunction &function) const = 0;
+};
+
+// Evaluates operations on constants, simplifies algebraic identities,
+// phis and selects of a single value, and resolves branches on constants
+class ConstantFolding : public IrPass {
+public:
+    std::string name() const override;
+    uint32_t run(IrFunction &function) const override;
+};
+
+// Reuses pure values computed in a dominating block, and loads of an
+// address not stored to since it was loaded or stored in the same block
+class CommonSubexpressions : public IrPass {
+public:
+    std::string name() const override;
+    uint32_t run(IrFunction &function) const override;
+};
+
+// Removes unreachable blocks, and instructions whose value is never used
+// and which have no effect
+class DeadCodeElimination : public IrPass {
+public:
+    std::string name() const override;
+    uint32_t run(IrFunction &function) const override;
+};
+
+// Merges blocks into their only predecessor and bypasses empty blocks
+class SimplifyCfg : public IrPass {
+public:
+    std::string name() const override;
+    uint32_t run(IrFunction &function) const override;
+};
+
+std::optional<int32_t> fold_unary(FuncCode funccode, int32_t a);
+
+std::optional<int32_t> fold_binary(FuncCode funccode, int32_t a, int32_t b);
+
+// Runs its passes over each function until none changes it, verifying the
+// function after each change
+class IrPassManager {
+public:
+    IrPassManager();
+
+    static IrPassManager standard();
+
+    void add(std::unique_ptr<IrPass> pass);
+    void run(IrModule &module) const;
+private:
+    static constexpr uint32_t max_rounds = 8;
+
+    std::vector<std::unique_ptr<IrPass>> m_passes;
+};
+
+#endif
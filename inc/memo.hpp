@@ -0,0 +1,43 @@
+#ifndef FLEXUL_MEMO_HPP
+#define FLEXUL_MEMO_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <optional>
+#include <cstdint>
+
+// Direct-mapped caches of results of memoized functions, keyed on their
+// arguments. A miss is completed by the store of the function result.
+class MemoCaches {
+public:
+    std::optional<uint32_t> load(uint32_t table, std::vector<uint32_t> key);
+    void store(uint32_t table, uint32_t value);
+    // Names of the functions owning the tables, for the analytics
+    void set_names(std::unordered_map<uint32_t, std::string> names);
+    void analytics() const;
+private:
+    struct Slot {
+        bool valid = false;
+        std::vector<uint32_t> key;
+        uint32_t value = 0;
+    };
+    struct Cache {
+        std::vector<Slot> slots;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+    struct Pending {
+        Cache *cache;
+        std::size_t slot;
+        std::vector<uint32_t> key;
+    };
+    static constexpr std::size_t cache_size = 4096;
+
+    std::unordered_map<uint32_t, Cache> m_caches;
+    std::unordered_map<uint32_t, std::string> m_names;
+    std::vector<Pending> m_pending;
+};
+
+#endif
@@ -16,4 +16,6 @@ std::string const &get_op_name(OpCode opcode);
 
 std::string const &get_func_name(OpCode opcode, FuncCode funccode);
 
+bool has_count(OpCode opcode);
+
 #endif
@@ -1,6 +1,8 @@
 #ifndef FLEXUL_OPCODES_HPP
 #define FLEXUL_OPCODES_HPP
 
+#include <cstdint>
+
 enum class OpCode {
     Nop = 0,
     SysCall,
@@ -18,7 +20,15 @@ enum class OpCode {
     Ret,
     Jump,
     BrTrue,
-    BrFalse
+    BrFalse,
+    TailCall,
+    StoreRel,
+    MemoLoad,
+    MemoStore,
+    LoadReg,
+    StoreReg,
+    Select,
+    JumpTable
 };
 
 enum class FuncCode {
@@ -33,12 +43,31 @@ enum class FuncCode {
     LessThan,
     LessEquals,
     Assign,
+    And,
+    Or,
+    Xor,
+    Shl,
+    Shr,
 
     Neg = 1, // unary
+    Not,
 
     Exit = 1, // syscall
     PutC,
     GetC
 };
 
+// Position in the bytecode, resolved once serialization is done
+using Label = uint32_t;
+
+// Words pushed by Call above the arguments: the caller's bp and ip
+constexpr uint32_t call_frame_size = 2;
+
+// Counts of arguments, frame arguments and register indices are encoded in
+// a byte of the instruction
+constexpr uint32_t max_count = 0xFF;
+
+// Registers in the window of each frame, for its first scalar locals
+constexpr uint32_t frame_registers = 4;
+
 #endif
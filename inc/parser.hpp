@@ -2,64 +2,132 @@
 #define FLEXUL_PARSER_HPP
 
 #include "tokenizer.hpp"
+#include "source.hpp"
 #include "tree.hpp"
-#include <fstream>
-#include <unordered_set>
-#include <stack>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
+// Something a file does to what is read after it, in the files read with
+// it: it includes a file, or declares the type of a kind of literal
+struct Directive {
+    // The declarations and literals of the file read before it
+    std::size_t declarations;
+    std::size_t literals;
+    // The included file, or no_file for a declaration
+    FileId include;
+    TokenType literal;
+    TypeNode *type;
+};
+
+// The declarations of one file, and what it leaves to be resolved across
+// files. A file that failed to parse keeps what it read before the error.
+struct FileSyntax {
+    std::vector<StatementNode *> declarations;
+    // Literals, and the and/or nodes typed like both boolean literals, 
+    // whose types are declared before them, in any file
+    std::vector<ExpressionNode *> literals;
+    std::vector<Directive> directives;
+    std::exception_ptr error;
+};
+
+// Parses one file, without the files it includes. Tokens of the tree refer
+// to the sources, and its nodes are made in the arena, so both must outlive
+// the tree.
 class Parser {
 public:
-    Parser();
-    Parser(std::string const &filename);
-    std::unique_ptr<BaseNode> parse();
+    Parser(SourceManager &sources, Arena &arena, AtomCache &atoms, 
+            FileId file, std::function<void(FileId)> on_include);
+    FileSyntax parse();
 private:
-    // Overrides curr_token
-    void include_file(std::string const &filename);
-
     Token get_token();
-    
-    TypeNode *get_literal_type(TokenType type);
 
-    Token expect_data(std::string const &data);
+    Token expect_data(std::string_view data);
     Token expect_type(TokenType type);
     Token expect_token(Token const &other);
-    Token accept_data(std::string const &data);
+    Token accept_data(std::string_view data);
     Token accept_type(TokenType type);
-    Token check_data(std::string const &data) const;
+    Token check_data(std::string_view data) const;
     Token check_type(TokenType type) const;
 
-    std::unique_ptr<BaseNode> parse_filebody();
+    void parse_filebody();
     void parse_include();
-    std::unique_ptr<StatementNode> parse_function_declaration();
-    std::unique_ptr<StatementNode> parse_inline_declaration();
-    std::unique_ptr<ExpressionListNode> parse_param_list();
+    StatementNode *parse_function_declaration();
+    StatementNode *parse_inline_declaration();
+    ExpressionListNode *parse_param_list();
     CallableSignature parse_param_declaration();
-    std::unique_ptr<StatementNode> parse_braced_block(bool is_scoped);
-    std::unique_ptr<StatementNode> parse_type_declaration();
-    std::unique_ptr<TypeNode> parse_type();
-    std::unique_ptr<StatementNode> parse_statement(bool is_scoped);
-    std::unique_ptr<StatementNode> parse_if_else();
-    std::unique_ptr<StatementNode> parse_for();
-    std::unique_ptr<StatementNode> parse_while();
-    std::unique_ptr<StatementNode> parse_var_declaration();
-    std::unique_ptr<ExpressionNode> parse_expression();
-    std::unique_ptr<ExpressionNode> parse_assignment();
-    std::unique_ptr<ExpressionNode> parse_lambda();
-    std::unique_ptr<ExpressionNode> parse_ternary();
-    std::unique_ptr<ExpressionNode> parse_or();
-    std::unique_ptr<ExpressionNode> parse_and();
-    std::unique_ptr<ExpressionNode> parse_equality_1();
-    std::unique_ptr<ExpressionNode> parse_equality_2();
-    std::unique_ptr<ExpressionNode> parse_sum();
-    std::unique_ptr<ExpressionNode> parse_term();
-    std::unique_ptr<ExpressionNode> parse_value();
-    std::unique_ptr<ExpressionNode> parse_postfix(
-            std::unique_ptr<ExpressionNode> value);
+    StatementNode *parse_braced_block(bool is_scoped);
+    StatementNode *parse_type_declaration();
+    TypeNode *parse_type();
+    StatementNode *parse_statement(bool is_scoped);
+    StatementNode *parse_if_else();
+    StatementNode *parse_for();
+    StatementNode *parse_while();
+    StatementNode *parse_switch();
+    StatementNode *parse_var_declaration();
+    ExpressionNode *parse_expression();
+    // Throws if the tree is too deep for the walks after parsing
+    void check_depth(BaseNode const *node) const;
+    ExpressionNode *parse_assignment();
+    ExpressionNode *parse_lambda();
+    ExpressionNode *parse_ternary();
+    ExpressionNode *parse_binary();
+    void reduce_binary();
+    ExpressionNode *parse_value();
+    ExpressionNode *parse_primary();
+    ExpressionNode *parse_postfix(
+            ExpressionNode *value);
     
-    std::stack<Tokenizer> m_tokenizers;
+    SourceManager &m_sources;
+    Arena &m_arena;
+    Tokenizer m_tokenizer;
     Token m_curr_token;
-    std::unordered_set<std::string> m_included_files;
-    std::unordered_map<TokenType, TypeNode *> m_type_literals;
+    std::function<void(FileId)> m_on_include;
+    FileSyntax m_syntax;
+    // Operands and pending operators of the expressions being parsed, each
+    // parse_binary and parse_value working above those of its callers
+    std::vector<ExpressionNode *> m_operands;
+    std::vector<std::pair<Token, uint8_t>> m_operators;
+    std::vector<Token> m_prefixes;
+    // Tokens read, and expressions being parsed within each other
+    std::size_t m_n_tokens;
+    uint32_t m_nesting;
+};
+
+// Parses a file and the files it includes, each once, on a pool of threads,
+// as they are found. Their declarations are spliced where each file is
+// first included, so the tree is the same as if the includes were read in
+// place, whatever the number of threads.
+class ProgramParser {
+public:
+    ProgramParser(SourceManager &sources, Arena &arena, 
+            std::string const &filename, uint32_t n_threads);
+    BaseNode *parse();
+private:
+    // Parses queued files until none is queued or being parsed
+    void work();
+    void schedule(FileId file);
+    void splice(FileId file, std::vector<StatementNode *> &declarations);
+    void set_literal_type(ExpressionNode *literal);
+
+    SourceManager &m_sources;
+    Arena &m_arena;
+    std::string m_filename;
+    uint32_t m_n_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<FileId> m_queue;
+    uint32_t m_n_busy;
+    // Indexed by file, sized as files are found
+    std::vector<bool> m_scheduled;
+    std::vector<FileSyntax> m_files;
+    std::vector<bool> m_spliced;
+    // Indexed by the token type of each kind of literal
+    std::vector<TypeNode *> m_literal_types;
 };
 
 #endif
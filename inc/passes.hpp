@@ -0,0 +1,29 @@
+#ifndef FLEXUL_PASSES_HPP
+#define FLEXUL_PASSES_HPP
+
+#include <string>
+#include <cstdint>
+
+enum class Pass {
+    Peephole, TailCalls, Inline, ConstEval, AutoMemo, StrengthReduce, 
+    Licm, InductionVars, Unroll, ValueNumbering, Registers, Select, 
+    JumpTables, Ssa, Count
+};
+
+// Optimization passes enabled for a compilation
+class PassSet {
+public:
+    PassSet();
+
+    static PassSet level(uint32_t level);
+
+    void parse(std::string const &list);
+    void set(Pass pass, bool enabled);
+    bool has(Pass pass) const;
+
+    std::string to_string() const;
+private:
+    uint32_t m_mask;
+};
+
+#endif
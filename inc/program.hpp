@@ -1,27 +1,33 @@
 #ifndef FLEXUL_PROGRAM_HPP
 #define FLEXUL_PROGRAM_HPP
 
+#include "runtime.hpp"
 #include <fstream>
 #include <vector>
+#include <string>
 #include <cstdint>
-#include <ctime>
 
 class Program {
 public:
     Program();
     static Program load(std::vector<uint32_t>);
     uint32_t run();
-    void analytics() const;
+    Runtime &runtime();
     void dump_stack() const;
     void disassemble() const;
     void disassemble_instr(uint32_t instr, uint32_t next, uint32_t &i) const;
 private:
+    void return_from_call(uint32_t value, uint32_t n_args);
+    void memo_load(uint32_t table, uint32_t n_args);
+    void memo_store(uint32_t table);
+
     std::vector<uint32_t> m_stack;
     uint32_t m_ip;
     uint32_t m_bp;
-    
-    uint64_t m_completed_instrs;
-    clock_t m_execution_time;
+    // Register windows of all frames, the current one starting at m_rp
+    std::vector<uint32_t> m_registers;
+    uint32_t m_rp;
+    Runtime m_runtime;
 };
 
 #endif
@@ -0,0 +1,152 @@
+#ifndef FLEXUL_REGCODE_HPP
+#define FLEXUL_REGCODE_HPP
+
+#include "opcodes.hpp"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Three-address instructions of the register VM. Operands are slots of the
+// current frame, addressed relative to bp like LoadRel, or immediates.
+enum class RegOp {
+    Move,       // dst = [a]
+    MoveImm,    // dst = a
+    LoadAddr,   // dst = bp + a
+    LoadAbs,    // dst = mem[a]
+    Load,       // dst = mem[[a]]
+    Store,      // mem[[a]] = [b]
+    StoreImm,   // mem[[a]] = b
+    StoreAbs,   // mem[a] = [b]
+    Clear,      // dst .. dst + a = 0
+    Unary,      // dst = func [a]
+    Binary,     // dst = [a] func [b]
+    BinaryImm,  // dst = [a] func b
+    Select,     // dst = [a] ? [b] : [c]
+    Jump,       // goto a
+    BrTrue,     // if [a] goto b
+    BrFalse,    // if not [a] goto b
+    BrCmp,      // if ([a] func [b]) == dst goto c
+    BrCmpImm,   // if ([a] func b) == dst goto c
+    JumpTable,  // goto tables[c + min([a], b)]
+    Call,       // call a, with bp and ip saved at dst
+    CallDyn,    // call [a], with bp and ip saved at dst
+    TailCall,   // replace frame of c args by the b args below dst, goto a
+    TailCallDyn,// same, to [a]
+    Ret,        // return [a], releasing b args
+    RetImm,     // return a, releasing b args
+    MemoLoad,   // return memoized result of table a for b args, if any
+    MemoStore,  // memoize [b] in table a
+    GetReg,     // dst = register a
+    SetReg,     // register dst = [a]
+    SetRegImm,  // register dst = a
+    Exit,       // exit [a]
+    ExitImm,    // exit a
+    PutC,       // dst = putc [a]
+    GetC        // dst = getc
+};
+
+struct RegInstr {
+    RegOp op;
+    FuncCode funccode;
+    int32_t dst;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+};
+
+// Register code for a stack bytecode program. Memory starts with the
+// bytecode, so that global and frame addresses are the same in both VMs.
+struct RegCode {
+    std::vector<RegInstr> instrs;
+    std::vector<uint32_t> memory;
+    // Instruction at each bytecode address at which a dynamic call may
+    // enter, or no_entry
+    std::vector<uint32_t> entries;
+    // Targets of JumpTable instructions, each table ending with its default
+    std::vector<uint32_t> tables;
+    // Largest offset from bp used by the function entered at each
+    // instruction, 0 at instructions that are not entered by calls
+    std::vector<uint32_t> frame_sizes;
+
+    static constexpr uint32_t no_entry = UINT32_MAX;
+
+    void disassemble() const;
+};
+
+// Translates stack bytecode into register code. The depth of the operand
+// stack is known at each instruction, so stack positions become frame
+// slots, and loads and constants are only copied when their slot is needed.
+class RegisterCompiler {
+public:
+    RegisterCompiler(std::vector<uint32_t> const &bytecode,
+            std::vector<uint32_t> const &labels);
+
+    RegCode compile();
+private:
+    enum class ValueKind { Const, Ref, Stored };
+
+    // A value of the operand stack: a constant, the current value of a
+    // slot, or stored at its own position by an instruction
+    struct Value {
+        ValueKind kind;
+        int32_t data;
+        std::size_t producer;
+    };
+
+    struct Decoded {
+        uint32_t address;
+        OpCode opcode;
+        FuncCode funccode;
+        uint32_t count;
+        uint32_t frame_args;
+        bool has_immediate;
+        uint32_t immediate;
+        uint32_t size;
+    };
+
+    static constexpr int32_t unknown_depth = INT32_MIN;
+    static constexpr std::size_t no_producer = SIZE_MAX;
+
+    Decoded decode(uint32_t address) const;
+    bool pops_operand(Decoded const &instr) const;
+    void compute_depths();
+    void propagate(uint32_t address, int32_t depth, uint32_t entry);
+
+    bool translate(Decoded const &instr);
+    void start_block(uint32_t address);
+    void end_block();
+
+    std::size_t emit(RegOp op, FuncCode funccode, int32_t dst,
+            int32_t a = 0, int32_t b = 0, int32_t c = 0);
+    void push(Value value);
+    void push_stored(int32_t position, std::size_t producer);
+    Value pop();
+    Value operand(Decoded const &instr);
+    int32_t position(std::size_t index) const;
+    void materialize(std::size_t index);
+    void materialize_top(std::size_t count);
+    int32_t slot_of(Value const &value, int32_t position);
+    void write_slot(int32_t slot);
+    void flush_refs();
+    bool retarget(Value const &value, int32_t slot);
+    bool fuse_branch(Value const &value, bool sense, uint32_t target);
+
+    std::vector<uint32_t> const &m_bytecode;
+    std::vector<bool> m_labels;
+    std::vector<int32_t> m_depths;
+    // Entry of the function of each reachable instruction, and the
+    // deepest offset used by the function entered at each address
+    std::vector<uint32_t> m_owners;
+    std::vector<int32_t> m_frame_depths;
+    std::vector<uint32_t> m_worklist;
+
+    RegCode m_code;
+    std::vector<uint32_t> m_block_pcs;
+    // Branches and calls whose target is still a bytecode address
+    std::vector<std::size_t> m_jumps;
+    std::vector<Value> m_values;
+    int32_t m_depth;
+    std::size_t m_block_start;
+};
+
+#endif
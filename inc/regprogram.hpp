@@ -0,0 +1,30 @@
+#ifndef FLEXUL_REGPROGRAM_HPP
+#define FLEXUL_REGPROGRAM_HPP
+
+#include "regcode.hpp"
+#include "runtime.hpp"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Interpreter of register code, with the memory layout of the stack VM
+class RegisterProgram {
+public:
+    RegisterProgram();
+    static RegisterProgram load(RegCode code);
+    uint32_t run();
+    Runtime &runtime();
+private:
+    void enter_frame(uint32_t bp);
+    void return_from_call(uint32_t value, uint32_t n_args);
+
+    RegCode m_code;
+    uint32_t m_pc;
+    uint32_t m_bp;
+    // Register windows of all frames, the current one starting at m_rp
+    std::vector<uint32_t> m_registers;
+    uint32_t m_rp;
+    Runtime m_runtime;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef FLEXUL_RUNTIME_HPP
+#define FLEXUL_RUNTIME_HPP
+
+#include "memo.hpp"
+#include "opcodes.hpp"
+#include <string>
+#include <cstdint>
+#include <ctime>
+
+// State of a run that both VMs keep alike: limits, redirected I/O, memo 
+// caches and the counters reported by the analytics
+struct Runtime {
+    Runtime();
+
+    void set_limits(uint64_t max_instrs, std::size_t max_stack_size);
+    void set_io(std::string const *input, std::string *output);
+    int put_char(int c);
+    int get_char();
+    void analytics() const;
+
+    MemoCaches memo_caches;
+    uint64_t completed_instrs;
+    uint64_t max_instrs;
+    std::size_t stack_limit;
+    // Standard input and output are used when not redirected
+    std::string const *input;
+    std::size_t input_pos;
+    std::string *output;
+    std::size_t max_stack_size;
+    clock_t execution_time;
+};
+
+// Arithmetic of both VMs. Operations the host would trap on raise a 
+// runtime error instead.
+int32_t apply_unary(FuncCode funccode, int32_t a);
+int32_t apply_binary(FuncCode funccode, int32_t a, int32_t b);
+
+#endif
@@ -5,32 +5,66 @@
 #include "opcodes.hpp"
 #include "symbol.hpp"
 #include "callable.hpp"
+#include "passes.hpp"
+#include "ir.hpp"
+#include "source.hpp"
+#include "arena.hpp"
 #include <vector>
 #include <queue>
 #include <stack>
 #include <string>
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <cstdint>
 #include <fstream>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 
 class BaseNode;
 
 class CallableNode;
 
+class FunctionNode;
+
 class Serializer;
 
-using Label = uint32_t;
+class CodeCache;
+
+struct CodeObject;
 
 using LabelMap = std::unordered_map<Label, uint32_t>;
 
 struct JobEntry {
     JobEntry();
-    JobEntry(uint32_t label, BaseNode *node, bool no_serialize);
+    JobEntry(uint32_t label, BaseNode *node, bool no_serialize, 
+            uint32_t n_args = 0);
 
     uint32_t label;
     BaseNode *node;
     bool no_serialize;
+    // Arguments released on return, for bodies that do not open a frame
+    uint32_t n_args;
+};
+
+// Function body expanded at the call site: its parameters and locals are 
+// mapped to scratch slots in the frame of the enclosing function
+struct InlinedCall {
+    InlinedCall(SymbolId id, uint32_t base, uint32_t n_params, Label exit);
+
+    SymbolId id;
+    uint32_t base;
+    uint32_t n_params;
+    Label exit;
+};
+
+// Role of an expression in local value numbering: the first computation 
+// of a value keeps a copy in a frame slot, later ones load it, and an 
+// argument equal to the preceding one duplicates it
+enum class ValueUse {
+    Keep, Reuse, Dup
 };
 
 enum class EntryType {
@@ -47,14 +81,32 @@ public:
             bool references_label = false);
     static StackEntry instr(OpCode opcode, FuncCode funccode, 
             uint32_t data, bool references_label = false);
+    static StackEntry counted(OpCode opcode, uint32_t count);
+    static StackEntry counted(OpCode opcode, uint32_t count, 
+            uint32_t data, bool references_label = false);
     static StackEntry label(Label label);
+    static StackEntry data(uint32_t data, bool references_label = false);
 
     bool has_no_effect() const;
-    bool combine(StackEntry const &right, StackEntry &combined) const;
+    bool is_non_negative() const;
+    bool jumps_to(Label label) const;
+    bool stores_to(uint32_t offset) const;
+    bool combine(StackEntry const &right, StackEntry &combined, 
+            PassSet const &passes) const;
+    bool reduce_strength(StackEntry const &left, StackEntry &reduced) const;
+    void relabel(std::vector<Label> const &labels, Label first);
+    // Whether the data is a label or a symbol, which differ between 
+    // programs
+    bool is_relocated() const;
+    void set_data(uint32_t data);
+    void write(std::ostream &out) const;
+    static StackEntry read(std::istream &in);
     void register_label(LabelMap &map, uint32_t &i) const;
     void assemble(std::vector<uint32_t> &stack, LabelMap const &map) const;
 
+    bool is_label() const;
     size_t get_size() const;
+    uint32_t get_data() const;
 
     void disassemble() const;
 private:
@@ -65,42 +117,203 @@ private:
     bool m_has_immediate;
     bool m_references_label;
     size_t m_size;
+    // Arguments of the frame replaced by a TailCall
+    uint32_t m_frame_args;
+};
+
+// Labels a worker takes from the shared counter in blocks, so that it does 
+// not lock for each of them
+struct LabelRange {
+    Label next;
+    Label end;
+};
+
+// Code generated for one job on its own, before it is linked
+struct CodeBuffer {
+    CodeBuffer();
+
+    std::vector<StackEntry> code;
+    // Labels taken and jobs added by the job, in order
+    std::vector<Label> labels;
+    std::vector<Label> jobs;
+    std::vector<std::string> remarks;
+    bool address_taken;
+    std::exception_ptr error;
 };
 
 class Serializer {
 public:
-    Serializer(SymbolTable &symbol_table);
+    Serializer(SymbolTable &symbol_table, SourceManager const &sources);
 
     void call(SymbolId id, 
-            std::vector<std::unique_ptr<ExpressionNode>> const &args);
+            NodeList<ExpressionNode> args);
     void push_callable_addr(SymbolId id);
+    void mark_address_taken();
 
     void add_instr(OpCode opcode, FuncCode funccode = FuncCode::Nop);
     void add_instr(OpCode opcode, uint32_t data, bool references_label = false);
     void add_instr(OpCode opcode, FuncCode funccode, 
             uint32_t data, bool references_label = false);
-    void add_job(Label label, BaseNode *node, bool no_serialize);
+    void add_counted_instr(OpCode opcode, uint32_t count);
+    void add_counted_instr(OpCode opcode, uint32_t count, 
+            uint32_t data, bool references_label = false);
+    void add_job(Label label, BaseNode *node, bool no_serialize, 
+            uint32_t n_args = 0);
     void add_function_implementation(SymbolId id);
     uint32_t add_label();
     uint32_t add_label(Label label);
     uint32_t get_label();
     uint32_t get_stack_size() const;
 
+    void open_frame(SymbolId id, uint32_t size, uint32_t n_args, bool memo);
+    void close_frame();
+    void add_frame_reset();
+    uint32_t reserve_frame(uint32_t size);
+    void release_frame(uint32_t size);
+    uint32_t frame_offset(SymbolEntry const &entry) const;
+    void assign_register(SymbolId id, uint32_t index, bool reset);
+    std::optional<uint32_t> frame_register(SymbolId id) const;
+    FunctionNode const *current_function() const;
+
+    void hoist(BaseNode const *node, uint32_t offset);
+    void unhoist(BaseNode const *node);
+    bool is_hoisted(BaseNode const *node) const;
+    bool load_hoisted(BaseNode const *node);
+    void number_value(BaseNode const *node, ValueUse use, uint32_t offset);
+    void drop_values(BaseNode const *node);
+    void clear_values();
+    bool load_value(BaseNode const *node);
+    void store_value(BaseNode const *node);
+
+    void set_inline_threshold(uint32_t threshold);
+    void set_passes(PassSet passes);
+    void set_unroll_limits(uint32_t max_factor, uint32_t budget);
+    uint32_t max_unroll_factor() const;
+    uint32_t unroll_budget() const;
+    void spend_unroll_budget(uint32_t size);
+    PassSet const &passes() const;
+    void set_ir(IrModule *ir);
+    IrFunction *ir_function(SymbolId id) const;
+    bool should_inline(FunctionNode const *callee);
+    bool is_memoized(FunctionNode const *function) const;
+    bool is_tail_recursion(SymbolId callee) const;
+    void set_eval_limits(uint64_t max_instrs, std::size_t max_stack_size, 
+            uint64_t budget);
+    void set_threads(uint32_t n_threads);
+    void set_cache(CodeCache *cache);
+    // The options the code depends on
+    std::string settings() const;
+    std::optional<uint32_t> evaluate_call(FunctionNode const *callee, 
+            NodeList<ExpressionNode> args);
+    void spend_eval_budget(uint64_t instrs);
+    void open_inlined_call(SymbolId id, uint32_t base, uint32_t n_params);
+    void close_inlined_call();
+    void add_return();
+    void add_switch(std::vector<std::pair<int32_t, Label>> cases, 
+            Label otherwise);
+
+    void add_remark(std::string const &remark);
+    std::vector<std::string> const &remarks() const;
+    // Where the token is in the sources, for remarks
+    std::string location(Token const &token) const;
+
     void serialize();
     std::vector<uint32_t> assemble();
+    std::vector<uint32_t> code_labels() const;
     void disassemble() const;
 
     SymbolTable &symbol_table();
     InlineFrames &inline_frames();
 private:
+    Serializer(Serializer &root, LabelRange &labels);
+
+    void serialize_jobs();
+    void work();
+    void schedule(JobEntry const &job);
+    LabelRange reserve_labels();
+    CodeBuffer generate(JobEntry const &job);
+    void load_object(CodeObject const &object);
+    std::optional<CodeObject> make_object() const;
+    void link();
+    void patch_frame_entry(std::size_t index, uint32_t size);
     void add_entry(StackEntry const &entry);
+    void add_case_search(std::vector<std::pair<int32_t, Label>> const &cases, 
+            std::size_t begin, std::size_t end, uint32_t slot, 
+            Label otherwise);
+
+    // Smallest number of cases, and largest span of values per case, 
+    // dispatched through a jump table
+    static constexpr std::size_t min_table_cases = 4;
+    static constexpr uint32_t max_table_span = 3;
+    // Cases compared one by one within a binary search
+    static constexpr std::size_t max_linear_cases = 3;
+    static constexpr uint32_t label_block = 256;
 
     SymbolTable &m_symbol_table;
+    SourceManager const &m_sources;
     InlineFrames m_inline_frames;
 
+    // Jobs are shared by the workers of the root serializer, each of which 
+    // generates one job at a time into a serializer of its own
+    Serializer *m_root;
+    uint32_t m_n_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    uint32_t m_n_busy;
     std::queue<JobEntry> m_code_jobs;
+    std::unordered_set<Label> m_implemented;
+    std::unordered_map<Label, CodeBuffer> m_buffers;
+    // Labels taken before linking are above all symbols, and are numbered 
+    // anew from m_first_label by link()
+    Label m_first_label;
+    Label m_next_label;
+    LabelRange m_own_labels;
+    LabelRange *m_label_range;
+    std::vector<Label> m_taken_labels;
+    std::vector<Label> m_added_jobs;
+    CodeCache *m_cache;
+
     LabelMap m_labels;
     std::vector<StackEntry> m_stack;
+
+    // Entries before m_combine_floor are never combined by add_entry
+    std::size_t m_combine_floor;
+    std::optional<std::size_t> m_frame_entry;
+    std::vector<std::size_t> m_frame_resets;
+    SymbolId m_frame_id;
+    uint32_t m_frame_args;
+    bool m_frame_memo;
+    uint32_t m_frame_top;
+    uint32_t m_frame_max;
+    // Locals of the frame kept in its register window, and the registers 
+    // zeroed when the frame is reset
+    std::unordered_map<SymbolId, uint32_t> m_frame_registers;
+    std::vector<uint32_t> m_register_resets;
+
+    uint32_t m_inline_threshold;
+    PassSet m_passes;
+    // Compile-time evaluation runs in a sandboxed program, 0 disables it
+    uint64_t m_eval_max_instrs;
+    std::size_t m_eval_max_stack_size;
+    // Instructions left to all evaluations of the compile, kept by the 
+    // root. Code whose evaluations were cut short by it depends on the 
+    // order of the jobs, and is not cached.
+    uint64_t m_eval_budget;
+    bool m_eval_cut;
+    bool m_address_taken;
+    // Tree nodes that may still be duplicated by unrolling loops in the 
+    // function, so that its code does not depend on the others
+    uint32_t m_max_unroll_factor;
+    uint32_t m_unroll_budget;
+    std::vector<InlinedCall> m_inlined_calls;
+    // Nodes computed before the enclosing loop, by frame offset
+    std::unordered_map<BaseNode const *, uint32_t> m_hoisted;
+    // Value numbers of the current function, by frame offset
+    std::unordered_map<BaseNode const *, std::pair<ValueUse, uint32_t>> m_values;
+    std::unordered_set<uint32_t> m_dropped_values;
+    std::unordered_map<uint32_t, uint32_t> m_value_reuses;
+    IrModule *m_ir;
+    std::vector<std::string> m_remarks;
 };
 
 #endif
@@ -0,0 +1,72 @@
+#ifndef FLEXUL_SOURCE_HPP
+#define FLEXUL_SOURCE_HPP
+
+#include "token.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+// Index of a file in its SourceManager
+using FileId = uint32_t;
+
+constexpr FileId no_file = UINT32_MAX;
+
+// Where a token was read
+struct SourcePos {
+    FileId file = no_file;
+    uint32_t row = 0;
+    uint32_t col = 0;
+};
+
+// A source file mapped read-only into memory. Tokens refer to its text
+// without copying, so it must outlive them.
+class SourceFile {
+public:
+    SourceFile(std::string const &filename);
+    ~SourceFile();
+    SourceFile(SourceFile const &) = delete;
+    SourceFile &operator =(SourceFile const &) = delete;
+
+    std::string const &filename() const;
+    std::string_view text() const;
+    bool contains(std::string_view data) const;
+    // The row and column of an offset into the text, counted from 1
+    std::pair<uint32_t, uint32_t> row_col(std::size_t offset) const;
+private:
+    std::string m_filename;
+    char const *m_data;
+    std::size_t m_size;
+    // Offsets of the lines, found the first time a position is asked for
+    mutable std::vector<std::size_t> m_lines;
+    mutable std::once_flag m_lines_found;
+};
+
+// Maps each file once, however often it is opened, and keeps it for as
+// long as the tokens read from it. Identifiers of all files are interned
+// together. Files may be opened and read from several threads.
+class SourceManager {
+public:
+    SourceManager();
+
+    // Looks for the file as given, then as an .fx file in std/
+    FileId open(std::string const &filename);
+    SourceFile const &file(FileId id) const;
+    std::size_t size() const;
+    // Where the text of a token starts, or no_file for synthetic tokens
+    SourcePos locate(Token const &token) const;
+    // The file name, row and column of a position
+    std::string describe(SourcePos const &pos) const;
+    std::string describe(Token const &token) const;
+    Interner &interner();
+private:
+    std::vector<std::unique_ptr<SourceFile>> m_files;
+    std::unordered_map<std::string, FileId> m_ids;
+    Interner m_interner;
+    mutable std::mutex m_mutex;
+};
+
+#endif
@@ -3,6 +3,8 @@
 #define FLEXUL_SYMBOL_HPP
 
 #include "opcodes.hpp"
+#include "interner.hpp"
+#include "typetable.hpp"
 #include <memory>
 #include <cstdint>
 #include <string>
@@ -25,6 +27,9 @@ enum class StorageType {
 
 using SymbolId = uint32_t;
 
+// The id of the null entry, never given to a declared symbol
+constexpr SymbolId no_symbol = 0;
+
 using SymbolIdList = std::vector<SymbolId>;
 
 class BaseNode;
@@ -59,41 +64,63 @@ struct SymbolEntry {
     uint32_t value;
     uint32_t size;
     uint64_t usages;
-    bool implemented;
     bool overload;
+    bool pure;
 };
 
-using SymbolMap = std::unordered_map<std::string, SymbolId>;
-
-struct ScopeTracker {
+// The names visible at a point of the program, each bound to its symbol
+// in a table indexed by atom. A name declared in a scope shadows the
+// enclosing declarations until the scope is closed, which restores them
+// from an undo log. Opening and closing a scope thus costs only the names
+// declared in it.
+class ScopeTracker {
+public:
     ScopeTracker();
-    ScopeTracker(SymbolMap global, SymbolMap enclosing, SymbolMap current);
 
-    SymbolMap global;
-    SymbolMap enclosing;
-    SymbolMap current;
+    void open_scope();
+    void close_scope();
+    // The symbol the name is bound to, or no_symbol
+    SymbolId find(Atom atom) const;
+    // Whether the name is declared in the innermost scope
+    bool in_scope(Atom atom) const;
+    void bind(Atom atom, SymbolId id);
+private:
+    struct Binding {
+        SymbolId id;
+        uint32_t depth;
+    };
+
+    struct Shadowed {
+        Atom atom;
+        Binding binding;
+    };
+
+    std::vector<Binding> m_bindings;
+    std::vector<Shadowed> m_undo;
+    // Size of the undo log when each open scope was opened
+    std::vector<std::size_t> m_scopes;
 };
 
-SymbolId lookup_symbol(std::string const &symbol, ScopeTracker const &scopes);
-
-SymbolId lookup_scope(std::string const &symbol, SymbolMap const &scope);
-
 class SymbolTable {
 public:
-    SymbolTable(std::unique_ptr<BaseNode> &root);
+    SymbolTable(BaseNode *root, Interner &interner);
 
     void resolve();
+    void resolve_purity();
     void add_job(BaseNode *node);
 
     SymbolId next_id();
     SymbolEntry const &get(SymbolId id) const;
-    SymbolId declare(SymbolMap &scope, std::string const &symbol, 
+    SymbolId lookup(Atom atom, ScopeTracker const &scopes) const;
+    SymbolId lookup_global(std::string_view name) const;
+    // Declares the name in the innermost scope
+    SymbolId declare(ScopeTracker &scopes, Atom atom, 
             BaseNode *definition, TypeNode *type, StorageType storage_type, 
             uint32_t value = 0, uint32_t size = 1);
-    SymbolId declare_callable(std::string const &name, SymbolMap &scope, 
+    SymbolId declare_callable(Atom atom, ScopeTracker &scopes, 
             CallableNode *node);
 
-    void load_predefined(SymbolMap &symbol_map);
+    void load_predefined(ScopeTracker &scopes);
     void dump() const;
 
     void open_container();
@@ -102,8 +129,8 @@ public:
     void resolve_local_container();
     SymbolIdList const &container() const;
 
-    SymbolMap const &global() const;
     std::vector<SymbolId> const &callable(SymbolId id) const;
+    TypeTable &types();
 
     std::vector<SymbolEntry>::const_iterator begin() const;
     std::vector<SymbolEntry>::const_iterator end() const;
@@ -112,14 +139,17 @@ public:
 private:
     void add(SymbolEntry const &entry);
 
-    SymbolMap m_global;
+    // Bindings of the global scope, once resolved
+    ScopeTracker m_global;
 
-    std::unique_ptr<BaseNode> &m_root;
+    BaseNode *m_root;
+    Interner &m_interner;
     std::queue<BaseNode *> m_jobs;
     std::vector<SymbolEntry> m_table;
     std::unordered_map<SymbolId, std::vector<SymbolId>> m_callables;
     std::stack<SymbolIdList> m_containers;
     SymbolId m_counter;
+    TypeTable m_types;
 
     friend Serializer;
 };
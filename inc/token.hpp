@@ -1,38 +1,52 @@
 #ifndef FLEXUL_TOKEN_HPP
 #define FLEXUL_TOKEN_HPP
 
+#include "utils.hpp"
+#include "interner.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
+#include <span>
 #include <iostream>
 #include <unordered_map>
 
-enum class TokenType {
+enum class TokenType : uint8_t {
     Null, Identifier, IntLit, Keyword, Operator, Separator, 
-    Function, Inline, Writeback, TypeDef, Like, Return, Include, 
-    If, Else, While, For, Lambda, Var, True, False, EndOfFile, Synthetic
+    Function, Inline, Writeback, Memo, TypeDef, Like, Return, Include, 
+    If, Else, While, For, Switch, Case, Default, Lambda, Var, True, False, 
+    EndOfFile, Synthetic
 };
 
 std::ostream &operator <<(std::ostream &stream, TokenType const type);
 
 std::string to_string(TokenType type);
 
-using SyntaxMap = std::unordered_map<std::string, TokenType>;
+using SyntaxMap = std::vector<std::pair<std::string_view, TokenType>>;
 
+// Keywords in the order of their atoms: every source manager interns them
+// before any identifier
 extern SyntaxMap const default_syntax_map;
 
-class Tokenizer;
+// The type of a keyword's atom, or Identifier for any other atom
+TokenType keyword_type(Atom atom);
 
+// Refers to its text in a source file, which the SourceManager locates when
+// its position is needed, so that tokens stay small enough to embed in
+// every node.
 class Token {
 public:
     Token();
-    Token(TokenType type, std::size_t row, std::size_t col);
-    Token(TokenType type, std::string data, std::size_t row, std::size_t col);
-    static Token synthetic(std::string data);
+    Token(TokenType type, std::string_view data, Atom atom = no_atom);
+    // The data must outlive the token, like a string literal
+    static Token synthetic(std::string_view data);
     static Token null();
     TokenType type() const;
-    std::string data() const;
+    // Refers to the source text, or to the data of a synthetic token
+    std::string_view data() const;
     uint32_t to_int() const;
-    bool is_synthetic(std::string const &cmp_data) const;
+    bool is_synthetic(std::string_view cmp_data) const;
+    // The interned name of an identifier or operator, or no_atom
+    Atom atom() const;
 
     friend std::string to_string(Token const &token);
     friend std::ostream &operator <<(std::ostream &stream, Token const &token);
@@ -40,34 +54,15 @@ public:
     bool operator ==(Token const &other) const;
     bool operator !=(Token const &other) const;
     operator bool() const;
+    static constexpr std::size_t max_size = UINT16_MAX;
 private:
+    char const *m_data;
+    Atom m_atom;
+    uint16_t m_size;
     TokenType m_type;
-    std::string m_data;
-    // todo: make point at start instead of end of token
-    std::size_t row;
-    std::size_t col;
 };
 
-class TokenList {
-public:
-    TokenList();
-    
-    Token const &get();
-    Token const &peek() const;
-    Token const &look_ahead(std::size_t offset) const;
-
-    std::vector<Token>::const_iterator begin() const;
-    std::vector<Token>::const_iterator end() const;
-private:
-    void add(Token token);
-
-    std::vector<Token> m_tokens;
-    std::size_t m_p;
-
-    friend Tokenizer;
-};
-
-std::string tokenlist_to_string(std::vector<Token> const &tokens, 
+std::string tokenlist_to_string(std::span<Token const> tokens, 
         std::string const &sep = ", ");
 
 #endif
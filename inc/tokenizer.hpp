@@ -2,37 +2,33 @@
 #define FLEXUL_TOKENIZER_HPP
 
 #include "token.hpp"
-#include "utils.hpp"
-#include <vector>
-#include <string>
+#include <string_view>
 
+// Splits source text into tokens whose data refers to the text
 class Tokenizer {
 public:
     Tokenizer();
-    Tokenizer(std::string const &filename);
-    ~Tokenizer() {
-        print_iterable(m_tokens);
-    }
+    Tokenizer(std::string_view text, AtomCache &atoms);
     Token get_token();
     bool eof();
-
-    TokenList const &list() const { return m_tokens; }
+    // The character the tokenizer stopped at, to locate its errors
+    Token position() const;
 private:
+    // The current character, or '\0' at the end of the text
+    char current() const;
     void next_char();
     void cleanup();
     void assert_no_newline() const;
+    std::string_view text_from(std::size_t start) const;
     Token get_identifier();
     Token get_intlit();
     Token get_charlit();
     Token get_operator();
     Token get_separator();
 
-    std::string m_text;
-    size_t m_i;// todo all size_ts to std::size_t
-    std::size_t m_row;
-    std::size_t m_col;
-
-    TokenList m_tokens;
+    std::string_view m_text;
+    AtomCache *m_atoms;
+    std::size_t m_i;
 };
 
 bool is_op_char(char c);
@@ -3,43 +3,96 @@
 
 #include "token.hpp"
 #include "serializer.hpp"
+#include "opcodes.hpp"
 #include "symbol.hpp"
+#include "arena.hpp"
 #include <vector>
+#include <span>
 #include <unordered_map>
+#include <unordered_set>
 #include <optional>
-#include <memory>
 
 class Serializer; 
 
 class TreePrinter;
 
+class IrBuilder;
+
+struct IrInstr;
+
+struct IrBlock;
+
+struct IrLvalue;
+
+class ValueNumbering;
+
+struct NumberedValue;
+
 class TypeNode;
 
 class ExpressionNode;
 
 class ExpressionListNode;
 
-enum class TypeMatch {
-    NoMatch, ImplicitMatch, AnyMatch, ExactMatch
-};
+std::size_t tree_size(BaseNode const *node);
 
+bool contains_call(BaseNode const *node, SymbolId callee);
+
+// Calls to the callee, and how many of them are the operand of a return
+void count_calls(BaseNode const *node, SymbolId callee, uint32_t &calls, 
+        uint32_t &tail_calls);
+
+bool is_constant(BaseNode const *node, SymbolTable const &symbol_table);
+
+// Instructions taken to evaluate node, if evaluating it early or needlessly 
+// can neither fail nor have effects. Parameters of inline functions count 
+// for nothing with inline_args, as their argument is checked at the call, 
+// and are not speculatable otherwise.
+std::optional<uint32_t> speculation_cost(BaseNode const *node, 
+        SymbolTable const &symbol_table, bool inline_args);
+
+// Local variables that may be changed through a pointer
+void collect_address_taken(BaseNode const *node, 
+        std::unordered_set<SymbolId> &ids);
+
+// Nodes are never destroyed, but freed with the arena they were made in
 class BaseNode {
 public:
     BaseNode(Token token);
-    virtual ~BaseNode();
 
     virtual bool is_lvalue() const;
     // First pass: collects symbols which can be referenced before declaration:
     // functions, global variables, definitions
     virtual void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &current) = 0;
+            ScopeTracker &scopes) = 0;
     // Second pass: collects all other symbols and resolves occurences.
     virtual void resolve_locals(SymbolTable &symbol_table, 
             ScopeTracker &scopes) = 0;
     virtual void resolve_types(SymbolTable &symbol_table) { (void)symbol_table; };
     virtual void serialize(Serializer &serializer) const = 0;
     virtual void serialize_load_address(Serializer &serializer) const;
+    // Lowers the node to the IR, returning the value of expressions
+    virtual IrInstr *lower(IrBuilder &builder) const;
+    virtual IrLvalue lower_lvalue(IrBuilder &builder) const;
     virtual std::optional<uint32_t> get_constant_value() const;
+    // Nodes evaluated as part of this node, excluding types and the bodies 
+    // of nested lambdas. Used by analyses that only need to walk the code.
+    virtual std::vector<BaseNode *> children() const;
+    // Whether evaluating the node reads or writes no global state or memory, 
+    // and calls only pure functions. Function purity must be resolved.
+    virtual bool is_pure(SymbolTable const &symbol_table) const;
+    // Value numbering: the number of the key of a value the node computes,
+    // and how evaluating the node changes the values available
+    virtual std::optional<uint32_t> value_key(ValueNumbering &numbering, 
+            NumberedValue &value) const;
+    virtual void number_values(ValueNumbering &numbering) const;
+    // Loop optimization: whether the node has the same value in each 
+    // iteration of a loop changing the modified locals, and the local the 
+    // node itself changes
+    virtual bool is_invariant(SymbolTable const &symbol_table, 
+            std::unordered_set<SymbolId> const &modified) const;
+    virtual std::optional<SymbolId> modified_local(
+            SymbolTable const &symbol_table) const;
 
     virtual void print(TreePrinter &printer) const = 0;
 
@@ -47,9 +100,10 @@ public:
     Token token() const;
     void set_id(SymbolId id);
     SymbolId id() const;
+protected:
+    ~BaseNode() = default;
 private:
     Token m_token;
-    std::unique_ptr<TypeNode> m_type;
     SymbolId m_id;
 };
 
@@ -57,7 +111,7 @@ class TypeNode : public BaseNode {
 public:
     TypeNode(Token token);
 
-    void resolve_globals(SymbolTable &symbol_table, SymbolMap &current) override;
+    void resolve_globals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
     
@@ -66,8 +120,17 @@ public:
     virtual TypeNode const *called_type() const = 0;
     virtual TypeNode const *pointed_type() const = 0;
 
+    // What the type is made of, with its parts interned in the table. Types
+    // with the same key match alike.
+    virtual std::string type_key(TypeTable &types) const = 0;
+    TypeId type_id() const;
+    void set_type_id(TypeId id) const;
+
     friend std::string to_string(TypeNode const *node);
     virtual std::string type_string() const = 0;
+private:
+    // Set once the type is interned
+    mutable TypeId m_type_id;
 };
 
 class AnyTypeNode : public TypeNode {
@@ -80,6 +143,7 @@ public:
 
     TypeNode const *called_type() const override;
     TypeNode const *pointed_type() const override;
+    std::string type_key(TypeTable &types) const override;
 
     void print(TreePrinter &printer) const override;
     std::string type_string() const override;
@@ -97,6 +161,7 @@ public:
 
     TypeNode const *called_type() const override;
     TypeNode const *pointed_type() const override;
+    std::string type_key(TypeTable &types) const override;
 
     void print(TreePrinter &printer) const override;
     std::string type_string() const override;
@@ -105,7 +170,7 @@ public:
 class PointerTypeNode : public TypeNode {
 public:
     PointerTypeNode();
-    PointerTypeNode(Token token, std::unique_ptr<TypeNode> pointed_type);
+    PointerTypeNode(Token token, TypeNode *pointed_type);
 
     void set_internal(TypeNode *pointed_type_internal);
 
@@ -115,18 +180,19 @@ public:
 
     TypeNode const *called_type() const override;
     TypeNode const *pointed_type() const override;
+    std::string type_key(TypeTable &types) const override;
 
     void print(TreePrinter &printer) const override;
     std::string type_string() const override;
 private:
-    std::unique_ptr<TypeNode> m_pointed_type;
+    TypeNode *m_pointed_type;
     TypeNode *m_pointed_type_internal;
 };
 
 class ArrayTypeNode : public TypeNode {
 public:
-    ArrayTypeNode(Token token, std::unique_ptr<TypeNode> array_type,
-            std::unique_ptr<ExpressionNode> size);
+    ArrayTypeNode(Token token, TypeNode *array_type,
+            ExpressionNode *size);
 
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
 
@@ -134,17 +200,18 @@ public:
 
     TypeNode const *called_type() const override;
     TypeNode const *pointed_type() const override;
+    std::string type_key(TypeTable &types) const override;
 
     void print(TreePrinter &printer) const override;
     std::string type_string() const override;
 private:
-    std::unique_ptr<TypeNode> m_array_type;
-    std::unique_ptr<ExpressionNode> m_size;
+    TypeNode *m_array_type;
+    ExpressionNode *m_size;
 };
 
 class TypeListNode : public TypeNode {
 public:
-    TypeListNode(std::vector<std::unique_ptr<TypeNode>> type_list);
+    TypeListNode(NodeList<TypeNode> type_list);
 
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
 
@@ -152,19 +219,20 @@ public:
 
     TypeNode const *called_type() const override;
     TypeNode const *pointed_type() const override;
+    std::string type_key(TypeTable &types) const override;
 
     void print(TreePrinter &printer) const override;
     std::string type_string() const override;
 
-    std::vector<std::unique_ptr<TypeNode>> const &list() const;
+    NodeList<TypeNode> list() const;
 private:
-    std::vector<std::unique_ptr<TypeNode>> m_type_list;
+    NodeList<TypeNode> m_type_list;
 };
 
 class CallableTypeNode : public TypeNode {
 public:
-    CallableTypeNode(Token token, std::unique_ptr<TypeListNode> param_types, 
-            std::unique_ptr<TypeNode> return_type);
+    CallableTypeNode(Token token, TypeListNode *param_types, 
+            TypeNode *return_type);
     
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
 
@@ -172,6 +240,7 @@ public:
 
     TypeNode const *called_type() const override;
     TypeNode const *pointed_type() const override;
+    std::string type_key(TypeTable &types) const override;
 
     void print(TreePrinter &printer) const override;
     std::string type_string() const override;
@@ -179,25 +248,32 @@ public:
     TypeListNode *param_types() const;
     TypeNode *return_type() const;
 private:
-    std::unique_ptr<TypeListNode> m_param_types;
-    std::unique_ptr<TypeNode> m_return_type;
+    TypeListNode *m_param_types;
+    TypeNode *m_return_type;
 };
 
 struct CallableSignature {
-    CallableSignature(std::vector<Token> params, 
-            std::unique_ptr<CallableTypeNode> type);
+    CallableSignature(std::span<Token const> params, 
+            CallableTypeNode *type);
 
-    std::vector<Token> params;
-    std::unique_ptr<CallableTypeNode> type;
+    std::span<Token const> params;
+    CallableTypeNode *type;
 };
 
 class ExpressionNode : public BaseNode {
 public:
     ExpressionNode(Token token, TypeNode *m_type = nullptr); // todo temp
 
-    void resolve_globals(SymbolTable &symbol_table, SymbolMap &current) override;
+    void resolve_globals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
+    // Jumps to target if the expression is true when, and false otherwise, 
+    // leaving nothing on the stack
+    virtual void serialize_branch(Serializer &serializer, Label target, 
+            bool when) const;
+    virtual void lower_branch(IrBuilder &builder, IrBlock *case_true, 
+            IrBlock *case_false) const;
 
     TypeNode *type() const;
+    void set_type(TypeNode *type);
 protected:
     TypeNode *m_type;
 };
@@ -216,6 +292,14 @@ public:
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
     void serialize_load_address(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    IrLvalue lower_lvalue(IrBuilder &builder) const override;
+    bool is_pure(SymbolTable const &symbol_table) const override;
+    std::optional<uint32_t> value_key(ValueNumbering &numbering, 
+            NumberedValue &value) const override;
+    void number_values(ValueNumbering &numbering) const override;
+    bool is_invariant(SymbolTable const &symbol_table, 
+            std::unordered_set<SymbolId> const &modified) const override;
 
     void print(TreePrinter &printer) const override;
 };
@@ -227,6 +311,11 @@ public:
     void resolve_locals(SymbolTable &symbol_table, 
             ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
+    std::optional<uint32_t> value_key(ValueNumbering &numbering, 
+            NumberedValue &value) const override;
+    void number_values(ValueNumbering &numbering) const override;
+    bool is_invariant(SymbolTable const &symbol_table, 
+            std::unordered_set<SymbolId> const &modified) const override;
 
     void print(TreePrinter &printer) const override;
 };
@@ -236,6 +325,7 @@ public:
     IntegerLiteralNode(Token token, TypeNode *type);
 
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
     std::optional<uint32_t> get_constant_value() const;
 private:
     uint32_t m_value;
@@ -246,6 +336,7 @@ public:
     TrueLiteralNode(Token token, TypeNode *type);
 
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
 };
 
 class FalseLiteralNode : public LiteralNode {
@@ -253,185 +344,254 @@ public:
     FalseLiteralNode(Token token, TypeNode *type);
 
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
 };
 
 class UnaryExpressionNode : public ExpressionNode {
 public:
-    UnaryExpressionNode(Token token, std::unique_ptr<ExpressionNode> operand);
+    UnaryExpressionNode(Token token, ExpressionNode *operand);
 
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
+    std::vector<BaseNode *> children() const override;
 
     void print(TreePrinter &printer) const override;
+
+    ExpressionNode *operand() const;
 protected:
     // todo BaseNode -> ExpressionNode
-    std::unique_ptr<ExpressionNode> m_operand;
+    ExpressionNode *m_operand;
 };
 
 class AddressOfNode : public UnaryExpressionNode {
 public:
-    AddressOfNode(Token token, std::unique_ptr<ExpressionNode> operand);
+    AddressOfNode(Token token, ExpressionNode *operand);
 
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    void number_values(ValueNumbering &numbering) const override;
+    std::optional<SymbolId> modified_local(
+            SymbolTable const &symbol_table) const override;
 private:
     PointerTypeNode m_pointer_type;
 };
 
 class DereferenceNode : public UnaryExpressionNode {
 public:
-    DereferenceNode(Token token, std::unique_ptr<ExpressionNode> operand);
+    DereferenceNode(Token token, ExpressionNode *operand);
 
     bool is_lvalue() const override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
     void serialize_load_address(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    IrLvalue lower_lvalue(IrBuilder &builder) const override;
+    bool is_pure(SymbolTable const &symbol_table) const override;
+    std::optional<uint32_t> value_key(ValueNumbering &numbering, 
+            NumberedValue &value) const override;
+    void number_values(ValueNumbering &numbering) const override;
 };
 
 class BinaryExpressionNode : public ExpressionNode {
 public:
-    BinaryExpressionNode(Token token, std::unique_ptr<ExpressionNode> left, 
-            std::unique_ptr<ExpressionNode> right);
+    BinaryExpressionNode(Token token, ExpressionNode *left, 
+            ExpressionNode *right);
 
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
+    std::vector<BaseNode *> children() const override;
 
     void print(TreePrinter &printer) const override;
+
+    ExpressionNode *left() const;
+    ExpressionNode *right() const;
 protected:
-    std::unique_ptr<ExpressionNode> m_left;
-    std::unique_ptr<ExpressionNode> m_right;
+    ExpressionNode *m_left;
+    ExpressionNode *m_right;
 };
 
 class AssignNode : public BinaryExpressionNode {
 public:
-    AssignNode(Token token, std::unique_ptr<ExpressionNode> left, 
-            std::unique_ptr<ExpressionNode> right);
+    AssignNode(Token token, ExpressionNode *left, 
+            ExpressionNode *right);
 
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    void number_values(ValueNumbering &numbering) const override;
+    std::optional<SymbolId> modified_local(
+            SymbolTable const &symbol_table) const override;
 };
 
 class AndNode : public BinaryExpressionNode {
 public:
-    AndNode(Token token, std::unique_ptr<ExpressionNode> left, 
-            std::unique_ptr<ExpressionNode> right, 
+    AndNode(Token token, ExpressionNode *left, 
+            ExpressionNode *right, 
             TypeNode *type);
 
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    void serialize_branch(Serializer &serializer, Label target, 
+            bool when) const override;
+    void lower_branch(IrBuilder &builder, IrBlock *case_true, 
+            IrBlock *case_false) const override;
+    void number_values(ValueNumbering &numbering) const override;
 };
 
 class OrNode : public BinaryExpressionNode {
 public:
-    OrNode(Token token, std::unique_ptr<ExpressionNode> left, 
-            std::unique_ptr<ExpressionNode> right,
+    OrNode(Token token, ExpressionNode *left, 
+            ExpressionNode *right,
             TypeNode *type);
 
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    void serialize_branch(Serializer &serializer, Label target, 
+            bool when) const override;
+    void lower_branch(IrBuilder &builder, IrBlock *case_true, 
+            IrBlock *case_false) const override;
+    void number_values(ValueNumbering &numbering) const override;
 };
 
 class SubscriptNode : public BinaryExpressionNode {
 public:
-    SubscriptNode(std::unique_ptr<ExpressionNode> array, 
-            std::unique_ptr<ExpressionNode> subscript);
+    SubscriptNode(ExpressionNode *array, 
+            ExpressionNode *subscript);
 
     bool is_lvalue() const override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
     void serialize_load_address(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    IrLvalue lower_lvalue(IrBuilder &builder) const override;
+    bool is_pure(SymbolTable const &symbol_table) const override;
+    std::optional<uint32_t> value_key(ValueNumbering &numbering, 
+            NumberedValue &value) const override;
+    void number_values(ValueNumbering &numbering) const override;
 };
 
 class CallNode : public ExpressionNode {
 public:
-    CallNode(std::unique_ptr<ExpressionNode> func, 
-            std::unique_ptr<ExpressionListNode> args);
+    CallNode(ExpressionNode *func, 
+            ExpressionListNode *args);
 
-    static std::unique_ptr<CallNode> make_call(Token ident, 
-            std::vector<std::unique_ptr<ExpressionNode>> params);
-    static std::unique_ptr<CallNode> make_unary_call(Token ident, 
-            std::unique_ptr<ExpressionNode> param);
-    static std::unique_ptr<CallNode> make_binary_call(Token ident, 
-            std::unique_ptr<ExpressionNode> left, 
-            std::unique_ptr<ExpressionNode> right);
+    static CallNode *make_call(Arena &arena, Token ident, 
+            NodeList<ExpressionNode> params);
+    static CallNode *make_unary_call(Arena &arena, Token ident, 
+            ExpressionNode *param);
+    static CallNode *make_binary_call(Arena &arena, Token ident, 
+            ExpressionNode *left, ExpressionNode *right);
 
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    bool serialize_tail_recursion(Serializer &serializer) const;
+    std::vector<BaseNode *> children() const override;
+    bool is_pure(SymbolTable const &symbol_table) const override;
+    std::optional<uint32_t> value_key(ValueNumbering &numbering, 
+            NumberedValue &value) const override;
+    void number_values(ValueNumbering &numbering) const override;
+    bool is_invariant(SymbolTable const &symbol_table, 
+            std::unordered_set<SymbolId> const &modified) const override;
+    std::optional<SymbolId> modified_local(
+            SymbolTable const &symbol_table) const override;
+
+    SymbolId overload_id() const;
+    ExpressionNode *func() const;
+    NodeList<ExpressionNode> args() const;
 
     void print(TreePrinter &printer) const override;
 private:
-    std::unique_ptr<ExpressionNode> m_func;
-    std::unique_ptr<ExpressionListNode> m_args;
+    ExpressionNode *m_func;
+    ExpressionListNode *m_args;
     SymbolId m_overload_id;
 };
 
 class TernaryNode : public ExpressionNode {
 public:
-    TernaryNode(Token token, std::unique_ptr<ExpressionNode> cond, 
-            std::unique_ptr<ExpressionNode> case_true, 
-            std::unique_ptr<ExpressionNode> case_false);
+    TernaryNode(Token token, ExpressionNode *cond, 
+            ExpressionNode *case_true, 
+            ExpressionNode *case_false);
 
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 private:
-    std::unique_ptr<ExpressionNode> m_cond;
-    std::unique_ptr<ExpressionNode> m_case_true;
-    std::unique_ptr<ExpressionNode> m_case_false;
+    // Largest cost of an arm evaluated when the other one is selected
+    static constexpr uint32_t select_max_cost = 4;
+
+    bool is_select(SymbolTable const &symbol_table) const;
+
+    ExpressionNode *m_cond;
+    ExpressionNode *m_case_true;
+    ExpressionNode *m_case_false;
 };
 
 class AttributeNode : public ExpressionNode {
 public:
-    AttributeNode(Token token, std::unique_ptr<ExpressionNode> object,
-            std::unique_ptr<VariableNode> attribute);
+    AttributeNode(Token token, ExpressionNode *object,
+            VariableNode *attribute);
 
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 private:
-    std::unique_ptr<ExpressionNode> m_object;
-    std::unique_ptr<VariableNode> m_attribute;
+    ExpressionNode *m_object;
+    VariableNode *m_attribute;
 };
 
 class LambdaNode : public ExpressionNode {
 public:
     LambdaNode(Token token, 
             CallableSignature signature, 
-            std::unique_ptr<StatementNode> body);
+            StatementNode *body);
 
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 
     std::string label() const override;
 private:
-    std::unique_ptr<StatementNode> m_body;
+    StatementNode *m_body;
     CallableSignature m_signature;
 };
 
 class CallableNode : public StatementNode {
 public:
     CallableNode(Token token, Token ident, 
-            CallableSignature signature, std::unique_ptr<BaseNode> body);
+            CallableSignature signature, BaseNode *body);
 
     void resolve_types(SymbolTable &symbol_table) override;
 
-    TypeMatch is_matching_call(
-            std::vector<std::unique_ptr<ExpressionNode>> const &args) const;
+    TypeMatch is_matching_call(TypeTable &types,
+            NodeList<ExpressionNode> args) const;
     virtual void serialize_call(Serializer &serializer, 
-            std::vector<std::unique_ptr<ExpressionNode>> const &args) const = 0;
+            NodeList<ExpressionNode> args) const = 0;
+    virtual IrInstr *lower_call(IrBuilder &builder, 
+            NodeList<ExpressionNode> args) const = 0;
+    std::vector<BaseNode *> children() const override;
 
+    BaseNode *body() const;
     Token const &ident() const;
-    std::vector<Token> const &params() const;
+    std::span<Token const> params() const;
     uint32_t n_params() const;
     CallableSignature const &signature() const;
 protected:
-    std::unique_ptr<BaseNode> m_body;
+    BaseNode *m_body;
     Token m_ident;
     CallableSignature m_signature;
 };
@@ -439,43 +599,62 @@ protected:
 class FunctionNode : public CallableNode {
 public:
     FunctionNode(Token token, Token ident, 
-            CallableSignature signature, std::unique_ptr<BaseNode> body,
-            bool writeback);
+            CallableSignature signature, BaseNode *body,
+            bool writeback, bool memo);
 
     void resolve_globals(
-            SymbolTable &symbol_table, SymbolMap &symbol_map) override;
+            SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void serialize(Serializer &serializer) const override;
     void serialize_call(Serializer &serializer, 
-            std::vector<std::unique_ptr<ExpressionNode>> const &args) const override;
+            NodeList<ExpressionNode> args) const override;
+    IrInstr *lower_call(IrBuilder &builder, 
+            NodeList<ExpressionNode> args) const override;
+    void serialize_tail_recursion(Serializer &serializer, 
+            NodeList<ExpressionNode> args) const;
 
     void print(TreePrinter &printer) const override;
 
     std::string label() const override;
+
+    uint32_t frame_size() const;
+    bool writeback() const;
+    bool memo() const;
 private:
+    void serialize_inline(Serializer &serializer, 
+            NodeList<ExpressionNode> args) const;
+
     uint32_t m_frame_size;
     bool m_writeback;
+    bool m_memo;
 };
 
 class InlineNode : public CallableNode {
 public:
     InlineNode(Token token, Token ident, 
-            CallableSignature signature, std::unique_ptr<BaseNode> body,
+            CallableSignature signature, BaseNode *body,
             bool writeback);
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
     void serialize_call(Serializer &serializer, 
-            std::vector<std::unique_ptr<ExpressionNode>> const &args
-            ) const override;
+            NodeList<ExpressionNode> args) const override;
+    IrInstr *lower_call(IrBuilder &builder, 
+            NodeList<ExpressionNode> args) const override;
 
     void print(TreePrinter &printer) const override;
 
     std::string label() const override;
+
+    bool writeback() const;
+    // Parameters are declared one after the other, so that their ids 
+    // follow the first
+    std::vector<SymbolId> param_ids() const;
 private:
-    std::vector<SymbolId> m_param_ids;
+    SymbolId m_first_param_id;
     bool m_writeback;
 };
 
@@ -485,193 +664,279 @@ public:
     EmptyNode();
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 };
 
 class BlockNode : public StatementNode {
 public:
-    BlockNode(std::vector<std::unique_ptr<StatementNode>> children);
+    BlockNode(NodeList<StatementNode> children);
 
     void resolve_globals(
-            SymbolTable &symbol_table, SymbolMap &symbol_map) override;
+            SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 private:
-    std::vector<std::unique_ptr<StatementNode>> m_statements;
-    SymbolMap m_scope_map;
+    NodeList<StatementNode> m_statements;
 };
 
 // Block which introduces a new scope: statement blocks
 class ScopeNode : public StatementNode {
 public:
-    ScopeNode(std::unique_ptr<StatementNode> statement);
+    ScopeNode(StatementNode *statement);
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 private:
-    std::unique_ptr<StatementNode> m_statement;
+    StatementNode *m_statement;
 };
 
 class TypeDeclarationNode : public StatementNode {
 public:
-    TypeDeclarationNode(Token token, std::unique_ptr<NamedTypeNode> ident);
+    TypeDeclarationNode(Token token, NamedTypeNode *ident);
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 
     std::string label() const override;
 private:
-    std::unique_ptr<NamedTypeNode> m_ident;
+    NamedTypeNode *m_ident;
 };
 
 class ExpressionListNode : public BaseNode {
 public:
     ExpressionListNode(Token token, 
-            std::vector<std::unique_ptr<ExpressionNode>> children);
+            NodeList<ExpressionNode> children);
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    std::vector<BaseNode *> children() const override;
+    bool is_invariant(SymbolTable const &symbol_table, 
+            std::unordered_set<SymbolId> const &modified) const override;
 
     void print(TreePrinter &printer) const override;
 
-    std::vector<std::unique_ptr<ExpressionNode>> const &exprs();
+    NodeList<ExpressionNode> exprs();
 private:
-    std::vector<std::unique_ptr<ExpressionNode>> m_exprs;
+    NodeList<ExpressionNode> m_exprs;
 };
 
 class IfNode : public StatementNode {
 public:
-    IfNode(Token token, std::unique_ptr<ExpressionNode> cond, 
-            std::unique_ptr<StatementNode> case_true);
+    IfNode(Token token, ExpressionNode *cond, 
+            StatementNode *case_true);
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 private:
-    std::unique_ptr<ExpressionNode> m_cond;
-    std::unique_ptr<StatementNode> m_case_true;
+    ExpressionNode *m_cond;
+    StatementNode *m_case_true;
 };
 
 class IfElseNode : public StatementNode {
 public:
-    IfElseNode(Token token, std::unique_ptr<ExpressionNode> cond, 
-            std::unique_ptr<StatementNode> case_true, 
-            std::unique_ptr<StatementNode> case_false);
+    IfElseNode(Token token, ExpressionNode *cond, 
+            StatementNode *case_true, 
+            StatementNode *case_false);
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 private:
-    std::unique_ptr<ExpressionNode> m_cond;
-    std::unique_ptr<StatementNode> m_case_true;
-    std::unique_ptr<StatementNode> m_case_false;
+    ExpressionNode *m_cond;
+    StatementNode *m_case_true;
+    StatementNode *m_case_false;
+};
+
+// Statement run when the value of a switch is one of the values
+struct SwitchCase {
+    SwitchCase(std::span<int32_t const> values, StatementNode *body);
+
+    std::span<int32_t const> values;
+    StatementNode *body;
+};
+
+// Runs the body of the case matching the value, or the default body, 
+// without falling through to the next case
+class SwitchNode : public StatementNode {
+public:
+    SwitchNode(Token token, ExpressionNode *value, 
+            std::span<SwitchCase const> cases, 
+            StatementNode *case_default);
+
+    void resolve_globals(SymbolTable &symbol_table, 
+            ScopeTracker &scopes) override;
+    void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
+    void resolve_types(SymbolTable &symbol_table) override;
+    void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
+
+    void print(TreePrinter &printer) const override;
+    std::string label() const override;
+private:
+    ExpressionNode *m_value;
+    std::span<SwitchCase const> m_cases;
+    StatementNode *m_case_default;
 };
 
 class ForLoopNode : public StatementNode {
 public:
     ForLoopNode(Token token, 
-            std::unique_ptr<StatementNode> init, 
-            std::unique_ptr<ExpressionNode> cond, 
-            std::unique_ptr<StatementNode> post, 
-            std::unique_ptr<StatementNode> body);
+            StatementNode *init, 
+            ExpressionNode *cond, 
+            StatementNode *post, 
+            StatementNode *body);
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 private:
-    std::unique_ptr<StatementNode> m_init;
-    std::unique_ptr<ExpressionNode> m_cond;
-    std::unique_ptr<StatementNode> m_post;
-    std::unique_ptr<StatementNode> m_body;
+    uint32_t hoist_invariants(Serializer &serializer, 
+            std::vector<BaseNode const *> &hoisted) const;
+    uint32_t hoist_induction_pointers(Serializer &serializer, 
+            std::vector<BaseNode const *> &hoisted, 
+            std::vector<std::pair<uint32_t, int32_t>> &pointers) const;
+    std::optional<std::pair<SymbolId, int32_t>> induction_step(
+            SymbolTable const &symbol_table) const;
+    ExpressionNode const *counted_bound(SymbolTable const &symbol_table, 
+            SymbolId index, FuncCode &compare) const;
+    uint32_t unroll_factor(Serializer &serializer, 
+            std::optional<uint32_t> &trip_count) const;
+    void serialize_unrolled(Serializer &serializer, uint32_t factor, 
+            std::optional<uint32_t> trip_count, 
+            std::vector<std::pair<uint32_t, int32_t>> const &pointers) const;
+    void serialize_iteration(Serializer &serializer, 
+            std::vector<std::pair<uint32_t, int32_t>> const &pointers) const;
+
+    StatementNode *m_init;
+    ExpressionNode *m_cond;
+    StatementNode *m_post;
+    StatementNode *m_body;
 };
 
 class ReturnNode : public StatementNode {
 public:
-    ReturnNode(Token token, std::unique_ptr<ExpressionNode> operand);
+    ReturnNode(Token token, ExpressionNode *operand);
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
 private:
-    std::unique_ptr<ExpressionNode> m_operand;
+    ExpressionNode *m_operand;
 };
 
 class VarDeclarationNode : public StatementNode {
 public:
     VarDeclarationNode(Token token, Token ident, 
-            std::unique_ptr<TypeNode> type,
-            std::unique_ptr<ExpressionNode> size, 
-            std::unique_ptr<ExpressionNode> init_value);
+            TypeNode *type,
+            ExpressionNode *size, 
+            ExpressionNode *init_value);
 
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &current) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, 
             ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
+    std::optional<SymbolId> modified_local(
+            SymbolTable const &symbol_table) const override;
 
     void print(TreePrinter &printer) const override;
 
     std::string label() const override;
+
+    ExpressionNode *init_value() const;
 private:
     uint32_t declared_size() const;
 
     Token m_ident;
-    std::unique_ptr<TypeNode> m_type;
-    std::unique_ptr<ExpressionNode> m_size;
-    std::unique_ptr<ExpressionNode> m_init_value;
+    TypeNode *m_type;
+    ExpressionNode *m_size;
+    ExpressionNode *m_init_value;
 };
 
 class ExpressionStatementNode : public StatementNode {
 public:
-    ExpressionStatementNode(std::unique_ptr<ExpressionNode> expr);
+    ExpressionStatementNode(ExpressionNode *expr);
     
     void resolve_globals(SymbolTable &symbol_table, 
-            SymbolMap &symbol_map) override;
+            ScopeTracker &scopes) override;
     void resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) override;
     void resolve_types(SymbolTable &symbol_table) override;
     void serialize(Serializer &serializer) const override;
+    IrInstr *lower(IrBuilder &builder) const override;
+    std::vector<BaseNode *> children() const override;
+    void number_values(ValueNumbering &numbering) const override;
 
     void print(TreePrinter &printer) const override;
+
+    ExpressionNode *expr() const;
 private:
-    std::unique_ptr<ExpressionNode> m_expr;
+    ExpressionNode *m_expr;
 };
 
 #endif
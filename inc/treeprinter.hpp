@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <functional>
 
 class BaseNode;
 
@@ -10,6 +11,9 @@ class TreePrinter {
 public:
     TreePrinter(bool with_pointers, bool with_types, 
             bool with_symbol_ids);
+    // Walks the tree, calling the visitor on each node instead of printing
+    // it
+    TreePrinter(std::function<void(BaseNode const *)> visitor);
     
     void print_node(BaseNode const *node);
     void next_child(BaseNode const *next);
@@ -31,6 +35,7 @@ private:
     bool with_pointers;
     bool with_types;
     bool with_symbol_ids;
+    std::function<void(BaseNode const *)> m_visitor;
 };
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef FLEXUL_TYPETABLE_HPP
+#define FLEXUL_TYPETABLE_HPP
+
+#include "utils.hpp"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+class TypeNode;
+
+enum class TypeMatch {
+    NoMatch, ImplicitMatch, AnyMatch, ExactMatch
+};
+
+// Index of a type in its TypeTable
+using TypeId = uint32_t;
+
+constexpr TypeId no_type = UINT32_MAX;
+
+// Keeps one node for each structure of type, which the types alike stand
+// for. Types alike match exactly, and other pairs are matched once.
+class TypeTable {
+public:
+    TypeTable();
+
+    TypeId intern(TypeNode const *type);
+    TypeNode const *get(TypeId id) const;
+    // How well a value of the other type fits the type
+    TypeMatch matching(TypeNode const *type, TypeNode const *other);
+private:
+    std::vector<TypeNode const *> m_types;
+    StringMap<TypeId> m_ids;
+    std::unordered_map<uint64_t, TypeMatch> m_matches;
+};
+
+#endif
@@ -4,8 +4,10 @@
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <optional>
+#include <unordered_map>
 
 template <typename T>
 void print_map(T const &map, size_t width = 16, std::ostream &os = std::cout) {
@@ -34,6 +36,20 @@ T assert_equal(T const &x, T const &y, std::string const &err) {
     throw std::runtime_error(err);
 }
 
+// Hashes strings and string views alike, so that maps keyed on strings
+// can be searched with a view
+struct StringHash {
+    using is_transparent = void;
+
+    std::size_t operator ()(std::string_view string) const {
+        return std::hash<std::string_view>()(string);
+    }
+};
+
+template <typename T>
+using StringMap = std::unordered_map<std::string, T, StringHash, 
+        std::equal_to<>>;
+
 bool endswith(std::string const &string, std::string const &postfix);
 
 #endif
@@ -0,0 +1,105 @@
+#ifndef FLEXUL_VALUENUMBERING_HPP
+#define FLEXUL_VALUENUMBERING_HPP
+
+#include "symbol.hpp"
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <string>
+#include <cstdint>
+
+class BaseNode;
+
+class CallNode;
+
+class InlineNode;
+
+class Serializer;
+
+// What a value numbering key computes. Values of different kinds never
+// share a key.
+enum class ValueKind : uint32_t {
+    Variable, Constant, Subscript, Dereference, Intrinsic, Call
+};
+
+// A computation of a value, its later repetitions, and what may change it
+struct NumberedValue {
+    BaseNode const *first = nullptr;
+    std::vector<BaseNode const *> reuses;
+    std::unordered_set<SymbolId> locals;
+    bool memory = false;
+    uint32_t cost = 0;
+};
+
+// Local value numbering over the extended basic blocks of a function body:
+// a load or pure call computed again, while no store or call in between may
+// have changed its value, reuses the first result. Nodes number themselves
+// through their hooks, calling back into the numbering.
+class ValueNumbering {
+public:
+    ValueNumbering(SymbolTable const &symbol_table, BaseNode const *body);
+
+    void number(BaseNode const *node);
+    uint32_t apply(Serializer &serializer, std::string const &name) const;
+
+    SymbolTable const &symbol_table() const;
+    bool is_address_taken(SymbolId id) const;
+    bool is_pure_callee(CallNode const *call) const;
+    // Number of the key made of the kind, the id and the numbers of the
+    // keys of the operands, the same for keys alike
+    uint32_t intern(ValueKind kind, uint32_t id,
+            std::vector<uint32_t> operands = {});
+    // Number of the structural key of a value, collecting what it depends 
+    // on. Each node is keyed once, bottom-up, and later looked up.
+    std::optional<uint32_t> key(BaseNode const *node, NumberedValue &value);
+
+    void number_children(BaseNode const *node);
+    // The branch may be skipped, the values it computes are not kept
+    void number_branch(BaseNode const *condition, BaseNode const *branch);
+    // Exactly one of the branches after the first child is taken
+    void number_branches(std::vector<BaseNode *> const &children);
+    void number_loop(BaseNode const *init, BaseNode const *cond,
+            BaseNode const *post, BaseNode const *body);
+    void number_call(CallNode const *call);
+    void number_address(BaseNode const *node);
+    void number_store(BaseNode const *target, BaseNode const *store);
+    void number_declaration(SymbolId id,
+            std::vector<BaseNode *> const &children);
+    // Forgets all values, where the code may be entered from elsewhere
+    void forget();
+private:
+    // Kind, id and operand key numbers
+    using Key = std::vector<uint32_t>;
+    using Available = std::unordered_map<uint32_t, std::size_t>;
+
+    // The key of a node, and what the value depends on
+    struct NodeKey {
+        std::optional<uint32_t> number;
+        NumberedValue value;
+    };
+
+    std::optional<uint32_t> value_key(BaseNode const *node,
+            NumberedValue &value);
+    std::optional<std::vector<std::size_t>> arg_order(
+            CallNode const *call) const;
+    bool collect_arg_order(BaseNode const *node, InlineNode const *callee,
+            std::vector<std::size_t> &order) const;
+    bool args_adjacent(CallNode const *call) const;
+    void forget_stores(std::optional<SymbolId> local);
+    void join(Available const &other);
+
+    SymbolTable const &m_symbol_table;
+    std::unordered_set<SymbolId> m_address_taken;
+    std::map<Key, uint32_t> m_keys;
+    // Kind of each key number, and whether the value is known when compiling
+    std::vector<ValueKind> m_kinds;
+    std::vector<bool> m_constant;
+    std::unordered_map<BaseNode const *, NodeKey> m_node_keys;
+    std::vector<NumberedValue> m_values;
+    std::vector<BaseNode const *> m_duplicates;
+    Available m_available;
+};
+
+#endif
@@ -0,0 +1,10 @@
+#include "arena.hpp"
+
+Arena::Arena()
+        : m_memory(initial_size), m_mutex(), m_branches() {}
+
+Arena &Arena::branch() {
+    std::lock_guard lock(m_mutex);
+    m_branches.push_back(std::make_unique<Arena>());
+    return *m_branches.back();
+}
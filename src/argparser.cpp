@@ -1,6 +1,7 @@
 #include "argparser.hpp"
 #include <cctype>
 #include <stdexcept>
+#include <optional>
 
 Argument::Argument()
         : name(), alias(), value(), type(ArgType::Invalid) {}
@@ -48,13 +49,32 @@ void ArgParser::parse(int argc, char *argv[]) {
     for (i = 1; i < argc; i++) {
         char *str = argv[i];
         if (str[0] == '-') {
-            if (str[1] == '-') { // long name: --argname
-                argIndex = lookup_keyword(std::string(&str[2]));
-            } else if (std::isalpha(str[1]) && str[2] == '\0') { // alias: -a
+            std::optional<std::string> value;
+            if (str[1] == '-') { // long name: --argname or --argname=value
+                std::string name(&str[2]);
+                size_t equals = name.find('=');
+                if (equals != std::string::npos) {
+                    value = name.substr(equals + 1);
+                    name.resize(equals);
+                }
+                argIndex = lookup_keyword(name);
+            } else if (std::isalpha(str[1])) { // alias: -a or -avalue
                 argIndex = lookup_keyword(std::string(1, str[1]));
+                if (str[2] != '\0') {
+                    value = std::string(&str[2]);
+                }
             } else {
                 throw std::runtime_error("Expected argument value");
             }
+            // Argument value attached to the name
+            if (value.has_value()) {
+                if (m_keywords[argIndex].type != ArgType::String) {
+                    throw std::runtime_error(
+                            "Unexpected argument value: " + std::string(str));
+                }
+                m_keywords[argIndex].value = value.value();
+                continue;
+            }
             // Argument value found in next place for string argument
             if (m_keywords[argIndex].type == ArgType::String) {
                 i++;
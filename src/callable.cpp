@@ -14,7 +14,7 @@ InlineFrames::InlineFrames(Serializer &serializer)
         : m_serializer(serializer), m_params(), m_records() {}
 
 void InlineFrames::open_call(
-        std::vector<std::unique_ptr<ExpressionNode>> const &args, 
+        NodeList<ExpressionNode> args, 
         std::vector<SymbolId> const &param_ids, bool writeback) {
     for (std::size_t i = 0; i < param_ids.size(); i++) {
         SymbolId id = param_ids[i];
@@ -22,7 +22,7 @@ void InlineFrames::open_call(
         m_records.push(InlineRecord(
             id, iter == m_params.end() ? InlineVariable() : iter->second
         ));
-        m_params[id] = InlineVariable(args[i].get(), false, false);
+        m_params[id] = InlineVariable(args[i], false, false);
     }
     if (writeback) {
         args.front()->serialize_load_address(m_serializer);
@@ -0,0 +1,421 @@
+#include "codecache.hpp"
+#include "tree.hpp"
+#include "treeprinter.hpp"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <limits>
+#include <unistd.h>
+
+static constexpr uint64_t hash_basis = 14695981039346656037ull;
+
+// FNV-1a, which is the same in every build of the compiler
+static uint64_t hash_word(uint64_t hash, uint64_t word) {
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ (word & 0xff)) * 1099511628211ull;
+        word >>= 8;
+    }
+    return hash;
+}
+
+static uint64_t hash_data(uint64_t hash, std::string_view data) {
+    for (char c : data) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+    }
+    return hash_word(hash, data.size());
+}
+
+CodeObject::CodeObject()
+        : code(), relocations(), n_labels(0), jobs(), remarks(),
+        address_taken(false) {}
+
+CodeCache::CodeCache(std::string directory, SymbolTable const &symbol_table,
+        SourceManager const &sources, std::string const &options)
+        : m_directory(directory), m_symbol_table(symbol_table),
+        m_sources(sources), m_options(hash_data(hash_basis, options)),
+        m_names(), m_ids(), m_keys(), m_files(), m_modules(sources.size()),
+        m_mutex() {
+    std::filesystem::create_directories(m_directory);
+    name_symbols();
+    hash_symbols();
+}
+
+// Code refers to functions, globals and types, never to the locals of
+// another function
+bool CodeCache::is_global(SymbolId id) const {
+    if (id == no_symbol || id >= m_symbol_table.counter()) {
+        return false;
+    }
+    switch (m_symbol_table.get(id).storage_type) {
+        case StorageType::Relative:
+        case StorageType::RelativeRef:
+        case StorageType::InlineReference:
+            return false;
+        default:
+            return true;
+    }
+}
+
+void CodeCache::name_symbols() {
+    m_names.resize(m_symbol_table.counter());
+    std::unordered_map<std::string, uint32_t> ranks;
+    for (SymbolEntry const &entry : m_symbol_table) {
+        if (!is_global(entry.id)) {
+            continue;
+        }
+        std::string name = entry.symbol + ":"
+                + (entry.type == nullptr ? "" : to_string(entry.type));
+        name += "#" + std::to_string(ranks[name]++);
+        m_ids[name] = entry.id;
+        m_names[entry.id] = std::move(name);
+    }
+}
+
+// Hashes the source text of the definition, which also places it, and
+// collects the symbols it refers to
+uint64_t CodeCache::hash_definition(SymbolId id,
+        std::vector<SymbolId> &refs) {
+    SymbolEntry const &entry = m_symbol_table.get(id);
+    uint64_t hash = hash_data(hash_basis, m_names[id]);
+    hash = hash_word(hash, static_cast<uint64_t>(entry.storage_type));
+    hash = hash_word(hash, entry.size);
+    hash = hash_word(hash, entry.pure);
+    if (entry.storage_type == StorageType::Callable) {
+        refs = m_symbol_table.callable(id);
+    } else if (entry.definition != nullptr) {
+        Token start = entry.definition->token();
+        SourcePos pos = m_sources.locate(start);
+        m_files[id] = pos.file;
+        SourceFile const *file = pos.file == no_file ? nullptr
+                : &m_sources.file(pos.file);
+        char const *end = start.data().data() + start.data().size();
+        TreePrinter visitor([&](BaseNode const *node) {
+            if (node->id() != id && is_global(node->id())) {
+                refs.push_back(node->id());
+            }
+            std::string_view data = node->token().data();
+            if (file != nullptr && file->contains(data)
+                    && data.data() + data.size() > end) {
+                end = data.data() + data.size();
+            }
+        });
+        entry.definition->print(visitor);
+        if (file != nullptr) {
+            hash = hash_data(hash, m_sources.describe(pos));
+            hash = hash_data(hash, std::string_view(start.data().data(),
+                    end - start.data().data()));
+        }
+        if (auto function = dynamic_cast<FunctionNode const *>(
+                entry.definition)) {
+            hash = hash_word(hash, function->memo());
+            hash = hash_word(hash, function->writeback());
+        } else if (auto inlined = dynamic_cast<InlineNode const *>(
+                entry.definition)) {
+            hash = hash_word(hash, inlined->writeback());
+        }
+    }
+    for (SymbolId ref : refs) {
+        hash = hash_data(hash, m_names[ref]);
+    }
+    return hash;
+}
+
+// The key of a symbol covers the definitions of all symbols it reaches.
+// Those of a strongly connected component are hashed together, after the
+// components they refer to.
+void CodeCache::hash_symbols() {
+    constexpr uint32_t unvisited = std::numeric_limits<uint32_t>::max();
+    std::size_t n_symbols = m_symbol_table.counter();
+    std::vector<uint64_t> hashes(n_symbols);
+    std::vector<std::vector<SymbolId>> refs(n_symbols);
+    m_files.assign(n_symbols, no_file);
+    for (SymbolId id = 0; id < n_symbols; id++) {
+        if (is_global(id)) {
+            hashes[id] = hash_definition(id, refs[id]);
+        }
+    }
+
+    std::vector<uint32_t> index(n_symbols, unvisited);
+    std::vector<uint32_t> low(n_symbols);
+    std::vector<uint32_t> component(n_symbols, unvisited);
+    std::vector<uint64_t> component_hashes;
+    std::vector<SymbolId> stack;
+    std::vector<std::pair<SymbolId, std::size_t>> calls;
+    uint32_t n_visited = 0;
+    auto visit = [&](SymbolId id) {
+        index[id] = low[id] = n_visited++;
+        stack.push_back(id);
+        calls.emplace_back(id, 0);
+    };
+    for (SymbolId root = 0; root < n_symbols; root++) {
+        if (!is_global(root) || index[root] != unvisited) {
+            continue;
+        }
+        visit(root);
+        while (!calls.empty()) {
+            auto &[id, next] = calls.back();
+            if (next < refs[id].size()) {
+                SymbolId ref = refs[id][next++];
+                if (index[ref] == unvisited) {
+                    visit(ref);
+                } else if (component[ref] == unvisited) {
+                    low[id] = std::min(low[id], index[ref]);
+                }
+                continue;
+            }
+            SymbolId done = id;
+            calls.pop_back();
+            if (!calls.empty()) {
+                SymbolId caller = calls.back().first;
+                low[caller] = std::min(low[caller], low[done]);
+            }
+            if (low[done] != index[done]) {
+                continue;
+            }
+            uint32_t current = component_hashes.size();
+            std::vector<SymbolId> members;
+            do {
+                members.push_back(stack.back());
+                component[stack.back()] = current;
+                stack.pop_back();
+            } while (members.back() != done);
+            std::vector<uint64_t> own;
+            std::vector<uint64_t> reached;
+            for (SymbolId member : members) {
+                own.push_back(hashes[member]);
+                for (SymbolId ref : refs[member]) {
+                    if (component[ref] != current) {
+                        reached.push_back(component_hashes[component[ref]]);
+                    }
+                }
+            }
+            std::sort(own.begin(), own.end());
+            std::sort(reached.begin(), reached.end());
+            reached.erase(std::unique(reached.begin(), reached.end()),
+                    reached.end());
+            uint64_t hash = hash_basis;
+            for (uint64_t member_hash : own) {
+                hash = hash_word(hash, member_hash);
+            }
+            for (uint64_t reached_hash : reached) {
+                hash = hash_word(hash, reached_hash);
+            }
+            component_hashes.push_back(hash);
+        }
+    }
+
+    m_keys.resize(n_symbols);
+    for (SymbolId id = 0; id < n_symbols; id++) {
+        if (is_global(id)) {
+            uint64_t hash = hash_word(m_options, hashes[id]);
+            m_keys[id] = hash_word(hash, component_hashes[component[id]]);
+        }
+    }
+}
+
+std::string CodeCache::path(FileId file) const {
+    std::string filename = std::filesystem::weakly_canonical(
+            m_sources.file(file).filename()).string();
+    std::ostringstream name;
+    name << std::hex << hash_data(m_options, filename) << ".fxm";
+    return (std::filesystem::path(m_directory) / name.str()).string();
+}
+
+static void write_word(std::ostream &out, uint64_t word) {
+    out.write(reinterpret_cast<char const *>(&word), sizeof(word));
+}
+
+static void write_string(std::ostream &out, std::string const &string) {
+    write_word(out, string.size());
+    out.write(string.data(), string.size());
+}
+
+static uint64_t read_word(std::istream &in) {
+    uint64_t word = 0;
+    in.read(reinterpret_cast<char *>(&word), sizeof(word));
+    return word;
+}
+
+static std::string read_string(std::istream &in) {
+    std::string string(std::min<uint64_t>(read_word(in), 1 << 24), '\0');
+    in.read(string.data(), string.size());
+    return string;
+}
+
+// The module of the file a function is defined in, read the first time.
+// A module that is missing, of another version or cut short is empty.
+CodeCache::Module *CodeCache::module(SymbolId id) {
+    FileId file = m_files[id];
+    if (file == no_file) {
+        return nullptr;
+    }
+    Module &module = m_modules[file];
+    if (module.loaded) {
+        return &module;
+    }
+    module.loaded = true;
+    std::ifstream in(path(file), std::ios::binary);
+    if (read_word(in) != version) {
+        return &module;
+    }
+    uint64_t n_objects = read_word(in);
+    for (uint64_t i = 0; i < n_objects && in; i++) {
+        std::string name = read_string(in);
+        Module::Entry entry;
+        entry.key = read_word(in);
+        entry.data = std::make_shared<std::string const>(read_string(in));
+        if (in) {
+            module.objects[name] = entry;
+        }
+    }
+    return &module;
+}
+
+std::optional<CodeObject> CodeCache::load(SymbolId id) {
+    std::shared_ptr<std::string const> data;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Module *module = this->module(id);
+        if (module == nullptr) {
+            return std::nullopt;
+        }
+        auto iter = module->objects.find(m_names[id]);
+        if (iter == module->objects.end() || iter->second.key != m_keys[id]) {
+            return std::nullopt;
+        }
+        data = iter->second.data;
+    }
+    return decode(*data);
+}
+
+void CodeCache::store(SymbolId id, CodeObject const &object) {
+    std::string data = encode(object);
+    if (data.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Module *module = this->module(id);
+    if (module != nullptr) {
+        module->objects[m_names[id]] = {m_keys[id],
+                std::make_shared<std::string const>(std::move(data))};
+        module->changed = true;
+    }
+}
+
+// Each module is written to a file of its own first, so that a build
+// reading it at the same time never sees it in part
+void CodeCache::save() const {
+    for (FileId file = 0; file < m_modules.size(); file++) {
+        Module const &module = m_modules[file];
+        if (!module.changed) {
+            continue;
+        }
+        std::string filename = path(file);
+        std::string temp = filename + "." + std::to_string(getpid());
+        {
+            std::ofstream out(temp, std::ios::binary);
+            write_word(out, version);
+            write_word(out, module.objects.size());
+            for (auto const &[name, entry] : module.objects) {
+                write_string(out, name);
+                write_word(out, entry.key);
+                write_string(out, *entry.data);
+            }
+            if (!out) {
+                throw std::runtime_error("Could not write module: " + temp);
+            }
+        }
+        std::filesystem::rename(temp, filename);
+    }
+}
+
+// Symbols are listed by name before the code, which refers to them by index.
+// Objects referring to locals of other functions are not kept.
+std::string CodeCache::encode(CodeObject const &object) const {
+    std::vector<SymbolId> symbols;
+    std::unordered_map<SymbolId, std::size_t> indices;
+    auto symbol_index = [&](SymbolId symbol) {
+        auto [iter, inserted] = indices.emplace(symbol, symbols.size());
+        if (inserted) {
+            symbols.push_back(symbol);
+        }
+        return iter->second;
+    };
+    std::ostringstream body;
+    write_word(body, object.n_labels);
+    write_word(body, object.jobs.size());
+    for (SymbolId job : object.jobs) {
+        write_word(body, symbol_index(job));
+    }
+    write_word(body, object.code.size());
+    for (std::size_t i = 0; i < object.code.size(); i++) {
+        StackEntry entry = object.code[i];
+        if (object.relocations[i] == Relocation::Symbol) {
+            entry.set_data(symbol_index(entry.get_data()));
+        }
+        write_word(body, static_cast<uint64_t>(object.relocations[i]));
+        entry.write(body);
+    }
+    write_word(body, object.address_taken);
+    write_word(body, object.remarks.size());
+    for (std::string const &remark : object.remarks) {
+        write_string(body, remark);
+    }
+
+    std::ostringstream out;
+    write_word(out, symbols.size());
+    for (SymbolId symbol : symbols) {
+        if (!is_global(symbol)) {
+            return "";
+        }
+        write_string(out, m_names[symbol]);
+    }
+    out << body.str();
+    return out.str();
+}
+
+std::optional<CodeObject> CodeCache::decode(std::string const &data) const {
+    std::istringstream in(data);
+    std::vector<SymbolId> symbols(std::min<uint64_t>(read_word(in),
+            data.size()));
+    for (SymbolId &symbol : symbols) {
+        auto iter = m_ids.find(read_string(in));
+        if (!in || iter == m_ids.end()) {
+            return std::nullopt;
+        }
+        symbol = iter->second;
+    }
+    CodeObject object;
+    object.n_labels = read_word(in);
+    object.jobs.resize(std::min<uint64_t>(read_word(in), data.size()));
+    for (SymbolId &job : object.jobs) {
+        uint64_t symbol = read_word(in);
+        if (symbol >= symbols.size()) {
+            return std::nullopt;
+        }
+        job = symbols[symbol];
+    }
+    uint64_t n_entries = read_word(in);
+    for (uint64_t i = 0; i < n_entries && in; i++) {
+        Relocation relocation = static_cast<Relocation>(read_word(in));
+        StackEntry entry = StackEntry::read(in);
+        if (relocation == Relocation::Symbol) {
+            if (entry.get_data() >= symbols.size()) {
+                return std::nullopt;
+            }
+            entry.set_data(symbols[entry.get_data()]);
+        }
+        object.code.push_back(entry);
+        object.relocations.push_back(relocation);
+    }
+    object.address_taken = read_word(in);
+    object.remarks.resize(std::min<uint64_t>(read_word(in), data.size()));
+    for (std::string &remark : object.remarks) {
+        remark = read_string(in);
+    }
+    if (!in) {
+        return std::nullopt;
+    }
+    return object;
+}
@@ -0,0 +1,53 @@
+#include "interner.hpp"
+
+Interner::Interner()
+        : m_atoms(), m_names(), m_mutex() {}
+
+Atom Interner::intern(std::string_view name) {
+    {
+        std::shared_lock lock(m_mutex);
+        auto iter = m_atoms.find(name);
+        if (iter != m_atoms.end()) {
+            return iter->second;
+        }
+    }
+    std::unique_lock lock(m_mutex);
+    // Another thread may have interned it in between
+    auto iter = m_atoms.find(name);
+    if (iter != m_atoms.end()) {
+        return iter->second;
+    }
+    Atom atom = m_names.size();
+    m_names.emplace_back(name);
+    m_atoms.emplace(m_names.back(), atom);
+    return atom;
+}
+
+Atom Interner::find(std::string_view name) const {
+    std::shared_lock lock(m_mutex);
+    auto iter = m_atoms.find(name);
+    return iter == m_atoms.end() ? no_atom : iter->second;
+}
+
+std::string_view Interner::name(Atom atom) const {
+    std::shared_lock lock(m_mutex);
+    return m_names.at(atom);
+}
+
+std::size_t Interner::size() const {
+    std::shared_lock lock(m_mutex);
+    return m_names.size();
+}
+
+AtomCache::AtomCache(Interner &interner)
+        : m_interner(interner), m_atoms() {}
+
+Atom AtomCache::intern(std::string_view name) {
+    auto iter = m_atoms.find(name);
+    if (iter != m_atoms.end()) {
+        return iter->second;
+    }
+    Atom atom = m_interner.intern(name);
+    m_atoms.emplace(m_interner.name(atom), atom);
+    return atom;
+}
@@ -0,0 +1,507 @@
+#include "ir.hpp"
+#include "mnemonics.hpp"
+#include "tree.hpp"
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+static std::string const ir_op_names[] = {
+    "const", "param", "frameaddr", "globaladdr", "funcaddr", "load", "store",
+    "unary", "binary", "select", "call", "calldyn", "syscall", "phi", "jump",
+    "branch", "switch", "return"
+};
+
+IrInstr::IrInstr(IrOp op, FuncCode funccode, int32_t imm,
+        std::vector<IrInstr *> args)
+        : op(op), funccode(funccode), imm(imm), args(std::move(args)),
+        targets(), cases(), block(nullptr), id(0) {}
+
+bool IrInstr::has_value() const {
+    switch (op) {
+        case IrOp::Store:
+        case IrOp::Jump:
+        case IrOp::Branch:
+        case IrOp::Switch:
+        case IrOp::Return:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool IrInstr::has_side_effects() const {
+    switch (op) {
+        case IrOp::Store:
+        case IrOp::Call:
+        case IrOp::CallDyn:
+        case IrOp::SysCall:
+        case IrOp::Jump:
+        case IrOp::Branch:
+        case IrOp::Switch:
+        case IrOp::Return:
+            return true;
+        case IrOp::Binary:
+            // Division may fail, unless by a constant other than 0 and -1
+            if (funccode == FuncCode::Div || funccode == FuncCode::Mod) {
+                IrInstr const *divisor = args[1];
+                return divisor->op != IrOp::Const || divisor->imm == 0
+                        || divisor->imm == -1;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+bool IrInstr::is_terminator() const {
+    return op == IrOp::Jump || op == IrOp::Branch || op == IrOp::Switch
+            || op == IrOp::Return;
+}
+
+bool IrInstr::is_rematerializable() const {
+    switch (op) {
+        case IrOp::Const:
+        case IrOp::Param:
+        case IrOp::FrameAddr:
+        case IrOp::GlobalAddr:
+        case IrOp::FuncAddr:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool IrInstr::is_commutative() const {
+    if (op != IrOp::Binary) {
+        return false;
+    }
+    switch (funccode) {
+        case FuncCode::Add:
+        case FuncCode::Mul:
+        case FuncCode::Equals:
+        case FuncCode::NotEquals:
+        case FuncCode::And:
+        case FuncCode::Or:
+        case FuncCode::Xor:
+            return true;
+        default:
+            return false;
+    }
+}
+
+IrBlock::IrBlock(uint32_t id)
+        : id(id), instrs(), preds() {}
+
+IrInstr *IrBlock::terminator() const {
+    if (instrs.empty() || !instrs.back()->is_terminator()) {
+        return nullptr;
+    }
+    return instrs.back().get();
+}
+
+std::vector<IrBlock *> IrBlock::successors() const {
+    IrInstr const *last = terminator();
+    if (last == nullptr) {
+        return {};
+    }
+    return last->targets;
+}
+
+std::size_t IrBlock::first_non_phi() const {
+    std::size_t index = 0;
+    while (index < instrs.size() && instrs[index]->op == IrOp::Phi) {
+        index++;
+    }
+    return index;
+}
+
+IrFunction::IrFunction(FunctionNode const *node, std::string name)
+        : node(node), name(std::move(name)), blocks(), next_value(0),
+        next_block(0) {}
+
+IrBlock *IrFunction::add_block() {
+    blocks.push_back(std::make_unique<IrBlock>(next_block++));
+    return blocks.back().get();
+}
+
+IrInstr *IrFunction::append(IrBlock *block, IrOp op, FuncCode funccode,
+        int32_t imm, std::vector<IrInstr *> args) {
+    return insert(block, block->instrs.size(), op, funccode, imm,
+            std::move(args));
+}
+
+IrInstr *IrFunction::insert(IrBlock *block, std::size_t index, IrOp op,
+        FuncCode funccode, int32_t imm, std::vector<IrInstr *> args) {
+    auto instr = std::make_unique<IrInstr>(op, funccode, imm, std::move(args));
+    instr->block = block;
+    instr->id = next_value++;
+    IrInstr *result = instr.get();
+    block->instrs.insert(block->instrs.begin() + index, std::move(instr));
+    return result;
+}
+
+// The terminator of from is set by the caller
+void IrFunction::add_edge(IrBlock *from, IrBlock *to) {
+    to->preds.push_back(from);
+}
+
+// Drops one edge from the predecessors of to, with the matching phi
+// arguments. The terminator of from is updated by the caller.
+void IrFunction::remove_edge(IrBlock *from, IrBlock *to) {
+    auto iter = std::find(to->preds.begin(), to->preds.end(), from);
+    if (iter == to->preds.end()) {
+        throw std::runtime_error("Removing missing IR edge");
+    }
+    std::size_t index = iter - to->preds.begin();
+    to->preds.erase(iter);
+    for (std::size_t i = 0; i < to->first_non_phi(); i++) {
+        IrInstr *phi = to->instrs[i].get();
+        phi->args.erase(phi->args.begin() + index);
+    }
+}
+
+void IrFunction::replace_uses(IrInstr *from, IrInstr *to) {
+    for (auto const &block : blocks) {
+        for (auto const &instr : block->instrs) {
+            std::replace(instr->args.begin(), instr->args.end(), from, to);
+        }
+    }
+}
+
+bool IrFunction::remove_unreachable() {
+    std::vector<IrBlock *> order = reverse_postorder();
+    std::unordered_set<IrBlock *> reachable(order.begin(), order.end());
+    if (reachable.size() == blocks.size()) {
+        return false;
+    }
+    for (auto const &block : blocks) {
+        if (reachable.count(block.get()) != 0) {
+            continue;
+        }
+        for (IrBlock *successor : block->successors()) {
+            if (reachable.count(successor) != 0) {
+                remove_edge(block.get(), successor);
+            }
+        }
+    }
+    std::erase_if(blocks, [&](std::unique_ptr<IrBlock> const &block) {
+        return reachable.count(block.get()) == 0;
+    });
+    return true;
+}
+
+// An edge from a block with several successors to one with several
+// predecessors gets a block of its own, where copies for phis can go
+void IrFunction::split_critical_edges() {
+    std::size_t count = blocks.size();
+    for (std::size_t i = 0; i < count; i++) {
+        IrInstr *last = blocks[i]->terminator();
+        if (last == nullptr || last->targets.size() < 2) {
+            continue;
+        }
+        for (IrBlock *&target : last->targets) {
+            if (target->preds.size() < 2) {
+                continue;
+            }
+            IrBlock *edge = add_block();
+            IrInstr *jump = append(edge, IrOp::Jump);
+            jump->targets.push_back(target);
+            edge->preds.push_back(blocks[i].get());
+            *std::find(target->preds.begin(), target->preds.end(),
+                    blocks[i].get()) = edge;
+            target = edge;
+        }
+    }
+}
+
+// Successors are visited last to first, so that a block is followed by
+// its first successor where possible, as the emitter lays out blocks in
+// this order
+std::vector<IrBlock *> IrFunction::reverse_postorder() const {
+    std::vector<IrBlock *> order;
+    if (blocks.empty()) {
+        return order;
+    }
+    std::unordered_set<IrBlock *> visited;
+    // Blocks with the index of their next successor to visit
+    std::vector<std::pair<IrBlock *, std::size_t>> stack;
+    stack.push_back({blocks.front().get(), 0});
+    visited.insert(blocks.front().get());
+    while (!stack.empty()) {
+        auto &[block, next] = stack.back();
+        std::vector<IrBlock *> successors = block->successors();
+        if (next < successors.size()) {
+            IrBlock *successor = successors[successors.size() - ++next];
+            if (visited.insert(successor).second) {
+                stack.push_back({successor, 0});
+            }
+            continue;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+// Iterative algorithm of Cooper, Harvey and Kennedy over reachable blocks
+std::unordered_map<IrBlock *, IrBlock *>
+        IrFunction::immediate_dominators() const {
+    std::vector<IrBlock *> order = reverse_postorder();
+    std::unordered_map<IrBlock *, std::size_t> index;
+    for (std::size_t i = 0; i < order.size(); i++) {
+        index[order[i]] = i;
+    }
+    std::unordered_map<IrBlock *, IrBlock *> idom;
+    if (order.empty()) {
+        return idom;
+    }
+    idom[order.front()] = order.front();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (std::size_t i = 1; i < order.size(); i++) {
+            IrBlock *dominator = nullptr;
+            for (IrBlock *pred : order[i]->preds) {
+                if (idom.count(pred) == 0) {
+                    continue;
+                }
+                if (dominator == nullptr) {
+                    dominator = pred;
+                    continue;
+                }
+                IrBlock *other = pred;
+                while (dominator != other) {
+                    while (index[dominator] > index[other]) {
+                        dominator = idom[dominator];
+                    }
+                    while (index[other] > index[dominator]) {
+                        other = idom[other];
+                    }
+                }
+            }
+            if (idom[order[i]] != dominator) {
+                idom[order[i]] = dominator;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+std::unordered_map<IrInstr *, uint32_t> IrFunction::use_counts() const {
+    std::unordered_map<IrInstr *, uint32_t> counts;
+    for (auto const &block : blocks) {
+        for (auto const &instr : block->instrs) {
+            for (IrInstr *arg : instr->args) {
+                counts[arg]++;
+            }
+        }
+    }
+    return counts;
+}
+
+std::size_t IrFunction::size() const {
+    std::size_t size = 0;
+    for (auto const &block : blocks) {
+        size += block->instrs.size();
+    }
+    return size;
+}
+
+static bool dominates(IrBlock *dominator, IrBlock *block,
+        std::unordered_map<IrBlock *, IrBlock *> const &idom) {
+    while (block != dominator) {
+        IrBlock *next = idom.at(block);
+        if (next == block) {
+            return false;
+        }
+        block = next;
+    }
+    return true;
+}
+
+// Checks the invariants the passes and the emitter rely on
+void IrFunction::verify() const {
+    auto fail = [&](std::string const &message) {
+        throw std::runtime_error("Invalid IR in " + name + ": " + message);
+    };
+    std::unordered_map<IrInstr *, std::size_t> positions;
+    std::unordered_map<IrBlock *, std::vector<IrBlock *>> incoming;
+    for (auto const &block : blocks) {
+        if (block->terminator() == nullptr) {
+            fail("block " + std::to_string(block->id) + " not terminated");
+        }
+        for (std::size_t i = 0; i < block->instrs.size(); i++) {
+            IrInstr *instr = block->instrs[i].get();
+            positions[instr] = i;
+            if (instr->block != block.get()) {
+                fail("instruction in wrong block");
+            }
+            if (instr->is_terminator() != (i + 1 == block->instrs.size())) {
+                fail("misplaced terminator");
+            }
+            if (instr->op == IrOp::Phi && i >= block->first_non_phi()) {
+                fail("misplaced phi");
+            }
+        }
+        for (IrBlock *successor : block->successors()) {
+            incoming[successor].push_back(block.get());
+        }
+    }
+    if (!blocks.empty() && !blocks.front()->preds.empty()) {
+        fail("entry block has predecessors");
+    }
+    std::unordered_map<IrBlock *, IrBlock *> idom = immediate_dominators();
+    for (auto const &block : blocks) {
+        std::vector<IrBlock *> expected = incoming[block.get()];
+        std::vector<IrBlock *> preds = block->preds;
+        std::sort(expected.begin(), expected.end());
+        std::sort(preds.begin(), preds.end());
+        if (expected != preds) {
+            fail("predecessors of block " + std::to_string(block->id));
+        }
+        if (idom.count(block.get()) == 0) {
+            continue;
+        }
+        for (auto const &instr : block->instrs) {
+            for (std::size_t i = 0; i < instr->args.size(); i++) {
+                IrInstr *arg = instr->args[i];
+                if (positions.count(arg) == 0) {
+                    fail("use of removed value");
+                }
+                if (!arg->has_value()) {
+                    fail("use of instruction without value");
+                }
+                IrBlock *user = instr->op == IrOp::Phi
+                        ? block->preds.at(i) : block.get();
+                if (idom.count(user) == 0) {
+                    continue;
+                }
+                bool available = arg->block == user && instr->op != IrOp::Phi
+                        ? positions[arg] < positions[instr.get()]
+                        : dominates(arg->block, user, idom);
+                if (!available) {
+                    fail("%" + std::to_string(arg->id)
+                            + " does not dominate its use");
+                }
+            }
+            if (instr->op == IrOp::Phi
+                    && instr->args.size() != block->preds.size()) {
+                fail("phi arguments do not match predecessors");
+            }
+        }
+    }
+}
+
+void IrFunction::dump() const {
+    std::cerr << "fn " << name << ":" << std::endl;
+    for (auto const &block : blocks) {
+        std::cerr << "  b" << block->id << ":";
+        if (!block->preds.empty()) {
+            std::cerr << "  ; preds";
+            for (IrBlock *pred : block->preds) {
+                std::cerr << " b" << pred->id;
+            }
+        }
+        std::cerr << std::endl;
+        for (auto const &instr : block->instrs) {
+            std::cerr << "    ";
+            if (instr->has_value()) {
+                std::cerr << "%" << instr->id << " = ";
+            }
+            std::cerr << ir_op_names[static_cast<std::size_t>(instr->op)];
+            if (instr->op == IrOp::Unary) {
+                std::cerr << "." << get_func_name(OpCode::Unary,
+                        instr->funccode);
+            } else if (instr->op == IrOp::Binary) {
+                std::cerr << "." << get_func_name(OpCode::Binary,
+                        instr->funccode);
+            } else if (instr->op == IrOp::SysCall) {
+                std::cerr << "." << get_func_name(OpCode::SysCall,
+                        instr->funccode);
+            }
+            char const *separator = " ";
+            switch (instr->op) {
+                case IrOp::Const:
+                case IrOp::Param:
+                case IrOp::FrameAddr:
+                    std::cerr << " " << instr->imm;
+                    separator = ", ";
+                    break;
+                case IrOp::GlobalAddr:
+                case IrOp::FuncAddr:
+                case IrOp::Call:
+                    std::cerr << " .L" << instr->imm;
+                    separator = ", ";
+                    break;
+                default:
+                    break;
+            }
+            for (std::size_t i = 0; i < instr->args.size(); i++) {
+                std::cerr << separator;
+                separator = ", ";
+                if (instr->op == IrOp::Phi) {
+                    std::cerr << "[%" << instr->args[i]->id << ", b"
+                            << block->preds[i]->id << "]";
+                } else {
+                    std::cerr << "%" << instr->args[i]->id;
+                }
+            }
+            for (std::size_t i = 0; i < instr->targets.size(); i++) {
+                std::cerr << separator;
+                separator = ", ";
+                if (i > 0 && instr->op == IrOp::Switch) {
+                    std::cerr << "[" << instr->cases[i - 1] << ", ";
+                }
+                std::cerr << "b" << instr->targets[i]->id;
+                if (i > 0 && instr->op == IrOp::Switch) {
+                    std::cerr << "]";
+                }
+            }
+            std::cerr << std::endl;
+        }
+    }
+}
+
+IrModule::IrModule()
+        : m_functions(), m_by_id(), m_unlowered(), m_remarks() {}
+
+void IrModule::add(std::unique_ptr<IrFunction> function) {
+    m_by_id[function->node->id()] = function.get();
+    m_functions.push_back(std::move(function));
+}
+
+void IrModule::add_unlowered(FunctionNode const *, std::string const &name,
+        std::string const &reason) {
+    m_unlowered.push_back({name, reason});
+    add_remark("not lowered '" + name + "' to IR: " + reason);
+}
+
+IrFunction *IrModule::find(SymbolId id) const {
+    auto iter = m_by_id.find(id);
+    return iter == m_by_id.end() ? nullptr : iter->second;
+}
+
+std::vector<std::unique_ptr<IrFunction>> const &IrModule::functions() const {
+    return m_functions;
+}
+
+void IrModule::add_remark(std::string const &remark) {
+    m_remarks.push_back(remark);
+}
+
+std::vector<std::string> const &IrModule::remarks() const {
+    return m_remarks;
+}
+
+void IrModule::dump() const {
+    for (auto const &function : m_functions) {
+        function->dump();
+    }
+    for (auto const &[name, reason] : m_unlowered) {
+        std::cerr << "fn " << name << ": not lowered, " << reason
+                << std::endl;
+    }
+}
@@ -0,0 +1,365 @@
+#include "irbuilder.hpp"
+#include "tree.hpp"
+#include <stdexcept>
+
+IrBuilder::IrBuilder(SymbolTable const &symbol_table, PassSet const &passes)
+        : m_symbol_table(symbol_table), m_passes(passes), m_function(), 
+        m_block(nullptr),
+        m_in_memory(), m_definitions(), m_incomplete(), m_sealed(),
+        m_replaced(), m_environment() {}
+
+IrModule IrBuilder::build() {
+    IrModule module;
+    for (SymbolEntry const &entry : m_symbol_table) {
+        auto node = dynamic_cast<FunctionNode const *>(entry.definition);
+        // Parameters are also defined by their function
+        if (node == nullptr || node->id() != entry.id) {
+            continue;
+        }
+        std::string name(node->ident().data());
+        try {
+            std::unique_ptr<IrFunction> function = lower_function(node);
+            module.add_remark("lowered '" + name + "' to IR: "
+                    + std::to_string(function->size()) + " instructions");
+            module.add(std::move(function));
+        } catch (std::exception const &e) {
+            module.add_unlowered(node, name, e.what());
+        }
+    }
+    return module;
+}
+
+std::unique_ptr<IrFunction> IrBuilder::lower_function(
+        FunctionNode const *node) {
+    m_in_memory.clear();
+    collect_address_taken(node->body(), m_in_memory);
+    while (true) {
+        m_function = std::make_unique<IrFunction>(node,
+                std::string(node->ident().data()));
+        m_definitions.clear();
+        m_incomplete.clear();
+        m_sealed.clear();
+        m_replaced.clear();
+        m_environment = std::make_shared<IrEnvironment>();
+        set_block(new_block());
+        seal(m_block);
+        try {
+            node->body()->lower(*this);
+        } catch (Restart const &) {
+            continue;
+        }
+        ret(constant(0));
+        finish();
+        return std::move(m_function);
+    }
+}
+
+SymbolTable const &IrBuilder::symbol_table() const {
+    return m_symbol_table;
+}
+
+PassSet const &IrBuilder::passes() const {
+    return m_passes;
+}
+
+IrFunction &IrBuilder::function() {
+    return *m_function;
+}
+
+IrBlock *IrBuilder::block() const {
+    return m_block;
+}
+
+IrBlock *IrBuilder::new_block() {
+    return m_function->add_block();
+}
+
+void IrBuilder::set_block(IrBlock *block) {
+    m_block = block;
+}
+
+// All predecessors of block are known: completes the phis of its reads
+void IrBuilder::seal(IrBlock *block) {
+    auto iter = m_incomplete.find(block);
+    if (iter != m_incomplete.end()) {
+        for (auto const &[id, phi] : iter->second) {
+            add_phi_operands(id, phi);
+        }
+        m_incomplete.erase(iter);
+    }
+    m_sealed.insert(block);
+}
+
+IrInstr *IrBuilder::emit(IrOp op, FuncCode funccode, int32_t imm,
+        std::vector<IrInstr *> args) {
+    return m_function->append(m_block, op, funccode, imm, std::move(args));
+}
+
+// Constants are kept at the start of the entry block, where they dominate
+// every use
+IrInstr *IrBuilder::constant(int32_t value) {
+    IrBlock *entry = m_function->blocks.front().get();
+    std::size_t index = 0;
+    while (index < entry->instrs.size()
+            && entry->instrs[index]->is_rematerializable()) {
+        index++;
+    }
+    return m_function->insert(entry, index, IrOp::Const, FuncCode::Nop,
+            value);
+}
+
+void IrBuilder::jump(IrBlock *target) {
+    IrInstr *instr = emit(IrOp::Jump);
+    instr->targets = {target};
+    m_function->add_edge(m_block, target);
+}
+
+void IrBuilder::branch(IrInstr *cond, IrBlock *case_true,
+        IrBlock *case_false) {
+    IrInstr *instr = emit(IrOp::Branch, FuncCode::Nop, 0, {cond});
+    instr->targets = {case_true, case_false};
+    m_function->add_edge(m_block, case_true);
+    m_function->add_edge(m_block, case_false);
+}
+
+void IrBuilder::switch_on(IrInstr *value, IrBlock *otherwise, 
+        std::vector<std::pair<int32_t, IrBlock *>> const &cases) {
+    IrInstr *instr = emit(IrOp::Switch, FuncCode::Nop, 0, {value});
+    instr->targets = {otherwise};
+    m_function->add_edge(m_block, otherwise);
+    for (auto const &[case_value, target] : cases) {
+        instr->cases.push_back(case_value);
+        instr->targets.push_back(target);
+        m_function->add_edge(m_block, target);
+    }
+}
+
+// Code following a return goes to a block without predecessors
+void IrBuilder::ret(IrInstr *value) {
+    emit(IrOp::Return, FuncCode::Nop, 0, {value});
+    set_block(new_block());
+    seal(m_block);
+}
+
+IrInstr *IrBuilder::phi(IrBlock *block, std::vector<IrInstr *> args) {
+    return m_function->insert(block, block->first_non_phi(), IrOp::Phi,
+            FuncCode::Nop, 0, std::move(args));
+}
+
+IrLvalue IrBuilder::variable_lvalue(SymbolId id) {
+    SymbolEntry const &entry = m_symbol_table.get(id);
+    switch (entry.storage_type) {
+        case StorageType::Relative:
+            if (m_in_memory.count(id) == 0) {
+                return {id, nullptr};
+            }
+            return {0, emit(IrOp::FrameAddr, FuncCode::Nop, entry.value)};
+        case StorageType::RelativeRef:
+            return {0, emit(IrOp::FrameAddr, FuncCode::Nop, entry.value)};
+        case StorageType::Absolute:
+            return {0, emit(IrOp::GlobalAddr, FuncCode::Nop, entry.id)};
+        default:
+            throw std::runtime_error("Invalid storage type");
+    }
+}
+
+IrInstr *IrBuilder::load(IrLvalue const &lvalue) {
+    if (lvalue.address == nullptr) {
+        return read_variable(lvalue.variable, m_block);
+    }
+    return emit(IrOp::Load, FuncCode::Nop, 0, {lvalue.address});
+}
+
+void IrBuilder::store(IrLvalue const &lvalue, IrInstr *value) {
+    if (lvalue.address == nullptr) {
+        write_variable(lvalue.variable, m_block, value);
+    } else {
+        emit(IrOp::Store, FuncCode::Nop, 0, {lvalue.address, value});
+    }
+}
+
+IrInstr *IrBuilder::address_of(IrLvalue const &lvalue) {
+    if (lvalue.address == nullptr) {
+        m_in_memory.insert(lvalue.variable);
+        throw Restart();
+    }
+    return lvalue.address;
+}
+
+IrInstr *IrBuilder::lower_param(SymbolId id) {
+    IrBinding &param = binding(id);
+    if (param.writeback.has_value()) {
+        return load(param.writeback.value());
+    }
+    std::shared_ptr<IrEnvironment> saved = m_environment;
+    m_environment = param.environment;
+    IrInstr *value = param.node->lower(*this);
+    m_environment = saved;
+    return value;
+}
+
+IrLvalue IrBuilder::lower_param_lvalue(SymbolId id) {
+    IrBinding &param = binding(id);
+    if (param.writeback.has_value()) {
+        return param.writeback.value();
+    }
+    std::shared_ptr<IrEnvironment> saved = m_environment;
+    m_environment = param.environment;
+    IrLvalue lvalue = param.node->lower_lvalue(*this);
+    m_environment = saved;
+    return lvalue;
+}
+
+std::shared_ptr<IrEnvironment> IrBuilder::open_inline_call(
+        NodeList<ExpressionNode> args,
+        std::vector<SymbolId> const &param_ids,
+        std::optional<IrLvalue> writeback) {
+    auto environment = std::make_shared<IrEnvironment>();
+    for (std::size_t i = 0; i < param_ids.size(); i++) {
+        environment->params[param_ids[i]] =
+                {args[i], m_environment, std::nullopt, false};
+    }
+    if (writeback.has_value()) {
+        environment->params[param_ids.front()].writeback = writeback;
+    }
+    std::swap(environment, m_environment);
+    return environment;
+}
+
+void IrBuilder::close_inline_call(std::shared_ptr<IrEnvironment> saved) {
+    m_environment = std::move(saved);
+}
+
+IrBinding &IrBuilder::binding(SymbolId id) {
+    auto iter = m_environment->params.find(id);
+    if (iter == m_environment->params.end()) {
+        throw std::runtime_error("Unbound inline parameter");
+    }
+    if (iter->second.used) {
+        throw std::runtime_error("Inline variable may only be used once");
+    }
+    iter->second.used = true;
+    return iter->second;
+}
+
+IrInstr *IrBuilder::read_variable(SymbolId id, IrBlock *block) {
+    auto &definitions = m_definitions[block];
+    auto iter = definitions.find(id);
+    if (iter != definitions.end()) {
+        return resolve(iter->second);
+    }
+    return read_variable_recursive(id, block);
+}
+
+IrInstr *IrBuilder::read_variable_recursive(SymbolId id, IrBlock *block) {
+    IrInstr *value;
+    if (m_sealed.count(block) == 0) {
+        value = phi(block, {});
+        m_incomplete[block].push_back({id, value});
+    } else if (block->preds.empty()) {
+        // Parameters start with their argument, locals zeroed
+        SymbolEntry const &entry = m_symbol_table.get(id);
+        if (dynamic_cast<FunctionNode const *>(entry.definition) != nullptr) {
+            value = m_function->insert(m_function->blocks.front().get(), 0,
+                    IrOp::Param, FuncCode::Nop, entry.value);
+        } else {
+            value = undefined();
+        }
+    } else if (block->preds.size() == 1) {
+        value = read_variable(id, block->preds.front());
+    } else {
+        value = phi(block, {});
+        write_variable(id, block, value);
+        value = add_phi_operands(id, value);
+    }
+    write_variable(id, block, value);
+    return value;
+}
+
+void IrBuilder::write_variable(SymbolId id, IrBlock *block, IrInstr *value) {
+    m_definitions[block][id] = value;
+}
+
+IrInstr *IrBuilder::add_phi_operands(SymbolId id, IrInstr *phi) {
+    for (IrBlock *pred : phi->block->preds) {
+        phi->args.push_back(read_variable(id, pred));
+    }
+    return remove_trivial_phi(phi);
+}
+
+// A phi merging a single value, besides itself, is replaced by that value
+IrInstr *IrBuilder::remove_trivial_phi(IrInstr *phi) {
+    IrInstr *same = nullptr;
+    for (IrInstr *arg : phi->args) {
+        arg = resolve(arg);
+        if (arg == same || arg == phi) {
+            continue;
+        }
+        if (same != nullptr) {
+            return phi;
+        }
+        same = arg;
+    }
+    if (same == nullptr) {
+        same = undefined();
+    }
+    m_replaced[phi] = same;
+    return same;
+}
+
+IrInstr *IrBuilder::resolve(IrInstr *value) const {
+    auto iter = m_replaced.find(value);
+    while (iter != m_replaced.end()) {
+        value = iter->second;
+        iter = m_replaced.find(value);
+    }
+    return value;
+}
+
+IrInstr *IrBuilder::undefined() {
+    return constant(0);
+}
+
+// Drops replaced phis, then those made trivial by their removal
+void IrBuilder::finish() {
+    for (auto const &block : m_function->blocks) {
+        for (auto const &instr : block->instrs) {
+            for (IrInstr *&arg : instr->args) {
+                arg = resolve(arg);
+            }
+        }
+        std::erase_if(block->instrs, [&](std::unique_ptr<IrInstr> const &instr) {
+            return m_replaced.count(instr.get()) != 0;
+        });
+    }
+    m_function->remove_unreachable();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto const &block : m_function->blocks) {
+            for (std::size_t i = 0; i < block->first_non_phi(); i++) {
+                IrInstr *phi = block->instrs[i].get();
+                IrInstr *same = nullptr;
+                bool trivial = true;
+                for (IrInstr *arg : phi->args) {
+                    if (arg == phi || arg == same) {
+                        continue;
+                    }
+                    if (same != nullptr) {
+                        trivial = false;
+                        break;
+                    }
+                    same = arg;
+                }
+                if (!trivial) {
+                    continue;
+                }
+                m_function->replace_uses(phi,
+                        same == nullptr ? undefined() : same);
+                block->instrs.erase(block->instrs.begin() + i);
+                changed = true;
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,256 @@
+#include "iremitter.hpp"
+#include "serializer.hpp"
+#include <algorithm>
+
+IrEmitter::IrEmitter(Serializer &serializer, IrFunction &function)
+        : m_serializer(serializer), m_function(function), m_uses(),
+        m_stacked(), m_slots(), m_labels() {}
+
+void IrEmitter::emit() {
+    m_function.split_critical_edges();
+    m_uses = m_function.use_counts();
+    std::vector<IrBlock *> order = m_function.reverse_postorder();
+    for (IrBlock *block : order) {
+        for (std::ptrdiff_t i = block->instrs.size() - 1; i >= 0; i--) {
+            IrInstr *instr = block->instrs[i].get();
+            if (m_stacked.count(instr) == 0) {
+                std::ptrdiff_t cursor = i - 1;
+                stackify(instr, operands(instr), cursor);
+            }
+        }
+        m_labels[block] = m_serializer.get_label();
+    }
+    uint32_t n_slots = 0;
+    for (IrBlock *block : order) {
+        for (auto const &owned : block->instrs) {
+            IrInstr *instr = owned.get();
+            if (instr->op == IrOp::Phi || (instr->has_value()
+                    && m_uses[instr] > 0 && m_stacked.count(instr) == 0
+                    && !instr->is_rematerializable())) {
+                m_slots[instr] = n_slots++;
+            }
+        }
+    }
+    uint32_t base = m_serializer.reserve_frame(n_slots);
+    for (auto &[instr, slot] : m_slots) {
+        slot += base;
+    }
+    for (std::size_t i = 0; i < order.size(); i++) {
+        if (i > 0) {
+            m_serializer.add_label(m_labels[order[i]]);
+        }
+        emit_block(order[i], i + 1 < order.size() ? order[i + 1] : nullptr);
+    }
+    m_serializer.release_frame(n_slots);
+}
+
+// Operands are left on the stack by the instructions right before their
+// user, in order, so they are matched to those back to front
+void IrEmitter::stackify(IrInstr *user, std::vector<IrInstr *> const &operands,
+        std::ptrdiff_t &cursor) {
+    IrBlock *block = user->block;
+    for (auto iter = operands.rbegin(); iter != operands.rend(); iter++) {
+        IrInstr *operand = *iter;
+        if (operand->is_rematerializable() || cursor < 0
+                || block->instrs[cursor].get() != operand
+                || operand->op == IrOp::Phi || m_uses[operand] != 1) {
+            continue;
+        }
+        m_stacked.insert(operand);
+        cursor--;
+        stackify(operand, this->operands(operand), cursor);
+    }
+}
+
+// A jump copies the values of its target's phis for the edge taken
+std::vector<IrInstr *> IrEmitter::operands(IrInstr *instr) const {
+    if (instr->op != IrOp::Jump) {
+        return instr->args;
+    }
+    IrBlock *target = instr->targets.front();
+    std::size_t index = std::find(target->preds.begin(), target->preds.end(),
+            instr->block) - target->preds.begin();
+    std::vector<IrInstr *> values;
+    for (std::size_t i = 0; i < target->first_non_phi(); i++) {
+        IrInstr *phi = target->instrs[i].get();
+        if (phi->args[index] != phi) {
+            values.push_back(phi->args[index]);
+        }
+    }
+    return values;
+}
+
+void IrEmitter::emit_block(IrBlock *block, IrBlock *next) {
+    for (auto const &owned : block->instrs) {
+        IrInstr *instr = owned.get();
+        if (instr->op == IrOp::Phi || instr->is_rematerializable()
+                || m_stacked.count(instr) != 0) {
+            continue;
+        }
+        if (instr->is_terminator()) {
+            emit_terminator(instr, next);
+        } else {
+            emit_value(instr);
+        }
+    }
+}
+
+void IrEmitter::emit_value(IrInstr *instr) {
+    if (!instr->has_value()) {
+        emit_instr(instr);
+        return;
+    }
+    auto slot = m_slots.find(instr);
+    if (slot != m_slots.end()) {
+        emit_instr(instr);
+        m_serializer.add_instr(OpCode::StoreRel, slot->second);
+    } else if (instr->has_side_effects()) {
+        emit_instr(instr);
+        m_serializer.add_instr(OpCode::Pop);
+    }
+}
+
+void IrEmitter::emit_operand(IrInstr *instr) {
+    if (instr->is_rematerializable() || m_stacked.count(instr) != 0) {
+        emit_instr(instr);
+    } else {
+        m_serializer.add_instr(OpCode::LoadRel, m_slots.at(instr));
+    }
+}
+
+void IrEmitter::emit_instr(IrInstr *instr) {
+    IrInstr *address = instr->args.empty() ? nullptr : instr->args.front();
+    switch (instr->op) {
+        case IrOp::Const:
+            m_serializer.add_instr(OpCode::Push, instr->imm);
+            break;
+        case IrOp::Param:
+            m_serializer.add_instr(OpCode::LoadRel, instr->imm);
+            break;
+        case IrOp::FrameAddr:
+            m_serializer.mark_address_taken();
+            m_serializer.add_instr(OpCode::LoadAddrRel, instr->imm);
+            break;
+        case IrOp::GlobalAddr:
+            m_serializer.add_instr(OpCode::Push, instr->imm, true);
+            break;
+        case IrOp::FuncAddr:
+            m_serializer.add_function_implementation(instr->imm);
+            m_serializer.mark_address_taken();
+            m_serializer.add_instr(OpCode::Push, instr->imm, true);
+            break;
+        case IrOp::Load:
+            if (address->op == IrOp::FrameAddr) {
+                m_serializer.add_instr(OpCode::LoadRel, address->imm);
+            } else if (address->op == IrOp::GlobalAddr) {
+                m_serializer.add_instr(OpCode::LoadAbs, address->imm, true);
+            } else {
+                emit_operand(address);
+                m_serializer.add_instr(OpCode::LoadAbs);
+            }
+            break;
+        case IrOp::Store:
+            if (address->op == IrOp::FrameAddr) {
+                emit_operand(instr->args[1]);
+                m_serializer.add_instr(OpCode::StoreRel, address->imm);
+            } else {
+                emit_operand(address);
+                emit_operand(instr->args[1]);
+                m_serializer.add_instr(OpCode::Binary, FuncCode::Assign);
+                m_serializer.add_instr(OpCode::Pop);
+            }
+            break;
+        case IrOp::Unary:
+        case IrOp::Binary:
+        case IrOp::SysCall:
+            for (IrInstr *arg : instr->args) {
+                emit_operand(arg);
+            }
+            m_serializer.add_instr(instr->op == IrOp::Unary ? OpCode::Unary
+                    : instr->op == IrOp::Binary ? OpCode::Binary
+                    : OpCode::SysCall, instr->funccode);
+            break;
+        case IrOp::Select:
+            for (IrInstr *arg : instr->args) {
+                emit_operand(arg);
+            }
+            m_serializer.add_instr(OpCode::Select);
+            break;
+        case IrOp::Call:
+            m_serializer.add_function_implementation(instr->imm);
+            for (IrInstr *arg : instr->args) {
+                emit_operand(arg);
+            }
+            m_serializer.add_counted_instr(OpCode::Call, instr->args.size(),
+                    instr->imm, true);
+            break;
+        case IrOp::CallDyn:
+            for (IrInstr *arg : instr->args) {
+                emit_operand(arg);
+            }
+            m_serializer.add_counted_instr(OpCode::Call,
+                    instr->args.size() - 1);
+            break;
+        default:
+            throw std::runtime_error("Invalid IR value");
+    }
+}
+
+void IrEmitter::emit_terminator(IrInstr *instr, IrBlock *next) {
+    switch (instr->op) {
+        case IrOp::Jump: {
+            IrBlock *target = instr->targets.front();
+            std::vector<IrInstr *> values = operands(instr);
+            for (IrInstr *value : values) {
+                emit_operand(value);
+            }
+            // All values are loaded before any phi is written
+            std::size_t index = std::find(target->preds.begin(),
+                    target->preds.end(), instr->block) - target->preds.begin();
+            for (std::size_t i = target->first_non_phi(); i > 0; i--) {
+                IrInstr *phi = target->instrs[i - 1].get();
+                if (phi->args[index] != phi) {
+                    m_serializer.add_instr(OpCode::StoreRel, m_slots.at(phi));
+                }
+            }
+            if (target != next) {
+                m_serializer.add_instr(OpCode::Jump, m_labels.at(target),
+                        true);
+            }
+            break;
+        }
+        case IrOp::Branch: {
+            IrBlock *case_true = instr->targets[0];
+            IrBlock *case_false = instr->targets[1];
+            emit_operand(instr->args.front());
+            if (case_true == next) {
+                m_serializer.add_instr(OpCode::BrFalse,
+                        m_labels.at(case_false), true);
+            } else {
+                m_serializer.add_instr(OpCode::BrTrue,
+                        m_labels.at(case_true), true);
+                if (case_false != next) {
+                    m_serializer.add_instr(OpCode::Jump,
+                            m_labels.at(case_false), true);
+                }
+            }
+            break;
+        }
+        case IrOp::Switch: {
+            std::vector<std::pair<int32_t, Label>> cases;
+            for (std::size_t i = 0; i < instr->cases.size(); i++) {
+                cases.emplace_back(instr->cases[i],
+                        m_labels.at(instr->targets[i + 1]));
+            }
+            emit_operand(instr->args.front());
+            m_serializer.add_switch(cases, m_labels.at(instr->targets[0]));
+            break;
+        }
+        case IrOp::Return:
+            emit_operand(instr->args.front());
+            m_serializer.add_return();
+            break;
+        default:
+            throw std::runtime_error("Invalid IR terminator");
+    }
+}
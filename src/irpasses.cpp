@@ -0,0 +1,502 @@
+#include "irpasses.hpp"
+#include <map>
+#include <unordered_set>
+#include <algorithm>
+#include <climits>
+
+IrPass::~IrPass() {}
+
+// Arithmetic wraps around, as in the VMs. Division is not folded where it
+// would fail at run time.
+std::optional<int32_t> fold_unary(FuncCode funccode, int32_t a) {
+    switch (funccode) {
+        case FuncCode::Neg:
+            return static_cast<int32_t>(0u - static_cast<uint32_t>(a));
+        case FuncCode::Not:
+            return ~a;
+        default:
+            return std::nullopt;
+    }
+}
+
+std::optional<int32_t> fold_binary(FuncCode funccode, int32_t a, int32_t b) {
+    uint32_t ua = static_cast<uint32_t>(a);
+    uint32_t ub = static_cast<uint32_t>(b);
+    switch (funccode) {
+        case FuncCode::Add:
+            return static_cast<int32_t>(ua + ub);
+        case FuncCode::Sub:
+            return static_cast<int32_t>(ua - ub);
+        case FuncCode::Mul:
+            return static_cast<int32_t>(ua * ub);
+        case FuncCode::Div:
+        case FuncCode::Mod:
+            if (b == 0 || (a == INT32_MIN && b == -1)) {
+                return std::nullopt;
+            }
+            return funccode == FuncCode::Div ? a / b : a % b;
+        case FuncCode::Equals:
+            return a == b;
+        case FuncCode::NotEquals:
+            return a != b;
+        case FuncCode::LessThan:
+            return a < b;
+        case FuncCode::LessEquals:
+            return a <= b;
+        case FuncCode::And:
+            return a & b;
+        case FuncCode::Or:
+            return a | b;
+        case FuncCode::Xor:
+            return a ^ b;
+        case FuncCode::Shl:
+            return static_cast<int32_t>(ua << (b & 31));
+        case FuncCode::Shr:
+            return a >> (b & 31);
+        default:
+            return std::nullopt;
+    }
+}
+
+static void make_constant(IrInstr *instr, int32_t value) {
+    instr->op = IrOp::Const;
+    instr->funccode = FuncCode::Nop;
+    instr->imm = value;
+    instr->args.clear();
+}
+
+static bool is_constant(IrInstr const *instr, int32_t value) {
+    return instr->op == IrOp::Const && instr->imm == value;
+}
+
+// Operand equal to the result of a binary operation with a constant
+static IrInstr *binary_identity(IrInstr const *instr) {
+    IrInstr *left = instr->args[0];
+    IrInstr *right = instr->args[1];
+    switch (instr->funccode) {
+        case FuncCode::Add:
+        case FuncCode::Or:
+        case FuncCode::Xor:
+            if (is_constant(left, 0)) {
+                return right;
+            }
+            return is_constant(right, 0) ? left : nullptr;
+        case FuncCode::Sub:
+        case FuncCode::Shl:
+        case FuncCode::Shr:
+            return is_constant(right, 0) ? left : nullptr;
+        case FuncCode::Mul:
+            if (is_constant(left, 1)) {
+                return right;
+            }
+            return is_constant(right, 1) ? left : nullptr;
+        case FuncCode::Div:
+            return is_constant(right, 1) ? left : nullptr;
+        default:
+            return nullptr;
+    }
+}
+
+// Constant result of a binary operation on unknown operands
+static std::optional<int32_t> binary_constant(IrInstr const *instr) {
+    IrInstr const *left = instr->args[0];
+    IrInstr const *right = instr->args[1];
+    switch (instr->funccode) {
+        case FuncCode::Mul:
+        case FuncCode::And:
+            if (is_constant(left, 0) || is_constant(right, 0)) {
+                return 0;
+            }
+            break;
+        case FuncCode::Sub:
+        case FuncCode::Xor:
+        case FuncCode::NotEquals:
+        case FuncCode::LessThan:
+            if (left == right) {
+                return 0;
+            }
+            break;
+        case FuncCode::Equals:
+        case FuncCode::LessEquals:
+            if (left == right) {
+                return 1;
+            }
+            break;
+        default:
+            break;
+    }
+    return std::nullopt;
+}
+
+// Replaces a terminator by a jump to one of its targets, dropping the 
+// edges to all others
+static void jump_to(IrFunction &function, IrInstr *instr, IrBlock *target) {
+    bool kept = false;
+    for (IrBlock *successor : instr->targets) {
+        if (successor == target && !kept) {
+            kept = true;
+        } else {
+            function.remove_edge(instr->block, successor);
+        }
+    }
+    instr->op = IrOp::Jump;
+    instr->args.clear();
+    instr->cases.clear();
+    instr->targets = {target};
+}
+
+std::string ConstantFolding::name() const {
+    return "const-fold";
+}
+
+uint32_t ConstantFolding::run(IrFunction &function) const {
+    uint32_t changes = 0;
+    std::unordered_map<IrInstr *, uint32_t> uses = function.use_counts();
+    auto replace = [&](IrInstr *instr, IrInstr *value) {
+        if (uses[instr] == 0) {
+            return;
+        }
+        function.replace_uses(instr, value);
+        uses[value] += uses[instr];
+        uses[instr] = 0;
+        changes++;
+    };
+    for (IrBlock *block : function.reverse_postorder()) {
+        for (auto const &owned : block->instrs) {
+            IrInstr *instr = owned.get();
+            std::optional<int32_t> value;
+            switch (instr->op) {
+                case IrOp::Unary:
+                    if (instr->args[0]->op == IrOp::Const) {
+                        value = fold_unary(instr->funccode,
+                                instr->args[0]->imm);
+                    }
+                    break;
+                case IrOp::Binary:
+                    if (instr->args[0]->op == IrOp::Const
+                            && instr->args[1]->op == IrOp::Const) {
+                        value = fold_binary(instr->funccode,
+                                instr->args[0]->imm, instr->args[1]->imm);
+                    } else if (IrInstr *same = binary_identity(instr)) {
+                        replace(instr, same);
+                    } else {
+                        value = binary_constant(instr);
+                    }
+                    break;
+                case IrOp::Select:
+                    if (instr->args[0]->op == IrOp::Const) {
+                        replace(instr, instr->args[instr->args[0]->imm != 0
+                                ? 1 : 2]);
+                    } else if (instr->args[1] == instr->args[2]) {
+                        replace(instr, instr->args[1]);
+                    }
+                    break;
+                case IrOp::Phi: {
+                    IrInstr *same = instr->args.empty() ? nullptr
+                            : instr->args.front();
+                    for (IrInstr *arg : instr->args) {
+                        if (arg != same && arg != instr) {
+                            same = nullptr;
+                            break;
+                        }
+                    }
+                    if (same != nullptr && same != instr) {
+                        replace(instr, same);
+                    }
+                    break;
+                }
+                case IrOp::Branch:
+                    if (instr->args[0]->op == IrOp::Const) {
+                        bool taken = instr->args[0]->imm != 0;
+                        jump_to(function, instr, 
+                                instr->targets[taken ? 0 : 1]);
+                        changes++;
+                    }
+                    break;
+                case IrOp::Switch:
+                    if (instr->args[0]->op == IrOp::Const) {
+                        std::size_t taken = 0;
+                        for (std::size_t i = 0; i < instr->cases.size(); i++) {
+                            if (instr->cases[i] == instr->args[0]->imm) {
+                                taken = i + 1;
+                            }
+                        }
+                        jump_to(function, instr, instr->targets[taken]);
+                        changes++;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            if (value.has_value()) {
+                make_constant(instr, value.value());
+                changes++;
+            }
+        }
+    }
+    return changes;
+}
+
+std::string CommonSubexpressions::name() const {
+    return "cse";
+}
+
+using ValueKey = std::vector<uintptr_t>;
+
+static std::optional<ValueKey> value_key(IrInstr const *instr) {
+    switch (instr->op) {
+        case IrOp::Const:
+        case IrOp::Param:
+        case IrOp::FrameAddr:
+        case IrOp::GlobalAddr:
+        case IrOp::FuncAddr:
+        case IrOp::Unary:
+        case IrOp::Binary:
+        case IrOp::Select:
+        case IrOp::Load:
+            break;
+        default:
+            return std::nullopt;
+    }
+    ValueKey key = {static_cast<uintptr_t>(instr->op),
+            static_cast<uintptr_t>(instr->funccode),
+            static_cast<uintptr_t>(static_cast<uint32_t>(instr->imm))};
+    for (IrInstr *arg : instr->args) {
+        key.push_back(reinterpret_cast<uintptr_t>(arg));
+    }
+    if (instr->is_commutative()) {
+        std::sort(key.begin() + 3, key.end());
+    }
+    return key;
+}
+
+uint32_t CommonSubexpressions::run(IrFunction &function) const {
+    uint32_t changes = 0;
+    std::unordered_map<IrBlock *, IrBlock *> idom =
+            function.immediate_dominators();
+    std::unordered_map<IrBlock *, std::vector<IrBlock *>> children;
+    for (IrBlock *block : function.reverse_postorder()) {
+        if (idom[block] != block) {
+            children[idom[block]].push_back(block);
+        }
+    }
+    // Pure values available in the dominators of the current block, with
+    // the keys added by each block on the path to undo
+    std::map<ValueKey, IrInstr *> available;
+    std::vector<std::pair<IrBlock *, std::vector<ValueKey>>> stack;
+    stack.push_back({function.blocks.front().get(), {}});
+    std::vector<IrBlock *> pending = {function.blocks.front().get()};
+    while (!pending.empty()) {
+        IrBlock *block = pending.back();
+        pending.pop_back();
+        if (block == nullptr) {
+            for (ValueKey const &key : stack.back().second) {
+                available.erase(key);
+            }
+            stack.pop_back();
+            continue;
+        }
+        if (stack.back().first != block) {
+            stack.push_back({block, {}});
+        }
+        std::vector<ValueKey> &added = stack.back().second;
+        // Loads and the values last stored, by address, in this block
+        std::map<IrInstr *, IrInstr *> memory;
+        for (std::size_t i = 0; i < block->instrs.size();) {
+            IrInstr *instr = block->instrs[i].get();
+            if (instr->op == IrOp::Store) {
+                memory.clear();
+                memory[instr->args[0]] = instr->args[1];
+            } else if (instr->has_side_effects()
+                    && instr->op != IrOp::Binary) {
+                memory.clear();
+            }
+            IrInstr *existing = nullptr;
+            if (instr->op == IrOp::Load) {
+                auto iter = memory.find(instr->args[0]);
+                if (iter != memory.end()) {
+                    existing = iter->second;
+                } else {
+                    memory[instr->args[0]] = instr;
+                }
+            } else if (auto key = value_key(instr)) {
+                auto iter = available.find(key.value());
+                if (iter != available.end()) {
+                    existing = iter->second;
+                } else {
+                    available[key.value()] = instr;
+                    added.push_back(key.value());
+                }
+            }
+            if (existing != nullptr) {
+                function.replace_uses(instr, existing);
+                block->instrs.erase(block->instrs.begin() + i);
+                changes++;
+            } else {
+                i++;
+            }
+        }
+        pending.push_back(nullptr);
+        for (IrBlock *child : children[block]) {
+            pending.push_back(child);
+        }
+    }
+    return changes;
+}
+
+std::string DeadCodeElimination::name() const {
+    return "dce";
+}
+
+uint32_t DeadCodeElimination::run(IrFunction &function) const {
+    uint32_t changes = function.remove_unreachable() ? 1 : 0;
+    std::unordered_set<IrInstr *> live;
+    std::vector<IrInstr *> worklist;
+    for (auto const &block : function.blocks) {
+        for (auto const &instr : block->instrs) {
+            if (instr->has_side_effects()) {
+                live.insert(instr.get());
+                worklist.push_back(instr.get());
+            }
+        }
+    }
+    while (!worklist.empty()) {
+        IrInstr *instr = worklist.back();
+        worklist.pop_back();
+        for (IrInstr *arg : instr->args) {
+            if (live.insert(arg).second) {
+                worklist.push_back(arg);
+            }
+        }
+    }
+    for (auto const &block : function.blocks) {
+        changes += std::erase_if(block->instrs,
+                [&](std::unique_ptr<IrInstr> const &instr) {
+            return live.count(instr.get()) == 0;
+        });
+    }
+    return changes;
+}
+
+std::string SimplifyCfg::name() const {
+    return "simplify-cfg";
+}
+
+uint32_t SimplifyCfg::run(IrFunction &function) const {
+    uint32_t changes = 0;
+    for (auto const &block : function.blocks) {
+        IrInstr *last = block->terminator();
+        if ((last->op == IrOp::Branch || last->op == IrOp::Switch) 
+                && std::all_of(last->targets.begin(), last->targets.end(), 
+                    [&](IrBlock *target) {
+                        return target == last->targets.front();
+                    })) {
+            jump_to(function, last, last->targets.front());
+            changes++;
+        }
+    }
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (std::size_t i = 1; i < function.blocks.size(); i++) {
+            IrBlock *block = function.blocks[i].get();
+            if (block->preds.size() != 1) {
+                continue;
+            }
+            IrBlock *pred = block->preds.front();
+            IrInstr *jump = pred->terminator();
+            if (pred == block || jump->op != IrOp::Jump) {
+                continue;
+            }
+            // Phis of a single predecessor merge a single value
+            while (!block->instrs.empty()
+                    && block->instrs.front()->op == IrOp::Phi) {
+                function.replace_uses(block->instrs.front().get(),
+                        block->instrs.front()->args.front());
+                block->instrs.erase(block->instrs.begin());
+            }
+            pred->instrs.pop_back();
+            for (auto &instr : block->instrs) {
+                instr->block = pred;
+                pred->instrs.push_back(std::move(instr));
+            }
+            for (IrBlock *successor : pred->successors()) {
+                std::replace(successor->preds.begin(), successor->preds.end(),
+                        block, pred);
+            }
+            function.blocks.erase(function.blocks.begin() + i);
+            merged = true;
+            changes++;
+            break;
+        }
+    }
+    // Jumps to a block that only jumps on go to its target directly,
+    // unless the target merges values by predecessor
+    for (auto const &block : function.blocks) {
+        IrInstr *jump = block->terminator();
+        if (block.get() == function.blocks.front().get()
+                || block->instrs.size() != 1 || jump->op != IrOp::Jump) {
+            continue;
+        }
+        IrBlock *target = jump->targets.front();
+        if (target == block.get() || target->first_non_phi() != 0) {
+            continue;
+        }
+        std::vector<IrBlock *> preds = block->preds;
+        for (IrBlock *pred : preds) {
+            for (IrBlock *&successor : pred->terminator()->targets) {
+                if (successor == block.get()) {
+                    successor = target;
+                    target->preds.push_back(pred);
+                }
+            }
+        }
+        changes += block->preds.size();
+        block->preds.clear();
+    }
+    return changes;
+}
+
+IrPassManager::IrPassManager()
+        : m_passes() {}
+
+IrPassManager IrPassManager::standard() {
+    IrPassManager manager;
+    manager.add(std::make_unique<ConstantFolding>());
+    manager.add(std::make_unique<CommonSubexpressions>());
+    manager.add(std::make_unique<DeadCodeElimination>());
+    manager.add(std::make_unique<SimplifyCfg>());
+    return manager;
+}
+
+void IrPassManager::add(std::unique_ptr<IrPass> pass) {
+    m_passes.push_back(std::move(pass));
+}
+
+void IrPassManager::run(IrModule &module) const {
+    for (auto const &function : module.functions()) {
+        function->verify();
+        std::vector<uint32_t> changes(m_passes.size(), 0);
+        for (uint32_t round = 0; round < max_rounds; round++) {
+            bool changed = false;
+            for (std::size_t i = 0; i < m_passes.size(); i++) {
+                uint32_t count = m_passes[i]->run(*function);
+                if (count > 0) {
+                    function->verify();
+                    changes[i] += count;
+                    changed = true;
+                }
+            }
+            if (!changed) {
+                break;
+            }
+        }
+        for (std::size_t i = 0; i < m_passes.size(); i++) {
+            if (changes[i] > 0) {
+                module.add_remark(m_passes[i]->name() + " made "
+                        + std::to_string(changes[i]) + " changes in '"
+                        + function->name + "'");
+            }
+        }
+    }
+}
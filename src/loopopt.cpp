@@ -0,0 +1,495 @@
+#include "tree.hpp"
+#include <unordered_set>
+#include <map>
+
+// Local variables that may change while node is executed
+static void collect_modified(BaseNode const *node, 
+        SymbolTable const &symbol_table, std::unordered_set<SymbolId> &modified) {
+    if (auto local = node->modified_local(symbol_table)) {
+        modified.insert(local.value());
+    }
+    for (BaseNode const *child : node->children()) {
+        collect_modified(child, symbol_table, modified);
+    }
+}
+
+// Evaluating node early can neither fail nor take long
+static bool is_speculatable(BaseNode const *node, 
+        SymbolTable const &symbol_table) {
+    return speculation_cost(node, symbol_table, true).has_value();
+}
+
+static void collect_invariants(BaseNode const *node, Serializer &serializer,
+        std::unordered_set<SymbolId> const &modified, 
+        std::vector<BaseNode const *> &invariants) {
+    SymbolTable const &symbol_table = serializer.symbol_table();
+    if (serializer.is_hoisted(node)) {
+        return;
+    }
+    if (dynamic_cast<CallNode const *>(node) != nullptr
+            && !is_constant(node, symbol_table)
+            && node->is_invariant(symbol_table, modified)
+            && is_speculatable(node, symbol_table)) {
+        invariants.push_back(node);
+        return;
+    }
+    for (BaseNode const *child : node->children()) {
+        collect_invariants(child, serializer, modified, invariants);
+    }
+}
+
+// Subscripts base[index] with an invariant base
+static void collect_subscripts(BaseNode const *node, SymbolId index, 
+        SymbolTable const &symbol_table, 
+        std::unordered_set<SymbolId> const &modified, 
+        std::vector<SubscriptNode const *> &subscripts) {
+    if (auto subscript = dynamic_cast<SubscriptNode const *>(node)) {
+        auto base = dynamic_cast<VariableNode const *>(subscript->left());
+        auto offset = dynamic_cast<VariableNode const *>(subscript->right());
+        if (base != nullptr && offset != nullptr && offset->id() == index 
+                && base->is_invariant(symbol_table, modified)) {
+            subscripts.push_back(subscript);
+            return;
+        }
+    }
+    for (BaseNode const *child : node->children()) {
+        collect_subscripts(child, index, symbol_table, modified, subscripts);
+    }
+}
+
+// Funccode of a call to an intrinsic, directly or through an inline 
+// function forwarding its parameters
+static std::optional<FuncCode> binary_intrinsic(CallNode const *call, 
+        SymbolTable const &symbol_table) {
+    SymbolEntry const &entry = symbol_table.get(call->func()->id());
+    if (entry.storage_type == StorageType::Intrinsic) {
+        IntrinsicEntry const &intrinsic = intrinsics[entry.value];
+        if (intrinsic.opcode == OpCode::Binary) {
+            return intrinsic.funccode;
+        }
+        return std::nullopt;
+    }
+    if (entry.storage_type != StorageType::Callable) {
+        return std::nullopt;
+    }
+    auto inline_function = dynamic_cast<InlineNode const *>(
+            symbol_table.get(call->overload_id()).definition);
+    if (inline_function == nullptr || inline_function->n_params() != 2) {
+        return std::nullopt;
+    }
+    auto body = dynamic_cast<CallNode const *>(inline_function->body());
+    if (body == nullptr || body->args().size() != 2) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        auto param = dynamic_cast<VariableNode const *>(body->args()[i]);
+        if (param == nullptr 
+                || param->token().atom() 
+                    != inline_function->params()[i].atom()) {
+            return std::nullopt;
+        }
+    }
+    return binary_intrinsic(body, symbol_table);
+}
+
+// Evaluates pure expressions that do not change during the loop once 
+// before it, into scratch slots of the frame
+uint32_t ForLoopNode::hoist_invariants(Serializer &serializer, 
+        std::vector<BaseNode const *> &hoisted) const {
+    if (!serializer.passes().has(Pass::Licm)) {
+        return 0;
+    }
+    SymbolTable const &symbol_table = serializer.symbol_table();
+    std::unordered_set<SymbolId> modified;
+    collect_modified(this, symbol_table, modified);
+    collect_address_taken(serializer.current_function()->body(), modified);
+    std::vector<BaseNode const *> invariants;
+    collect_invariants(m_cond, serializer, modified, invariants);
+    collect_invariants(m_post, serializer, modified, invariants);
+    collect_invariants(m_body, serializer, modified, invariants);
+    for (BaseNode const *node : invariants) {
+        uint32_t offset = serializer.reserve_frame(1);
+        // Computed before the loop, where values numbered inside it are not
+        serializer.drop_values(node);
+        node->serialize(serializer);
+        serializer.add_instr(OpCode::StoreRel, offset);
+        serializer.hoist(node, offset);
+        hoisted.push_back(node);
+    }
+    if (!invariants.empty()) {
+        serializer.add_remark("hoisted " + std::to_string(invariants.size()) 
+                + " invariant expressions out of loop at " 
+                + serializer.location(token()));
+    }
+    return invariants.size();
+}
+
+// Replaces base[i] by a pointer advanced together with i, when that saves 
+// more than the three instructions spent advancing it every iteration
+uint32_t ForLoopNode::hoist_induction_pointers(Serializer &serializer, 
+        std::vector<BaseNode const *> &hoisted, 
+        std::vector<std::pair<uint32_t, int32_t>> &pointers) const {
+    static std::size_t const min_uses = 4;
+    if (!serializer.passes().has(Pass::InductionVars)) {
+        return 0;
+    }
+    SymbolTable const &symbol_table = serializer.symbol_table();
+    auto step = induction_step(symbol_table);
+    if (!step.has_value()) {
+        return 0;
+    }
+    SymbolId index = step.value().first;
+    std::unordered_set<SymbolId> modified;
+    collect_modified(m_cond, symbol_table, modified);
+    collect_modified(m_body, symbol_table, modified);
+    collect_address_taken(serializer.current_function()->body(), modified);
+    if (modified.count(index) != 0) {
+        return 0;
+    }
+    std::vector<SubscriptNode const *> subscripts;
+    collect_subscripts(m_cond, index, symbol_table, modified, subscripts);
+    collect_subscripts(m_body, index, symbol_table, modified, subscripts);
+    std::map<SymbolId, std::vector<SubscriptNode const *>> bases;
+    for (SubscriptNode const *subscript : subscripts) {
+        bases[subscript->left()->id()].push_back(subscript);
+    }
+    std::string location = serializer.location(token());
+    uint32_t slots = 0;
+    for (auto const &[base, uses] : bases) {
+        std::string name = "'" + symbol_table.get(base).symbol + "'";
+        if (uses.size() < min_uses) {
+            serializer.add_remark("no induction pointer for " + name 
+                    + " in loop at " + location + ": " 
+                    + std::to_string(uses.size()) + " uses");
+            continue;
+        }
+        uint32_t offset = serializer.reserve_frame(1);
+        uses.front()->serialize_load_address(serializer);
+        serializer.add_instr(OpCode::StoreRel, offset);
+        for (SubscriptNode const *use : uses) {
+            serializer.hoist(use, offset);
+            hoisted.push_back(use);
+        }
+        pointers.push_back({offset, step.value().second});
+        slots++;
+        serializer.add_remark("induction pointer for " + name 
+                + " in loop at " + location);
+    }
+    return slots;
+}
+
+// Copies of the body of a counted loop are executed between checks of 
+// the condition, with a remainder loop for the last iterations when the 
+// trip count is unknown
+void ForLoopNode::serialize_unrolled(Serializer &serializer, uint32_t factor, 
+        std::optional<uint32_t> trip_count, 
+        std::vector<std::pair<uint32_t, int32_t>> const &pointers) const {
+    uint32_t i;
+    if (trip_count.has_value() && trip_count.value() <= factor) {
+        for (i = 0; i < trip_count.value(); i++) {
+            serialize_iteration(serializer, pointers);
+        }
+        return;
+    }
+    Label unrolled_label = serializer.get_label();
+    Label guard_label = serializer.get_label();
+    if (trip_count.has_value()) {
+        // The trip count is a multiple of the factor, and at least one
+        serializer.add_label(unrolled_label);
+        for (i = 0; i < factor; i++) {
+            serialize_iteration(serializer, pointers);
+        }
+        m_cond->serialize_branch(serializer, unrolled_label, true);
+        return;
+    }
+    SymbolTable const &symbol_table = serializer.symbol_table();
+    auto [index, step] = induction_step(symbol_table).value();
+    FuncCode compare;
+    ExpressionNode const *bound = counted_bound(symbol_table, index, compare);
+    ExpressionNode const *variable = static_cast<CallNode const *>(
+            m_cond)->args()[0];
+    Label loop_body_label = serializer.get_label();
+    Label cond_label = serializer.get_label();
+
+    int32_t span = (factor - 1) * step;
+
+    // Only the remainder loop runs when the bound less the span would wrap
+    bound->serialize(serializer);
+    serializer.add_instr(OpCode::Binary, FuncCode::LessThan, 
+            static_cast<uint32_t>(INT32_MIN + span));
+    serializer.add_instr(OpCode::BrTrue, cond_label, true);
+    serializer.add_instr(OpCode::Jump, guard_label, true);
+    serializer.add_label(unrolled_label);
+    for (i = 0; i < factor; i++) {
+        serialize_iteration(serializer, pointers);
+    }
+    // All iterations of the unrolled body are within the bound, compared 
+    // without adding to the variable, which may be close to overflowing
+    serializer.add_label(guard_label);
+    variable->serialize(serializer);
+    bound->serialize(serializer);
+    serializer.add_instr(OpCode::Binary, FuncCode::Sub, span);
+    serializer.add_instr(OpCode::Binary, compare);
+    serializer.add_instr(OpCode::BrTrue, unrolled_label, true);
+
+    serializer.add_instr(OpCode::Jump, cond_label, true);
+    serializer.add_label(loop_body_label);
+    serialize_iteration(serializer, pointers);
+    serializer.add_label(cond_label);
+    m_cond->serialize_branch(serializer, loop_body_label, true);
+}
+
+void ForLoopNode::serialize_iteration(Serializer &serializer, 
+        std::vector<std::pair<uint32_t, int32_t>> const &pointers) const {
+    m_body->serialize(serializer);
+    m_post->serialize(serializer);
+    for (auto const &[offset, step] : pointers) {
+        serializer.add_instr(OpCode::LoadRel, offset);
+        serializer.add_instr(OpCode::Binary, FuncCode::Add, step);
+        serializer.add_instr(OpCode::StoreRel, offset);
+    }
+}
+
+// Largest factor within the budget that divides a known trip count, or 
+// that leaves room for the remainder loop otherwise; 1 if not unrolled
+uint32_t ForLoopNode::unroll_factor(Serializer &serializer, 
+        std::optional<uint32_t> &trip_count) const {
+    if (!serializer.passes().has(Pass::Unroll) 
+            || serializer.max_unroll_factor() < 2) {
+        return 1;
+    }
+    SymbolTable const &symbol_table = serializer.symbol_table();
+    auto step = induction_step(symbol_table);
+    if (!step.has_value() || step.value().second <= 0) {
+        return 1;
+    }
+    SymbolId index = step.value().first;
+    FuncCode compare;
+    ExpressionNode const *bound = counted_bound(symbol_table, index, compare);
+    std::unordered_set<SymbolId> modified;
+    collect_modified(m_cond, symbol_table, modified);
+    collect_modified(m_body, symbol_table, modified);
+    collect_address_taken(serializer.current_function()->body(), modified);
+    if (bound == nullptr || modified.count(index) != 0) {
+        return 1;
+    }
+    collect_modified(m_post, symbol_table, modified);
+    if (!bound->is_invariant(symbol_table, modified)) {
+        return 1;
+    }
+
+    // Trip count from a constant start and bound
+    auto init = dynamic_cast<ExpressionStatementNode const *>(m_init);
+    auto assign = init == nullptr ? nullptr 
+            : dynamic_cast<AssignNode const *>(init->expr());
+    std::optional<uint32_t> start = assign == nullptr ? std::nullopt 
+            : assign->right()->get_constant_value();
+    std::optional<uint32_t> end = bound->get_constant_value();
+    if (start.has_value() && end.has_value() 
+            && assign->left()->id() == index) {
+        int64_t distance = static_cast<int64_t>(
+                static_cast<int32_t>(end.value())) 
+                - static_cast<int32_t>(start.value()) 
+                + (compare == FuncCode::LessEquals);
+        trip_count = distance <= 0 ? 0 
+                : (distance + step.value().second - 1) / step.value().second;
+    }
+    std::string location = serializer.location(token());
+    if (trip_count == 0u) {
+        return 1;
+    }
+
+    uint32_t size = tree_size(m_body) + tree_size(m_post);
+    uint32_t budget = serializer.unroll_budget();
+    if (trip_count.has_value() 
+            && trip_count.value() <= serializer.max_unroll_factor() 
+            && (trip_count.value() - 1) * size <= budget) {
+        serializer.spend_unroll_budget((trip_count.value() - 1) * size);
+        serializer.add_remark("fully unrolled loop at " + location + " (" 
+                + std::to_string(trip_count.value()) + " iterations)");
+        return trip_count.value();
+    }
+    uint32_t factor = 1;
+    uint32_t candidate;
+    if (trip_count.has_value()) {
+        for (candidate = serializer.max_unroll_factor(); candidate >= 2; 
+                candidate--) {
+            if (trip_count.value() % candidate == 0 
+                    && (candidate - 1) * size <= budget) {
+                factor = candidate;
+                break;
+            }
+        }
+        if (factor < 2) {
+            trip_count.reset();
+        }
+    }
+    if (!trip_count.has_value()) {
+        // The guard subtracts the steps of the unrolled body from the bound
+        for (candidate = serializer.max_unroll_factor(); candidate >= 2; 
+                candidate--) {
+            if (candidate * size <= budget 
+                    && static_cast<int64_t>(candidate - 1) 
+                        * step.value().second <= INT32_MAX) {
+                factor = candidate;
+                break;
+            }
+        }
+    }
+    if (factor < 2) {
+        serializer.add_remark("not unrolled loop at " + location 
+                + ": budget exhausted");
+        return 1;
+    }
+    serializer.spend_unroll_budget(
+            (trip_count.has_value() ? factor - 1 : factor) * size);
+    serializer.add_remark("unrolled loop at " + location + " by " 
+            + std::to_string(factor) 
+            + (trip_count.has_value() ? " (" 
+                + std::to_string(trip_count.value()) + " iterations)" 
+                : " with remainder loop"));
+    return factor;
+}
+
+// Bound of a condition i < bound or i <= bound on the loop variable
+ExpressionNode const *ForLoopNode::counted_bound(
+        SymbolTable const &symbol_table, SymbolId index, 
+        FuncCode &compare) const {
+    auto cond = dynamic_cast<CallNode const *>(m_cond);
+    if (cond == nullptr || cond->args().size() != 2) {
+        return nullptr;
+    }
+    auto variable = dynamic_cast<VariableNode const *>(cond->args()[0]);
+    compare = binary_intrinsic(cond, symbol_table).value_or(FuncCode::Nop);
+    if (variable == nullptr || variable->id() != index 
+            || (compare != FuncCode::LessThan 
+                && compare != FuncCode::LessEquals)) {
+        return nullptr;
+    }
+    return cond->args()[1];
+}
+
+// Loop variable and its step when post is i = i + step or i = i - step
+std::optional<std::pair<SymbolId, int32_t>> ForLoopNode::induction_step(
+        SymbolTable const &symbol_table) const {
+    auto post = dynamic_cast<ExpressionStatementNode const *>(m_post);
+    auto assign = post == nullptr ? nullptr 
+            : dynamic_cast<AssignNode const *>(post->expr());
+    if (assign == nullptr) {
+        return std::nullopt;
+    }
+    auto variable = dynamic_cast<VariableNode const *>(assign->left());
+    auto update = dynamic_cast<CallNode const *>(assign->right());
+    if (variable == nullptr || update == nullptr 
+            || update->args().size() != 2 
+            || symbol_table.get(variable->id()).storage_type 
+                != StorageType::Relative) {
+        return std::nullopt;
+    }
+    auto operand = dynamic_cast<VariableNode const *>(update->args()[0]);
+    std::optional<uint32_t> step = update->args()[1]->get_constant_value();
+    if (operand == nullptr || operand->id() != variable->id() 
+            || !step.has_value()) {
+        return std::nullopt;
+    }
+    switch (binary_intrinsic(update, symbol_table).value_or(FuncCode::Nop)) {
+        case FuncCode::Add:
+            return std::make_pair(variable->id(), 
+                    static_cast<int32_t>(step.value()));
+        case FuncCode::Sub:
+            return std::make_pair(variable->id(), 
+                    -static_cast<int32_t>(step.value()));
+        default:
+            return std::nullopt;
+    }
+}
+
+// Hooks of the nodes
+
+bool BaseNode::is_invariant(SymbolTable const &, 
+        std::unordered_set<SymbolId> const &) const {
+    return false;
+}
+
+std::optional<SymbolId> BaseNode::modified_local(SymbolTable const &) const {
+    return std::nullopt;
+}
+
+bool VariableNode::is_invariant(SymbolTable const &symbol_table, 
+        std::unordered_set<SymbolId> const &modified) const {
+    switch (symbol_table.get(id()).storage_type) {
+        case StorageType::Callable:
+        case StorageType::Intrinsic:
+        case StorageType::AbsoluteRef:
+        case StorageType::RelativeRef:
+            return true;
+        case StorageType::Relative:
+            return modified.count(id()) == 0;
+        default:
+            return false;
+    }
+}
+
+bool LiteralNode::is_invariant(SymbolTable const &, 
+        std::unordered_set<SymbolId> const &) const {
+    return true;
+}
+
+std::optional<SymbolId> AddressOfNode::modified_local(
+        SymbolTable const &) const {
+    if (auto target = dynamic_cast<VariableNode const *>(operand())) {
+        return target->id();
+    }
+    return std::nullopt;
+}
+
+std::optional<SymbolId> AssignNode::modified_local(
+        SymbolTable const &) const {
+    if (auto target = dynamic_cast<VariableNode const *>(left())) {
+        return target->id();
+    }
+    return std::nullopt;
+}
+
+// Whether the callee is pure is left to the caller to check
+bool CallNode::is_invariant(SymbolTable const &symbol_table, 
+        std::unordered_set<SymbolId> const &modified) const {
+    for (BaseNode const *child : children()) {
+        if (!child->is_invariant(symbol_table, modified)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The first argument of a writeback function is assigned its result
+std::optional<SymbolId> CallNode::modified_local(
+        SymbolTable const &symbol_table) const {
+    BaseNode const *definition = m_overload_id == 0 ? nullptr 
+            : symbol_table.get(m_overload_id).definition;
+    auto function = dynamic_cast<FunctionNode const *>(definition);
+    auto inline_function = dynamic_cast<InlineNode const *>(definition);
+    if ((function != nullptr && function->writeback()) 
+            || (inline_function != nullptr && inline_function->writeback())) {
+        if (auto target = dynamic_cast<VariableNode const *>(
+                args().front())) {
+            return target->id();
+        }
+    }
+    return std::nullopt;
+}
+
+bool ExpressionListNode::is_invariant(SymbolTable const &symbol_table, 
+        std::unordered_set<SymbolId> const &modified) const {
+    for (BaseNode const *child : children()) {
+        if (!child->is_invariant(symbol_table, modified)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<SymbolId> VarDeclarationNode::modified_local(
+        SymbolTable const &) const {
+    return id();
+}
@@ -1,10 +1,19 @@
 #include "parser.hpp"
 #include "serializer.hpp"
+#include "codecache.hpp"
+#include "irbuilder.hpp"
+#include "irpasses.hpp"
 #include "treeprinter.hpp"
 #include "program.hpp"
+#include "regprogram.hpp"
 #include "argparser.hpp"
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <optional>
+#include <chrono>
+#include <thread>
+#include <sys/resource.h>
 
 ArgParser get_args(int argc, char *argv[]) {
     ArgParser args;
@@ -18,24 +27,137 @@ ArgParser get_args(int argc, char *argv[]) {
     args.add("tree-symbol-ids", "", "", ArgType::Flag);
     args.add("stats", "", "", ArgType::Flag);
     args.add("dis", "", "", ArgType::Flag);
+    args.add("dump-ir", "", "", ArgType::Flag);
     args.add("symbols", "", "", ArgType::Flag);
     args.add("no-exec", "n", "", ArgType::Flag);
+    args.add("remarks", "", "", ArgType::Flag);
+    args.add("inline-threshold", "", "16", ArgType::String);
+    args.add("auto-memo", "", "", ArgType::Flag);
+    args.add("opt-level", "O", "2", ArgType::String);
+    args.add("passes", "", "", ArgType::String);
+    args.add("differential", "", "", ArgType::Flag);
+    args.add("unroll-factor", "", "4", ArgType::String);
+    args.add("unroll-budget", "", "1024", ArgType::String);
+    args.add("eval-instrs", "", "10000000", ArgType::String);
+    args.add("eval-stack", "", "1048576", ArgType::String);
+    args.add("eval-budget", "", "20000000", ArgType::String);
+    args.add("vm", "", "register", ArgType::String);
+    args.add("bench", "", "", ArgType::String);
+    args.add("threads", "j", "0", ArgType::String);
+    args.add("cache", "", "", ArgType::String);
 
     args.parse(argc, argv);
 
     return args;
 }
 
-std::vector<uint32_t> compile(ArgParser const &args) {
+uint32_t get_uint_arg(ArgParser const &args, std::string const &name) {
+    std::string const &value = args.get(name).value;
+    try {
+        std::size_t end;
+        unsigned long result = std::stoul(value, &end);
+        if (end == value.size()) {
+            return result;
+        }
+    } catch (std::exception const &) {}
+    throw std::runtime_error(
+            "Expected unsigned integer for " + name + ", got " + value);
+}
+
+// Threads to parse with, one per core unless given
+uint32_t get_threads(ArgParser const &args) {
+    uint32_t threads = get_uint_arg(args, "threads");
+    return threads > 0 ? threads : std::thread::hardware_concurrency();
+}
+
+PassSet get_passes(ArgParser const &args) {
+    PassSet passes = PassSet::level(get_uint_arg(args, "opt-level"));
+    if (args.get("auto-memo")) {
+        passes.set(Pass::AutoMemo, true);
+    }
+    passes.parse(args.get("passes").value);
+    return passes;
+}
+
+// Stack bytecode, and the register code translated from it when the 
+// register VM is selected
+struct Compiled {
+    std::vector<uint32_t> bytecode;
+    std::optional<RegCode> regcode;
+    // Names of the functions, by the id their memo caches are keyed on
+    std::unordered_map<uint32_t, std::string> function_names;
+};
+
+bool use_register_vm(ArgParser const &args) {
+    std::string const &vm = args.get("vm").value;
+    if (vm != "stack" && vm != "register") {
+        throw std::runtime_error("Expected stack or register for vm, got " 
+                + vm);
+    }
+    return vm == "register";
+}
+
+Compiled compile(ArgParser const &args, PassSet const &passes, 
+        bool report, bool register_vm) {
     std::string infilename = args.get(0).value;
 
-    std::unique_ptr<BaseNode> root = Parser(infilename).parse();
+    SourceManager sources;
+    Arena arena;
+    BaseNode *root = ProgramParser(sources, arena, infilename, 
+            get_threads(args)).parse();
 
-    SymbolTable symbol_table(root);
+    SymbolTable symbol_table(root, sources.interner());
     symbol_table.resolve();
 
-    Serializer serializer(symbol_table);
+    Serializer serializer(symbol_table, sources);
+    serializer.set_inline_threshold(get_uint_arg(args, "inline-threshold"));
+    serializer.set_passes(passes);
+    serializer.set_unroll_limits(get_uint_arg(args, "unroll-factor"), 
+            get_uint_arg(args, "unroll-budget"));
+    serializer.set_eval_limits(get_uint_arg(args, "eval-instrs"), 
+            get_uint_arg(args, "eval-stack"), 
+            get_uint_arg(args, "eval-budget"));
+    serializer.set_threads(get_threads(args));
+
+    std::optional<CodeCache> cache;
+    if (!args.get("cache").value.empty()) {
+        cache.emplace(args.get("cache").value, symbol_table, sources, 
+                serializer.settings());
+        serializer.set_cache(&cache.value());
+    }
+
+    std::optional<IrModule> ir;
+    if (passes.has(Pass::Ssa) || (report && args.get("dump-ir"))) {
+        ir = IrBuilder(symbol_table, passes).build();
+        IrPassManager::standard().run(ir.value());
+        for (std::string const &remark : ir->remarks()) {
+            serializer.add_remark(remark);
+        }
+        serializer.set_ir(&ir.value());
+    }
     serializer.serialize();
+    if (cache.has_value()) {
+        cache->save();
+    }
+
+    Compiled compiled;
+    compiled.bytecode = serializer.assemble();
+    for (SymbolEntry const &entry : symbol_table) {
+        FunctionNode const *function = 
+                dynamic_cast<FunctionNode const *>(entry.definition);
+        if (function != nullptr && function->id() == entry.id) {
+            compiled.function_names.emplace(entry.id, 
+                    std::string(function->ident().data()));
+        }
+    }
+    if (register_vm) {
+        compiled.regcode = RegisterCompiler(compiled.bytecode, 
+                serializer.code_labels()).compile();
+    }
+
+    if (!report) {
+        return compiled;
+    }
 
     if (args.get("tree")) {
         bool tree_all = args.get("tree-all");
@@ -53,33 +175,255 @@ std::vector<uint32_t> compile(ArgParser const &args) {
         symbol_table.dump();
     }
 
+    if (args.get("dump-ir") && ir.has_value()) {
+        std::cerr << "IR:" << std::endl;
+        ir->dump();
+    }
+
+    if (args.get("remarks")) {
+        std::cerr << "Remarks:" << std::endl;
+        for (std::string const &remark : serializer.remarks()) {
+            std::cerr << "    " << remark << std::endl;
+        }
+    }
+
     if (args.get("dis")) {
         std::cerr << "Assembly:" << std::endl;
         serializer.disassemble();
+        if (compiled.regcode.has_value()) {
+            std::cerr << "Register code:" << std::endl;
+            compiled.regcode->disassemble();
+        }
     }
     
-    return serializer.assemble();
+    return compiled;
 }
 
-void run_bytecode(ArgParser const &args, 
-        std::vector<uint32_t> bytecode) {
-    Program program = Program::load(bytecode);
+template <typename Machine>
+void run_program(ArgParser const &args, Machine program, 
+        Compiled &compiled) {
+    program.runtime().memo_caches.set_names(
+            std::move(compiled.function_names));
     uint32_t exit_code = program.run();
     std::cout << "Program finished with exit code " 
             << exit_code << " (" 
             << static_cast<int32_t>(exit_code) << ")" << std::endl;
     if (args.get("stats")) {
-        program.analytics();
+        program.runtime().analytics();
+    }
+}
+
+void run_bytecode(ArgParser const &args, Compiled compiled) {
+    if (compiled.regcode.has_value()) {
+        run_program(args, 
+                RegisterProgram::load(std::move(compiled.regcode.value())), 
+                compiled);
+    } else {
+        run_program(args, Program::load(std::move(compiled.bytecode)), 
+                compiled);
+    }
+}
+
+struct RunResult {
+    std::string outcome;
+    std::string output;
+};
+
+template <typename Machine>
+RunResult run_captured(Machine program, std::string const &input) {
+    RunResult result;
+    program.runtime().set_io(&input, &result.output);
+    try {
+        result.outcome = "exit code " 
+                + std::to_string(static_cast<int32_t>(program.run()));
+    } catch (std::exception const &e) {
+        result.outcome = "error: " + std::string(e.what());
+    }
+    return result;
+}
+
+RunResult run_captured(Compiled compiled, std::string const &input) {
+    if (compiled.regcode.has_value()) {
+        return run_captured(
+                RegisterProgram::load(std::move(compiled.regcode.value())), 
+                input);
+    }
+    return run_captured(Program::load(std::move(compiled.bytecode)), input);
+}
+
+// Runs the unoptimized build on the stack VM and the optimized build on 
+// the selected VM with the same input
+void run_differential(ArgParser const &args, PassSet const &passes) {
+    std::string input(std::istreambuf_iterator<char>(std::cin), {});
+    bool register_vm = use_register_vm(args);
+    RunResult reference = run_captured(
+            compile(args, PassSet::level(0), false, false), input);
+    RunResult optimized = run_captured(
+            compile(args, passes, true, register_vm), input);
+    std::cout << optimized.output;
+    std::cout << "Differential: -O0 " << reference.outcome 
+            << ", optimized [" << passes.to_string() << "] " 
+            << (register_vm ? "on register VM " : "")
+            << optimized.outcome << std::endl;
+    if (reference.outcome != optimized.outcome) {
+        throw std::runtime_error("Differential mismatch in outcome");
+    }
+    if (reference.output != optimized.output) {
+        throw std::runtime_error("Differential mismatch in output");
+    }
+}
+
+// Tokenizes the file over and over for at least a second
+void bench_tokenizer(std::string const &filename) {
+    using Clock = std::chrono::steady_clock;
+    SourceManager sources;
+    FileId file = sources.open(filename);
+    std::string_view text = sources.file(file).text();
+    AtomCache atoms(sources.interner());
+    uint64_t n_tokens = 0;
+    uint32_t rounds = 0;
+    Clock::time_point start = Clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        Tokenizer tokenizer(text, atoms);
+        while (tokenizer.get_token().type() != TokenType::EndOfFile) {
+            n_tokens++;
+        }
+        rounds++;
+        elapsed = Clock::now() - start;
+    } while (elapsed.count() < 1.0);
+    double megabytes = 1e-6 * text.size() * rounds;
+    std::cout << "Tokenized " << megabytes << " MB, " << n_tokens 
+            << " tokens in " << rounds << " rounds: " 
+            << megabytes / elapsed.count() << " MB/s, " 
+            << 1e-6 * n_tokens / elapsed.count() << " M tokens/s" 
+            << std::endl;
+}
+
+// Parses the file, resolves its names and frees it all over and over for 
+// at least a second
+void bench_frontend(std::string const &filename, uint32_t threads) {
+    using Clock = std::chrono::steady_clock;
+    std::chrono::duration<double> parsing(0), resolving(0), freeing(0);
+    std::chrono::duration<double> elapsed;
+    uint32_t rounds = 0;
+    Clock::time_point start = Clock::now();
+    do {
+        Clock::time_point round_start = Clock::now();
+        Clock::time_point resolved;
+        {
+            SourceManager sources;
+            Arena arena;
+            BaseNode *root = ProgramParser(sources, arena, filename, 
+                    threads).parse();
+            Clock::time_point parsed = Clock::now();
+            SymbolTable symbol_table(root, sources.interner());
+            symbol_table.resolve();
+            resolved = Clock::now();
+            parsing += parsed - round_start;
+            resolving += resolved - parsed;
+        }
+        Clock::time_point freed = Clock::now();
+        freeing += freed - resolved;
+        rounds++;
+        elapsed = freed - start;
+    } while (elapsed.count() < 1.0);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::cout << "Front end in " << rounds << " rounds: parse " 
+            << 1e3 * parsing.count() / rounds << " ms, resolve " 
+            << 1e3 * resolving.count() / rounds << " ms, free " 
+            << 1e3 * freeing.count() / rounds << " ms per round, peak RSS " 
+            << usage.ru_maxrss / 1024 << " MB" << std::endl;
+}
+
+// Generates the code of the program over and over for at least a second.
+// With a cache, the first round that fills it is timed apart.
+void bench_codegen(ArgParser const &args, PassSet const &passes) {
+    using Clock = std::chrono::steady_clock;
+    SourceManager sources;
+    Arena arena;
+    BaseNode *root = ProgramParser(sources, arena, args.get(0).value, 
+            get_threads(args)).parse();
+    SymbolTable symbol_table(root, sources.interner());
+    symbol_table.resolve();
+    bool cached = !args.get("cache").value.empty();
+    double first_round = 0.0;
+    std::size_t n_words = 0;
+    uint32_t rounds = 0;
+    Clock::time_point start = Clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        Serializer serializer(symbol_table, sources);
+        serializer.set_inline_threshold(
+                get_uint_arg(args, "inline-threshold"));
+        serializer.set_passes(passes);
+        serializer.set_unroll_limits(get_uint_arg(args, "unroll-factor"), 
+                get_uint_arg(args, "unroll-budget"));
+        serializer.set_eval_limits(get_uint_arg(args, "eval-instrs"), 
+                get_uint_arg(args, "eval-stack"), 
+                get_uint_arg(args, "eval-budget"));
+        serializer.set_threads(get_threads(args));
+        std::optional<CodeCache> cache;
+        if (cached) {
+            cache.emplace(args.get("cache").value, symbol_table, sources,
+                    serializer.settings());
+            serializer.set_cache(&cache.value());
+        }
+        serializer.serialize();
+        if (cache.has_value()) {
+            cache->save();
+        }
+        n_words = serializer.assemble().size();
+        rounds++;
+        elapsed = Clock::now() - start;
+        if (cached && first_round == 0.0) {
+            first_round = elapsed.count();
+            start = Clock::now();
+            rounds = 0;
+            elapsed = Clock::duration::zero();
+        }
+    } while (elapsed.count() < 1.0);
+    if (cached) {
+        std::cout << "First round: " << 1e3 * first_round << " ms"
+                << std::endl;
+    }
+    std::cout << "Generated " << n_words << " words of code in " << rounds 
+            << " rounds: " << 1e3 * elapsed.count() / rounds 
+            << " ms per round" << std::endl;
+}
+
+void run_benchmark(ArgParser const &args, PassSet const &passes) {
+    std::string const &bench = args.get("bench").value;
+    if (bench == "tokenizer") {
+        bench_tokenizer(args.get(0).value);
+    } else if (bench == "frontend") {
+        bench_frontend(args.get(0).value, get_threads(args));
+    } else if (bench == "codegen") {
+        bench_codegen(args, passes);
+    } else {
+        throw std::runtime_error("Unknown benchmark: " + bench);
     }
 }
 
 int main(int argc, char *argv[]) {
     try {
         ArgParser args = get_args(argc, argv);
+        PassSet passes = get_passes(args);
+
+        if (!args.get("bench").value.empty()) {
+            run_benchmark(args, passes);
+            return 0;
+        }
+
+        if (args.get("differential") && !args.get("no-exec")) {
+            run_differential(args, passes);
+            return 0;
+        }
         
-        std::vector<uint32_t> bytecode = compile(args);
+        Compiled compiled = compile(args, passes, true, use_register_vm(args));
         if (!args.get("no-exec")) {
-            run_bytecode(args, bytecode);
+            run_bytecode(args, std::move(compiled));
         }
     } catch (std::exception const &e) {
         std::cerr << "Error: " + std::string(e.what()) << std::endl;
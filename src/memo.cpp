@@ -0,0 +1,67 @@
+#include "memo.hpp"
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+std::optional<uint32_t> MemoCaches::load(uint32_t table,
+        std::vector<uint32_t> key) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t const &word : key) {
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    Cache &cache = m_caches[table];
+    if (cache.slots.empty()) {
+        cache.slots.resize(cache_size);
+    }
+    std::size_t slot = hash % cache_size;
+    if (cache.slots[slot].valid && cache.slots[slot].key == key) {
+        cache.hits++;
+        return cache.slots[slot].value;
+    }
+    cache.misses++;
+    m_pending.push_back({&cache, slot, std::move(key)});
+    return std::nullopt;
+}
+
+void MemoCaches::store(uint32_t table, uint32_t value) {
+    if (m_pending.empty() || m_pending.back().cache != &m_caches[table]) {
+        throw std::runtime_error("Memo store without matching load");
+    }
+    Pending &pending = m_pending.back();
+    Slot &slot = pending.cache->slots[pending.slot];
+    if (slot.valid && slot.key != pending.key) {
+        pending.cache->evictions++;
+    }
+    slot.valid = true;
+    slot.key = std::move(pending.key);
+    slot.value = value;
+    m_pending.pop_back();
+}
+
+void MemoCaches::set_names(std::unordered_map<uint32_t, std::string> names) {
+    m_names = std::move(names);
+}
+
+void MemoCaches::analytics() const {
+    std::vector<uint32_t> tables;
+    for (auto const &[table, cache] : m_caches) {
+        tables.push_back(table);
+    }
+    std::sort(tables.begin(), tables.end());
+    for (uint32_t const &table : tables) {
+        Cache const &cache = m_caches.at(table);
+        uint64_t lookups = cache.hits + cache.misses;
+        auto name = m_names.find(table);
+        if (name != m_names.end()) {
+            std::cout << "Memo cache '" << name->second << "':";
+        } else {
+            std::cout << "Memo cache " << table << ":";
+        }
+        std::cout << " hits " << cache.hits
+                << ", misses " << cache.misses
+                << ", evictions " << cache.evictions
+                << ", hit rate "
+                << (lookups ? 100.0 * cache.hits / lookups : 0.0)
+                << "%" << std::endl;
+    }
+}
@@ -5,16 +5,17 @@ std::string empty = "";
 std::string const op_names[] = {
     "nop", "syscall", "unary", "binary", 
     "push", "pop", "addsp", "loadrel", "loadabs", "loadaddrrel", "dupload",
-    "dup", "call", "ret", "jump", "brtrue", "brfalse"
+    "dup", "call", "ret", "jump", "brtrue", "brfalse", "tailcall", "storerel",
+    "memoload", "memostore", "loadreg", "storereg", "select", "jumptable"
 };
 
 std::string const unary_func_names[] = {
-    "nop", "neg"
+    "nop", "neg", "not"
 };
 
 std::string const binary_func_names[] = {
     "nop", "add", "sub", "mul", "div", "mod", "equal", "notequal", 
-    "lessthan", "lessequal", "assign"
+    "lessthan", "lessequal", "assign", "and", "or", "xor", "shl", "shr"
 };
 
 std::string const syscall_func_names[] = {
@@ -37,3 +38,19 @@ std::string const &get_func_name(OpCode opcode, FuncCode funccode) {
             return empty;
     }
 }
+
+// Instructions whose funccode is a count: the arguments passed by Call and 
+// TailCall, released by Ret and read by MemoLoad, or a register index
+bool has_count(OpCode opcode) {
+    switch (opcode) {
+        case OpCode::Call:
+        case OpCode::TailCall:
+        case OpCode::Ret:
+        case OpCode::MemoLoad:
+        case OpCode::LoadReg:
+        case OpCode::StoreReg:
+            return true;
+        default:
+            return false;
+    }
+}
@@ -1,61 +1,52 @@
 #include "parser.hpp"
 #include "utils.hpp"
 #include <iostream>
-
-Parser::Parser() {}
-
-Parser::Parser(std::string const &filename) {
-    include_file(filename);
-}
-
-std::unique_ptr<BaseNode> Parser::parse() {
-    std::unique_ptr<BaseNode> root = parse_filebody();
-    if (get_token().type() != TokenType::EndOfFile) {
-        throw std::runtime_error(
-                "Unexpected token: " + to_string(m_curr_token));
-    }
-    return root;
-}
-
-void Parser::include_file(std::string const &filename) {
-    if (m_included_files.find(filename) != m_included_files.end()) {
+#include <algorithm>
+
+// Deepest expression tree the recursive walks after parsing are given,
+// counted in nodes, and the most expressions parsed within each other, 
+// both well within the stack of any thread
+static constexpr uint32_t max_expression_depth = 20000;
+static constexpr uint32_t max_expression_nesting = 2000;
+
+Parser::Parser(SourceManager &sources, Arena &arena, AtomCache &atoms, 
+        FileId file, std::function<void(FileId)> on_include)
+        : m_sources(sources), m_arena(arena), 
+        m_tokenizer(sources.file(file).text(), atoms), 
+        m_curr_token(), m_on_include(std::move(on_include)), m_syntax(), 
+        m_operands(), m_operators(), m_prefixes(), m_n_tokens(0), 
+        m_nesting(0) {}
+
+FileSyntax Parser::parse() {
+    try {
         get_token();
-    } else {
-        Tokenizer tokenizer(filename);
-        m_curr_token = tokenizer.get_token();
-        m_tokenizers.push(tokenizer);
-        m_included_files.insert(filename);
+        parse_filebody();
+    } catch (std::runtime_error const &e) {
+        m_syntax.error = std::make_exception_ptr(std::runtime_error(
+                m_sources.describe(m_curr_token) + ": " + e.what()));
+    } catch (...) {
+        m_syntax.error = std::current_exception();
     }
+    return std::move(m_syntax);
 }
 
+// Errors of the tokenizer are located at the character it stopped at
 Token Parser::get_token() {
-    if (m_tokenizers.empty()) {
-        return Token(TokenType::EndOfFile, 0, 0);
-    }
-    m_curr_token = m_tokenizers.top().get_token();
-    while (m_curr_token.type() == TokenType::EndOfFile) {
-        m_tokenizers.pop();
-        if (m_tokenizers.empty()) {
-            return m_curr_token;
-        }
-        m_curr_token = m_tokenizers.top().get_token();
+    try {
+        m_curr_token = m_tokenizer.get_token();
+    } catch (std::runtime_error const &) {
+        m_curr_token = m_tokenizer.position();
+        throw;
     }
+    m_n_tokens++;
     return m_curr_token;
 }
 
-TypeNode *Parser::get_literal_type(TokenType type) {
-    auto iter = m_type_literals.find(type);
-    if (iter == m_type_literals.end()) {
-        return nullptr;
-    }
-    return iter->second;
-}
-
-Token Parser::expect_data(std::string const &data) {
+Token Parser::expect_data(std::string_view data) {
     Token token = m_curr_token;
     if (token.data() != data) {
         throw std::runtime_error(
-                "Expected '" + data + "', got '" 
+                "Expected '" + std::string(data) + "', got '" 
                 + to_string(token) + "'");
     }
     get_token();
@@ -84,7 +75,7 @@ Token Parser::expect_token(Token const &other) {
     return token;
 }
 
-Token Parser::accept_data(std::string const &data) {
+Token Parser::accept_data(std::string_view data) {
     Token token = m_curr_token;
     if (token.data() != data) {
         return Token::null();
@@ -102,7 +93,7 @@ Token Parser::accept_type(TokenType type) {
     return token;
 }
 
-Token Parser::check_data(std::string const &data) const {
+Token Parser::check_data(std::string_view data) const {
     if (m_curr_token.data() != data) {
         return Token::null();
     }
@@ -116,14 +107,14 @@ Token Parser::check_type(TokenType type) const {
     return m_curr_token;
 }
 
-std::unique_ptr<BaseNode> Parser::parse_filebody() {
-    std::vector<std::unique_ptr<StatementNode>> nodes;
-    std::unique_ptr<StatementNode> node;
+void Parser::parse_filebody() {
+    StatementNode *node;
     while (!check_type(TokenType::EndOfFile)) {
         node = nullptr;
         if (check_type(TokenType::Include)) {
             parse_include();
-        } else if (check_type(TokenType::Function)) {
+        } else if (check_type(TokenType::Function) 
+                || check_type(TokenType::Memo)) {
             node = parse_function_declaration();
         } else if (check_type(TokenType::Inline)) {
             node = parse_inline_declaration();
@@ -136,23 +127,26 @@ std::unique_ptr<BaseNode> Parser::parse_filebody() {
             throw std::runtime_error("Expected declaration");
         }
         if (node != nullptr) {
-            nodes.push_back(std::move(node));
+            m_syntax.declarations.push_back(node);
         }
     }
-    return std::make_unique<BlockNode>(std::move(nodes));
 }
 
 void Parser::parse_include() {
     expect_type(TokenType::Include);
-    std::string filename = expect_type(TokenType::Identifier).data();
-    if (m_curr_token.data() != ";") {
+    std::string filename(expect_type(TokenType::Identifier).data());
+    if (!check_data(";")) {
         expect_data(";");
-    } else {
-        include_file(filename);
     }
+    FileId file = m_sources.open(filename);
+    m_syntax.directives.push_back({m_syntax.declarations.size(), 
+            m_syntax.literals.size(), file, TokenType::Null, nullptr});
+    m_on_include(file);
+    get_token();
 }
 
-std::unique_ptr<StatementNode> Parser::parse_function_declaration() {
+StatementNode *Parser::parse_function_declaration() {
+    bool memo = accept_type(TokenType::Memo);
     Token fn_token = expect_type(TokenType::Function);
     bool writeback = accept_type(TokenType::Writeback);
     Token ident = accept_type(TokenType::Identifier);
@@ -160,13 +154,12 @@ std::unique_ptr<StatementNode> Parser::parse_function_declaration() {
         ident = expect_type(TokenType::Operator);
     }
     CallableSignature signature = parse_param_declaration();
-    std::unique_ptr<StatementNode> body = parse_braced_block(false);
-    return std::make_unique<ScopeNode>(
-            std::move(std::make_unique<FunctionNode>(fn_token, ident, 
-                std::move(signature), std::move(body), writeback)));
+    StatementNode *body = parse_braced_block(false);
+    return m_arena.make<ScopeNode>(m_arena.make<FunctionNode>(fn_token, 
+            ident, signature, body, writeback, memo));
 }
 
-std::unique_ptr<StatementNode> Parser::parse_inline_declaration() {
+StatementNode *Parser::parse_inline_declaration() {
     Token inline_token = expect_type(TokenType::Inline);
     bool writeback = accept_type(TokenType::Writeback);
     Token ident = accept_type(TokenType::Identifier);
@@ -175,15 +168,14 @@ std::unique_ptr<StatementNode> Parser::parse_inline_declaration() {
     }
     CallableSignature signature = parse_param_declaration();
     expect_data(":");
-    std::unique_ptr<ExpressionNode> body = parse_expression();
+    ExpressionNode *body = parse_expression();
     expect_data(";");
-    return std::make_unique<ScopeNode>(std::move(
-            std::make_unique<InlineNode>(inline_token, ident, 
-                std::move(signature), std::move(body), writeback)));
+    return m_arena.make<ScopeNode>(m_arena.make<InlineNode>(inline_token, 
+            ident, signature, body, writeback));
 }
 
-std::unique_ptr<ExpressionListNode> Parser::parse_param_list() {
-    std::vector<std::unique_ptr<ExpressionNode>> params;
+ExpressionListNode *Parser::parse_param_list() {
+    std::vector<ExpressionNode *> params;
 
     expect_data("(");
     if (!accept_data(")")) {
@@ -197,14 +189,14 @@ std::unique_ptr<ExpressionListNode> Parser::parse_param_list() {
             }
         }
     }
-    return std::make_unique<ExpressionListNode>(
-            Token::synthetic("<params>"), std::move(params));
+    return m_arena.make<ExpressionListNode>(
+            Token::synthetic("<params>"), m_arena.copy(params));
 }
 
 CallableSignature Parser::parse_param_declaration() {
     std::vector<Token> params;
-    std::vector<std::unique_ptr<TypeNode>> type_list;
-    std::unique_ptr<TypeNode> return_type, param_type;
+    std::vector<TypeNode *> type_list;
+    TypeNode *return_type, *param_type;
 
     expect_data("(");
     if (!accept_data(")")) {
@@ -213,9 +205,9 @@ CallableSignature Parser::parse_param_declaration() {
             if (accept_data(":")) {
                 param_type = parse_type();
             } else {
-                param_type = std::make_unique<AnyTypeNode>();
+                param_type = m_arena.make<AnyTypeNode>();
             }
-            type_list.push_back(std::move(param_type));
+            type_list.push_back(param_type);
             if (!accept_data(",")) {
                 expect_data(")");
                 break;
@@ -225,55 +217,56 @@ CallableSignature Parser::parse_param_declaration() {
     if (accept_data("->")) {
         return_type = parse_type();
     } else {
-        return_type = std::make_unique<AnyTypeNode>();
+        return_type = m_arena.make<AnyTypeNode>();
     }
-    return CallableSignature(params, std::make_unique<CallableTypeNode>(
-            Token::synthetic("->"), 
-            std::make_unique<TypeListNode>(std::move(type_list)), 
-            std::move(return_type)));
+    return CallableSignature(m_arena.copy(params), 
+            m_arena.make<CallableTypeNode>(Token::synthetic("->"), 
+                m_arena.make<TypeListNode>(m_arena.copy(type_list)), 
+                return_type));
 }
 
-std::unique_ptr<StatementNode> Parser::parse_braced_block(bool is_scoped) {
-    std::vector<std::unique_ptr<StatementNode> > statements;
+StatementNode *Parser::parse_braced_block(bool is_scoped) {
+    std::vector<StatementNode *> statements;
     expect_data("{");
     while (m_curr_token.data() != "}") {
         statements.push_back(parse_statement(false));
     }
     get_token();
+    BlockNode *block = m_arena.make<BlockNode>(m_arena.copy(statements));
     if (is_scoped) {
-        return std::make_unique<ScopeNode>(
-                std::move(std::make_unique<BlockNode>(std::move(statements))));
+        return m_arena.make<ScopeNode>(block);
     }
-    return std::make_unique<BlockNode>(std::move(statements));
+    return block;
 }
 
-std::unique_ptr<StatementNode> Parser::parse_type_declaration() {
+StatementNode *Parser::parse_type_declaration() {
     Token token = expect_type(TokenType::TypeDef);
     Token ident = expect_type(TokenType::Identifier);
-    std::unique_ptr<NamedTypeNode> ident_node 
-            = std::make_unique<NamedTypeNode>(ident);
+    NamedTypeNode *ident_node = m_arena.make<NamedTypeNode>(ident);
     if (accept_type(TokenType::Like)) {
         do {
-            m_type_literals[m_curr_token.type()] = ident_node.get();
+            m_syntax.directives.push_back({m_syntax.declarations.size(), 
+                    m_syntax.literals.size(), no_file, m_curr_token.type(), 
+                    ident_node});
             get_token();
         } while (accept_data(","));
     }
     expect_data(";");
-    return std::make_unique<TypeDeclarationNode>(token, std::move(ident_node));
+    return m_arena.make<TypeDeclarationNode>(token, ident_node);
 }
 
-std::unique_ptr<TypeNode> Parser::parse_type() {
+TypeNode *Parser::parse_type() {
     Token ident;
-    std::vector<std::unique_ptr<TypeNode>> type_list;
-    if (ident = accept_type(TokenType::Identifier)) {
-        std::unique_ptr<TypeNode> node;
+    std::vector<TypeNode *> type_list;
+    if ((ident = accept_type(TokenType::Identifier))) {
+        TypeNode *node;
         if (ident.data() == "Any") { // todo 
-            node = std::make_unique<AnyTypeNode>();
+            node = m_arena.make<AnyTypeNode>();
         } else {
-            node = std::make_unique<NamedTypeNode>(ident);
+            node = m_arena.make<NamedTypeNode>(ident);
         }
         if (check_data("->")) {
-            type_list.push_back(std::move(node));
+            type_list.push_back(node);
         } else {
             return node;
         }
@@ -289,13 +282,13 @@ std::unique_ptr<TypeNode> Parser::parse_type() {
         }
     }
     Token token = expect_data("->");
-    return std::make_unique<CallableTypeNode>(
-            token, std::make_unique<TypeListNode>(std::move(type_list)), 
+    return m_arena.make<CallableTypeNode>(token, 
+            m_arena.make<TypeListNode>(m_arena.copy(type_list)), 
             parse_type());
 }
 
-std::unique_ptr<StatementNode> Parser::parse_statement(bool is_scoped) {
-    std::unique_ptr<StatementNode> node;
+StatementNode *Parser::parse_statement(bool is_scoped) {
+    StatementNode *node;
     Token token = m_curr_token;
     if (check_type(TokenType::If)) {
         node = parse_if_else();
@@ -303,87 +296,127 @@ std::unique_ptr<StatementNode> Parser::parse_statement(bool is_scoped) {
         node = parse_for();
     } else if (check_type(TokenType::While)) {
         node = parse_while();
+    } else if (check_type(TokenType::Switch)) {
+        node = parse_switch();
     } else if (token.data() == "{") {
         node = parse_braced_block(!is_scoped);
     } else if (token.data() == ";") {
-        node = std::make_unique<EmptyNode>();
+        node = m_arena.make<EmptyNode>();
         get_token();
     } else {
         if (accept_type(TokenType::Return)) {
-            node = std::make_unique<ReturnNode>(token, parse_expression());
+            node = m_arena.make<ReturnNode>(token, parse_expression());
         } else if (check_type(TokenType::Var)) {
             node = parse_var_declaration();
         } else {
-            node = std::make_unique<ExpressionStatementNode>(
+            node = m_arena.make<ExpressionStatementNode>(
                     parse_expression());
         }
         expect_data(";");
     }
     if (is_scoped) {
-        return std::make_unique<ScopeNode>(std::move(node));
+        return m_arena.make<ScopeNode>(node);
     }
     return node;
 }
 
-std::unique_ptr<StatementNode> Parser::parse_if_else() {
+StatementNode *Parser::parse_if_else() {
     Token token = expect_type(TokenType::If);
     expect_data("(");
-    std::unique_ptr<ExpressionNode> cond = parse_expression();
+    ExpressionNode *cond = parse_expression();
     expect_data(")");
-    std::unique_ptr<StatementNode> body_true = parse_statement(true);
+    StatementNode *body_true = parse_statement(true);
     if (accept_type(TokenType::Else)) {
-        std::unique_ptr<StatementNode> body_false = parse_statement(true);
-        return std::make_unique<ScopeNode>(
-                std::move(std::make_unique<IfElseNode>(token, 
-                    std::move(cond), std::move(body_true), 
-                    std::move(body_false))));
+        StatementNode *body_false = parse_statement(true);
+        return m_arena.make<ScopeNode>(m_arena.make<IfElseNode>(token, 
+                cond, body_true, body_false));
     }
-    return std::make_unique<ScopeNode>(
-            std::move(std::make_unique<IfNode>(token, 
-                std::move(cond), std::move(body_true))));
+    return m_arena.make<ScopeNode>(m_arena.make<IfNode>(token, 
+            cond, body_true));
 }
 
-std::unique_ptr<StatementNode> Parser::parse_for() {
+StatementNode *Parser::parse_for() {
     Token token = expect_type(TokenType::For);
     expect_data("(");
-    std::unique_ptr<StatementNode> init = 
-            std::make_unique<ExpressionStatementNode>(parse_expression());
+    StatementNode *init = 
+            m_arena.make<ExpressionStatementNode>(parse_expression());
     expect_data(";");
-    std::unique_ptr<ExpressionNode> cond = parse_expression();
+    ExpressionNode *cond = parse_expression();
     expect_data(";");
-    std::unique_ptr<StatementNode> post = 
-            std::make_unique<ExpressionStatementNode>(parse_expression());
+    StatementNode *post = 
+            m_arena.make<ExpressionStatementNode>(parse_expression());
     expect_data(")");
-    std::unique_ptr<StatementNode> body = parse_statement(true);
-    return std::make_unique<ScopeNode>(
-            std::move(std::make_unique<ForLoopNode>(token, 
-                std::move(init), std::move(cond), 
-                std::move(post), std::move(body))));
+    StatementNode *body = parse_statement(true);
+    return m_arena.make<ScopeNode>(m_arena.make<ForLoopNode>(token, 
+            init, cond, post, body));
 }
 
-std::unique_ptr<StatementNode> Parser::parse_while() {
+StatementNode *Parser::parse_while() {
     Token token = expect_type(TokenType::While);
     expect_data("(");
-    std::unique_ptr<ExpressionNode> cond = parse_expression();
+    ExpressionNode *cond = parse_expression();
+    expect_data(")");
+    StatementNode *body = parse_statement(true);
+    return m_arena.make<ScopeNode>(m_arena.make<ForLoopNode>(token, 
+            m_arena.make<EmptyNode>(), cond, m_arena.make<EmptyNode>(), 
+            body));
+}
+
+// Case values are integer literals, optionally negated
+StatementNode *Parser::parse_switch() {
+    Token token = expect_type(TokenType::Switch);
+    expect_data("(");
+    ExpressionNode *value = parse_expression();
     expect_data(")");
-    std::unique_ptr<StatementNode> body = parse_statement(true);
-    return std::make_unique<ScopeNode>(std::move(
-            std::make_unique<ForLoopNode>(token, 
-                std::make_unique<EmptyNode>(),
-                std::move(cond),
-                std::make_unique<EmptyNode>(),
-                std::move(body))));
+    expect_data("{");
+    std::vector<SwitchCase> cases;
+    StatementNode *case_default = nullptr;
+    std::unordered_set<int32_t> seen;
+    while (!accept_data("}")) {
+        if (Token default_token = accept_type(TokenType::Default)) {
+            if (case_default != nullptr) {
+                throw std::runtime_error("Multiple defaults in switch: " 
+                        + to_string(default_token));
+            }
+            expect_data(":");
+            case_default = parse_statement(true);
+            continue;
+        }
+        expect_type(TokenType::Case);
+        std::vector<int32_t> values;
+        do {
+            bool negated = accept_data("-");
+            Token literal = expect_type(TokenType::IntLit);
+            int32_t case_value = literal.to_int();
+            if (negated) {
+                case_value = -case_value;
+            }
+            if (!seen.insert(case_value).second) {
+                throw std::runtime_error(
+                        "Duplicate case value: " + to_string(literal));
+            }
+            values.push_back(case_value);
+        } while (accept_data(","));
+        expect_data(":");
+        cases.push_back(SwitchCase(m_arena.copy(values), 
+                parse_statement(true)));
+    }
+    if (case_default == nullptr) {
+        case_default = m_arena.make<EmptyNode>();
+    }
+    return m_arena.make<ScopeNode>(m_arena.make<SwitchNode>(token, value, 
+            m_arena.copy(cases), case_default));
 }
 
-std::unique_ptr<StatementNode> Parser::parse_var_declaration() {
-    std::vector<std::unique_ptr<StatementNode>> nodes;
+StatementNode *Parser::parse_var_declaration() {
+    std::vector<StatementNode *> nodes;
     Token token = expect_type(TokenType::Var);
 
     do {
         Token ident = expect_type(TokenType::Identifier);
-        std::unique_ptr<TypeNode> type = nullptr;
-        std::unique_ptr<ExpressionNode> size = nullptr;
-        std::unique_ptr<ExpressionNode> init_value = nullptr;
+        TypeNode *type = nullptr;
+        ExpressionNode *size = nullptr;
+        ExpressionNode *init_value = nullptr;
         if (accept_data("[")) {
             size = parse_expression();
             expect_data("]");
@@ -391,215 +424,377 @@ std::unique_ptr<StatementNode> Parser::parse_var_declaration() {
         if (accept_data(":")) {
             type = parse_type();
         } else {
-            type = std::make_unique<AnyTypeNode>();
+            type = m_arena.make<AnyTypeNode>();
         }
         if (accept_data("=")) {
             init_value = parse_expression();
         }
-        nodes.push_back(std::make_unique<VarDeclarationNode>(
-                token, ident, std::move(type), std::move(size), 
-                std::move(init_value)));
+        nodes.push_back(m_arena.make<VarDeclarationNode>(
+                token, ident, type, size, init_value));
     } while (accept_data(","));
 
     if (nodes.size() == 1) {
-        return std::move(nodes[0]);
+        return nodes[0];
     }
-    return std::make_unique<BlockNode>(std::move(nodes));
+    return m_arena.make<BlockNode>(m_arena.copy(nodes));
 }
 
-std::unique_ptr<ExpressionNode> Parser::parse_expression() {
-    if (check_type(TokenType::Lambda)) {
-        return parse_lambda();
+// Each operator or prefix adds at most two nodes to the depth of the tree,
+// so only expressions of many tokens are walked to find their depth
+ExpressionNode *Parser::parse_expression() {
+    if (m_nesting == max_expression_nesting) {
+        throw std::runtime_error("Expression too deep");
     }
-    return parse_assignment();
+    std::size_t first_token = m_n_tokens;
+    m_nesting++;
+    ExpressionNode *node = check_type(TokenType::Lambda) 
+            ? parse_lambda() : parse_assignment();
+    m_nesting--;
+    if (m_nesting == 0 
+            && 2 * (m_n_tokens - first_token) > max_expression_depth) {
+        check_depth(node);
+    }
+    return node;
 }
 
-std::unique_ptr<ExpressionNode> Parser::parse_assignment() {
-    static std::unordered_map<std::string, std::string> const assignments = {
-        {"+=", "+"},
-        {"-=", "-"},
-        {"/=", "/"},
-        {"*=", "*"},
-        {"%=", "%"}
-    };
+void Parser::check_depth(BaseNode const *node) const {
+    std::vector<std::pair<BaseNode const *, uint32_t>> stack{{node, 1}};
+    while (!stack.empty()) {
+        auto [next, depth] = stack.back();
+        stack.pop_back();
+        if (depth > max_expression_depth) {
+            throw std::runtime_error("Expression too deep");
+        }
+        for (BaseNode const *child : next->children()) {
+            stack.emplace_back(child, depth + 1);
+        }
+    }
+}
 
-    std::unique_ptr<ExpressionNode> left = parse_ternary();
+ExpressionNode *Parser::parse_assignment() {
+    ExpressionNode *left = parse_ternary();
     Token token = m_curr_token;
     if (accept_data("=")) {
-        return std::make_unique<AssignNode>(token, 
-                std::move(left), parse_expression());
-    } else {
-        auto iter = assignments.find(token.data());
-        if (iter != assignments.end()) {
-            get_token();
-            return CallNode::make_binary_call(token, 
-                    std::move(left), parse_expression());
-        }
+        return m_arena.make<AssignNode>(token, 
+                left, parse_expression());
+    } else if (accept_data("+=") || accept_data("-=") || accept_data("/=")
+            || accept_data("*=") || accept_data("%=")) {
+        return CallNode::make_binary_call(m_arena, token, 
+                left, parse_expression());
     }
     return left;
 }
 
-std::unique_ptr<ExpressionNode> Parser::parse_lambda() {
+ExpressionNode *Parser::parse_lambda() {
     Token token = expect_type(TokenType::Lambda);
     CallableSignature signature = parse_param_declaration();
     expect_data(":");
-    std::unique_ptr<ExpressionNode> body = parse_expression();
-    return std::make_unique<LambdaNode>( // todo <--
-            token, std::move(signature),
-            std::make_unique<ReturnNode>(
-                Token::synthetic("<lambda-return>"), std::move(body)));
+    ExpressionNode *body = parse_expression();
+    return m_arena.make<LambdaNode>( // todo <--
+            token, signature,
+            m_arena.make<ReturnNode>(
+                Token::synthetic("<lambda-return>"), body));
 }
 
-std::unique_ptr<ExpressionNode> Parser::parse_ternary() {
-    std::unique_ptr<ExpressionNode> cond = parse_or();
+ExpressionNode *Parser::parse_ternary() {
+    ExpressionNode *cond = parse_binary();
     Token token = m_curr_token;
     if (accept_data("?")) {
-        std::unique_ptr<ExpressionNode> expr_true = parse_ternary();
+        ExpressionNode *expr_true = parse_ternary();
         expect_data(":");
-        std::unique_ptr<ExpressionNode> expr_false = parse_ternary();
-        return std::make_unique<TernaryNode>(token, 
-                std::move(cond), std::move(expr_true), std::move(expr_false));
+        ExpressionNode *expr_false = parse_ternary();
+        return m_arena.make<TernaryNode>(token, 
+                cond, expr_true, expr_false);
     }
     return cond;
 }
 
-std::unique_ptr<ExpressionNode> Parser::parse_or() {
-    static TypeNode *type = assert_equal(      // todo: will be determined in 
-            get_literal_type(TokenType::True), // the token scanner phase
-            get_literal_type(TokenType::False), 
-            "boolean literal types must match");
-    std::unique_ptr<ExpressionNode> left = parse_and();
-    Token token = m_curr_token;
-    while (accept_data("||")) {
-        left = std::make_unique<OrNode>(
-                token, std::move(left), parse_and(), type);
-        token = m_curr_token;
+struct BinaryOperator {
+    std::string_view data;
+    uint8_t precedence;
+    bool right_assoc;
+};
+
+// From the loosest to the tightest binding
+static BinaryOperator const binary_operators[] = {
+    {"||", 1, false},
+    {"&&", 2, false},
+    {"|", 3, false},
+    {"^", 4, false},
+    {"&", 5, false},
+    {"==", 6, true},
+    {"!=", 6, true},
+    {"<", 7, false},
+    {">", 7, false},
+    {"<=", 7, false},
+    {">=", 7, false},
+    {"<<", 8, false},
+    {">>", 8, false},
+    {"+", 9, false},
+    {"-", 9, false},
+    {"*", 10, false},
+    {"/", 10, false},
+    {"%", 10, false}
+};
+
+static BinaryOperator const *find_binary_operator(Token const &token) {
+    if (token.type() != TokenType::Operator) {
+        return nullptr;
     }
-    return left;
-}
-
-std::unique_ptr<ExpressionNode> Parser::parse_and() {
-    static TypeNode *type = assert_equal(
-        get_literal_type(TokenType::True), 
-        get_literal_type(TokenType::False), 
-        "boolean literal types must match");
-    std::unique_ptr<ExpressionNode> left = parse_equality_1();
-    Token token = m_curr_token;
-    while (accept_data("&&")) {
-        left = std::make_unique<AndNode>(
-                    token, std::move(left), parse_equality_1(), type);
-        token = m_curr_token;
+    for (BinaryOperator const &op : binary_operators) {
+        if (op.data == token.data()) {
+            return &op;
+        }
     }
-    return left;
-}
-
-std::unique_ptr<ExpressionNode> Parser::parse_equality_1() {
-    std::unique_ptr<ExpressionNode> left = parse_equality_2();
-    Token token = m_curr_token;
-    while (accept_data("==") || accept_data("!=")) {
-        left = CallNode::make_binary_call(token, 
-                std::move(left), parse_equality_1());
-        token = m_curr_token;
+    return nullptr;
+}
+
+// Parses a chain of binary operators by precedence climbing, keeping the
+// operands and operators on stacks, so that a value is parsed without
+// descending through every level and long chains do not recurse
+ExpressionNode *Parser::parse_binary() {
+    ExpressionNode *left = parse_value();
+    BinaryOperator const *op = find_binary_operator(m_curr_token);
+    if (op == nullptr) {
+        return left;
+    }
+    std::size_t base = m_operators.size();
+    m_operands.push_back(left);
+    while (op != nullptr) {
+        // Operators that bind at least as tightly take their right operand
+        // before the next one takes them as its left
+        while (m_operators.size() > base 
+                && (m_operators.back().second > op->precedence
+                    || (m_operators.back().second == op->precedence
+                        && !op->right_assoc))) {
+            reduce_binary();
+        }
+        m_operators.emplace_back(m_curr_token, op->precedence);
+        get_token();
+        m_operands.push_back(parse_value());
+        op = find_binary_operator(m_curr_token);
+    }
+    while (m_operators.size() > base) {
+        reduce_binary();
+    }
+    ExpressionNode *result = m_operands.back();
+    m_operands.pop_back();
+    return result;
+}
+
+void Parser::reduce_binary() {
+    Token token = m_operators.back().first;
+    m_operators.pop_back();
+    ExpressionNode *right = m_operands.back();
+    m_operands.pop_back();
+    ExpressionNode *&left = m_operands.back();
+    if (token.data() == "||" || token.data() == "&&") {
+        if (token.data() == "||") {
+            left = m_arena.make<OrNode>(token, left, right, nullptr);
+        } else {
+            left = m_arena.make<AndNode>(token, left, right, nullptr);
+        }
+        m_syntax.literals.push_back(left);
+    } else {
+        left = CallNode::make_binary_call(m_arena, token, left, right);
     }
-    return left;
 }
 
-std::unique_ptr<ExpressionNode> Parser::parse_equality_2() {
-    std::unique_ptr<ExpressionNode> left = parse_sum();
-    Token token = m_curr_token;
-    while (accept_data("<") || accept_data(">") || accept_data("<=") 
-            || accept_data(">=")) {
-        left = CallNode::make_binary_call(token, 
-                std::move(left), parse_sum());
-        token = m_curr_token;
-    }
-    return left;
+static bool is_prefix_operator(Token const &token) {
+    std::string_view data = token.data();
+    return token.type() == TokenType::Operator && (data == "+" 
+            || data == "-" || data == "~" || data == "&" || data == "*");
 }
 
-std::unique_ptr<ExpressionNode> Parser::parse_sum() {
-    std::unique_ptr<ExpressionNode> left = parse_term();
-    Token token = m_curr_token;
-    while (accept_data("+") || accept_data("-")) {
-        left = CallNode::make_binary_call(token, 
-                std::move(left), parse_term());
-        token = m_curr_token;
+// Prefix operators are applied innermost first, each to its operand with
+// the postfix operators that follow it
+ExpressionNode *Parser::parse_value() {
+    std::size_t base = m_prefixes.size();
+    while (is_prefix_operator(m_curr_token)) {
+        m_prefixes.push_back(m_curr_token);
+        get_token();
     }
-    return left;
-}
-
-std::unique_ptr<ExpressionNode> Parser::parse_term() {
-    std::unique_ptr<ExpressionNode> left = parse_value();
-    Token token = m_curr_token;
-    while (accept_data("*") || accept_data("/") || accept_data("%")) {
-        left = CallNode::make_binary_call(token, 
-                std::move(left), parse_value());
-        token = m_curr_token;
+    ExpressionNode *value = parse_postfix(parse_primary());
+    while (m_prefixes.size() > base) {
+        Token token = m_prefixes.back();
+        m_prefixes.pop_back();
+        if (token.data() == "&") {
+            if (!value->is_lvalue()) {
+                throw std::runtime_error("Expected lvalue");
+            }
+            value = m_arena.make<AddressOfNode>(token, value);
+        } else if (token.data() == "*") {
+            value = m_arena.make<DereferenceNode>(token, value);
+        } else {
+            value = CallNode::make_unary_call(m_arena, token, value);
+        }
+        value = parse_postfix(value);
     }
-    return left;
+    return value;
 }
 
-std::unique_ptr<ExpressionNode> Parser::parse_value() {
+// Literals are typed once the types declared for them before, in any 
+// file, are known
+ExpressionNode *Parser::parse_primary() {
     Token token = m_curr_token;
-    std::unique_ptr<ExpressionNode> value;
-    if (accept_data("+") || accept_data("-")) {
-        value = CallNode::make_unary_call(token, parse_value());
-    } else if (accept_data("&")) {
-        value = parse_value();
-        if (token.data() == "&" && !value->is_lvalue()) {
-            throw std::runtime_error("Expected lvalue");
-        }
-        value = std::make_unique<AddressOfNode>(token, std::move(value));
-    } else if (accept_data("*")) {
-        value = std::make_unique<DereferenceNode>(token, parse_value());
-    } else if (accept_type(TokenType::IntLit)) {
-        value = std::make_unique<IntegerLiteralNode>(
-                token, get_literal_type(TokenType::IntLit));
+    ExpressionNode *literal = nullptr;
+    if (accept_type(TokenType::IntLit)) {
+        literal = m_arena.make<IntegerLiteralNode>(token, nullptr);
     } else if (accept_type(TokenType::True)) {
-        value = std::make_unique<TrueLiteralNode>(
-                token, get_literal_type(TokenType::True));
+        literal = m_arena.make<TrueLiteralNode>(token, nullptr);
     } else if (accept_type(TokenType::False)) {
-        value = std::make_unique<FalseLiteralNode>(
-                token, get_literal_type(TokenType::False));
-    } else if (accept_type(TokenType::Identifier)) {
-        value = std::make_unique<VariableNode>(token);
+        literal = m_arena.make<FalseLiteralNode>(token, nullptr);
+    }
+    if (literal != nullptr) {
+        m_syntax.literals.push_back(literal);
+        return literal;
+    }
+    if (accept_type(TokenType::Identifier)) {
+        return m_arena.make<VariableNode>(token);
     } else if (accept_data("(")) {
-        value = parse_expression();
+        ExpressionNode *value = parse_expression();
         expect_data(")");
-    } else {
-        throw std::runtime_error("Expected value, got " + to_string(token));
+        return value;
     }
-    return parse_postfix(std::move(value));
+    throw std::runtime_error("Expected value, got " + to_string(token));
 }
 
-std::unique_ptr<ExpressionNode> Parser::parse_postfix(
-            std::unique_ptr<ExpressionNode> value) {
-    static std::unordered_map<std::string, std::string> const assignments = {
-        {"++", "+"},
-        {"--", "-"}
-    };
-
+ExpressionNode *Parser::parse_postfix(
+            ExpressionNode *value) {
     while (true) {
         Token token = m_curr_token;
         if (check_data("(")) {
-            value = std::make_unique<CallNode>(
-                    std::move(value), parse_param_list());
+            value = m_arena.make<CallNode>(
+                    value, parse_param_list());
         } else if (accept_data("[")) {
-            std::unique_ptr<ExpressionNode> subscript = parse_expression();
+            ExpressionNode *subscript = parse_expression();
             expect_data("]");
-            value = std::make_unique<SubscriptNode>(
-                    std::move(value), std::move(subscript));
+            value = m_arena.make<SubscriptNode>(
+                    value, subscript);
         } else if (accept_data(".")) {
-            value = std::make_unique<AttributeNode>(token, 
-                    std::move(value), 
-                    std::make_unique<VariableNode>(
+            value = m_arena.make<AttributeNode>(token, 
+                    value, 
+                    m_arena.make<VariableNode>(
                         expect_type(TokenType::Identifier)));
         } else {
-            auto iter = assignments.find(token.data());
-            if (iter != assignments.end()) {
-                get_token();
-                value = CallNode::make_unary_call(token, std::move(value));
+            if (accept_data("++") || accept_data("--")) {
+                value = CallNode::make_unary_call(m_arena, token, value);
             }
             return value;
         }
     }
 }
+
+ProgramParser::ProgramParser(SourceManager &sources, Arena &arena, 
+        std::string const &filename, uint32_t n_threads)
+        : m_sources(sources), m_arena(arena), m_filename(filename), 
+        m_n_threads(std::max(n_threads, 1u)), m_mutex(), m_changed(), 
+        m_queue(), m_n_busy(0), m_scheduled(), m_files(), m_spliced(), 
+        m_literal_types(static_cast<std::size_t>(TokenType::Synthetic) + 1) {}
+
+BaseNode *ProgramParser::parse() {
+    FileId root = m_sources.open(m_filename);
+    schedule(root);
+    std::vector<std::jthread> threads;
+    for (uint32_t i = 1; i < m_n_threads; i++) {
+        threads.emplace_back(&ProgramParser::work, this);
+    }
+    work();
+    threads.clear();
+
+    std::vector<StatementNode *> declarations;
+    m_spliced.assign(m_files.size(), false);
+    splice(root, declarations);
+    return m_arena.make<BlockNode>(m_arena.copy(declarations));
+}
+
+void ProgramParser::work() {
+    Arena &arena = m_arena.branch();
+    AtomCache atoms(m_sources.interner());
+    std::unique_lock lock(m_mutex);
+    while (true) {
+        m_changed.wait(lock, [this]() { 
+            return !m_queue.empty() || m_n_busy == 0; 
+        });
+        if (m_queue.empty()) {
+            return;
+        }
+        FileId file = m_queue.front();
+        m_queue.pop_front();
+        m_n_busy++;
+        lock.unlock();
+        FileSyntax syntax = Parser(m_sources, arena, atoms, file, 
+                [this](FileId included) { schedule(included); }).parse();
+        lock.lock();
+        m_files[file] = std::move(syntax);
+        m_n_busy--;
+        if (m_n_busy == 0 && m_queue.empty()) {
+            m_changed.notify_all();
+        }
+    }
+}
+
+void ProgramParser::schedule(FileId file) {
+    std::lock_guard lock(m_mutex);
+    if (file >= m_scheduled.size()) {
+        m_scheduled.resize(file + 1, false);
+        m_files.resize(file + 1);
+    }
+    if (!m_scheduled[file]) {
+        m_scheduled[file] = true;
+        m_queue.push_back(file);
+        m_changed.notify_one();
+    }
+}
+
+// Declarations of the file and of the files it includes for the first time,
+// in the order the serial reading of the includes would have met them
+void ProgramParser::splice(FileId file, 
+        std::vector<StatementNode *> &declarations) {
+    m_spliced[file] = true;
+    FileSyntax const &syntax = m_files[file];
+    std::size_t n_declarations = 0;
+    std::size_t n_literals = 0;
+    auto read_until = [&](std::size_t end_declarations, 
+            std::size_t end_literals) {
+        declarations.insert(declarations.end(), 
+                syntax.declarations.begin() + n_declarations, 
+                syntax.declarations.begin() + end_declarations);
+        for (; n_literals < end_literals; n_literals++) {
+            set_literal_type(syntax.literals[n_literals]);
+        }
+        n_declarations = end_declarations;
+    };
+    for (Directive const &directive : syntax.directives) {
+        read_until(directive.declarations, directive.literals);
+        if (directive.include == no_file) {
+            m_literal_types[static_cast<std::size_t>(directive.literal)] = 
+                    directive.type;
+        } else if (!m_spliced[directive.include]) {
+            splice(directive.include, declarations);
+        }
+    }
+    read_until(syntax.declarations.size(), syntax.literals.size());
+    if (syntax.error) {
+        std::rethrow_exception(syntax.error);
+    }
+}
+
+void ProgramParser::set_literal_type(ExpressionNode *literal) {
+    auto type_of = [this](TokenType type) {
+        return m_literal_types[static_cast<std::size_t>(type)];
+    };
+    TokenType type = literal->token().type();
+    if (type != TokenType::Operator) {
+        literal->set_type(type_of(type));
+        return;
+    }
+    try {
+        literal->set_type(assert_equal(type_of(TokenType::True), 
+                type_of(TokenType::False), 
+                "boolean literal types must match"));
+    } catch (std::runtime_error const &e) {
+        throw std::runtime_error(m_sources.describe(literal->token()) 
+                + ": " + e.what());
+    }
+}
@@ -0,0 +1,89 @@
+#include "passes.hpp"
+#include <stdexcept>
+
+static std::string const pass_names[] = {
+    "peephole", "tail-calls", "inline", "const-eval", "auto-memo", 
+    "strength-reduce", "licm", "induction-vars", "unroll", "value-numbering",
+    "registers", "select", "jump-tables", "ssa"
+};
+
+static_assert(sizeof(pass_names) / sizeof(pass_names[0]) 
+        == static_cast<std::size_t>(Pass::Count));
+
+PassSet::PassSet()
+        : m_mask(0) {}
+
+PassSet PassSet::level(uint32_t level) {
+    PassSet passes;
+    if (level > 3) {
+        throw std::runtime_error(
+                "Invalid optimization level: " + std::to_string(level));
+    }
+    if (level >= 1) {
+        passes.set(Pass::Peephole, true);
+        passes.set(Pass::TailCalls, true);
+        passes.set(Pass::Registers, true);
+        passes.set(Pass::Select, true);
+        passes.set(Pass::JumpTables, true);
+    }
+    if (level >= 2) {
+        passes.set(Pass::Inline, true);
+        passes.set(Pass::ConstEval, true);
+        passes.set(Pass::StrengthReduce, true);
+        passes.set(Pass::Licm, true);
+        passes.set(Pass::InductionVars, true);
+        passes.set(Pass::ValueNumbering, true);
+    }
+    // Memoizing functions whose arguments never repeat only costs, so 
+    // auto-memo is left to be asked for
+    if (level >= 3) {
+        passes.set(Pass::Unroll, true);
+    }
+    return passes;
+}
+
+// Comma-separated pass names, prefixed by "no-" to disable
+void PassSet::parse(std::string const &list) {
+    std::size_t start = 0;
+    while (start < list.size()) {
+        std::size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string name = list.substr(start, end - start);
+        bool enabled = name.rfind("no-", 0) != 0;
+        if (!enabled) {
+            name = name.substr(3);
+        }
+        std::size_t i;
+        for (i = 0; i < static_cast<std::size_t>(Pass::Count); i++) {
+            if (pass_names[i] == name) {
+                break;
+            }
+        }
+        if (i == static_cast<std::size_t>(Pass::Count)) {
+            throw std::runtime_error("Unknown pass: " + name);
+        }
+        set(static_cast<Pass>(i), enabled);
+        start = end + 1;
+    }
+}
+
+void PassSet::set(Pass pass, bool enabled) {
+    uint32_t bit = 1u << static_cast<uint32_t>(pass);
+    m_mask = enabled ? m_mask | bit : m_mask & ~bit;
+}
+
+bool PassSet::has(Pass pass) const {
+    return (m_mask >> static_cast<uint32_t>(pass)) & 1;
+}
+
+std::string PassSet::to_string() const {
+    std::string result;
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Pass::Count); i++) {
+        if (has(static_cast<Pass>(i))) {
+            result += (result.empty() ? "" : ",") + pass_names[i];
+        }
+    }
+    return result;
+}
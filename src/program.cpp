@@ -3,9 +3,11 @@
 #include "opcodes.hpp"
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include "utils.hpp"
 Program::Program() 
-        : m_ip(0), m_bp(0), m_completed_instrs(0), m_execution_time(0) {}
+        : m_ip(0), m_bp(0), m_registers(frame_registers), m_rp(0), 
+        m_runtime() {}
 
 Program Program::load(std::vector<uint32_t> bytecode) {
     Program program;
@@ -13,21 +15,30 @@ Program Program::load(std::vector<uint32_t> bytecode) {
     return program;
 }
 
+Runtime &Program::runtime() {
+    return m_runtime;
+}
+
 uint32_t Program::run() {
-    uint32_t instr, addr, ret_val, n_args, ret_bp, operand;
+    uint32_t instr, addr, count, frame_args, ret_bp, ret_ip, base;
+    uint32_t operand = 0;
     int32_t a, b, y;
     OpCode opcode;
     FuncCode funccode;
     clock_t start = std::clock();
-    m_completed_instrs = 0;
+    m_runtime.completed_instrs = 0;
     while (m_ip < m_stack.size()) {
+        if (m_runtime.completed_instrs >= m_runtime.max_instrs) {
+            throw std::runtime_error("Instruction limit exceeded");
+        }
         instr = m_stack[m_ip];
         opcode = static_cast<OpCode>(instr & 0x7F);
         funccode = static_cast<FuncCode>((instr >> 8) & 0xFF);
+        count = (instr >> 8) & 0xFF;
         if ((instr >> 7) & 1) {
             operand = m_stack[m_ip + 1];
             m_ip++;
-        } else if (opcode != OpCode::Nop 
+        } else if (opcode != OpCode::Nop && opcode != OpCode::LoadReg
                 && !(opcode == OpCode::SysCall && funccode == FuncCode::GetC)) {
             operand = m_stack[m_stack.size() - 1];
             m_stack.pop_back();
@@ -37,13 +48,13 @@ uint32_t Program::run() {
             case OpCode::SysCall:
                 switch (funccode) {
                     case FuncCode::Exit:
-                        m_execution_time = std::clock() - start;
+                        m_runtime.execution_time = std::clock() - start;
                         return operand;
                     case FuncCode::PutC:
-                        m_stack.push_back(putc(operand, stdout));
+                        m_stack.push_back(m_runtime.put_char(operand));
                         break;
                     case FuncCode::GetC:
-                        m_stack.push_back(getc(stdin));
+                        m_stack.push_back(m_runtime.get_char());
                         break;
                     default: 
                         throw std::runtime_error(
@@ -51,64 +62,16 @@ uint32_t Program::run() {
                 }
                 break;
             case OpCode::Unary:
-                a = operand;
-                y = a;
-                switch (funccode) {
-                    case FuncCode::Nop:
-                        break;
-                    case FuncCode::Neg:
-                        y = -a;
-                        break;
-                    default: 
-                        throw std::runtime_error(
-                                "Unrecognized funccode");
-                }
-                m_stack.push_back(y);
+                m_stack.push_back(apply_unary(funccode, operand));
                 break;
             case OpCode::Binary: 
                 a = m_stack[m_stack.size() - 1];
                 b = operand;
-                y = a;
-                switch (funccode) {
-                    case FuncCode::Nop: 
-                        break;
-                    case FuncCode::Add:
-                        y = a + b; 
-                        break;
-                    case FuncCode::Sub:
-                        y = a - b;
-                        break;
-                    case FuncCode::Mul:
-                        y = a * b;
-                        break;
-                    case FuncCode::Div:
-                        if (b == 0) {
-                            throw std::runtime_error("Division by zero");
-                        }
-                        y = a / b;
-                        break;
-                    case FuncCode::Mod: 
-                        y = a % b;
-                        break;
-                    case FuncCode::Equals:
-                        y = a == b;
-                        break;
-                    case FuncCode::NotEquals:
-                        y = a != b;
-                        break;
-                    case FuncCode::LessThan:
-                        y = a < b;
-                        break;
-                    case FuncCode::LessEquals:
-                        y = a <= b;
-                        break;
-                    case FuncCode::Assign:
-                        m_stack[a] = b;
-                        y = b;
-                        break;
-                    default: 
-                        throw std::runtime_error(
-                                "Unrecognized funccode");
+                if (funccode == FuncCode::Assign) {
+                    m_stack[a] = b;
+                    y = b;
+                } else {
+                    y = apply_binary(funccode, a, b);
                 }
                 m_stack[m_stack.size() - 1] = y;
                 break;
@@ -118,6 +81,10 @@ uint32_t Program::run() {
             case OpCode::Pop:
                 break;
             case OpCode::AddSp:
+                if (m_stack.size() + static_cast<int32_t>(operand) 
+                        > m_runtime.stack_limit) {
+                    throw std::runtime_error("Stack limit exceeded");
+                }
                 m_stack.resize(m_stack.size() + static_cast<int32_t>(operand));
                 break;
             case OpCode::LoadRel:
@@ -141,27 +108,79 @@ uint32_t Program::run() {
                 m_stack.push_back(operand);
                 break;
             case OpCode::Call:
-                // Before call: arguments, N arguments and func address pushed
+                // Before call: arguments and func address pushed. The callee 
+                // releases the arguments when it returns.
                 addr = operand;
                 m_stack.push_back(m_bp);
                 m_stack.push_back(m_ip);
                 m_bp = m_stack.size();
                 m_ip = addr - 1;
+                m_rp += frame_registers;
+                if (m_registers.size() < m_rp + frame_registers) {
+                    m_registers.resize(m_rp + frame_registers);
+                }
+                std::fill_n(m_registers.begin() + m_rp, frame_registers, 0);
+                m_runtime.max_stack_size = std::max(m_runtime.max_stack_size, 
+                        m_stack.size());
+                if (m_stack.size() > m_runtime.stack_limit) {
+                    throw std::runtime_error("Stack limit exceeded");
+                }
                 break;
-            case OpCode::Ret:
-                n_args = m_stack[m_bp - 3];
+            case OpCode::TailCall:
+                // Arguments of the current frame are replaced by those of 
+                // the callee, which returns directly to our caller
+                addr = operand;
+                frame_args = (instr >> 16) & 0xFF;
                 ret_bp = m_stack[m_bp - 2];
-                addr = m_stack[m_bp - 1];
-                ret_val = operand;
-                m_stack.resize(m_bp - 3 - n_args);
-                m_stack.push_back(ret_val);
-                m_bp = ret_bp;
-                m_ip = addr;
+                ret_ip = m_stack[m_bp - 1];
+                base = m_bp - call_frame_size - frame_args;
+                std::copy(m_stack.end() - count, m_stack.end(), 
+                        m_stack.begin() + base);
+                m_stack.resize(base + count);
+                m_stack.push_back(ret_bp);
+                m_stack.push_back(ret_ip);
+                m_bp = m_stack.size();
+                m_ip = addr - 1;
+                std::fill_n(m_registers.begin() + m_rp, frame_registers, 0);
+                break;
+            case OpCode::StoreRel:
+                a = operand;
+                m_stack[m_bp + a] = m_stack[m_stack.size() - 1];
+                m_stack.pop_back();
+                break;
+            case OpCode::Ret:
+                return_from_call(operand, count);
+                break;
+            case OpCode::MemoLoad:
+                memo_load(operand, count);
+                break;
+            case OpCode::MemoStore:
+                memo_store(operand);
+                break;
+            case OpCode::LoadReg:
+                m_stack.push_back(m_registers[m_rp + count]);
+                break;
+            case OpCode::StoreReg:
+                m_registers[m_rp + count] = operand;
+                break;
+            case OpCode::Select:
+                // Condition, then the values for true and false
+                a = m_stack[m_stack.size() - 1];
+                m_stack.pop_back();
+                y = m_stack[m_stack.size() - 1] ? a : operand;
+                m_stack[m_stack.size() - 1] = y;
                 break;
             case OpCode::Jump:
                 addr = operand;
                 m_ip = addr - 1;
                 break;
+            case OpCode::JumpTable:
+                // The table of operand targets follows, then the default
+                addr = m_stack[m_stack.size() - 1];
+                m_stack.pop_back();
+                addr = m_stack[m_ip + 1 + std::min(addr, operand)];
+                m_ip = addr - 1;
+                break;
             case OpCode::BrTrue:
             case OpCode::BrFalse:
                 a = m_stack[m_stack.size() - 1];
@@ -175,26 +194,36 @@ uint32_t Program::run() {
             default: 
                 break;
         }
-        m_completed_instrs++;
+        m_runtime.completed_instrs++;
         m_ip++;
     }
-    m_execution_time = std::clock() - start;
+    m_runtime.execution_time = std::clock() - start;
     std::cerr << "Instruction fetch overread at " << m_ip << std::endl;
     return -1;
 }
 
-void Program::analytics() const {
-    double execution_time_secs = 
-            static_cast<double>(m_execution_time) / CLOCKS_PER_SEC;
-    std::cout << "Instructions completed:  " 
-            << m_completed_instrs << std::endl;
-    std::cout << "Execution time:          " 
-            << execution_time_secs << std::endl;
-    std::cout << "Seconds per instruction: " 
-            << (execution_time_secs / m_completed_instrs) << std::endl;
-    std::cout << "Instructions per second: " 
-            << static_cast<uint64_t>(m_completed_instrs / execution_time_secs) 
-            << std::endl;
+void Program::return_from_call(uint32_t value, uint32_t n_args) {
+    uint32_t ret_bp = m_stack[m_bp - 2];
+    uint32_t addr = m_stack[m_bp - 1];
+    m_stack.resize(m_bp - call_frame_size - n_args);
+    m_stack.push_back(value);
+    m_bp = ret_bp;
+    m_ip = addr;
+    m_rp -= frame_registers;
+}
+
+void Program::memo_load(uint32_t table, uint32_t n_args) {
+    // Arguments of the current frame form the key
+    std::vector<uint32_t> key(
+            m_stack.begin() + (m_bp - call_frame_size - n_args), 
+            m_stack.begin() + (m_bp - call_frame_size));
+    if (auto value = m_runtime.memo_caches.load(table, std::move(key))) {
+        return_from_call(value.value(), n_args);
+    }
+}
+
+void Program::memo_store(uint32_t table) {
+    m_runtime.memo_caches.store(table, m_stack[m_stack.size() - 1]);
 }
 
 void Program::dump_stack() const {
@@ -223,7 +252,13 @@ void Program::disassemble_instr(
     } else if (opcode == OpCode::SysCall) {
         func_name = syscall_func_names[static_cast<size_t>(funccode)];
     }
-    if (func_name.empty()) {
+    if (has_count(opcode)) {
+        std::cerr << op_names[static_cast<size_t>(opcode)] << "." 
+                << ((instr >> 8) & 0xFF);
+        if (opcode == OpCode::TailCall) {
+            std::cerr << "." << ((instr >> 16) & 0xFF);
+        }
+    } else if (func_name.empty()) {
         std::cerr << op_names[static_cast<size_t>(opcode)];
     } else {
         std::cerr << op_names[static_cast<size_t>(opcode)] << " " << func_name;
@@ -0,0 +1,782 @@
+#include "regcode.hpp"
+#include "mnemonics.hpp"
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+
+static std::string const reg_op_names[] = {
+    "move", "moveimm", "loadaddr", "loadabs", "load", "store", "storeimm",
+    "storeabs", "clear", "unary", "binary", "binaryimm", "select", "jump",
+    "brtrue", "brfalse", "brcmp", "brcmpimm", "jumptable", "call", "calldyn",
+    "tailcall", "tailcalldyn", "ret", "retimm",
+    "memoload", "memostore", "getreg", "setreg", "setregimm", "exit",
+    "exitimm", "putc", "getc"
+};
+
+void RegCode::disassemble() const {
+    for (std::size_t i = 0; i < instrs.size(); i++) {
+        RegInstr const &instr = instrs[i];
+        std::cerr << std::setw(6) << i << ": "
+                << reg_op_names[static_cast<std::size_t>(instr.op)];
+        if (instr.op == RegOp::Unary) {
+            std::cerr << "." << get_func_name(OpCode::Unary, instr.funccode);
+        } else if (instr.op == RegOp::Binary || instr.op == RegOp::BinaryImm
+                || instr.op == RegOp::BrCmp || instr.op == RegOp::BrCmpImm) {
+            std::cerr << "." << get_func_name(OpCode::Binary, instr.funccode);
+        }
+        std::cerr << " " << instr.dst << ", " << instr.a << ", " << instr.b;
+        if (instr.op == RegOp::TailCall || instr.op == RegOp::TailCallDyn
+                || instr.op == RegOp::BrCmp || instr.op == RegOp::BrCmpImm
+                || instr.op == RegOp::Select
+                || instr.op == RegOp::JumpTable) {
+            std::cerr << ", " << instr.c;
+        }
+        std::cerr << std::endl;
+    }
+}
+
+RegisterCompiler::RegisterCompiler(std::vector<uint32_t> const &bytecode,
+        std::vector<uint32_t> const &labels)
+        : m_bytecode(bytecode), m_labels(bytecode.size() + 1, false),
+        m_depths(), m_owners(), m_frame_depths(), m_worklist(), m_code(), m_block_pcs(), m_jumps(),
+        m_values(), m_depth(0), m_block_start(0) {
+    for (uint32_t label : labels) {
+        if (label < bytecode.size()) {
+            m_labels[label] = true;
+        }
+    }
+}
+
+RegisterCompiler::Decoded RegisterCompiler::decode(uint32_t address) const {
+    uint32_t word = m_bytecode[address];
+    Decoded instr;
+    instr.address = address;
+    instr.opcode = static_cast<OpCode>(word & 0x7F);
+    instr.funccode = static_cast<FuncCode>((word >> 8) & 0xFF);
+    instr.count = (word >> 8) & 0xFF;
+    instr.frame_args = (word >> 16) & 0xFF;
+    instr.has_immediate = (word >> 7) & 1;
+    instr.immediate = 0;
+    instr.size = 1;
+    if (instr.has_immediate) {
+        if (address + 1 >= m_bytecode.size()) {
+            throw std::runtime_error("Truncated instruction");
+        }
+        instr.immediate = m_bytecode[address + 1];
+        instr.size = 2;
+    }
+    if (instr.opcode == OpCode::JumpTable) {
+        // Followed by its table and default
+        instr.size += instr.immediate + 1;
+        if (!instr.has_immediate || address + instr.size > m_bytecode.size()) {
+            throw std::runtime_error("Truncated jump table");
+        }
+    }
+    return instr;
+}
+
+bool RegisterCompiler::pops_operand(Decoded const &instr) const {
+    return !instr.has_immediate && instr.opcode != OpCode::Nop
+            && instr.opcode != OpCode::LoadReg
+            && !(instr.opcode == OpCode::SysCall
+                && instr.funccode == FuncCode::GetC);
+}
+
+// Code reached from the entries of two functions makes the frame of the
+// second one as large as any
+void RegisterCompiler::propagate(uint32_t address, int32_t depth, 
+        uint32_t entry) {
+    if (address >= m_bytecode.size()) {
+        throw std::runtime_error("Branch out of code");
+    }
+    if (m_depths[address] == unknown_depth) {
+        m_depths[address] = depth;
+        m_owners[address] = entry;
+        m_worklist.push_back(address);
+    } else if (m_depths[address] != depth) {
+        throw std::runtime_error("Inconsistent stack depth at "
+                + std::to_string(address));
+    } else if (m_owners[address] != entry) {
+        m_frame_depths[entry] = INT32_MAX;
+    }
+}
+
+// Depth of the operand stack before each reachable instruction, relative
+// to bp. Code that is only entered by dynamic calls starts at a label.
+void RegisterCompiler::compute_depths() {
+    m_depths.assign(m_bytecode.size(), unknown_depth);
+    m_owners.assign(m_bytecode.size(), 0);
+    m_frame_depths.assign(m_bytecode.size(), 0);
+    auto run = [&]() {
+        while (!m_worklist.empty()) {
+            uint32_t address = m_worklist.back();
+            m_worklist.pop_back();
+            Decoded instr = decode(address);
+            uint32_t next = address + instr.size;
+            uint32_t entry = m_owners[address];
+            int32_t &max_depth = m_frame_depths[entry];
+            int32_t depth = m_depths[address];
+            if (pops_operand(instr)) {
+                depth--;
+            }
+            bool falls_through = true;
+            switch (instr.opcode) {
+                case OpCode::SysCall:
+                    if (instr.funccode == FuncCode::Exit) {
+                        falls_through = false;
+                    } else {
+                        depth++;
+                    }
+                    break;
+                case OpCode::Unary:
+                case OpCode::Push:
+                case OpCode::LoadRel:
+                case OpCode::LoadAbs:
+                case OpCode::LoadAddrRel:
+                case OpCode::LoadReg:
+                    depth++;
+                    break;
+                case OpCode::AddSp:
+                    if (!instr.has_immediate) {
+                        throw std::runtime_error("Unsupported dynamic AddSp");
+                    }
+                    depth += static_cast<int32_t>(instr.immediate);
+                    break;
+                case OpCode::StoreRel:
+                case OpCode::Select:
+                    depth--;
+                    break;
+                case OpCode::DupLoad:
+                case OpCode::Dup:
+                    depth += 2;
+                    break;
+                case OpCode::Call:
+                    if (instr.has_immediate) {
+                        propagate(instr.immediate, 0, instr.immediate);
+                    }
+                    depth -= instr.count;
+                    max_depth = std::max(max_depth, depth 
+                            + static_cast<int32_t>(instr.count 
+                                + call_frame_size));
+                    depth++;
+                    break;
+                case OpCode::TailCall:
+                    if (instr.has_immediate) {
+                        propagate(instr.immediate, 0, instr.immediate);
+                    }
+                    falls_through = false;
+                    break;
+                case OpCode::Ret:
+                    falls_through = false;
+                    break;
+                case OpCode::Jump:
+                    if (!instr.has_immediate) {
+                        throw std::runtime_error("Unsupported dynamic jump");
+                    }
+                    propagate(instr.immediate, depth, entry);
+                    falls_through = false;
+                    break;
+                case OpCode::BrTrue:
+                case OpCode::BrFalse:
+                    if (!instr.has_immediate) {
+                        throw std::runtime_error("Unsupported dynamic branch");
+                    }
+                    depth--;
+                    propagate(instr.immediate, depth, entry);
+                    break;
+                case OpCode::JumpTable:
+                    depth--;
+                    for (uint32_t i = 2; i < instr.size; i++) {
+                        propagate(m_bytecode[address + i], depth, entry);
+                    }
+                    falls_through = false;
+                    break;
+                default:
+                    break;
+            }
+            max_depth = std::max(max_depth, depth + 2);
+            if (falls_through) {
+                propagate(next, depth, entry);
+            }
+        }
+    };
+    // Code at address 0 runs with bp = 0, above the bytecode
+    propagate(0, m_bytecode.size(), 0);
+    run();
+    for (uint32_t address = 0; address < m_bytecode.size(); address++) {
+        if (m_labels[address] && m_depths[address] == unknown_depth) {
+            propagate(address, 0, address);
+            run();
+        }
+    }
+    int32_t max_depth = 0;
+    for (int32_t depth : m_frame_depths) {
+        if (depth != INT32_MAX) {
+            max_depth = std::max(max_depth, depth);
+        }
+    }
+    for (int32_t &depth : m_frame_depths) {
+        if (depth == INT32_MAX) {
+            depth = max_depth;
+        }
+    }
+}
+
+RegCode RegisterCompiler::compile() {
+    compute_depths();
+    // Targets of branches start blocks, like labels
+    for (uint32_t address = 0; address < m_bytecode.size(); ) {
+        Decoded instr = decode(address);
+        if (m_depths[address] != unknown_depth && instr.has_immediate
+                && (instr.opcode == OpCode::Jump
+                    || instr.opcode == OpCode::BrTrue
+                    || instr.opcode == OpCode::BrFalse)) {
+            m_labels[instr.immediate] = true;
+        }
+        if (m_depths[address] != unknown_depth
+                && instr.opcode == OpCode::JumpTable) {
+            for (uint32_t i = 2; i < instr.size; i++) {
+                m_labels[m_bytecode[address + i]] = true;
+            }
+        }
+        address += instr.size;
+    }
+    m_code.memory = m_bytecode;
+    m_code.entries.assign(m_bytecode.size(), RegCode::no_entry);
+    m_block_pcs.assign(m_bytecode.size(), RegCode::no_entry);
+
+    bool live = false;
+    for (uint32_t address = 0; address < m_bytecode.size(); ) {
+        Decoded instr = decode(address);
+        if (m_depths[address] == unknown_depth) {
+            live = false;
+        } else {
+            if (m_labels[address] || !live) {
+                if (live) {
+                    end_block();
+                }
+                start_block(address);
+            }
+            live = translate(instr);
+        }
+        address += instr.size;
+    }
+    if (live) {
+        throw std::runtime_error("Code ends without return");
+    }
+
+    for (std::size_t index : m_jumps) {
+        RegInstr &instr = m_code.instrs[index];
+        int32_t &target = (instr.op == RegOp::BrTrue
+                || instr.op == RegOp::BrFalse) ? instr.b 
+                : (instr.op == RegOp::BrCmp || instr.op == RegOp::BrCmpImm) 
+                ? instr.c : instr.a;
+        uint32_t pc = m_block_pcs[static_cast<uint32_t>(target)];
+        if (pc == RegCode::no_entry) {
+            throw std::runtime_error("Unresolved branch target");
+        }
+        target = pc;
+    }
+    m_code.frame_sizes.assign(m_code.instrs.size(), 0);
+    for (uint32_t address = 0; address < m_bytecode.size(); address++) {
+        if (m_frame_depths[address] != 0) {
+            if (m_block_pcs[address] == RegCode::no_entry) {
+                throw std::runtime_error("Unresolved call target");
+            }
+            m_code.frame_sizes[m_block_pcs[address]] = 
+                    m_frame_depths[address] + call_frame_size;
+        }
+    }
+    for (uint32_t &target : m_code.tables) {
+        target = m_block_pcs[target];
+        if (target == RegCode::no_entry) {
+            throw std::runtime_error("Unresolved branch target");
+        }
+    }
+    return std::move(m_code);
+}
+
+void RegisterCompiler::start_block(uint32_t address) {
+    m_values.clear();
+    m_depth = m_depths[address];
+    m_block_start = m_code.instrs.size();
+    m_block_pcs[address] = m_code.instrs.size();
+    m_code.entries[address] = m_code.instrs.size();
+}
+
+// Stores all values of the operand stack at their positions, where the
+// code of any other block expects them
+void RegisterCompiler::end_block() {
+    for (std::size_t i = 0; i < m_values.size(); i++) {
+        materialize(i);
+    }
+    m_values.clear();
+}
+
+std::size_t RegisterCompiler::emit(RegOp op, FuncCode funccode, int32_t dst,
+        int32_t a, int32_t b, int32_t c) {
+    m_code.instrs.push_back({op, funccode, dst, a, b, c});
+    return m_code.instrs.size() - 1;
+}
+
+void RegisterCompiler::push(Value value) {
+    m_values.push_back(value);
+    m_depth++;
+}
+
+void RegisterCompiler::push_stored(int32_t position, std::size_t producer) {
+    if (position != m_depth) {
+        throw std::runtime_error("Invalid register code position");
+    }
+    push({ValueKind::Stored, position, producer});
+}
+
+RegisterCompiler::Value RegisterCompiler::pop() {
+    m_depth--;
+    if (m_values.empty()) {
+        // Stored at the start of the block
+        return {ValueKind::Stored, m_depth, no_producer};
+    }
+    Value value = m_values.back();
+    m_values.pop_back();
+    return value;
+}
+
+RegisterCompiler::Value RegisterCompiler::operand(Decoded const &instr) {
+    if (instr.has_immediate) {
+        return {ValueKind::Const, static_cast<int32_t>(instr.immediate),
+                no_producer};
+    }
+    return pop();
+}
+
+int32_t RegisterCompiler::position(std::size_t index) const {
+    return m_depth - static_cast<int32_t>(m_values.size() - index);
+}
+
+void RegisterCompiler::materialize(std::size_t index) {
+    Value value = m_values[index];
+    if (value.kind == ValueKind::Stored) {
+        return;
+    }
+    int32_t at = position(index);
+    m_values[index] = {ValueKind::Stored, at, no_producer};
+    write_slot(at);
+    if (value.kind == ValueKind::Const) {
+        emit(RegOp::MoveImm, FuncCode::Nop, at, value.data);
+    } else if (value.data != at) {
+        emit(RegOp::Move, FuncCode::Nop, at, value.data);
+    }
+}
+
+void RegisterCompiler::materialize_top(std::size_t count) {
+    std::size_t first = m_values.size() - std::min(count, m_values.size());
+    for (std::size_t i = first; i < m_values.size(); i++) {
+        materialize(i);
+    }
+}
+
+// Slot holding a popped value, which was at the given position
+int32_t RegisterCompiler::slot_of(Value const &value, int32_t position) {
+    switch (value.kind) {
+        case ValueKind::Ref:
+            return value.data;
+        case ValueKind::Const:
+            write_slot(position);
+            emit(RegOp::MoveImm, FuncCode::Nop, position, value.data);
+            return position;
+        default:
+            return position;
+    }
+}
+
+// Values that still refer to a slot are copied before it is overwritten
+void RegisterCompiler::write_slot(int32_t slot) {
+    for (std::size_t i = 0; i < m_values.size(); i++) {
+        if (m_values[i].kind == ValueKind::Ref && m_values[i].data == slot) {
+            materialize(i);
+        }
+    }
+}
+
+// Before code that may write any slot through a pointer
+void RegisterCompiler::flush_refs() {
+    for (std::size_t i = 0; i < m_values.size(); i++) {
+        if (m_values[i].kind == ValueKind::Ref) {
+            materialize(i);
+        }
+    }
+}
+
+// Makes the last instruction store its result directly in a slot, when it
+// is the one that computed the value
+bool RegisterCompiler::retarget(Value const &value, int32_t slot) {
+    if (value.kind != ValueKind::Stored || value.producer == no_producer
+            || value.producer + 1 != m_code.instrs.size()
+            || value.producer < m_block_start) {
+        return false;
+    }
+    for (Value const &other : m_values) {
+        if (other.kind == ValueKind::Ref
+                && (other.data == slot || other.data == value.data)) {
+            return false;
+        }
+    }
+    m_code.instrs.back().dst = slot;
+    return true;
+}
+
+// Branches on a comparison computed just before, when no other value 
+// needs to be stored at the end of the block
+bool RegisterCompiler::fuse_branch(Value const &value, bool sense, 
+        uint32_t target) {
+    if (value.kind != ValueKind::Stored || value.producer == no_producer
+            || value.producer + 1 != m_code.instrs.size()
+            || value.producer < m_block_start) {
+        return false;
+    }
+    for (Value const &other : m_values) {
+        if (other.kind != ValueKind::Stored) {
+            return false;
+        }
+    }
+    RegInstr &instr = m_code.instrs.back();
+    if (instr.op != RegOp::Binary && instr.op != RegOp::BinaryImm) {
+        return false;
+    }
+    switch (instr.funccode) {
+        case FuncCode::Equals:
+        case FuncCode::NotEquals:
+        case FuncCode::LessThan:
+        case FuncCode::LessEquals:
+            break;
+        default:
+            return false;
+    }
+    instr.op = instr.op == RegOp::Binary ? RegOp::BrCmp : RegOp::BrCmpImm;
+    instr.dst = sense;
+    instr.c = target;
+    m_jumps.push_back(m_code.instrs.size() - 1);
+    m_values.clear();
+    return true;
+}
+
+static bool is_commutative(FuncCode funccode) {
+    switch (funccode) {
+        case FuncCode::Add:
+        case FuncCode::Mul:
+        case FuncCode::Equals:
+        case FuncCode::NotEquals:
+        case FuncCode::And:
+        case FuncCode::Or:
+        case FuncCode::Xor:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool RegisterCompiler::translate(Decoded const &instr) {
+    Value value;
+    Value left;
+    int32_t at;
+    int32_t src;
+    std::size_t index;
+    switch (instr.opcode) {
+        case OpCode::Nop:
+            return true;
+        case OpCode::SysCall:
+            if (instr.funccode == FuncCode::GetC) {
+                at = m_depth;
+                write_slot(at);
+                push_stored(at, emit(RegOp::GetC, FuncCode::Nop, at));
+                return true;
+            }
+            value = operand(instr);
+            at = m_depth;
+            if (instr.funccode == FuncCode::Exit) {
+                if (value.kind == ValueKind::Const) {
+                    emit(RegOp::ExitImm, FuncCode::Nop, 0, value.data);
+                } else {
+                    emit(RegOp::Exit, FuncCode::Nop, 0, slot_of(value, at));
+                }
+                return false;
+            }
+            if (instr.funccode != FuncCode::PutC) {
+                throw std::runtime_error("Unrecognized funccode");
+            }
+            src = slot_of(value, at);
+            write_slot(at);
+            push_stored(at, emit(RegOp::PutC, FuncCode::Nop, at, src));
+            return true;
+        case OpCode::Unary:
+            value = operand(instr);
+            at = m_depth;
+            src = slot_of(value, at);
+            write_slot(at);
+            push_stored(at, emit(RegOp::Unary, instr.funccode, at, src));
+            return true;
+        case OpCode::Binary:
+            value = operand(instr);
+            at = m_depth;
+            left = pop();
+            if (instr.funccode == FuncCode::Assign) {
+                // The store may change any slot that a value refers to
+                flush_refs();
+                if (left.kind == ValueKind::Const) {
+                    emit(RegOp::StoreAbs, FuncCode::Nop, 0, left.data,
+                            slot_of(value, at));
+                } else if (value.kind == ValueKind::Const) {
+                    emit(RegOp::StoreImm, FuncCode::Nop, 0,
+                            slot_of(left, m_depth), value.data);
+                } else {
+                    src = slot_of(left, m_depth);
+                    emit(RegOp::Store, FuncCode::Nop, 0, src,
+                            slot_of(value, at));
+                }
+                if (value.kind == ValueKind::Stored) {
+                    value = {ValueKind::Ref, at, no_producer};
+                }
+                push(value);
+                return true;
+            }
+            if (value.kind == ValueKind::Const) {
+                src = slot_of(left, m_depth);
+                at = m_depth;
+                write_slot(at);
+                push_stored(at, emit(RegOp::BinaryImm, instr.funccode, at,
+                        src, value.data));
+                return true;
+            }
+            src = slot_of(value, at);
+            at = m_depth;
+            if (left.kind == ValueKind::Const && is_commutative(instr.funccode)) {
+                write_slot(at);
+                push_stored(at, emit(RegOp::BinaryImm, instr.funccode, at,
+                        src, left.data));
+                return true;
+            }
+            {
+                int32_t left_src = slot_of(left, at);
+                write_slot(at);
+                push_stored(at, emit(RegOp::Binary, instr.funccode, at,
+                        left_src, src));
+            }
+            return true;
+        case OpCode::Select:
+            value = operand(instr);
+            at = m_depth;
+            left = pop();
+            {
+                int32_t src_false = slot_of(value, at);
+                int32_t src_true = slot_of(left, m_depth);
+                Value cond = pop();
+                at = m_depth;
+                src = slot_of(cond, at);
+                write_slot(at);
+                push_stored(at, emit(RegOp::Select, FuncCode::Nop, at, src,
+                        src_true, src_false));
+            }
+            return true;
+        case OpCode::Push:
+            push(operand(instr));
+            return true;
+        case OpCode::Pop:
+            value = operand(instr);
+            if (value.kind == ValueKind::Stored
+                    && value.producer != no_producer
+                    && value.producer + 1 == m_code.instrs.size()
+                    && value.producer >= m_block_start) {
+                RegOp op = m_code.instrs.back().op;
+                if (op == RegOp::Move || op == RegOp::MoveImm
+                        || op == RegOp::LoadAddr || op == RegOp::GetReg) {
+                    m_code.instrs.pop_back();
+                }
+            }
+            return true;
+        case OpCode::AddSp:
+            at = static_cast<int32_t>(instr.immediate);
+            if (at < 0) {
+                for (int32_t i = 0; i < -at; i++) {
+                    pop();
+                }
+                return true;
+            }
+            end_block();
+            for (int32_t i = 0; i < at; i++) {
+                write_slot(m_depth + i);
+            }
+            if (at > 0) {
+                emit(RegOp::Clear, FuncCode::Nop, m_depth, at);
+            }
+            m_depth += at;
+            return true;
+        case OpCode::LoadRel:
+            if (!instr.has_immediate) {
+                throw std::runtime_error("Unsupported dynamic LoadRel");
+            }
+            push({ValueKind::Ref, static_cast<int32_t>(instr.immediate),
+                    no_producer});
+            return true;
+        case OpCode::LoadAbs:
+        case OpCode::DupLoad:
+            value = operand(instr);
+            at = m_depth;
+            if (instr.opcode == OpCode::DupLoad) {
+                push(value);
+            }
+            if (value.kind == ValueKind::Const) {
+                write_slot(m_depth);
+                push_stored(m_depth, emit(RegOp::LoadAbs, FuncCode::Nop,
+                        m_depth, value.data));
+            } else {
+                src = value.kind == ValueKind::Ref ? value.data : at;
+                write_slot(m_depth);
+                push_stored(m_depth, emit(RegOp::Load, FuncCode::Nop,
+                        m_depth, src));
+            }
+            return true;
+        case OpCode::LoadAddrRel:
+            if (!instr.has_immediate) {
+                throw std::runtime_error("Unsupported dynamic LoadAddrRel");
+            }
+            at = m_depth;
+            write_slot(at);
+            push_stored(at, emit(RegOp::LoadAddr, FuncCode::Nop, at,
+                    instr.immediate));
+            return true;
+        case OpCode::Dup:
+            value = operand(instr);
+            at = m_depth;
+            if (value.kind == ValueKind::Stored) {
+                push({ValueKind::Stored, at, no_producer});
+                push({ValueKind::Ref, at, no_producer});
+            } else {
+                push(value);
+                push(value);
+            }
+            return true;
+        case OpCode::Call:
+            value = operand(instr);
+            at = m_depth;
+            src = value.kind == ValueKind::Ref ? value.data : at;
+            materialize_top(instr.count);
+            // The callee may change any slot through a pointer
+            flush_refs();
+            if (value.kind == ValueKind::Const) {
+                index = emit(RegOp::Call, FuncCode::Nop, at, value.data);
+                m_jumps.push_back(index);
+            } else {
+                emit(RegOp::CallDyn, FuncCode::Nop, at, src);
+            }
+            for (uint32_t i = 0; i < instr.count; i++) {
+                pop();
+            }
+            push_stored(m_depth, no_producer);
+            return true;
+        case OpCode::TailCall:
+            value = operand(instr);
+            at = m_depth;
+            src = value.kind == ValueKind::Ref ? value.data : at;
+            materialize_top(instr.count);
+            if (value.kind == ValueKind::Const) {
+                index = emit(RegOp::TailCall, FuncCode::Nop, at, value.data,
+                        instr.count, instr.frame_args);
+                m_jumps.push_back(index);
+            } else {
+                emit(RegOp::TailCallDyn, FuncCode::Nop, at, src,
+                        instr.count, instr.frame_args);
+            }
+            return false;
+        case OpCode::Ret:
+            value = operand(instr);
+            at = m_depth;
+            if (value.kind == ValueKind::Const) {
+                emit(RegOp::RetImm, FuncCode::Nop, 0, value.data,
+                        instr.count);
+            } else {
+                emit(RegOp::Ret, FuncCode::Nop, 0, slot_of(value, at),
+                        instr.count);
+            }
+            return false;
+        case OpCode::Jump:
+            end_block();
+            m_jumps.push_back(emit(RegOp::Jump, FuncCode::Nop, 0,
+                    instr.immediate));
+            return false;
+        case OpCode::BrTrue:
+        case OpCode::BrFalse:
+            value = pop();
+            if (fuse_branch(value, instr.opcode == OpCode::BrTrue, 
+                    instr.immediate)) {
+                return true;
+            }
+            src = slot_of(value, m_depth);
+            end_block();
+            m_jumps.push_back(emit(instr.opcode == OpCode::BrTrue
+                    ? RegOp::BrTrue : RegOp::BrFalse, FuncCode::Nop, 0,
+                    src, instr.immediate));
+            return true;
+        case OpCode::JumpTable:
+            value = pop();
+            src = slot_of(value, m_depth);
+            end_block();
+            emit(RegOp::JumpTable, FuncCode::Nop, 0, src, instr.immediate,
+                    m_code.tables.size());
+            for (uint32_t i = 2; i < instr.size; i++) {
+                m_code.tables.push_back(m_bytecode[instr.address + i]);
+            }
+            return false;
+        case OpCode::StoreRel:
+            if (!instr.has_immediate) {
+                throw std::runtime_error("Unsupported dynamic StoreRel");
+            }
+            value = pop();
+            at = static_cast<int32_t>(instr.immediate);
+            if (retarget(value, at)) {
+                return true;
+            }
+            write_slot(at);
+            if (value.kind == ValueKind::Const) {
+                emit(RegOp::MoveImm, FuncCode::Nop, at, value.data);
+            } else {
+                src = value.kind == ValueKind::Ref ? value.data : m_depth;
+                if (src != at) {
+                    emit(RegOp::Move, FuncCode::Nop, at, src);
+                }
+            }
+            return true;
+        case OpCode::MemoLoad:
+            emit(RegOp::MemoLoad, FuncCode::Nop, 0, instr.immediate,
+                    instr.count);
+            return true;
+        case OpCode::MemoStore:
+            if (m_values.empty()) {
+                src = m_depth - 1;
+            } else {
+                materialize(m_values.size() - 1);
+                src = position(m_values.size() - 1);
+            }
+            emit(RegOp::MemoStore, FuncCode::Nop, 0, instr.immediate, src);
+            return true;
+        case OpCode::LoadReg:
+            at = m_depth;
+            write_slot(at);
+            push_stored(at, emit(RegOp::GetReg, FuncCode::Nop, at,
+                    instr.count));
+            return true;
+        case OpCode::StoreReg:
+            value = operand(instr);
+            if (value.kind == ValueKind::Const) {
+                emit(RegOp::SetRegImm, FuncCode::Nop, instr.count,
+                        value.data);
+            } else {
+                emit(RegOp::SetReg, FuncCode::Nop, instr.count,
+                        slot_of(value, m_depth));
+            }
+            return true;
+        default:
+            throw std::runtime_error("Unrecognized opcode");
+    }
+}
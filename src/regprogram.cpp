@@ -0,0 +1,226 @@
+#include "regprogram.hpp"
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+RegisterProgram::RegisterProgram()
+        : m_code(), m_pc(0), m_bp(0), m_registers(frame_registers), m_rp(0), 
+        m_runtime() {}
+
+RegisterProgram RegisterProgram::load(RegCode code) {
+    RegisterProgram program;
+    program.m_code = std::move(code);
+    return program;
+}
+
+Runtime &RegisterProgram::runtime() {
+    return m_runtime;
+}
+
+uint32_t RegisterProgram::run() {
+    std::vector<RegInstr> const &instrs = m_code.instrs;
+    std::vector<uint32_t> &memory = m_code.memory;
+    uint32_t addr, ret_bp, ret_pc, base;
+    clock_t start = std::clock();
+    m_runtime.completed_instrs = 0;
+    enter_frame(m_bp);
+    while (m_pc < instrs.size()) {
+        if (m_runtime.completed_instrs >= m_runtime.max_instrs) {
+            throw std::runtime_error("Instruction limit exceeded");
+        }
+        RegInstr const &instr = instrs[m_pc++];
+        uint32_t *frame = memory.data() + m_bp;
+        switch (instr.op) {
+            case RegOp::Move:
+                frame[instr.dst] = frame[instr.a];
+                break;
+            case RegOp::MoveImm:
+                frame[instr.dst] = instr.a;
+                break;
+            case RegOp::LoadAddr:
+                frame[instr.dst] = m_bp + instr.a;
+                break;
+            case RegOp::LoadAbs:
+                frame[instr.dst] = memory[instr.a];
+                break;
+            case RegOp::Load:
+                frame[instr.dst] = memory[frame[instr.a]];
+                break;
+            case RegOp::Store:
+                memory[frame[instr.a]] = frame[instr.b];
+                break;
+            case RegOp::StoreImm:
+                memory[frame[instr.a]] = instr.b;
+                break;
+            case RegOp::StoreAbs:
+                memory[instr.a] = frame[instr.b];
+                break;
+            case RegOp::Clear:
+                if (m_bp + instr.dst + instr.a > m_runtime.stack_limit) {
+                    throw std::runtime_error("Stack limit exceeded");
+                }
+                std::fill_n(frame + instr.dst, instr.a, 0);
+                break;
+            case RegOp::Unary:
+                frame[instr.dst] = apply_unary(instr.funccode, 
+                        frame[instr.a]);
+                break;
+            case RegOp::Binary:
+                frame[instr.dst] = apply_binary(instr.funccode,
+                        frame[instr.a], frame[instr.b]);
+                break;
+            case RegOp::BinaryImm:
+                frame[instr.dst] = apply_binary(instr.funccode,
+                        frame[instr.a], instr.b);
+                break;
+            case RegOp::Select:
+                frame[instr.dst] = frame[instr.a] ? frame[instr.b]
+                        : frame[instr.c];
+                break;
+            case RegOp::Jump:
+                m_pc = instr.a;
+                break;
+            case RegOp::BrTrue:
+                if (frame[instr.a]) {
+                    m_pc = instr.b;
+                }
+                break;
+            case RegOp::BrFalse:
+                if (!frame[instr.a]) {
+                    m_pc = instr.b;
+                }
+                break;
+            case RegOp::BrCmp:
+                if ((apply_binary(instr.funccode, frame[instr.a], 
+                        frame[instr.b]) != 0) == instr.dst) {
+                    m_pc = instr.c;
+                }
+                break;
+            case RegOp::BrCmpImm:
+                if ((apply_binary(instr.funccode, frame[instr.a], 
+                        instr.b) != 0) == instr.dst) {
+                    m_pc = instr.c;
+                }
+                break;
+            case RegOp::JumpTable:
+                m_pc = m_code.tables[instr.c + std::min(frame[instr.a],
+                        static_cast<uint32_t>(instr.b))];
+                break;
+            case RegOp::Call:
+            case RegOp::CallDyn:
+                addr = instr.a;
+                if (instr.op == RegOp::CallDyn) {
+                    addr = frame[instr.a];
+                    if (addr >= m_code.entries.size()
+                            || m_code.entries[addr] == RegCode::no_entry) {
+                        throw std::runtime_error("Invalid call target");
+                    }
+                    addr = m_code.entries[addr];
+                }
+                frame[instr.dst] = m_bp;
+                frame[instr.dst + 1] = m_pc;
+                m_pc = addr;
+                enter_frame(m_bp + instr.dst + call_frame_size);
+                m_rp += frame_registers;
+                if (m_registers.size() < m_rp + frame_registers) {
+                    m_registers.resize(m_rp + frame_registers);
+                }
+                std::fill_n(m_registers.begin() + m_rp, frame_registers, 0);
+                break;
+            case RegOp::TailCall:
+            case RegOp::TailCallDyn:
+                // Arguments of the current frame are replaced by those of
+                // the callee, which returns directly to our caller
+                addr = instr.a;
+                if (instr.op == RegOp::TailCallDyn) {
+                    addr = frame[instr.a];
+                    if (addr >= m_code.entries.size()
+                            || m_code.entries[addr] == RegCode::no_entry) {
+                        throw std::runtime_error("Invalid call target");
+                    }
+                    addr = m_code.entries[addr];
+                }
+                ret_bp = frame[-2];
+                ret_pc = frame[-1];
+                base = m_bp - call_frame_size - instr.c;
+                std::copy(frame + instr.dst - instr.b, frame + instr.dst,
+                        memory.begin() + base);
+                memory[base + instr.b] = ret_bp;
+                memory[base + instr.b + 1] = ret_pc;
+                m_pc = addr;
+                enter_frame(base + instr.b + call_frame_size);
+                std::fill_n(m_registers.begin() + m_rp, frame_registers, 0);
+                break;
+            case RegOp::Ret:
+                return_from_call(frame[instr.a], instr.b);
+                break;
+            case RegOp::RetImm:
+                return_from_call(instr.a, instr.b);
+                break;
+            case RegOp::MemoLoad:
+                {
+                    // Arguments of the current frame form the key
+                    std::vector<uint32_t> key(
+                            frame - call_frame_size - instr.b,
+                            frame - call_frame_size);
+                    if (auto value = m_runtime.memo_caches.load(instr.a,
+                            std::move(key))) {
+                        return_from_call(value.value(), instr.b);
+                    }
+                }
+                break;
+            case RegOp::MemoStore:
+                m_runtime.memo_caches.store(instr.a, frame[instr.b]);
+                break;
+            case RegOp::GetReg:
+                frame[instr.dst] = m_registers[m_rp + instr.a];
+                break;
+            case RegOp::SetReg:
+                m_registers[m_rp + instr.dst] = frame[instr.a];
+                break;
+            case RegOp::SetRegImm:
+                m_registers[m_rp + instr.dst] = instr.a;
+                break;
+            case RegOp::Exit:
+            case RegOp::ExitImm:
+                m_runtime.execution_time = std::clock() - start;
+                return instr.op == RegOp::Exit ? frame[instr.a] : instr.a;
+            case RegOp::PutC:
+                frame[instr.dst] = m_runtime.put_char(frame[instr.a]);
+                break;
+            case RegOp::GetC:
+                frame[instr.dst] = m_runtime.get_char();
+                break;
+        }
+        m_runtime.completed_instrs++;
+    }
+    m_runtime.execution_time = std::clock() - start;
+    std::cerr << "Instruction fetch overread at " << m_pc << std::endl;
+    return -1;
+}
+
+// Memory is grown for the frame of the function entered at m_pc, up to 
+// the stack limit
+void RegisterProgram::enter_frame(uint32_t bp) {
+    m_bp = bp;
+    m_runtime.max_stack_size = std::max<std::size_t>(
+            m_runtime.max_stack_size, bp);
+    std::size_t size = bp + m_code.frame_sizes[m_pc];
+    if (size > m_runtime.stack_limit) {
+        throw std::runtime_error("Stack limit exceeded");
+    }
+    if (m_code.memory.size() < size) {
+        m_code.memory.resize(std::max(size, std::min(
+                2 * m_code.memory.size(), m_runtime.stack_limit)));
+    }
+}
+
+void RegisterProgram::return_from_call(uint32_t value, uint32_t n_args) {
+    std::vector<uint32_t> &memory = m_code.memory;
+    uint32_t ret_bp = memory[m_bp - 2];
+    uint32_t ret_pc = memory[m_bp - 1];
+    memory[m_bp - call_frame_size - n_args] = value;
+    m_bp = ret_bp;
+    m_pc = ret_pc;
+    m_rp -= frame_registers;
+}
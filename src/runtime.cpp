@@ -0,0 +1,115 @@
+#include "runtime.hpp"
+#include <iostream>
+#include <cstdio>
+#include <stdexcept>
+
+Runtime::Runtime()
+        : memo_caches(), completed_instrs(0), 
+        max_instrs(UINT64_MAX), stack_limit(SIZE_MAX), 
+        input(nullptr), input_pos(0), output(nullptr), 
+        max_stack_size(0), execution_time(0) {}
+
+void Runtime::set_limits(uint64_t max_instrs, std::size_t max_stack_size) {
+    this->max_instrs = max_instrs;
+    stack_limit = max_stack_size;
+}
+
+void Runtime::set_io(std::string const *input, std::string *output) {
+    this->input = input;
+    input_pos = 0;
+    this->output = output;
+}
+
+int Runtime::put_char(int c) {
+    if (output == nullptr) {
+        return putc(c, stdout);
+    }
+    output->push_back(static_cast<char>(c));
+    return static_cast<unsigned char>(c);
+}
+
+int Runtime::get_char() {
+    if (input == nullptr) {
+        return getc(stdin);
+    }
+    if (input_pos >= input->size()) {
+        return EOF;
+    }
+    return static_cast<unsigned char>((*input)[input_pos++]);
+}
+
+void Runtime::analytics() const {
+    double execution_time_secs = 
+            static_cast<double>(execution_time) / CLOCKS_PER_SEC;
+    std::cout << "Instructions completed:  " 
+            << completed_instrs << std::endl;
+    std::cout << "Execution time:          " 
+            << execution_time_secs << std::endl;
+    std::cout << "Seconds per instruction: " 
+            << (execution_time_secs / completed_instrs) << std::endl;
+    std::cout << "Instructions per second: " 
+            << static_cast<uint64_t>(completed_instrs / execution_time_secs) 
+            << std::endl;
+    std::cout << "Maximum stack size:      " 
+            << max_stack_size << std::endl;
+    memo_caches.analytics();
+}
+
+int32_t apply_unary(FuncCode funccode, int32_t a) {
+    switch (funccode) {
+        case FuncCode::Nop:
+            return a;
+        case FuncCode::Neg:
+            return -static_cast<uint32_t>(a);
+        case FuncCode::Not:
+            return ~a;
+        default:
+            throw std::runtime_error("Unrecognized funccode");
+    }
+}
+
+// Wrapping operations are done on unsigned values, as signed overflow is
+// undefined
+int32_t apply_binary(FuncCode funccode, int32_t a, int32_t b) {
+    uint32_t ua = static_cast<uint32_t>(a);
+    uint32_t ub = static_cast<uint32_t>(b);
+    switch (funccode) {
+        case FuncCode::Nop:
+            return a;
+        case FuncCode::Add:
+            return ua + ub;
+        case FuncCode::Sub:
+            return ua - ub;
+        case FuncCode::Mul:
+            return ua * ub;
+        case FuncCode::Div:
+        case FuncCode::Mod:
+            if (b == 0) {
+                throw std::runtime_error("Division by zero");
+            }
+            if (a == INT32_MIN && b == -1) {
+                throw std::runtime_error("Division overflow");
+            }
+            return funccode == FuncCode::Div ? a / b : a % b;
+        case FuncCode::Equals:
+            return a == b;
+        case FuncCode::NotEquals:
+            return a != b;
+        case FuncCode::LessThan:
+            return a < b;
+        case FuncCode::LessEquals:
+            return a <= b;
+        case FuncCode::And:
+            return a & b;
+        case FuncCode::Or:
+            return a | b;
+        case FuncCode::Xor:
+            return a ^ b;
+        case FuncCode::Shl:
+            return ua << (b & 31);
+        case FuncCode::Shr:
+            return a >> (b & 31);
+        default:
+            throw std::runtime_error("Unrecognized funccode");
+    }
+}
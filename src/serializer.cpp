@@ -1,32 +1,46 @@
 #include "serializer.hpp"
 #include "utils.hpp"
 #include "mnemonics.hpp"
+#include "program.hpp"
+#include "codecache.hpp"
 #include <iostream>
 #include <stdexcept>
 #include <unordered_set>
 #include <optional>
+#include <bit>
+#include <thread>
 
 JobEntry::JobEntry()
-        : label(0), node(nullptr), no_serialize(false) {}
+        : label(0), node(nullptr), no_serialize(false), n_args(0) {}
 
 
-JobEntry::JobEntry(uint32_t label, BaseNode *node, bool no_serialize)
-        : label(label), node(node), no_serialize(no_serialize) {}
+JobEntry::JobEntry(uint32_t label, BaseNode *node, bool no_serialize, 
+        uint32_t n_args)
+        : label(label), node(node), no_serialize(no_serialize), 
+        n_args(n_args) {}
+
+CodeBuffer::CodeBuffer()
+        : code(), labels(), jobs(), remarks(), address_taken(false), 
+        error() {}
+
+InlinedCall::InlinedCall(SymbolId id, uint32_t base, uint32_t n_params, 
+        Label exit)
+        : id(id), base(base), n_params(n_params), exit(exit) {}
 
 StackEntry::StackEntry()
         : m_type(EntryType::Instruction), m_opcode(OpCode::Nop), 
         m_funccode(FuncCode::Nop), m_data(0), m_has_immediate(0),
-        m_references_label(0), m_size(0) {}
+        m_references_label(0), m_size(0), m_frame_args(0) {}
 
 StackEntry::StackEntry(EntryType type, OpCode opcode, FuncCode funccode, 
         uint32_t data, bool has_immediate, bool references_label)
         : m_type(type), m_opcode(opcode), m_funccode(funccode), 
         m_data(data), m_has_immediate(has_immediate), 
-        m_references_label(references_label), m_size(0) {
+        m_references_label(references_label), m_size(0), m_frame_args(0) {
     if (type == EntryType::Instruction) {
         m_size = 1 + has_immediate;
     } else if (type == EntryType::Data) {
-        throw std::runtime_error("data not implemented");
+        m_size = 1;
     }
 }
 
@@ -49,12 +63,37 @@ StackEntry StackEntry::instr(OpCode opcode, FuncCode funccode,
             data, true, references_label);
 }
 
+static FuncCode count_code(uint32_t count) {
+    if (count > max_count) {
+        throw std::runtime_error("Too many arguments: " 
+                + std::to_string(count) + ", at most " 
+                + std::to_string(max_count));
+    }
+    return static_cast<FuncCode>(count);
+}
+
+StackEntry StackEntry::counted(OpCode opcode, uint32_t count) {
+    return StackEntry::instr(opcode, count_code(count));
+}
+
+StackEntry StackEntry::counted(OpCode opcode, uint32_t count, 
+        uint32_t data, bool references_label) {
+    return StackEntry::instr(opcode, count_code(count), 
+            data, references_label);
+}
+
 StackEntry StackEntry::label(Label label) {
     return StackEntry(
             EntryType::Label, OpCode::Nop, FuncCode::Nop, 
             label, false, false);
 }
 
+StackEntry StackEntry::data(uint32_t data, bool references_label) {
+    return StackEntry(
+            EntryType::Data, OpCode::Nop, FuncCode::Nop, 
+            data, false, references_label);
+}
+
 bool StackEntry::has_no_effect() const {
     switch (m_opcode) {
         case OpCode::Nop:
@@ -74,9 +113,16 @@ bool StackEntry::has_no_effect() const {
                 case FuncCode::Add:
                 case FuncCode::Sub:
                     return m_has_immediate && m_data == 0;
+                case FuncCode::Or:
+                case FuncCode::Xor:
+                case FuncCode::Shl:
+                case FuncCode::Shr:
+                    return m_has_immediate && m_data == 0;
                 case FuncCode::Mul:
                 case FuncCode::Div:
                     return m_has_immediate && m_data == 1;
+                case FuncCode::And:
+                    return m_has_immediate && m_data == UINT32_MAX;
                 default:
                     break; 
             }
@@ -87,11 +133,50 @@ bool StackEntry::has_no_effect() const {
     return false;
 }
 
-bool StackEntry::combine(StackEntry const &right, StackEntry &combined) const {
+bool StackEntry::is_non_negative() const {
+    if (m_type != EntryType::Instruction || m_opcode != OpCode::Binary) {
+        return false;
+    }
+    switch (m_funccode) {
+        case FuncCode::Equals:
+        case FuncCode::NotEquals:
+        case FuncCode::LessThan:
+        case FuncCode::LessEquals:
+            return true;
+        case FuncCode::And:
+            return m_has_immediate && !m_references_label 
+                    && static_cast<int32_t>(m_data) >= 0;
+        default:
+            return false;
+    }
+}
+
+bool StackEntry::jumps_to(Label label) const {
+    return m_type == EntryType::Instruction && m_opcode == OpCode::Jump 
+            && m_has_immediate && m_references_label && m_data == label;
+}
+
+bool StackEntry::stores_to(uint32_t offset) const {
+    return m_type == EntryType::Instruction && m_opcode == OpCode::StoreRel 
+            && m_has_immediate && !m_references_label && m_data == offset;
+}
+
+bool StackEntry::combine(StackEntry const &right, StackEntry &combined, 
+        PassSet const &passes) const {
     if (m_type != EntryType::Instruction 
             || right.m_type != EntryType::Instruction) {
         return false;
     }
+    if (passes.has(Pass::TailCalls) && m_opcode == OpCode::Call 
+            && right.m_opcode == OpCode::Ret && !right.m_has_immediate) {
+        combined = StackEntry(EntryType::Instruction, OpCode::TailCall, 
+                m_funccode, m_data, m_has_immediate, m_references_label);
+        combined.m_frame_args = static_cast<uint32_t>(right.m_funccode);
+        return true;
+    }
+    if (!passes.has(Pass::Peephole)) {
+        return false;
+    }
     if (has_no_effect()) {
         combined = right;
         return true;
@@ -100,7 +185,8 @@ bool StackEntry::combine(StackEntry const &right, StackEntry &combined) const {
         combined = *this;
         return true;
     }
-    if (m_opcode == OpCode::Jump || m_opcode == OpCode::Ret) {
+    if (m_opcode == OpCode::Jump || m_opcode == OpCode::Ret 
+            || m_opcode == OpCode::TailCall) {
         combined = *this;
         return true; 
         // TODO: After serializing, remove unused labels and check 
@@ -120,10 +206,20 @@ bool StackEntry::combine(StackEntry const &right, StackEntry &combined) const {
         return true;
     }
     if (m_opcode == OpCode::Push && m_has_immediate && !right.m_has_immediate 
+            && right.m_opcode != OpCode::LoadReg
             && !(right.m_opcode == OpCode::SysCall  // todo better
                 && right.m_funccode == FuncCode::GetC)) {
         combined = StackEntry::instr(right.m_opcode, right.m_funccode, 
                 m_data, m_references_label);
+        combined.m_frame_args = right.m_frame_args;
+        return true;
+    }
+    // Values pushed without side effects and dropped right away
+    if (((m_opcode == OpCode::LoadRel && m_has_immediate) 
+                || m_opcode == OpCode::LoadReg
+                || (m_opcode == OpCode::Dup && !m_has_immediate)) 
+            && right.m_opcode == OpCode::Pop && !right.m_has_immediate) {
+        combined = StackEntry::instr(OpCode::Nop);
         return true;
     }
     if (m_opcode == OpCode::LoadAddrRel && m_has_immediate 
@@ -135,9 +231,12 @@ bool StackEntry::combine(StackEntry const &right, StackEntry &combined) const {
     if (m_opcode == OpCode::Push && m_has_immediate && !m_references_label) {
         std::optional<uint32_t> value;
         int32_t left_value = m_data;
-        if (right.m_opcode == OpCode::Unary) {
+        // A unary with an immediate already has its operand
+        if (right.m_opcode == OpCode::Unary && !right.m_has_immediate) {
             if (right.m_funccode == FuncCode::Neg) {
                 value = -left_value;
+            } else if (right.m_funccode == FuncCode::Not) {
+                value = ~left_value;
             }
         }
         if (right.m_opcode == OpCode::Binary && right.m_has_immediate 
@@ -153,11 +252,31 @@ bool StackEntry::combine(StackEntry const &right, StackEntry &combined) const {
                 case FuncCode::Mul:
                     value = left_value * right_value;
                     break;
+                // Division errors are left to be raised when run
                 case FuncCode::Div:
-                    value = left_value / right_value;
-                    break;
                 case FuncCode::Mod:
-                    value = left_value % right_value;
+                    if (right_value != 0 && !(left_value == INT32_MIN 
+                            && right_value == -1)) {
+                        value = right.m_funccode == FuncCode::Div 
+                                ? left_value / right_value 
+                                : left_value % right_value;
+                    }
+                    break;
+                case FuncCode::And:
+                    value = left_value & right_value;
+                    break;
+                case FuncCode::Or:
+                    value = left_value | right_value;
+                    break;
+                case FuncCode::Xor:
+                    value = left_value ^ right_value;
+                    break;
+                case FuncCode::Shl:
+                    value = static_cast<uint32_t>(left_value) 
+                            << (right_value & 31);
+                    break;
+                case FuncCode::Shr:
+                    value = left_value >> (right_value & 31);
                     break;
                 default:
                     break;
@@ -171,6 +290,86 @@ bool StackEntry::combine(StackEntry const &right, StackEntry &combined) const {
     return false;
 }
 
+// Multiplication by a power of two becomes a shift; division and modulo 
+// only when the dividend produced by left is known to be non-negative, 
+// as they round towards zero
+bool StackEntry::reduce_strength(StackEntry const &left, 
+        StackEntry &reduced) const {
+    if (m_type != EntryType::Instruction || m_opcode != OpCode::Binary 
+            || !m_has_immediate || m_references_label) {
+        return false;
+    }
+    int32_t divisor = m_data;
+    if (divisor <= 1 || (divisor & (divisor - 1)) != 0) {
+        return false;
+    }
+    uint32_t shift = std::countr_zero(m_data);
+    switch (m_funccode) {
+        case FuncCode::Mul:
+            reduced = instr(OpCode::Binary, FuncCode::Shl, shift);
+            return true;
+        case FuncCode::Div:
+            if (!left.is_non_negative()) {
+                return false;
+            }
+            reduced = instr(OpCode::Binary, FuncCode::Shr, shift);
+            return true;
+        case FuncCode::Mod:
+            if (!left.is_non_negative()) {
+                return false;
+            }
+            reduced = instr(OpCode::Binary, FuncCode::And, m_data - 1);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Labels taken from first on are renamed to their number in labels
+void StackEntry::relabel(std::vector<Label> const &labels, Label first) {
+    if ((m_type == EntryType::Label || m_references_label) 
+            && m_data >= first) {
+        m_data = labels[m_data - first];
+    }
+}
+
+bool StackEntry::is_relocated() const {
+    return m_type == EntryType::Label || m_references_label 
+            || (m_type == EntryType::Instruction 
+                && (m_opcode == OpCode::MemoLoad 
+                    || m_opcode == OpCode::MemoStore));
+}
+
+void StackEntry::set_data(uint32_t data) {
+    m_data = data;
+}
+
+// Fields are written as they are in memory, for the same build to read
+void StackEntry::write(std::ostream &out) const {
+    uint32_t words[] = {
+        static_cast<uint32_t>(m_type), static_cast<uint32_t>(m_opcode), 
+        static_cast<uint32_t>(m_funccode), m_data, 
+        static_cast<uint32_t>(m_has_immediate | m_references_label << 1), 
+        static_cast<uint32_t>(m_size), m_frame_args
+    };
+    out.write(reinterpret_cast<char const *>(words), sizeof(words));
+}
+
+StackEntry StackEntry::read(std::istream &in) {
+    uint32_t words[7] = {};
+    in.read(reinterpret_cast<char *>(words), sizeof(words));
+    StackEntry entry;
+    entry.m_type = static_cast<EntryType>(words[0]);
+    entry.m_opcode = static_cast<OpCode>(words[1]);
+    entry.m_funccode = static_cast<FuncCode>(words[2]);
+    entry.m_data = words[3];
+    entry.m_has_immediate = words[4] & 1;
+    entry.m_references_label = words[4] & 2;
+    entry.m_size = words[5];
+    entry.m_frame_args = words[6];
+    return entry;
+}
+
 void StackEntry::register_label(LabelMap &map, uint32_t &i) const {
     if (m_type == EntryType::Label) {
         if (map.find(m_data) != map.end()) {
@@ -199,24 +398,40 @@ void StackEntry::assemble(std::vector<uint32_t> &stack,
     if (m_type == EntryType::Instruction) {
         stack.push_back(static_cast<uint32_t>(m_opcode) 
                 | (static_cast<uint32_t>(m_funccode) << 8)
+                | (m_frame_args << 16)
                 | (m_has_immediate << 7));
         if (m_has_immediate) {
             stack.push_back(immediate);
         }
+    } else if (m_type == EntryType::Data) {
+        stack.push_back(immediate);
     }
 }
 
+bool StackEntry::is_label() const {
+    return m_type == EntryType::Label;
+}
+
 size_t StackEntry::get_size() const {
     return m_size;
 }
 
+uint32_t StackEntry::get_data() const {
+    return m_data;
+}
+
 void StackEntry::disassemble() const {
     if (m_type == EntryType::Label) {
         std::cerr << ".L" << m_data << ":" << std::endl;
     } else if (m_type == EntryType::Instruction) {
         std::cerr << "    " << get_op_name(m_opcode);
         std::string func_name = get_func_name(m_opcode, m_funccode);
-        if (!func_name.empty()) {
+        if (has_count(m_opcode)) {
+            std::cerr << "." << static_cast<uint32_t>(m_funccode);
+            if (m_opcode == OpCode::TailCall) {
+                std::cerr << "." << m_frame_args;
+            }
+        } else if (!func_name.empty()) {
             std::cerr << "." << func_name;
         }
         if (m_has_immediate) {
@@ -227,15 +442,51 @@ void StackEntry::disassemble() const {
             }
         }
         std::cerr << std::endl;
+    } else if (m_type == EntryType::Data) {
+        std::cerr << "    .word ";
+        if (m_references_label) {
+            std::cerr << ".L" << m_data << std::endl;
+        } else {
+            std::cerr << static_cast<int32_t>(m_data) << std::endl;
+        }
     }
 }
 
-Serializer::Serializer(SymbolTable &symbol_table)
-        : m_symbol_table(symbol_table), m_inline_frames(*this), 
-        m_code_jobs(), m_labels(), m_stack() {}
+Serializer::Serializer(SymbolTable &symbol_table, 
+        SourceManager const &sources)
+        : m_symbol_table(symbol_table), m_sources(sources), 
+        m_inline_frames(*this), m_root(this), m_n_threads(1), m_mutex(), 
+        m_changed(), m_n_busy(0), m_code_jobs(), m_implemented(), 
+        m_buffers(), m_first_label(symbol_table.counter()), 
+        m_next_label(m_first_label), m_own_labels{0, 0}, 
+        m_label_range(&m_own_labels), m_taken_labels(), m_added_jobs(), 
+        m_cache(nullptr), m_labels(), m_stack(), m_combine_floor(0), 
+        m_frame_entry(), m_frame_resets(), m_frame_id(0), m_frame_args(0), 
+        m_frame_memo(false), m_frame_top(0), m_frame_max(0), 
+        m_frame_registers(), m_register_resets(), m_inline_threshold(0), 
+        m_passes(), m_eval_max_instrs(0), m_eval_max_stack_size(0), 
+        m_eval_budget(0), m_eval_cut(false), m_address_taken(false), 
+        m_max_unroll_factor(0), m_unroll_budget(0), 
+        m_inlined_calls(), m_hoisted(), m_values(), m_dropped_values(), 
+        m_value_reuses(), m_ir(nullptr), m_remarks() {}
+
+// Generates the jobs of the root, with its settings
+Serializer::Serializer(Serializer &root, LabelRange &labels)
+        : Serializer(root.m_symbol_table, root.m_sources) {
+    m_root = &root;
+    m_label_range = &labels;
+    m_inline_threshold = root.m_inline_threshold;
+    m_passes = root.m_passes;
+    m_eval_max_instrs = root.m_eval_max_instrs;
+    m_eval_max_stack_size = root.m_eval_max_stack_size;
+    m_max_unroll_factor = root.m_max_unroll_factor;
+    m_unroll_budget = root.m_unroll_budget;
+    m_ir = root.m_ir;
+    m_cache = root.m_cache;
+}
 
 void Serializer::call(SymbolId id, 
-        std::vector<std::unique_ptr<ExpressionNode>> const &args) {
+        NodeList<ExpressionNode> args) {
     if (id == 0) {
         throw std::runtime_error("No matching call found");
     }
@@ -245,7 +496,6 @@ void Serializer::call(SymbolId id,
         m_symbol_table.dump();
         throw std::runtime_error("Definition is not callable: " + std::to_string(id));
     }
-    add_function_implementation(id);
     callable->serialize_call(*this, args);
 }
 
@@ -260,9 +510,14 @@ void Serializer::push_callable_addr(SymbolId id) {
         throw std::runtime_error("Can only reference function");
     }
     add_function_implementation(entry.id);
+    mark_address_taken();
     add_instr(OpCode::Push, entry.id, true);
 }
 
+void Serializer::mark_address_taken() {
+    m_address_taken = true;
+}
+
 void Serializer::add_instr(OpCode opcode, FuncCode funccode) {
     add_entry(StackEntry::instr(opcode, funccode));
 }
@@ -277,16 +532,23 @@ void Serializer::add_instr(OpCode opcode, FuncCode funccode,
     add_entry(StackEntry::instr(opcode, funccode, data, references_label));
 }
 
-void Serializer::add_job(uint32_t label, BaseNode *node, bool no_serialize) {
-    m_code_jobs.push({label, node, no_serialize});
+void Serializer::add_counted_instr(OpCode opcode, uint32_t count) {
+    add_entry(StackEntry::counted(opcode, count));
+}
+
+void Serializer::add_counted_instr(OpCode opcode, uint32_t count, 
+        uint32_t data, bool references_label) {
+    add_entry(StackEntry::counted(opcode, count, data, references_label));
+}
+
+void Serializer::add_job(uint32_t label, BaseNode *node, bool no_serialize, 
+        uint32_t n_args) {
+    m_added_jobs.push_back(label);
+    m_root->schedule(JobEntry(label, node, no_serialize, n_args));
 }
 
 void Serializer::add_function_implementation(SymbolId id) {
-    SymbolEntry &symbol = m_symbol_table.m_table[id];
-    if (!symbol.implemented) {
-        m_code_jobs.push(JobEntry(id, symbol.definition, false));
-        symbol.implemented = true;
-    }
+    add_job(id, m_symbol_table.get(id).definition, false);
 }
 
 uint32_t Serializer::add_label() {
@@ -299,7 +561,12 @@ uint32_t Serializer::add_label(Label label) {
 }
 
 uint32_t Serializer::get_label() {
-    return m_symbol_table.next_id();
+    if (m_label_range->next == m_label_range->end) {
+        *m_label_range = m_root->reserve_labels();
+    }
+    Label label = m_label_range->next++;
+    m_taken_labels.push_back(label);
+    return label;
 }
 
 uint32_t Serializer::get_stack_size() const {
@@ -310,10 +577,463 @@ uint32_t Serializer::get_stack_size() const {
     return size;
 }
 
+void Serializer::open_frame(SymbolId id, uint32_t size, uint32_t n_args, 
+        bool memo) {
+    // The frame may still grow by inlined calls, so the entry is not 
+    // combined and is patched by close_frame()
+    m_stack.push_back(StackEntry::instr(OpCode::AddSp, size));
+    m_frame_entry = m_stack.size() - 1;
+    m_frame_id = id;
+    m_frame_args = n_args;
+    m_frame_memo = memo;
+    m_combine_floor = m_stack.size();
+    m_frame_top = size;
+    m_frame_max = size;
+}
+
+void Serializer::close_frame() {
+    if (!m_frame_entry.has_value()) {
+        throw std::runtime_error("No open frame");
+    }
+    // Resets follow the frame entry, so patch back to front
+    for (auto iter = m_frame_resets.rbegin(); 
+            iter != m_frame_resets.rend(); iter++) {
+        patch_frame_entry(*iter, -m_frame_max);
+    }
+    patch_frame_entry(m_frame_entry.value(), m_frame_max);
+    m_frame_entry.reset();
+    m_frame_resets.clear();
+    m_frame_id = 0;
+    m_frame_args = 0;
+    m_frame_memo = false;
+    m_frame_registers.clear();
+    m_register_resets.clear();
+    m_combine_floor = 0;
+}
+
+void Serializer::add_frame_reset() {
+    // Discards the frame so that it is allocated anew at the function label
+    for (uint32_t index : m_register_resets) {
+        add_counted_instr(OpCode::StoreReg, index, 0);
+    }
+    m_stack.push_back(StackEntry::instr(OpCode::AddSp, 0));
+    m_frame_resets.push_back(m_stack.size() - 1);
+    m_combine_floor = m_stack.size();
+}
+
+uint32_t Serializer::reserve_frame(uint32_t size) {
+    uint32_t offset = m_frame_top;
+    m_frame_top += size;
+    m_frame_max = std::max(m_frame_max, m_frame_top);
+    return offset;
+}
+
+void Serializer::release_frame(uint32_t size) {
+    m_frame_top -= size;
+}
+
+uint32_t Serializer::frame_offset(SymbolEntry const &entry) const {
+    if (m_inlined_calls.empty()) {
+        return entry.value;
+    }
+    // Parameters are below the frame pointer, locals above it
+    InlinedCall const &call = m_inlined_calls.back();
+    int32_t offset = entry.value;
+    if (offset < 0) {
+        return call.base + offset + call_frame_size + call.n_params;
+    }
+    return call.base + call.n_params + offset;
+}
+
+void Serializer::set_inline_threshold(uint32_t threshold) {
+    m_inline_threshold = threshold;
+}
+
+void Serializer::set_passes(PassSet passes) {
+    m_passes = passes;
+}
+
+PassSet const &Serializer::passes() const {
+    return m_passes;
+}
+
+void Serializer::set_ir(IrModule *ir) {
+    m_ir = ir;
+}
+
+// Functions lowered to the IR are emitted from it when the pass is enabled
+IrFunction *Serializer::ir_function(SymbolId id) const {
+    if (m_ir == nullptr || !m_passes.has(Pass::Ssa)) {
+        return nullptr;
+    }
+    return m_ir->find(id);
+}
+
+void Serializer::set_unroll_limits(uint32_t max_factor, uint32_t budget) {
+    m_max_unroll_factor = max_factor;
+    m_unroll_budget = budget;
+}
+
+uint32_t Serializer::max_unroll_factor() const {
+    return m_max_unroll_factor;
+}
+
+uint32_t Serializer::unroll_budget() const {
+    return m_unroll_budget;
+}
+
+void Serializer::spend_unroll_budget(uint32_t size) {
+    m_unroll_budget -= size;
+}
+
+bool Serializer::should_inline(FunctionNode const *callee) {
+    static std::size_t const max_inline_depth = 8;
+    std::string name = "'" + std::string(callee->ident().data()) + "'";
+    if (!m_passes.has(Pass::Inline) || m_inline_threshold == 0) {
+        return false;
+    }
+    if (!m_frame_entry.has_value()) {
+        add_remark("not inlined " + name + ": no enclosing frame");
+        return false;
+    }
+    if (callee->writeback()) {
+        add_remark("not inlined " + name + ": writeback function");
+        return false;
+    }
+    if (is_memoized(callee)) {
+        add_remark("not inlined " + name + ": memoized function");
+        return false;
+    }
+    for (InlinedCall const &call : m_inlined_calls) {
+        if (call.id == callee->id()) {
+            add_remark("not inlined " + name + ": recursive call");
+            return false;
+        }
+    }
+    if (m_inlined_calls.size() >= max_inline_depth) {
+        add_remark("not inlined " + name + ": maximum depth reached");
+        return false;
+    }
+    std::size_t cost = tree_size(callee->body()) + callee->frame_size();
+    std::string cost_str = "cost " + std::to_string(cost) + ", threshold " 
+            + std::to_string(m_inline_threshold);
+    if (cost > m_inline_threshold) {
+        add_remark("not inlined " + name + ": too large (" + cost_str + ")");
+        return false;
+    }
+    add_remark("inlined " + name + " (" + cost_str + ")");
+    return true;
+}
+
+void Serializer::assign_register(SymbolId id, uint32_t index, bool reset) {
+    m_frame_registers[id] = index;
+    if (reset) {
+        m_register_resets.push_back(index);
+    }
+}
+
+std::optional<uint32_t> Serializer::frame_register(SymbolId id) const {
+    auto iter = m_frame_registers.find(id);
+    if (iter == m_frame_registers.end()) {
+        return std::nullopt;
+    }
+    return iter->second;
+}
+
+FunctionNode const *Serializer::current_function() const {
+    if (!m_frame_entry.has_value()) {
+        return nullptr;
+    }
+    SymbolId id = m_inlined_calls.empty() ? m_frame_id 
+            : m_inlined_calls.back().id;
+    return dynamic_cast<FunctionNode const *>(
+            m_symbol_table.get(id).definition);
+}
+
+void Serializer::hoist(BaseNode const *node, uint32_t offset) {
+    m_hoisted[node] = offset;
+}
+
+void Serializer::unhoist(BaseNode const *node) {
+    m_hoisted.erase(node);
+}
+
+bool Serializer::is_hoisted(BaseNode const *node) const {
+    return m_hoisted.find(node) != m_hoisted.end();
+}
+
+bool Serializer::load_hoisted(BaseNode const *node) {
+    auto iter = m_hoisted.find(node);
+    if (iter == m_hoisted.end()) {
+        return false;
+    }
+    add_instr(OpCode::LoadRel, iter->second);
+    return true;
+}
+
+void Serializer::number_value(BaseNode const *node, ValueUse use, 
+        uint32_t offset) {
+    m_values[node] = {use, offset};
+    if (use == ValueUse::Reuse) {
+        m_value_reuses[offset]++;
+    }
+}
+
+// Node is computed elsewhere, so values kept by it are never stored
+void Serializer::drop_values(BaseNode const *node) {
+    auto iter = m_values.find(node);
+    if (iter != m_values.end()) {
+        if (iter->second.first == ValueUse::Keep) {
+            m_dropped_values.insert(iter->second.second);
+        }
+        m_values.erase(iter);
+    }
+    for (BaseNode const *child : node->children()) {
+        drop_values(child);
+    }
+}
+
+void Serializer::clear_values() {
+    m_values.clear();
+    m_dropped_values.clear();
+    m_value_reuses.clear();
+}
+
+bool Serializer::load_value(BaseNode const *node) {
+    auto iter = m_values.find(node);
+    if (iter == m_values.end()) {
+        return false;
+    }
+    auto [use, offset] = iter->second;
+    if (use == ValueUse::Dup) {
+        add_instr(OpCode::Dup);
+        return true;
+    }
+    if (use != ValueUse::Reuse || m_dropped_values.count(offset) != 0) {
+        return false;
+    }
+    // The only reuse right after the value is kept takes it from the stack
+    if (m_passes.has(Pass::Peephole) && m_value_reuses[offset] == 1 
+            && m_stack.size() > m_combine_floor 
+            && m_stack.back().stores_to(offset)) {
+        m_stack.pop_back();
+        return true;
+    }
+    add_instr(OpCode::LoadRel, offset);
+    return true;
+    return false;
+}
+
+void Serializer::store_value(BaseNode const *node) {
+    auto iter = m_values.find(node);
+    if (iter == m_values.end() || iter->second.first != ValueUse::Keep) {
+        return;
+    }
+    add_instr(OpCode::StoreRel, iter->second.second);
+    add_instr(OpCode::LoadRel, iter->second.second);
+}
+
+bool Serializer::is_memoized(FunctionNode const *function) const {
+    if (function->memo()) {
+        return true;
+    }
+    if (!m_passes.has(Pass::AutoMemo) 
+            || !m_symbol_table.get(function->id()).pure) {
+        return false;
+    }
+    // Only functions branching into several calls of themselves repeat 
+    // arguments, tail calls are run as loops instead
+    uint32_t calls = 0;
+    uint32_t tail_calls = 0;
+    count_calls(function->body(), function->id(), calls, tail_calls);
+    return calls - tail_calls >= 2;
+}
+
+bool Serializer::is_tail_recursion(SymbolId callee) const {
+    return m_frame_entry.has_value() && m_inlined_calls.empty() 
+            && !m_frame_memo && m_passes.has(Pass::TailCalls) 
+            && callee == m_frame_id;
+}
+
+void Serializer::set_eval_limits(uint64_t max_instrs, 
+        std::size_t max_stack_size, uint64_t budget) {
+    m_eval_max_instrs = max_instrs;
+    m_eval_max_stack_size = max_stack_size;
+    m_eval_budget = budget;
+}
+
+void Serializer::set_threads(uint32_t n_threads) {
+    m_n_threads = std::max(n_threads, 1u);
+}
+
+void Serializer::set_cache(CodeCache *cache) {
+    m_cache = cache;
+}
+
+std::string Serializer::settings() const {
+    return m_passes.to_string() + " " + std::to_string(m_inline_threshold) 
+            + " " + std::to_string(m_eval_max_instrs) + " " 
+            + std::to_string(m_eval_max_stack_size) + " " 
+            + std::to_string(m_max_unroll_factor) + " " 
+            + std::to_string(m_unroll_budget);
+}
+
+std::optional<uint32_t> Serializer::evaluate_call(FunctionNode const *callee, 
+        NodeList<ExpressionNode> args) {
+    // The call to main is not evaluated, neither are calls in the sandbox
+    if (!m_passes.has(Pass::ConstEval) || m_eval_max_instrs == 0 
+            || !m_frame_entry.has_value() 
+            || callee->writeback() || !m_symbol_table.get(callee->id()).pure) {
+        return std::nullopt;
+    }
+    for (ExpressionNode *arg : args) {
+        if (!is_constant(arg, m_symbol_table)) {
+            return std::nullopt;
+        }
+    }
+    std::string name = "'" + std::string(callee->ident().data()) + "'";
+    uint64_t max_instrs;
+    {
+        std::lock_guard lock(m_root->m_mutex);
+        max_instrs = std::min(m_eval_max_instrs, m_root->m_eval_budget);
+    }
+    if (max_instrs == 0) {
+        m_eval_cut = true;
+        add_remark("not evaluated " + name + ": evaluation budget spent");
+        return std::nullopt;
+    }
+    Program program;
+    uint32_t value;
+    try {
+        Serializer sandbox(m_symbol_table, m_sources);
+        sandbox.set_inline_threshold(m_inline_threshold);
+        sandbox.set_passes(m_passes);
+        sandbox.set_unroll_limits(m_max_unroll_factor, m_unroll_budget);
+        sandbox.call(callee->id(), args);
+        sandbox.add_instr(OpCode::SysCall, FuncCode::Exit);
+        sandbox.serialize_jobs();
+        if (sandbox.m_address_taken) {
+            // Addresses in the sandbox mean nothing in the program
+            add_remark("not evaluated " + name + ": address taken");
+            return std::nullopt;
+        }
+        program = Program::load(sandbox.assemble());
+        program.runtime().set_limits(max_instrs, m_eval_max_stack_size);
+        value = program.run();
+    } catch (std::exception const &e) {
+        spend_eval_budget(program.runtime().completed_instrs);
+        m_eval_cut = m_eval_cut || max_instrs < m_eval_max_instrs;
+        add_remark("not evaluated " + name + ": " + e.what());
+        return std::nullopt;
+    }
+    spend_eval_budget(program.runtime().completed_instrs);
+    add_remark("evaluated " + name + " to " 
+            + std::to_string(static_cast<int32_t>(value)));
+    return value;
+}
+
+void Serializer::spend_eval_budget(uint64_t instrs) {
+    std::lock_guard lock(m_root->m_mutex);
+    m_root->m_eval_budget -= std::min(instrs, m_root->m_eval_budget);
+}
+
+void Serializer::open_inlined_call(SymbolId id, uint32_t base, 
+        uint32_t n_params) {
+    m_inlined_calls.push_back(InlinedCall(id, base, n_params, get_label()));
+}
+
+void Serializer::close_inlined_call() {
+    add_label(m_inlined_calls.back().exit);
+    m_inlined_calls.pop_back();
+}
+
+void Serializer::add_return() {
+    if (m_inlined_calls.empty()) {
+        if (m_frame_memo) {
+            add_instr(OpCode::MemoStore, m_frame_id);
+        }
+        add_counted_instr(OpCode::Ret, m_frame_args);
+    } else {
+        add_instr(OpCode::Jump, m_inlined_calls.back().exit, true);
+    }
+}
+
+// Jumps to the label of the case matching the value on top of the stack, 
+// or to otherwise. Dense cases index a jump table, others are found by a 
+// binary search, or compared one by one without the pass.
+void Serializer::add_switch(std::vector<std::pair<int32_t, Label>> cases, 
+        Label otherwise) {
+    std::sort(cases.begin(), cases.end());
+    std::string name = current_function() == nullptr ? "" 
+            : " in '" + std::string(current_function()->ident().data()) 
+                + "'";
+    int64_t first = cases.empty() ? 0 : cases.front().first;
+    int64_t span = cases.empty() ? 0 : cases.back().first - first + 1;
+    if (m_passes.has(Pass::JumpTables) && cases.size() >= min_table_cases 
+            && span <= static_cast<int64_t>(max_table_span * cases.size())) {
+        add_remark("switch" + name + ": jump table of " 
+                + std::to_string(span) + " entries");
+        add_instr(OpCode::Binary, FuncCode::Sub, first);
+        add_instr(OpCode::JumpTable, span);
+        std::size_t next = 0;
+        for (int64_t i = 0; i < span; i++) {
+            if (cases[next].first - first == i) {
+                add_entry(StackEntry::data(cases[next++].second, true));
+            } else {
+                add_entry(StackEntry::data(otherwise, true));
+            }
+        }
+        add_entry(StackEntry::data(otherwise, true));
+        return;
+    }
+    if (m_passes.has(Pass::JumpTables) && cases.size() > max_linear_cases) {
+        add_remark("switch" + name + ": binary search over " 
+                + std::to_string(cases.size()) + " cases");
+    }
+    uint32_t slot = reserve_frame(1);
+    add_instr(OpCode::StoreRel, slot);
+    add_case_search(cases, 0, cases.size(), slot, otherwise);
+    release_frame(1);
+}
+
+void Serializer::add_case_search(
+        std::vector<std::pair<int32_t, Label>> const &cases, 
+        std::size_t begin, std::size_t end, uint32_t slot, Label otherwise) {
+    if (end - begin <= max_linear_cases || !m_passes.has(Pass::JumpTables)) {
+        for (std::size_t i = begin; i < end; i++) {
+            add_instr(OpCode::LoadRel, slot);
+            add_instr(OpCode::Binary, FuncCode::Equals, cases[i].first);
+            add_instr(OpCode::BrTrue, cases[i].second, true);
+        }
+        add_instr(OpCode::Jump, otherwise, true);
+        return;
+    }
+    std::size_t middle = begin + (end - begin) / 2;
+    Label label_upper = get_label();
+    add_instr(OpCode::LoadRel, slot);
+    add_instr(OpCode::Binary, FuncCode::LessThan, cases[middle].first);
+    add_instr(OpCode::BrFalse, label_upper, true);
+    add_case_search(cases, begin, middle, slot, otherwise);
+    add_label(label_upper);
+    add_case_search(cases, middle, end, slot, otherwise);
+}
+
+void Serializer::add_remark(std::string const &remark) {
+    m_remarks.push_back(remark);
+}
+
+std::vector<std::string> const &Serializer::remarks() const {
+    return m_remarks;
+}
+
+std::string Serializer::location(Token const &token) const {
+    return m_sources.describe(token);
+}
+
 void Serializer::serialize() {
     uint32_t global_size = m_symbol_table.container_size();
 
-    SymbolId entry_id = lookup_scope("main", m_symbol_table.global());
+    SymbolId entry_id = m_symbol_table.lookup_global("main");
     auto callable = m_symbol_table.callable(entry_id);
     if (callable.size() != 1) {
         throw std::runtime_error("Multiple definitions for 'main'");
@@ -322,15 +1042,7 @@ void Serializer::serialize() {
     add_instr(OpCode::AddSp, global_size);
     call(callable.front(), {});
     add_instr(OpCode::SysCall, FuncCode::Exit);
-
-    while (!m_code_jobs.empty()) {
-        JobEntry &job = m_code_jobs.front();
-        if (!job.no_serialize) {
-            add_label(job.label);
-            job.node->serialize(*this);
-        }
-        m_code_jobs.pop();
-    }
+    serialize_jobs();
 
     uint32_t position = get_stack_size();
     for (SymbolId const id : m_symbol_table.container()) {
@@ -351,6 +1063,19 @@ std::vector<uint32_t> Serializer::assemble() {
     return bytecode;
 }
 
+// Addresses of all labels in the assembled code
+std::vector<uint32_t> Serializer::code_labels() const {
+    std::vector<uint32_t> labels;
+    uint32_t position = 0;
+    for (StackEntry const &entry : m_stack) {
+        if (entry.is_label()) {
+            labels.push_back(position);
+        }
+        position += entry.get_size();
+    }
+    return labels;
+}
+
 void Serializer::disassemble() const {
     for (StackEntry const &entry : m_stack) {
         entry.disassemble();
@@ -365,17 +1090,220 @@ InlineFrames &Serializer::inline_frames() {
     return m_inline_frames;
 }
 
+// Jobs are generated by a pool of workers, then linked in the order a 
+// single worker would have generated them
+void Serializer::serialize_jobs() {
+    std::vector<std::jthread> threads;
+    for (uint32_t i = 1; i < m_n_threads; i++) {
+        threads.emplace_back(&Serializer::work, this);
+    }
+    work();
+    threads.clear();
+    link();
+}
+
+void Serializer::work() {
+    LabelRange labels{0, 0};
+    std::unique_lock lock(m_mutex);
+    while (true) {
+        m_changed.wait(lock, [this]() { 
+            return !m_code_jobs.empty() || m_n_busy == 0; 
+        });
+        if (m_code_jobs.empty()) {
+            return;
+        }
+        JobEntry job = m_code_jobs.front();
+        m_code_jobs.pop();
+        m_n_busy++;
+        lock.unlock();
+        CodeBuffer buffer = Serializer(*this, labels).generate(job);
+        lock.lock();
+        m_buffers[job.label] = std::move(buffer);
+        m_n_busy--;
+        if (m_n_busy == 0 && m_code_jobs.empty()) {
+            m_changed.notify_all();
+        }
+    }
+}
+
+void Serializer::schedule(JobEntry const &job) {
+    std::lock_guard lock(m_mutex);
+    if (m_implemented.insert(job.label).second) {
+        m_code_jobs.push(job);
+        m_changed.notify_one();
+    }
+}
+
+LabelRange Serializer::reserve_labels() {
+    std::lock_guard lock(m_mutex);
+    Label first = m_next_label;
+    m_next_label += label_block;
+    return {first, m_next_label};
+}
+
+// Functions are taken from the cache when it has them, and stored in it 
+// once generated
+CodeBuffer Serializer::generate(JobEntry const &job) {
+    CodeBuffer buffer;
+    bool cached = m_cache != nullptr && job.label < m_first_label;
+    try {
+        std::optional<CodeObject> object;
+        if (cached) {
+            object = m_cache->load(job.label);
+        }
+        if (object.has_value()) {
+            load_object(object.value());
+        } else if (!job.no_serialize) {
+            add_label(job.label);
+            m_frame_args = job.n_args;
+            job.node->serialize(*this);
+            if (cached && !m_eval_cut 
+                    && (object = make_object()).has_value()) {
+                m_cache->store(job.label, object.value());
+            }
+        }
+    } catch (...) {
+        buffer.error = std::current_exception();
+    }
+    buffer.code = std::move(m_stack);
+    buffer.labels = std::move(m_taken_labels);
+    buffer.jobs = std::move(m_added_jobs);
+    buffer.remarks = std::move(m_remarks);
+    buffer.address_taken = m_address_taken;
+    return buffer;
+}
+
+// Labels and jobs are taken in the order they were when the object was 
+// made, so that it links the same
+void Serializer::load_object(CodeObject const &object) {
+    std::vector<Label> labels;
+    for (uint32_t i = 0; i < object.n_labels; i++) {
+        labels.push_back(get_label());
+    }
+    for (std::size_t i = 0; i < object.code.size(); i++) {
+        m_stack.push_back(object.code[i]);
+        if (object.relocations[i] == Relocation::Label) {
+            m_stack.back().set_data(labels.at(object.code[i].get_data()));
+        }
+    }
+    for (SymbolId job : object.jobs) {
+        add_function_implementation(job);
+    }
+    m_remarks = object.remarks;
+    m_address_taken = object.address_taken;
+}
+
+// Code adding lambdas is not kept, as their bodies are jobs of their own
+std::optional<CodeObject> Serializer::make_object() const {
+    CodeObject object;
+    for (Label job : m_added_jobs) {
+        if (job >= m_first_label) {
+            return std::nullopt;
+        }
+        object.jobs.push_back(job);
+    }
+    std::unordered_map<Label, uint32_t> labels;
+    for (Label label : m_taken_labels) {
+        labels.emplace(label, labels.size());
+    }
+    object.n_labels = labels.size();
+    for (StackEntry entry : m_stack) {
+        Relocation relocation = Relocation::None;
+        if (entry.is_relocated() && entry.get_data() >= m_first_label) {
+            relocation = Relocation::Label;
+            entry.set_data(labels.at(entry.get_data()));
+        } else if (entry.is_relocated()) {
+            relocation = Relocation::Symbol;
+        }
+        object.code.push_back(entry);
+        object.relocations.push_back(relocation);
+    }
+    object.remarks = m_remarks;
+    object.address_taken = m_address_taken;
+    return object;
+}
+
+// Appends the buffers breadth first from the jobs added here, which is the 
+// order of the queue, and numbers the labels in the order they were taken. 
+// The first error in that order is the one a single worker would have met.
+void Serializer::link() {
+    std::vector<Label> order;
+    std::unordered_set<Label> linked;
+    auto enqueue = [&order, &linked](std::vector<Label> const &jobs) {
+        for (Label job : jobs) {
+            if (linked.insert(job).second) {
+                order.push_back(job);
+            }
+        }
+    };
+    std::vector<Label> labels(m_next_label - m_first_label);
+    Label next = m_first_label;
+    auto number = [&labels, &next, this](std::vector<Label> const &taken) {
+        for (Label label : taken) {
+            labels[label - m_first_label] = next++;
+        }
+    };
+    enqueue(m_added_jobs);
+    number(m_taken_labels);
+    for (std::size_t i = 0; i < order.size(); i++) {
+        CodeBuffer const &buffer = m_buffers.at(order[i]);
+        if (buffer.error) {
+            std::rethrow_exception(buffer.error);
+        }
+        enqueue(buffer.jobs);
+        number(buffer.labels);
+    }
+    for (StackEntry &entry : m_stack) {
+        entry.relabel(labels, m_first_label);
+    }
+    for (Label job : order) {
+        CodeBuffer &buffer = m_buffers.at(job);
+        for (StackEntry &entry : buffer.code) {
+            entry.relabel(labels, m_first_label);
+        }
+        m_stack.insert(m_stack.end(), buffer.code.begin(), 
+                buffer.code.end());
+        m_remarks.insert(m_remarks.end(), buffer.remarks.begin(), 
+                buffer.remarks.end());
+        m_address_taken = m_address_taken || buffer.address_taken;
+    }
+    m_buffers.clear();
+    m_added_jobs.clear();
+    m_taken_labels.clear();
+    m_first_label = next;
+    m_next_label = next;
+    m_own_labels = {0, 0};
+}
+
+void Serializer::patch_frame_entry(std::size_t index, uint32_t size) {
+    if (size == 0) {
+        m_stack.erase(m_stack.begin() + index);
+    } else {
+        m_stack[index] = StackEntry::instr(OpCode::AddSp, size);
+    }
+}
+
 void Serializer::add_entry(StackEntry const &entry) {
+    if (entry.is_label() && m_passes.has(Pass::Peephole)) {
+        // Jump to the immediately following label
+        while (m_stack.size() > m_combine_floor 
+                && m_stack.back().jumps_to(entry.get_data())) {
+            m_stack.pop_back();
+        }
+    }
     m_stack.push_back(entry);
     StackEntry left;
     StackEntry right;
     StackEntry combined;
-    while (m_stack.size() > 1) {
+    while (m_stack.size() > 1 && m_stack.size() - 2 >= m_combine_floor) {
         left = m_stack[m_stack.size() - 2];
         right = m_stack[m_stack.size() - 1];
-        if (left.combine(right, combined)) {
+        if (left.combine(right, combined, m_passes)) {
             m_stack.pop_back();
             m_stack[m_stack.size() - 1] = combined;
+        } else if (m_passes.has(Pass::StrengthReduce) 
+                && right.reduce_strength(left, combined)) {
+            m_stack[m_stack.size() - 1] = combined;
         } else {
             return;
         }
@@ -0,0 +1,143 @@
+#include "source.hpp"
+#include "token.hpp"
+#include "utils.hpp"
+#include <stdexcept>
+#include <filesystem>
+#include <algorithm>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+SourceFile::SourceFile(std::string const &filename)
+        : m_filename(filename), m_data(nullptr), m_size(0), m_lines(), 
+        m_lines_found() {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file: " + filename);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        throw std::runtime_error("Could not read file: " + filename);
+    }
+    m_size = info.st_size;
+    if (m_size > 0) {
+        void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Could not map file: " + filename);
+        }
+        madvise(data, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<char const *>(data);
+    }
+    // The mapping stays valid once the file is closed
+    close(fd);
+}
+
+SourceFile::~SourceFile() {
+    if (m_data != nullptr) {
+        munmap(const_cast<char *>(m_data), m_size);
+    }
+}
+
+std::string const &SourceFile::filename() const {
+    return m_filename;
+}
+
+std::string_view SourceFile::text() const {
+    return std::string_view(m_data, m_size);
+}
+
+bool SourceFile::contains(std::string_view data) const {
+    // Pointers into different objects are only ordered by std::less
+    std::less<char const *> less;
+    return !less(data.data(), m_data) 
+            && !less(m_data + m_size, data.data() + data.size());
+}
+
+std::pair<uint32_t, uint32_t> SourceFile::row_col(std::size_t offset) const {
+    std::call_once(m_lines_found, [this]() {
+        m_lines.push_back(0);
+        for (std::size_t i = 0; i < m_size; i++) {
+            if (m_data[i] == '\n') {
+                m_lines.push_back(i + 1);
+            }
+        }
+    });
+    auto line = std::upper_bound(m_lines.begin(), m_lines.end(), offset) - 1;
+    return {line - m_lines.begin() + 1, offset - *line + 1};
+}
+
+SourceManager::SourceManager()
+        : m_files(), m_ids(), m_interner(), m_mutex() {
+    for (auto const &[keyword, type] : default_syntax_map) {
+        m_interner.intern(keyword);
+    }
+}
+
+FileId SourceManager::open(std::string const &filename) {
+    std::string path = filename;
+    if (!std::filesystem::is_regular_file(path)) {
+        path = "std/" + filename + (endswith(filename, ".fx") ? "" : ".fx");
+        if (!std::filesystem::is_regular_file(path)) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+    }
+    // Files reached through different paths are still mapped once
+    std::string key = std::filesystem::weakly_canonical(path).string();
+    std::lock_guard lock(m_mutex);
+    auto iter = m_ids.find(key);
+    if (iter != m_ids.end()) {
+        return iter->second;
+    }
+    FileId id = m_files.size();
+    m_files.push_back(std::make_unique<SourceFile>(path));
+    m_ids.emplace(key, id);
+    return id;
+}
+
+SourceFile const &SourceManager::file(FileId id) const {
+    std::lock_guard lock(m_mutex);
+    return *m_files.at(id);
+}
+
+std::size_t SourceManager::size() const {
+    std::lock_guard lock(m_mutex);
+    return m_files.size();
+}
+
+SourcePos SourceManager::locate(Token const &token) const {
+    if (token.type() == TokenType::Synthetic) {
+        return SourcePos();
+    }
+    std::lock_guard lock(m_mutex);
+    for (FileId id = 0; id < m_files.size(); id++) {
+        SourceFile const &file = *m_files[id];
+        if (file.contains(token.data())) {
+            auto [row, col] = file.row_col(
+                    token.data().data() - file.text().data());
+            return SourcePos{id, row, col};
+        }
+    }
+    return SourcePos();
+}
+
+std::string SourceManager::describe(SourcePos const &pos) const {
+    std::string location = std::to_string(pos.row) + ":" 
+            + std::to_string(pos.col);
+    std::lock_guard lock(m_mutex);
+    if (pos.file >= m_files.size()) {
+        return location;
+    }
+    return m_files[pos.file]->filename() + ":" + location;
+}
+
+std::string SourceManager::describe(Token const &token) const {
+    return describe(locate(token));
+}
+
+Interner &SourceManager::interner() {
+    return m_interner;
+}
@@ -17,6 +17,13 @@ std::vector<IntrinsicEntry> const intrinsics = {
     {"__ineq__", 2, OpCode::Binary, FuncCode::NotEquals},
     {"__ilt__", 2, OpCode::Binary, FuncCode::LessThan},
     {"__ile__", 2, OpCode::Binary, FuncCode::LessEquals},
+    {"__inot__", 1, OpCode::Unary, FuncCode::Not},
+    {"__iand__", 2, OpCode::Binary, FuncCode::And},
+    {"__ior__", 2, OpCode::Binary, FuncCode::Or},
+    {"__ixor__", 2, OpCode::Binary, FuncCode::Xor},
+    {"__ishl__", 2, OpCode::Binary, FuncCode::Shl},
+    {"__ishr__", 2, OpCode::Binary, FuncCode::Shr},
+    {"__select__", 3, OpCode::Select, FuncCode::Nop},
 };
 
 SymbolEntry::SymbolEntry(std::string symbol, BaseNode *definition, 
@@ -24,7 +31,7 @@ SymbolEntry::SymbolEntry(std::string symbol, BaseNode *definition,
             uint32_t value, uint32_t size)
             : symbol(symbol), definition(definition), type(type), id(id),
             storage_type(storage_type), value(value), size(size),
-            usages(0), implemented(false), overload(false) {}
+            usages(0), overload(false), pure(false) {}
 
 void SymbolEntry::overload_of(SymbolId name_id) {
     overload = true;
@@ -32,53 +39,54 @@ void SymbolEntry::overload_of(SymbolId name_id) {
 }
 
 ScopeTracker::ScopeTracker()
-        : global(), enclosing(), current() {}
+        : m_bindings(), m_undo(), m_scopes() {}
 
-ScopeTracker::ScopeTracker(SymbolMap global, SymbolMap enclosing, 
-        SymbolMap current)
-        : global(global), enclosing(enclosing), current(current) {}
-
-SymbolId lookup_symbol(std::string const &symbol, ScopeTracker const &scopes) {
-    SymbolMap::const_iterator iter;
+void ScopeTracker::open_scope() {
+    m_scopes.push_back(m_undo.size());
+}
 
-    iter = scopes.current.find(symbol);
-    if (iter != scopes.current.end()) {
-        return iter->second;
-    }
-    iter = scopes.enclosing.find(symbol);
-    if (iter != scopes.enclosing.end()) {
-        return iter->second;
+void ScopeTracker::close_scope() {
+    for (std::size_t i = m_undo.size(); i > m_scopes.back(); i--) {
+        m_bindings[m_undo[i - 1].atom] = m_undo[i - 1].binding;
     }
-    iter = scopes.global.find(symbol);
-    if (iter != scopes.global.end()) {
-        return iter->second;
-    }
-    throw std::runtime_error("Undeclared symbol: " + symbol);
+    m_undo.resize(m_scopes.back());
+    m_scopes.pop_back();
 }
 
-SymbolId lookup_scope(std::string const &symbol, SymbolMap const &scope) {
-    SymbolMap::const_iterator iter = scope.find(symbol);
-    if (iter == scope.end()) {
-        throw std::runtime_error(symbol + " not defined in scope");
+SymbolId ScopeTracker::find(Atom atom) const {
+    return atom < m_bindings.size() ? m_bindings[atom].id : no_symbol;
+}
+
+bool ScopeTracker::in_scope(Atom atom) const {
+    return find(atom) != no_symbol 
+            && m_bindings[atom].depth == m_scopes.size();
+}
+
+void ScopeTracker::bind(Atom atom, SymbolId id) {
+    if (atom >= m_bindings.size()) {
+        m_bindings.resize(atom + 1, {no_symbol, 0});
     }
-    return iter->second;
+    if (!m_scopes.empty()) {
+        m_undo.push_back({atom, m_bindings[atom]});
+    }
+    m_bindings[atom] = {id, static_cast<uint32_t>(m_scopes.size())};
 }
 
-SymbolTable::SymbolTable(std::unique_ptr<BaseNode> &root)
-        : m_root(root), m_jobs(), m_table({
+SymbolTable::SymbolTable(BaseNode *root, Interner &interner)
+        : m_root(root), m_interner(interner), m_jobs(), m_table({
             SymbolEntry(
                 "<null>", nullptr, nullptr, 0, StorageType::Invalid, 0, 0),
             SymbolEntry(
                 "<entry>", nullptr, nullptr, 1, StorageType::AbsoluteRef, 0, 0)
-        }), m_counter(2) {}
+        }), m_counter(2), m_types() {}
 
 void SymbolTable::resolve() {
     ScopeTracker scopes;
 
-    load_predefined(scopes.global);
+    load_predefined(scopes);
     open_container();
 
-    m_root->resolve_globals(*this, scopes.global);
+    m_root->resolve_globals(*this, scopes);
     
     for (SymbolEntry const &entry : m_table) {
         if (entry.overload) {
@@ -93,7 +101,37 @@ void SymbolTable::resolve() {
         m_jobs.pop();
     }
 
-    m_global = std::move(scopes.global);
+    resolve_purity();
+
+    m_global = std::move(scopes);
+}
+
+void SymbolTable::resolve_purity() {
+    // Functions start out pure and are marked impure until a fixpoint is 
+    // reached, so that (mutually) recursive functions can be pure
+    for (SymbolEntry &entry : m_table) {
+        FunctionNode *function = dynamic_cast<FunctionNode *>(entry.definition);
+        entry.pure = function != nullptr && function->id() == entry.id;
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (SymbolEntry &entry : m_table) {
+            if (entry.pure && !entry.definition->is_pure(*this)) {
+                entry.pure = false;
+                changed = true;
+            }
+        }
+    }
+    for (SymbolEntry const &entry : m_table) {
+        FunctionNode *function = dynamic_cast<FunctionNode *>(entry.definition);
+        if (function != nullptr && function->id() == entry.id 
+                && function->memo() && !entry.pure) {
+            throw std::runtime_error(
+                    "Memoized function is not pure: " 
+                    + std::string(function->ident().data()));
+        }
+    }
 }
 
 void SymbolTable::add_job(BaseNode *node) {
@@ -110,50 +148,64 @@ SymbolEntry const &SymbolTable::get(SymbolId id) const {
     return m_table[id];
 }
 
-SymbolId SymbolTable::declare(SymbolMap &scope, std::string const &symbol, 
+SymbolId SymbolTable::lookup(Atom atom, ScopeTracker const &scopes) const {
+    SymbolId id = scopes.find(atom);
+    if (id == no_symbol) {
+        throw std::runtime_error("Undeclared symbol: " 
+                + std::string(m_interner.name(atom)));
+    }
+    return id;
+}
+
+SymbolId SymbolTable::lookup_global(std::string_view name) const {
+    Atom atom = m_interner.find(name);
+    SymbolId id = atom == no_atom ? no_symbol : m_global.find(atom);
+    if (id == no_symbol) {
+        throw std::runtime_error(std::string(name) + " not defined in scope");
+    }
+    return id;
+}
+
+SymbolId SymbolTable::declare(ScopeTracker &scopes, Atom atom, 
         BaseNode *definition, TypeNode *type, StorageType storage_type, 
         uint32_t value, uint32_t size) {
-    SymbolMap::const_iterator iter = scope.find(symbol);
-    if (iter != scope.end()) {
-        print_map(scope);
+    std::string symbol(m_interner.name(atom));
+    if (scopes.in_scope(atom)) {
         dump();
         throw std::runtime_error("Redeclared symbol: " + symbol);
     }
     SymbolId id = next_id();
-    scope[symbol] = id;
+    scopes.bind(atom, id);
     add(SymbolEntry(symbol, definition, type, id, storage_type, value, size));
     return id;
 }
 
-SymbolId SymbolTable::declare_callable(std::string const &name, 
-        SymbolMap &scope, CallableNode *node) {
-    SymbolMap::const_iterator name_iter = scope.find(name);
-    SymbolId name_id;
-    if (name_iter == scope.end()) { // New callable
-        name_id = declare(scope, name, nullptr, nullptr, 
+SymbolId SymbolTable::declare_callable(Atom atom, ScopeTracker &scopes, 
+        CallableNode *node) {
+    SymbolId name_id = scopes.in_scope(atom) ? scopes.find(atom) : no_symbol;
+    if (name_id == no_symbol) { // New callable
+        name_id = declare(scopes, atom, nullptr, nullptr, 
                 StorageType::Callable);
-    } else {
-        name_id = name_iter->second;
-        if (get(name_id).storage_type != StorageType::Callable) {
-            throw std::runtime_error("Can only overload other callables");
-        }
+    } else if (get(name_id).storage_type != StorageType::Callable) {
+        throw std::runtime_error("Can only overload other callables");
     }
 
-    SymbolId definition_id = declare(scope, 
-            "." + name + "_" + std::to_string(counter()), 
-            node, node->signature().type.get(), StorageType::AbsoluteRef);
+    std::string definition = "." + std::string(m_interner.name(atom)) + "_" 
+            + std::to_string(counter());
+    SymbolId definition_id = declare(scopes, m_interner.intern(definition), 
+            node, node->signature().type, StorageType::AbsoluteRef);
 
     m_table[definition_id].overload_of(name_id);
     
     return definition_id;
 }
 
-void SymbolTable::load_predefined(SymbolMap &symbol_map) {
+void SymbolTable::load_predefined(ScopeTracker &scopes) {
     size_t i;
     for (i = 0; i < intrinsics.size(); i++) {
         IntrinsicEntry intrinsic = intrinsics[i];
-        declare(symbol_map, intrinsic.symbol, nullptr, &Any,
-                StorageType::Intrinsic, i);
+        declare(scopes, m_interner.intern(intrinsic.symbol), nullptr, 
+                &Any, StorageType::Intrinsic, i);
     }
 }
 
@@ -175,6 +227,9 @@ void SymbolTable::dump() const {
         if (entry.overload) {
             std::cout << " value=" << entry.value;
         }
+        if (entry.pure) {
+            std::cout << " pure";
+        }
         std::cout << std::endl;
     }
 }
@@ -208,10 +263,6 @@ SymbolIdList const &SymbolTable::container() const {
     return m_containers.top();
 }
 
-SymbolMap const &SymbolTable::global() const {
-    return m_global;
-}
-
 std::vector<SymbolId> const &SymbolTable::callable(SymbolId id) const {
     auto iter = m_callables.find(id);
     if (iter == m_callables.end()) {
@@ -221,6 +272,10 @@ std::vector<SymbolId> const &SymbolTable::callable(SymbolId id) const {
     return iter->second;
 }
 
+TypeTable &SymbolTable::types() {
+    return m_types;
+}
+
 std::vector<SymbolEntry>::const_iterator SymbolTable::begin() const {
     return m_table.begin();
 }
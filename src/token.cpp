@@ -1,5 +1,6 @@
 #include "token.hpp"
 #include <stdexcept>
+#include <charconv>
 
 std::ostream &operator <<(std::ostream &stream, TokenType const type) {
     stream << to_string(type);
@@ -30,6 +31,8 @@ std::string to_string(TokenType type) {
             return "inline";
         case TokenType::Writeback:
             return "writeback";
+        case TokenType::Memo:
+            return "memo";
         case TokenType::TypeDef:
             return "typedef";
         case TokenType::Like:
@@ -46,6 +49,12 @@ std::string to_string(TokenType type) {
             return "while";
         case TokenType::For:
             return "for";
+        case TokenType::Switch:
+            return "switch";
+        case TokenType::Case:
+            return "case";
+        case TokenType::Default:
+            return "default";
         case TokenType::Lambda:
             return "lambda";
         case TokenType::Var:
@@ -62,6 +71,7 @@ SyntaxMap const default_syntax_map = {
     {"fn", TokenType::Function},
     {"inline", TokenType::Inline},
     {"writeback", TokenType::Writeback},
+    {"memo", TokenType::Memo},
     {"typedef", TokenType::TypeDef},
     {"like", TokenType::Like},
     {"return", TokenType::Return},
@@ -70,23 +80,31 @@ SyntaxMap const default_syntax_map = {
     {"else", TokenType::Else},
     {"while", TokenType::While},
     {"for", TokenType::For},
+    {"switch", TokenType::Switch},
+    {"case", TokenType::Case},
+    {"default", TokenType::Default},
     {"lambda", TokenType::Lambda},
     {"var", TokenType::Var},
     {"true", TokenType::True},
     {"false", TokenType::False}
 };
 
-Token::Token() 
-        : m_type(TokenType::Null), m_data(""), row(0), col(0) {}
+TokenType keyword_type(Atom atom) {
+    return atom < default_syntax_map.size() 
+            ? default_syntax_map[atom].second : TokenType::Identifier;
+}
 
-Token::Token(TokenType type, std::size_t row, std::size_t col)
-        : m_type(type), m_data(""), row(row), col(col) {}
+static_assert(sizeof(Token) == 16);
 
-Token::Token(TokenType type, std::string data, std::size_t row, std::size_t col) 
-        : m_type(type), m_data(data), row(row), col(col) {}
+Token::Token() 
+        : m_data(""), m_atom(no_atom), m_size(0), m_type(TokenType::Null) {}
 
-Token Token::synthetic(std::string data) {
-    return Token(TokenType::Synthetic, data, 0, 0);
+Token::Token(TokenType type, std::string_view data, Atom atom) 
+        : m_data(data.data()), m_atom(atom), 
+        m_size(static_cast<uint16_t>(data.size())), m_type(type) {}
+
+Token Token::synthetic(std::string_view data) {
+    return Token(TokenType::Synthetic, data);
 }
 
 Token Token::null() {
@@ -97,17 +115,18 @@ TokenType Token::type() const {
     return m_type;
 }
 
-std::string Token::data() const {
-    return m_data;
+std::string_view Token::data() const {
+    return std::string_view(m_data, m_size);
 }
 
 uint32_t Token::to_int() const {
-    if (m_data.size() >= 3 && m_data[0] == '\'' 
-            && m_data[m_data.size() - 1] == '\'') {
-        if (m_data.size() == 3) {
-            return m_data[1];
-        } else if (m_data.size() == 4 && m_data[1] == '\\') {
-            switch (m_data[2]) {
+    std::string_view data = this->data();
+    if (data.size() >= 3 && data[0] == '\'' 
+            && data[data.size() - 1] == '\'') {
+        if (data.size() == 3) {
+            return data[1];
+        } else if (data.size() == 4 && data[1] == '\\') {
+            switch (data[2]) {
                 case 'n':
                     return '\n';
                 case 'r':
@@ -117,18 +136,18 @@ uint32_t Token::to_int() const {
                 case '\'':
                 case '\"':
                 case '\\':
-                    return m_data[2];
+                    return data[2];
                 case '0':
                     return 0;
                 default:
                     break;
             }
-        } else if (m_data.size() == 5 && m_data[1] == '\\' && m_data[2] == 'x') {
-            if (std::isxdigit(m_data[3]) && std::isxdigit(m_data[4])) {
+        } else if (data.size() == 5 && data[1] == '\\' && data[2] == 'x') {
+            if (std::isxdigit(data[3]) && std::isxdigit(data[4])) {
                 uint32_t n = 0;
                 size_t i;
                 for (i = 0; i < 2; i++) {
-                    char c = m_data[3 + i];
+                    char c = data[3 + i];
                     if (std::isdigit(c)) {
                         n = 16 * n + c - '0';
                     } else {
@@ -138,23 +157,29 @@ uint32_t Token::to_int() const {
                 return n;
             }
         }
-        throw std::runtime_error("Unrecognized char literal: " + m_data);
+        throw std::runtime_error("Unrecognized char literal: " 
+                + std::string(data));
     }
-    try {
-        return std::stoi(m_data);
-    } catch (std::exception const &e) {
+    int32_t value;
+    auto [end, error] = std::from_chars(data.data(), 
+            data.data() + data.size(), value);
+    if (error != std::errc() || end != data.data() + data.size()) {
         throw std::runtime_error(
-                "Could not convert string to int: " + m_data);
+                "Could not convert string to int: " + std::string(data));
     }
+    return value;
+}
+
+bool Token::is_synthetic(std::string_view cmp_data) const {
+    return m_type == TokenType::Synthetic && data() == cmp_data;
 }
 
-bool Token::is_synthetic(std::string const &cmp_data) const {
-    return m_type == TokenType::Synthetic && m_data == cmp_data;
+Atom Token::atom() const {
+    return m_atom;
 }
 
 std::string to_string(Token const &token) {
-    return to_string(token.m_type) + ": '" + token.m_data + "' (" 
-        + std::to_string(token.row) + ":" + std::to_string(token.col) + ")";
+    return to_string(token.m_type) + ": '" + std::string(token.data()) + "'";
 }
 
 std::ostream &operator <<(std::ostream &stream, Token const &token) {
@@ -163,49 +188,18 @@ std::ostream &operator <<(std::ostream &stream, Token const &token) {
 }
 
 bool Token::operator ==(Token const &other) const {
-    return m_type == other.m_type && m_data == other.m_data;
+    return m_type == other.m_type && data() == other.data();
 }
 
 bool Token::operator !=(Token const &other) const {
-    return m_type != other.m_type || m_data != other.m_data;
+    return !(*this == other);
 }
 
 Token::operator bool() const {
     return m_type != TokenType::Null;
 }
 
-TokenList::TokenList()
-        : m_tokens() {}
-
-Token const &TokenList::get() {
-    Token const &token = m_tokens[m_p];
-    if (m_p < m_tokens.size()) {
-        m_p++;
-    }
-    return token;
-}
-
-Token const &TokenList::peek() const {
-    return m_tokens[m_p];
-}
-
-Token const &TokenList::look_ahead(std::size_t offset) const {
-    return m_tokens[std::min(m_p + offset, m_tokens.size() - 1)];
-}
-
-std::vector<Token>::const_iterator TokenList::begin() const {
-    return m_tokens.begin();
-}
-
-std::vector<Token>::const_iterator TokenList::end() const {
-    return m_tokens.end();
-}
-
-void TokenList::add(Token token) {
-    m_tokens.push_back(token);
-}
-
-std::string tokenlist_to_string(std::vector<Token> const &tokens, 
+std::string tokenlist_to_string(std::span<Token const> tokens, 
         std::string const &sep) {
     std::string str = "";
     size_t i;
@@ -1,37 +1,19 @@
 #include "tokenizer.hpp"
-#include "utils.hpp"
 #include <cctype>
-#include <unordered_set>
+#include <algorithm>
 #include <stdexcept>
-#include <iostream>
-#include <fstream>
 
 Tokenizer::Tokenizer()
-        : m_text(), m_i(0), m_row(1), m_col(1) {}
-
-Tokenizer::Tokenizer(std::string const &filename)
-        : m_text(), m_i(0), 
-        m_row(1), m_col(1) {
-    std::string include_name = 
-            filename + (endswith(filename, ".fx") ? "" : ".fx");
-    std::ifstream file(filename);
-    if (!file) {
-        file = std::ifstream("std/" + include_name);
-    }
-    if (!file) {
-        throw std::runtime_error("Could not open file: " + filename);
-    }
-    m_text.assign(
-        (std::istreambuf_iterator<char>(file)),
-        (std::istreambuf_iterator<char>())
-    );
-}
+        : m_text(), m_atoms(nullptr), m_i(0) {}
+
+Tokenizer::Tokenizer(std::string_view text, AtomCache &atoms)
+        : m_text(text), m_atoms(&atoms), m_i(0) {}
 
 Token Tokenizer::get_token() {
     char c;
     cleanup();
     if (eof()) {
-        return Token(TokenType::EndOfFile, m_row, m_col);
+        return Token(TokenType::EndOfFile, text_from(m_i));
     }
     c = m_text[m_i];
     if (std::isalpha(c) || c == '_') {
@@ -56,16 +38,17 @@ bool Tokenizer::eof() {
     return m_i >= m_text.length();
 }
 
+Token Tokenizer::position() const {
+    return Token(TokenType::Null, m_text.substr(std::min(m_i, 
+            m_text.length()), 1));
+}
+
+char Tokenizer::current() const {
+    return m_i < m_text.length() ? m_text[m_i] : '\0';
+}
+
 void Tokenizer::next_char() {
     m_i++;
-    if (!eof()) {
-        if (m_text[m_i] == '\n') {
-            m_row++;
-            m_col = 1;
-        } else {
-            m_col++;
-        }
-    }
 }
 
 void Tokenizer::cleanup() {
@@ -89,67 +72,67 @@ void Tokenizer::cleanup() {
 }
 
 void Tokenizer::assert_no_newline() const {
-    if (m_text[m_i] == '\n' || m_text[m_i] == '\r') {
+    if (current() == '\n' || current() == '\r') {
         throw std::runtime_error("Unexpected newline");
     }
 }
 
+std::string_view Tokenizer::text_from(std::size_t start) const {
+    if (m_i - start > Token::max_size) {
+        throw std::runtime_error("Token too long");
+    }
+    return m_text.substr(start, m_i - start);
+}
+
 Token Tokenizer::get_identifier() {
-    size_t start = m_i;
-    std::string identifier;
+    std::size_t start = m_i;
     do {
         next_char();
-    } while (std::isalpha(m_text[m_i]) || std::isdigit(m_text[m_i]) || m_text[m_i] == '_');
-    identifier = m_text.substr(start, m_i - start);
-    SyntaxMap::const_iterator iter = default_syntax_map.find(identifier);
-    if (iter == default_syntax_map.end()) {
-        m_tokens.add(Token(TokenType::Identifier, identifier, m_row, m_col));
-    } else {
-        m_tokens.add(Token(iter->second, identifier, m_row, m_col));
+    } while (std::isalnum(current()) || current() == '_');
+    std::string_view identifier = text_from(start);
+    Atom atom = m_atoms->intern(identifier);
+    TokenType type = keyword_type(atom);
+    if (type != TokenType::Identifier) {
+        return Token(type, identifier);
     }
-    return m_tokens.m_tokens.back();
+    return Token(type, identifier, atom);
 }
 
 Token Tokenizer::get_intlit() {
-    size_t start = m_i;
+    std::size_t start = m_i;
     do {
         next_char();
-    } while (std::isdigit(m_text[m_i]));
-
-    m_tokens.add(Token(TokenType::IntLit, 
-            m_text.substr(start, m_i - start), m_row, m_col));
-    return m_tokens.m_tokens.back();
+    } while (std::isdigit(current()));
+    return Token(TokenType::IntLit, text_from(start));
 }
 
 Token Tokenizer::get_charlit() {
-    size_t start = m_i;
+    std::size_t start = m_i;
     do {
         next_char();
+        if (eof()) {
+            throw std::runtime_error("Unterminated char literal");
+        }
         assert_no_newline();
-    } while (m_text[m_i] != '\'');
+    } while (current() != '\'');
     next_char();
-    m_tokens.add(Token(TokenType::IntLit, 
-            m_text.substr(start, m_i - start), m_row, m_col));
-    return m_tokens.m_tokens.back();
+    return Token(TokenType::IntLit, text_from(start));
 }
 
 Token Tokenizer::get_operator() {
-    size_t start = m_i;
+    std::size_t start = m_i;
     do {
         next_char();
-    } while (is_op_char(m_text[m_i]));
-
-    m_tokens.add(Token(TokenType::Operator, 
-            m_text.substr(start, m_i - start), m_row, m_col));
-    return m_tokens.m_tokens.back();
+    } while (is_op_char(current()));
+    // Operators name the functions that implement them
+    std::string_view op = text_from(start);
+    return Token(TokenType::Operator, op, m_atoms->intern(op));
 }
 
 Token Tokenizer::get_separator() {
-    Token token(TokenType::Separator, 
-            m_text.substr(m_i, 1), m_row, m_col);
+    Token token(TokenType::Separator, m_text.substr(m_i, 1));
     next_char();
-    m_tokens.add(token);
-    return m_tokens.m_tokens.back();
+    return token;
 }
 
 bool is_op_char(char c) {
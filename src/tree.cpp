@@ -1,7 +1,11 @@
 #include "tree.hpp"
 #include "treeprinter.hpp"
+#include "irbuilder.hpp"
+#include "iremitter.hpp"
+#include "valuenumbering.hpp"
 #include "utils.hpp"
 #include <iostream>
+#include <unordered_set>
 
 AnyTypeNode Any;
 
@@ -11,11 +15,137 @@ TypeMatch weakest_match(TypeMatch m1, TypeMatch m2) {
             static_cast<int>(m2)));
 }
 
+std::size_t tree_size(BaseNode const *node) {
+    std::size_t size = 1;
+    for (BaseNode const *child : node->children()) {
+        size += tree_size(child);
+    }
+    return size;
+}
+
+bool contains_call(BaseNode const *node, SymbolId callee) {
+    CallNode const *call = dynamic_cast<CallNode const *>(node);
+    if (call != nullptr && call->overload_id() == callee) {
+        return true;
+    }
+    for (BaseNode const *child : node->children()) {
+        if (contains_call(child, callee)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void count_calls(BaseNode const *node, SymbolId callee, uint32_t &calls, 
+        uint32_t &tail_calls) {
+    CallNode const *call = dynamic_cast<CallNode const *>(node);
+    if (call != nullptr && call->overload_id() == callee) {
+        calls++;
+    }
+    if (dynamic_cast<ReturnNode const *>(node) != nullptr 
+            && !node->children().empty()) {
+        call = dynamic_cast<CallNode const *>(node->children().front());
+        if (call != nullptr && call->overload_id() == callee) {
+            tail_calls++;
+        }
+    }
+    for (BaseNode const *child : node->children()) {
+        count_calls(child, callee, calls, tail_calls);
+    }
+}
+
+// Only names of callables may be referenced, no variables
+static bool references_callables(BaseNode const *node, 
+        SymbolTable const &symbol_table) {
+    VariableNode const *variable = dynamic_cast<VariableNode const *>(node);
+    if (variable != nullptr) {
+        StorageType storage_type = 
+                symbol_table.get(variable->id()).storage_type;
+        return storage_type == StorageType::Callable 
+                || storage_type == StorageType::Intrinsic;
+    }
+    for (BaseNode const *child : node->children()) {
+        if (!references_callables(child, symbol_table)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The purity of a node covers the nodes below it
+bool is_constant(BaseNode const *node, SymbolTable const &symbol_table) {
+    return references_callables(node, symbol_table) 
+            && node->is_pure(symbol_table);
+}
+
+std::optional<uint32_t> speculation_cost(BaseNode const *node, 
+        SymbolTable const &symbol_table, bool inline_args) {
+    if (auto variable = dynamic_cast<VariableNode const *>(node)) {
+        if (symbol_table.get(variable->id()).storage_type 
+                != StorageType::InlineReference) {
+            return 1;
+        }
+        return inline_args ? std::optional<uint32_t>(0) : std::nullopt;
+    }
+    if (dynamic_cast<LiteralNode const *>(node) != nullptr) {
+        return 1;
+    }
+    CallNode const *call = dynamic_cast<CallNode const *>(node);
+    if (call == nullptr) {
+        return std::nullopt;
+    }
+    uint32_t cost = 0;
+    for (auto const &arg : call->args()) {
+        std::optional<uint32_t> arg_cost = 
+                speculation_cost(arg, symbol_table, inline_args);
+        if (!arg_cost.has_value()) {
+            return std::nullopt;
+        }
+        cost += arg_cost.value();
+    }
+    SymbolEntry const &entry = symbol_table.get(call->func()->id());
+    if (entry.storage_type == StorageType::Intrinsic) {
+        IntrinsicEntry const &intrinsic = intrinsics[entry.value];
+        if (intrinsic.opcode == OpCode::SysCall 
+                || intrinsic.funccode == FuncCode::Div 
+                || intrinsic.funccode == FuncCode::Mod) {
+            return std::nullopt;
+        }
+        return cost + 1;
+    }
+    if (entry.storage_type != StorageType::Callable) {
+        return std::nullopt;
+    }
+    auto inline_function = dynamic_cast<InlineNode const *>(
+            symbol_table.get(call->overload_id()).definition);
+    if (inline_function == nullptr || inline_function->writeback()) {
+        return std::nullopt;
+    }
+    // Parameters of the body stand for the arguments counted above
+    std::optional<uint32_t> body_cost = 
+            speculation_cost(inline_function->body(), symbol_table, true);
+    if (!body_cost.has_value()) {
+        return std::nullopt;
+    }
+    return cost + body_cost.value();
+}
+
+void collect_address_taken(BaseNode const *node, 
+        std::unordered_set<SymbolId> &ids) {
+    if (auto address = dynamic_cast<AddressOfNode const *>(node)) {
+        if (auto target = dynamic_cast<VariableNode const *>(
+                address->operand())) {
+            ids.insert(target->id());
+        }
+    }
+    for (BaseNode const *child : node->children()) {
+        collect_address_taken(child, ids);
+    }
+}
+
 BaseNode::BaseNode(Token token)
         : m_token(token), m_id(0) {}
 
-BaseNode::~BaseNode() {}
-
 bool BaseNode::is_lvalue() const {
     return false;
 }
@@ -26,8 +156,29 @@ std::optional<uint32_t> BaseNode::get_constant_value() const {
     return std::nullopt;
 }
 
+std::vector<BaseNode *> BaseNode::children() const {
+    return {};
+}
+
+bool BaseNode::is_pure(SymbolTable const &symbol_table) const {
+    for (BaseNode const *child : children()) {
+        if (!child->is_pure(symbol_table)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+IrInstr *BaseNode::lower(IrBuilder &) const {
+    throw std::runtime_error("Cannot lower " + label() + " to IR");
+}
+
+IrLvalue BaseNode::lower_lvalue(IrBuilder &) const {
+    throw std::runtime_error("Cannot lower address of " + label() + " to IR");
+}
+
 std::string BaseNode::label() const {
-    return m_token.data();
+    return std::string(m_token.data());
 }
 
 Token BaseNode::token() const {
@@ -43,14 +194,22 @@ SymbolId BaseNode::id() const {
 }
 
 TypeNode::TypeNode(Token token)
-        : BaseNode(token) {}
+        : BaseNode(token), m_type_id(no_type) {}
 
-void TypeNode::resolve_globals(SymbolTable &, SymbolMap &) {}
+void TypeNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
 
 void TypeNode::resolve_types(SymbolTable &) {}
 
 void TypeNode::serialize(Serializer &) const {}
 
+TypeId TypeNode::type_id() const {
+    return m_type_id;
+}
+
+void TypeNode::set_type_id(TypeId id) const {
+    m_type_id = id;
+}
+
 std::string to_string(TypeNode const *node) {
     if (node == nullptr) {
         return "(null)";
@@ -78,6 +237,10 @@ TypeNode const *AnyTypeNode::pointed_type() const {
     return this;
 }
 
+std::string AnyTypeNode::type_key(TypeTable &) const {
+    return "A";
+}
+
 void AnyTypeNode::print(TreePrinter &printer) const {
     printer.print_node(this);
 }
@@ -89,8 +252,9 @@ std::string AnyTypeNode::type_string() const {
 NamedTypeNode::NamedTypeNode(Token ident)
         : TypeNode(ident) {}
 
-void NamedTypeNode::resolve_locals(SymbolTable &, ScopeTracker &scopes) {
-    set_id(lookup_symbol(token().data(), scopes));
+void NamedTypeNode::resolve_locals(SymbolTable &symbol_table, 
+        ScopeTracker &scopes) {
+    set_id(symbol_table.lookup(token().atom(), scopes));
 }
 
 TypeMatch NamedTypeNode::matching(TypeNode const *node) const {
@@ -105,11 +269,17 @@ TypeMatch NamedTypeNode::matching(TypeNode const *node) const {
 }
 
 TypeNode const *NamedTypeNode::called_type() const {
-    throw std::runtime_error("Cannot call '" + token().data() + "'");
+    throw std::runtime_error("Cannot call '" + std::string(token().data()) 
+            + "'");
 }
 
 TypeNode const *NamedTypeNode::pointed_type() const {
-    throw std::runtime_error("No pointed type for '" + token().data() + "'");
+    throw std::runtime_error("No pointed type for '" 
+            + std::string(token().data()) + "'");
+}
+
+std::string NamedTypeNode::type_key(TypeTable &) const {
+    return "N" + to_string(token());
 }
 
 void NamedTypeNode::print(TreePrinter &printer) const {
@@ -117,7 +287,7 @@ void NamedTypeNode::print(TreePrinter &printer) const {
 }
 
 std::string NamedTypeNode::type_string() const {
-    return token().data();
+    return std::string(token().data());
 }
 
 PointerTypeNode::PointerTypeNode()
@@ -125,12 +295,14 @@ PointerTypeNode::PointerTypeNode()
         m_pointed_type_internal(&Any) {}
 
 PointerTypeNode::PointerTypeNode(Token token, 
-        std::unique_ptr<TypeNode> pointed_type)
-        : TypeNode(token), m_pointed_type(std::move(pointed_type)), 
-        m_pointed_type_internal(m_pointed_type.get()) {}
+        TypeNode *pointed_type)
+        : TypeNode(token), m_pointed_type(pointed_type), 
+        m_pointed_type_internal(m_pointed_type) {}
 
+// The type changes, so it is interned anew
 void PointerTypeNode::set_internal(TypeNode *pointed_type_internal) {
     m_pointed_type_internal = pointed_type_internal;
+    set_type_id(no_type);
 }
 
 void PointerTypeNode::resolve_locals(SymbolTable &symbol_table, 
@@ -161,6 +333,10 @@ TypeNode const *PointerTypeNode::pointed_type() const {
     return m_pointed_type_internal;
 }
 
+std::string PointerTypeNode::type_key(TypeTable &types) const {
+    return "P" + std::to_string(types.intern(m_pointed_type_internal));
+}
+
 void PointerTypeNode::print(TreePrinter &printer) const {
     printer.print_node(this);
     printer.last_child(m_pointed_type_internal);
@@ -170,10 +346,10 @@ std::string PointerTypeNode::type_string() const {
     return m_pointed_type_internal->type_string() + "*";
 }
 
-ArrayTypeNode::ArrayTypeNode(Token token, std::unique_ptr<TypeNode> array_type,
-        std::unique_ptr<ExpressionNode> size) 
-        : TypeNode(token), m_array_type(std::move(array_type)), 
-        m_size(std::move(size)) {}
+ArrayTypeNode::ArrayTypeNode(Token token, TypeNode *array_type,
+        ExpressionNode *size) 
+        : TypeNode(token), m_array_type(array_type), 
+        m_size(size) {}
 
 void ArrayTypeNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -200,22 +376,27 @@ TypeNode const *ArrayTypeNode::called_type() const {
 }
 
 TypeNode const *ArrayTypeNode::pointed_type() const {
-    return m_array_type.get();
+    return m_array_type;
+}
+
+// The size is left out, as it does not change what the array matches
+std::string ArrayTypeNode::type_key(TypeTable &types) const {
+    return "R" + std::to_string(types.intern(m_array_type));
 }
 
 void ArrayTypeNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_array_type.get());
-    printer.last_child(m_size.get());
+    printer.next_child(m_array_type);
+    printer.last_child(m_size);
 }
 
 std::string ArrayTypeNode::type_string() const {
     return m_array_type->type_string() + "[" + "(N)" + "]";
 }
 
-TypeListNode::TypeListNode(std::vector<std::unique_ptr<TypeNode>> type_list)
+TypeListNode::TypeListNode(NodeList<TypeNode> type_list)
         : TypeNode(Token::synthetic("<type-list>")), 
-        m_type_list(std::move(type_list)) {}
+        m_type_list(type_list) {}
 
 void TypeListNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -237,7 +418,7 @@ TypeMatch TypeListNode::matching(TypeNode const *node) const {
     TypeMatch match = TypeMatch::ExactMatch;
     for (std::size_t i = 0; i < list().size(); i++) {
         match = weakest_match(match, 
-                list()[i]->matching(other->list()[i].get()));
+                list()[i]->matching(other->list()[i]));
     }
     return match;
 }
@@ -250,25 +431,33 @@ TypeNode const *TypeListNode::pointed_type() const {
     throw std::runtime_error("No pointed type for typelist");
 }
 
+std::string TypeListNode::type_key(TypeTable &types) const {
+    std::string key = "L";
+    for (auto const &entry : m_type_list) {
+        key += std::to_string(types.intern(entry)) + ",";
+    }
+    return key;
+}
+
 void TypeListNode::print(TreePrinter &printer) const {
     printer.print_node(this);
     for (auto const &entry : m_type_list) {
         if (entry == m_type_list.back()) {
-            printer.last_child(entry.get());
+            printer.last_child(entry);
         } else {
-            printer.next_child(entry.get());
+            printer.next_child(entry);
         }
     }
 }
 
-std::vector<std::unique_ptr<TypeNode>> const &TypeListNode::list() const {
+NodeList<TypeNode> TypeListNode::list() const {
     return m_type_list;
 }
 
 std::string TypeListNode::type_string() const {
     std::string str = "(";
     for (auto const &entry : m_type_list) {
-        str += to_string(entry.get());
+        str += to_string(entry);
         if (entry != m_type_list.back()) {
             str += ", ";
         }
@@ -277,10 +466,10 @@ std::string TypeListNode::type_string() const {
 }
 
 CallableTypeNode::CallableTypeNode(Token token, 
-        std::unique_ptr<TypeListNode> param_types, 
-        std::unique_ptr<TypeNode> return_type)
-        : TypeNode(token), m_param_types(std::move(param_types)), 
-        m_return_type(std::move(return_type)) {}
+        TypeListNode *param_types, 
+        TypeNode *return_type)
+        : TypeNode(token), m_param_types(param_types), 
+        m_return_type(return_type) {}
 
 void CallableTypeNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -299,45 +488,73 @@ TypeMatch CallableTypeNode::matching(TypeNode const *node) const {
 }
 
 TypeNode const *CallableTypeNode::called_type() const {
-    return m_return_type.get();
+    return m_return_type;
 }
 
 TypeNode const *CallableTypeNode::pointed_type() const {
     throw std::runtime_error("No pointed type for callable type");
 }
 
+std::string CallableTypeNode::type_key(TypeTable &types) const {
+    return "C" + std::to_string(types.intern(m_param_types)) + ","
+            + std::to_string(types.intern(m_return_type));
+}
+
 void CallableTypeNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_param_types.get());
-    printer.last_child(m_return_type.get());
+    printer.next_child(m_param_types);
+    printer.last_child(m_return_type);
 }
 
 std::string CallableTypeNode::type_string() const {
-    return to_string(m_param_types.get()) 
-            + " -> " + to_string(m_return_type.get());
+    return to_string(m_param_types) 
+            + " -> " + to_string(m_return_type);
 }
 
 TypeListNode *CallableTypeNode::param_types() const {
-    return m_param_types.get();
+    return m_param_types;
 }
 
 TypeNode *CallableTypeNode::return_type() const {
-    return m_return_type.get();
+    return m_return_type;
 }
 
-CallableSignature::CallableSignature(std::vector<Token> params, 
-        std::unique_ptr<CallableTypeNode> type)
-        : params(params), type(std::move(type)) {}
+CallableSignature::CallableSignature(std::span<Token const> params, 
+        CallableTypeNode *type)
+        : params(params), type(type) {}
 
 ExpressionNode::ExpressionNode(Token token, TypeNode *type)
         : BaseNode(token), m_type(type) {}
 
-void ExpressionNode::resolve_globals(SymbolTable &, SymbolMap &) {}
+void ExpressionNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
+
+void ExpressionNode::serialize_branch(Serializer &serializer, Label target, 
+        bool when) const {
+    std::optional<uint32_t> value = get_constant_value();
+    if (value.has_value()) {
+        if ((value.value() != 0) == when) {
+            serializer.add_instr(OpCode::Jump, target, true);
+        }
+        return;
+    }
+    serialize(serializer);
+    serializer.add_instr(when ? OpCode::BrTrue : OpCode::BrFalse, target, 
+            true);
+}
+
+void ExpressionNode::lower_branch(IrBuilder &builder, IrBlock *case_true, 
+        IrBlock *case_false) const {
+    builder.branch(lower(builder), case_true, case_false);
+}
 
 TypeNode *ExpressionNode::type() const {
     return m_type;
 }
 
+void ExpressionNode::set_type(TypeNode *type) {
+    m_type = type;
+}
+
 StatementNode::StatementNode(Token token)
         : BaseNode(token) {}
 
@@ -348,8 +565,9 @@ bool VariableNode::is_lvalue() const {
     return true;
 }
 
-void VariableNode::resolve_locals(SymbolTable &, ScopeTracker &scopes) {
-    set_id(lookup_symbol(token().data(), scopes));
+void VariableNode::resolve_locals(SymbolTable &symbol_table, 
+        ScopeTracker &scopes) {
+    set_id(symbol_table.lookup(token().atom(), scopes));
 }
 
 void VariableNode::resolve_types(SymbolTable &symbol_table) {
@@ -360,16 +578,23 @@ void VariableNode::serialize(Serializer &serializer) const {
     SymbolEntry const &entry = serializer.symbol_table().get(id());
     switch (entry.storage_type) {
         case StorageType::AbsoluteRef:
+            serializer.mark_address_taken();
             serializer.add_instr(OpCode::Push, entry.id, true);
             break;
         case StorageType::RelativeRef:
-            serializer.add_instr(OpCode::LoadAddrRel, entry.value);
+            serializer.add_instr(OpCode::LoadAddrRel, 
+                    serializer.frame_offset(entry));
             break;
         case StorageType::Absolute:
             serializer.add_instr(OpCode::LoadAbs, entry.id, true);
             break;
         case StorageType::Relative:
-            serializer.add_instr(OpCode::LoadRel, entry.value);
+            if (auto index = serializer.frame_register(entry.id)) {
+                serializer.add_counted_instr(OpCode::LoadReg, index.value());
+                break;
+            }
+            serializer.add_instr(OpCode::LoadRel, 
+                    serializer.frame_offset(entry));
             break;
         case StorageType::Callable:
             serializer.push_callable_addr(entry.id);
@@ -393,7 +618,11 @@ void VariableNode::serialize_load_address(Serializer &serializer) const {
             serializer.add_instr(OpCode::Push, entry.id, true);
             break;
         case StorageType::Relative:
-            serializer.add_instr(OpCode::LoadAddrRel, entry.value);
+            if (serializer.frame_register(entry.id).has_value()) {
+                throw std::runtime_error("Cannot load address of register");
+            }
+            serializer.add_instr(OpCode::LoadAddrRel, 
+                    serializer.frame_offset(entry));
             break;
         case StorageType::InlineReference:
             serializer.inline_frames().use_address(serializer, entry.id);
@@ -403,6 +632,67 @@ void VariableNode::serialize_load_address(Serializer &serializer) const {
     }
 }
 
+IrInstr *VariableNode::lower(IrBuilder &builder) const {
+    SymbolTable const &symbol_table = builder.symbol_table();
+    SymbolEntry const &entry = symbol_table.get(id());
+    std::vector<SymbolId> callable;
+    switch (entry.storage_type) {
+        case StorageType::AbsoluteRef:
+            return builder.emit(IrOp::GlobalAddr, FuncCode::Nop, entry.id);
+        case StorageType::RelativeRef:
+            return builder.emit(IrOp::FrameAddr, FuncCode::Nop, entry.value);
+        case StorageType::Absolute:
+        case StorageType::Relative:
+            return builder.load(builder.variable_lvalue(entry.id));
+        case StorageType::Callable:
+            callable = symbol_table.callable(entry.id);
+            if (callable.size() != 1) {
+                throw std::runtime_error(
+                        "Can only reference single implementation");
+            }
+            if (symbol_table.get(callable.front()).storage_type 
+                    != StorageType::AbsoluteRef) {
+                throw std::runtime_error("Can only reference function");
+            }
+            return builder.emit(IrOp::FuncAddr, FuncCode::Nop, 
+                    callable.front());
+        case StorageType::InlineReference:
+            return builder.lower_param(entry.id);
+        default:
+            throw std::runtime_error("Invalid storage type");
+    }
+}
+
+IrLvalue VariableNode::lower_lvalue(IrBuilder &builder) const {
+    SymbolEntry const &entry = builder.symbol_table().get(id());
+    switch (entry.storage_type) {
+        case StorageType::AbsoluteRef:
+        case StorageType::RelativeRef:
+            throw std::runtime_error("Cannot load address of reference");
+        case StorageType::Absolute:
+        case StorageType::Relative:
+            return builder.variable_lvalue(entry.id);
+        case StorageType::InlineReference:
+            return builder.lower_param_lvalue(entry.id);
+        default:
+            throw std::runtime_error("Invalid storage type");
+    }
+}
+
+bool VariableNode::is_pure(SymbolTable const &symbol_table) const {
+    SymbolEntry const &entry = symbol_table.get(id());
+    switch (entry.storage_type) {
+        case StorageType::Absolute:
+            return false;
+        case StorageType::AbsoluteRef:
+            // Global arrays, as opposed to function addresses
+            return dynamic_cast<VarDeclarationNode *>(entry.definition) 
+                    == nullptr;
+        default:
+            return true;
+    }
+}
+
 void VariableNode::print(TreePrinter &printer) const {
     printer.print_node(this);
 }
@@ -426,6 +716,10 @@ void IntegerLiteralNode::serialize(Serializer &serializer) const {
     serializer.add_instr(OpCode::Push, m_value);
 }
 
+IrInstr *IntegerLiteralNode::lower(IrBuilder &builder) const {
+    return builder.constant(m_value);
+}
+
 TrueLiteralNode::TrueLiteralNode(Token token, TypeNode *type)
         : LiteralNode(token, type) {
 }
@@ -434,6 +728,10 @@ void TrueLiteralNode::serialize(Serializer &serializer) const {
     serializer.add_instr(OpCode::Push, 1);
 }
 
+IrInstr *TrueLiteralNode::lower(IrBuilder &builder) const {
+    return builder.constant(1);
+}
+
 FalseLiteralNode::FalseLiteralNode(Token token, TypeNode *type)
         : LiteralNode(token, type) {
 }
@@ -442,18 +740,22 @@ void FalseLiteralNode::serialize(Serializer &serializer) const {
     serializer.add_instr(OpCode::Push, false);
 }
 
+IrInstr *FalseLiteralNode::lower(IrBuilder &builder) const {
+    return builder.constant(0);
+}
+
 std::optional<uint32_t> IntegerLiteralNode::get_constant_value() const {
     return m_value;
 }
 
 UnaryExpressionNode::UnaryExpressionNode(Token token, 
-        std::unique_ptr<ExpressionNode> operand)
+        ExpressionNode *operand)
         : ExpressionNode(token), 
-        m_operand(std::move(operand)) {}
+        m_operand(operand) {}
 
 void UnaryExpressionNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.last_child(m_operand.get());
+    printer.last_child(m_operand);
 }
 
 void UnaryExpressionNode::resolve_locals(SymbolTable &symbol_table, 
@@ -461,9 +763,17 @@ void UnaryExpressionNode::resolve_locals(SymbolTable &symbol_table,
     m_operand->resolve_locals(symbol_table, scopes);
 }
 
+std::vector<BaseNode *> UnaryExpressionNode::children() const {
+    return {m_operand};
+}
+
+ExpressionNode *UnaryExpressionNode::operand() const {
+    return m_operand;
+}
+
 AddressOfNode::AddressOfNode(Token token, 
-        std::unique_ptr<ExpressionNode> operand)
-        : UnaryExpressionNode(token, std::move(operand)) {}
+        ExpressionNode *operand)
+        : UnaryExpressionNode(token, operand) {}
 
 void AddressOfNode::resolve_types(SymbolTable &symbol_table) {
     m_operand->resolve_types(symbol_table);
@@ -472,12 +782,17 @@ void AddressOfNode::resolve_types(SymbolTable &symbol_table) {
 }
 
 void AddressOfNode::serialize(Serializer &serializer) const {
+    serializer.mark_address_taken();
     m_operand->serialize_load_address(serializer);
 }
 
+IrInstr *AddressOfNode::lower(IrBuilder &builder) const {
+    return builder.address_of(m_operand->lower_lvalue(builder));
+}
+
 DereferenceNode::DereferenceNode(Token token, 
-        std::unique_ptr<ExpressionNode> operand)
-        : UnaryExpressionNode(token, std::move(operand)) {}
+        ExpressionNode *operand)
+        : UnaryExpressionNode(token, operand) {}
 
 bool DereferenceNode::is_lvalue() const {
     return true;
@@ -489,19 +804,35 @@ void DereferenceNode::resolve_types(SymbolTable &symbol_table) {
 }
 
 void DereferenceNode::serialize(Serializer &serializer) const {
+    if (serializer.load_value(this)) {
+        return;
+    }
     m_operand->serialize(serializer);
     serializer.add_instr(OpCode::LoadAbs);
+    serializer.store_value(this);
 }
 
 void DereferenceNode::serialize_load_address(Serializer &serializer) const {
     m_operand->serialize(serializer);
 }
 
+IrInstr *DereferenceNode::lower(IrBuilder &builder) const {
+    return builder.load(lower_lvalue(builder));
+}
+
+IrLvalue DereferenceNode::lower_lvalue(IrBuilder &builder) const {
+    return {0, m_operand->lower(builder)};
+}
+
+bool DereferenceNode::is_pure(SymbolTable const &) const {
+    return false;
+}
+
 BinaryExpressionNode::BinaryExpressionNode(Token token, 
-        std::unique_ptr<ExpressionNode> left, 
-        std::unique_ptr<ExpressionNode> right)
+        ExpressionNode *left, 
+        ExpressionNode *right)
         : ExpressionNode(token), 
-        m_left(std::move(left)), m_right(std::move(right)) {}
+        m_left(left), m_right(right) {}
 
 void BinaryExpressionNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -509,16 +840,28 @@ void BinaryExpressionNode::resolve_locals(SymbolTable &symbol_table,
     m_right->resolve_locals(symbol_table, scopes);
 }
 
+std::vector<BaseNode *> BinaryExpressionNode::children() const {
+    return {m_left, m_right};
+}
+
+ExpressionNode *BinaryExpressionNode::left() const {
+    return m_left;
+}
+
+ExpressionNode *BinaryExpressionNode::right() const {
+    return m_right;
+}
+
 void BinaryExpressionNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_left.get());
-    printer.last_child(m_right.get());
+    printer.next_child(m_left);
+    printer.last_child(m_right);
 }
 
 AssignNode::AssignNode(Token token, 
-        std::unique_ptr<ExpressionNode> left, 
-        std::unique_ptr<ExpressionNode> right)
-        : BinaryExpressionNode(token, std::move(left), std::move(right)) {
+        ExpressionNode *left, 
+        ExpressionNode *right)
+        : BinaryExpressionNode(token, left, right) {
     if (!m_left->is_lvalue()) {
         throw std::runtime_error("Expected lvalue as assignment target");
     }
@@ -531,14 +874,39 @@ void AssignNode::resolve_types(SymbolTable &symbol_table) {
 }
 
 void AssignNode::serialize(Serializer &serializer) const {
+    auto variable = dynamic_cast<VariableNode const *>(m_left);
+    SymbolEntry const *entry = variable == nullptr ? nullptr 
+            : &serializer.symbol_table().get(variable->id());
+    if (entry != nullptr && entry->storage_type == StorageType::Relative) {
+        // Stored directly, as the address is not needed for the result
+        m_right->serialize(serializer);
+        if (auto index = serializer.frame_register(entry->id)) {
+            serializer.add_counted_instr(OpCode::StoreReg, index.value());
+            serializer.add_counted_instr(OpCode::LoadReg, index.value());
+        } else {
+            uint32_t offset = serializer.frame_offset(*entry);
+            serializer.add_instr(OpCode::StoreRel, offset);
+            serializer.add_instr(OpCode::LoadRel, offset);
+        }
+        serializer.store_value(this);
+        return;
+    }
     m_left->serialize_load_address(serializer);
     m_right->serialize(serializer);
     serializer.add_instr(OpCode::Binary, FuncCode::Assign);
+    serializer.store_value(this);
+}
+
+IrInstr *AssignNode::lower(IrBuilder &builder) const {
+    IrLvalue target = m_left->lower_lvalue(builder);
+    IrInstr *value = m_right->lower(builder);
+    builder.store(target, value);
+    return value;
 }
 
-AndNode::AndNode(Token token, std::unique_ptr<ExpressionNode> left, 
-        std::unique_ptr<ExpressionNode> right, TypeNode *type)
-        : BinaryExpressionNode(token, std::move(left), std::move(right)) {
+AndNode::AndNode(Token token, ExpressionNode *left, 
+        ExpressionNode *right, TypeNode *type)
+        : BinaryExpressionNode(token, left, right) {
     m_type = type;
 }
 
@@ -551,11 +919,7 @@ void AndNode::serialize(Serializer &serializer) const {
     Label label_false = serializer.get_label();
     Label label_end = serializer.get_label();
 
-    m_left->serialize(serializer);
-    serializer.add_instr(OpCode::BrFalse, label_false, true);
-
-    m_right->serialize(serializer);
-    serializer.add_instr(OpCode::BrFalse, label_false, true);
+    serialize_branch(serializer, label_false, false);
     serializer.add_instr(OpCode::Push, 1);
     serializer.add_instr(OpCode::Jump, label_end, true);
 
@@ -565,11 +929,53 @@ void AndNode::serialize(Serializer &serializer) const {
     serializer.add_label(label_end);
 }
 
+void AndNode::serialize_branch(Serializer &serializer, Label target, 
+        bool when) const {
+    if (!when) {
+        m_left->serialize_branch(serializer, target, false);
+        m_right->serialize_branch(serializer, target, false);
+        return;
+    }
+    Label label_false = serializer.get_label();
+    m_left->serialize_branch(serializer, label_false, false);
+    m_right->serialize_branch(serializer, target, true);
+    serializer.add_label(label_false);
+}
+
+IrInstr *AndNode::lower(IrBuilder &builder) const {
+    IrInstr *zero = builder.constant(0);
+    IrInstr *left = m_left->lower(builder);
+    IrBlock *right_block = builder.new_block();
+    IrBlock *end = builder.new_block();
+    builder.branch(left, right_block, end);
+
+    builder.seal(right_block);
+    builder.set_block(right_block);
+    IrInstr *right = m_right->lower(builder);
+    right = builder.emit(IrOp::Binary, FuncCode::NotEquals, 0, 
+            {right, zero});
+    builder.jump(end);
+
+    builder.seal(end);
+    builder.set_block(end);
+    return builder.phi(end, {zero, right});
+}
+
+void AndNode::lower_branch(IrBuilder &builder, IrBlock *case_true, 
+        IrBlock *case_false) const {
+    IrBlock *right_block = builder.new_block();
+    m_left->lower_branch(builder, right_block, case_false);
+
+    builder.seal(right_block);
+    builder.set_block(right_block);
+    m_right->lower_branch(builder, case_true, case_false);
+}
+
 OrNode::OrNode(Token token, 
-        std::unique_ptr<ExpressionNode> left, 
-        std::unique_ptr<ExpressionNode> right,
+        ExpressionNode *left, 
+        ExpressionNode *right,
         TypeNode *type)
-        : BinaryExpressionNode(token, std::move(left), std::move(right)) {
+        : BinaryExpressionNode(token, left, right) {
     m_type = type;
 }
 
@@ -582,11 +988,7 @@ void OrNode::serialize(Serializer &serializer) const {
     Label label_true = serializer.get_label();
     Label label_end = serializer.get_label();
 
-    m_left->serialize(serializer);
-    serializer.add_instr(OpCode::BrTrue, label_true, true);
-
-    m_right->serialize(serializer);
-    serializer.add_instr(OpCode::BrTrue, label_true, true);
+    serialize_branch(serializer, label_true, true);
     serializer.add_instr(OpCode::Push, 0);
     serializer.add_instr(OpCode::Jump, label_end, true);
 
@@ -596,11 +998,54 @@ void OrNode::serialize(Serializer &serializer) const {
     serializer.add_label(label_end);
 }
 
+void OrNode::serialize_branch(Serializer &serializer, Label target, 
+        bool when) const {
+    if (when) {
+        m_left->serialize_branch(serializer, target, true);
+        m_right->serialize_branch(serializer, target, true);
+        return;
+    }
+    Label label_true = serializer.get_label();
+    m_left->serialize_branch(serializer, label_true, true);
+    m_right->serialize_branch(serializer, target, false);
+    serializer.add_label(label_true);
+}
+
+IrInstr *OrNode::lower(IrBuilder &builder) const {
+    IrInstr *zero = builder.constant(0);
+    IrInstr *one = builder.constant(1);
+    IrInstr *left = m_left->lower(builder);
+    IrBlock *right_block = builder.new_block();
+    IrBlock *end = builder.new_block();
+    builder.branch(left, end, right_block);
+
+    builder.seal(right_block);
+    builder.set_block(right_block);
+    IrInstr *right = m_right->lower(builder);
+    right = builder.emit(IrOp::Binary, FuncCode::NotEquals, 0, 
+            {right, zero});
+    builder.jump(end);
+
+    builder.seal(end);
+    builder.set_block(end);
+    return builder.phi(end, {one, right});
+}
+
+void OrNode::lower_branch(IrBuilder &builder, IrBlock *case_true, 
+        IrBlock *case_false) const {
+    IrBlock *right_block = builder.new_block();
+    m_left->lower_branch(builder, case_true, right_block);
+
+    builder.seal(right_block);
+    builder.set_block(right_block);
+    m_right->lower_branch(builder, case_true, case_false);
+}
+
 SubscriptNode::SubscriptNode(
-        std::unique_ptr<ExpressionNode> left, 
-        std::unique_ptr<ExpressionNode> right)
+        ExpressionNode *left, 
+        ExpressionNode *right)
         : BinaryExpressionNode(Token::synthetic("<subscript>"), 
-        std::move(left), std::move(right)) {}
+        left, right) {}
 
 bool SubscriptNode::is_lvalue() const {
     return true;
@@ -613,44 +1058,60 @@ void SubscriptNode::resolve_types(SymbolTable &symbol_table) {
 }
 
 void SubscriptNode::serialize(Serializer &serializer) const {
+    if (serializer.load_value(this)) {
+        return;
+    }
     serialize_load_address(serializer);
     serializer.add_instr(OpCode::LoadAbs);
+    serializer.store_value(this);
 }
 
 void SubscriptNode::serialize_load_address(Serializer &serializer) const {
+    if (serializer.load_hoisted(this)) {
+        return;
+    }
     m_left->serialize(serializer);
     m_right->serialize(serializer);
     serializer.add_instr(OpCode::Binary, FuncCode::Add);
 }
 
+IrInstr *SubscriptNode::lower(IrBuilder &builder) const {
+    return builder.load(lower_lvalue(builder));
+}
+
+IrLvalue SubscriptNode::lower_lvalue(IrBuilder &builder) const {
+    IrInstr *array = m_left->lower(builder);
+    IrInstr *index = m_right->lower(builder);
+    return {0, builder.emit(IrOp::Binary, FuncCode::Add, 0, {array, index})};
+}
+
+bool SubscriptNode::is_pure(SymbolTable const &) const {
+    return false;
+}
+
 CallNode::CallNode(
-        std::unique_ptr<ExpressionNode> func, 
-        std::unique_ptr<ExpressionListNode> args)
-        : ExpressionNode(Token::synthetic("<call>")), m_func(std::move(func)), 
-        m_args(std::move(args)), m_overload_id(0) {}
+        ExpressionNode *func, 
+        ExpressionListNode *args)
+        : ExpressionNode(Token::synthetic("<call>")), m_func(func), 
+        m_args(args), m_overload_id(0) {}
 
-std::unique_ptr<CallNode> CallNode::make_call(Token ident, 
-        std::vector<std::unique_ptr<ExpressionNode>> params) {
-    return std::make_unique<CallNode>(
-            std::make_unique<VariableNode>(ident), 
-            std::make_unique<ExpressionListNode>(
-                Token::synthetic("<params>"), std::move(params)));
+CallNode *CallNode::make_call(Arena &arena, Token ident, 
+        NodeList<ExpressionNode> params) {
+    return arena.make<CallNode>(arena.make<VariableNode>(ident), 
+            arena.make<ExpressionListNode>(
+                Token::synthetic("<params>"), arena.copy(params)));
 }
 
-std::unique_ptr<CallNode> CallNode::make_unary_call(Token ident, 
-        std::unique_ptr<ExpressionNode> param) {
-    std::vector<std::unique_ptr<ExpressionNode>> params;
-    params.push_back(std::move(param));
-    return CallNode::make_call(ident, std::move(params));
+CallNode *CallNode::make_unary_call(Arena &arena, Token ident, 
+        ExpressionNode *param) {
+    ExpressionNode *params[] = {param};
+    return CallNode::make_call(arena, ident, params);
 }
 
-std::unique_ptr<CallNode> CallNode::make_binary_call(Token ident, 
-        std::unique_ptr<ExpressionNode> left, 
-        std::unique_ptr<ExpressionNode> right) {
-    std::vector<std::unique_ptr<ExpressionNode>> params;
-    params.push_back(std::move(left));
-    params.push_back(std::move(right));
-    return CallNode::make_call(ident, std::move(params));
+CallNode *CallNode::make_binary_call(Arena &arena, Token ident, 
+        ExpressionNode *left, ExpressionNode *right) {
+    ExpressionNode *params[] = {left, right};
+    return CallNode::make_call(arena, ident, params);
 }
 
 void CallNode::resolve_locals(SymbolTable &symbol_table, 
@@ -662,6 +1123,11 @@ void CallNode::resolve_locals(SymbolTable &symbol_table,
 void CallNode::resolve_types(SymbolTable &symbol_table) {
     m_func->resolve_types(symbol_table);
     m_args->resolve_types(symbol_table);
+    if (m_args->exprs().size() > max_count) {
+        throw std::runtime_error("Too many arguments in call: " 
+                + std::to_string(m_args->exprs().size()) + ", at most " 
+                + std::to_string(max_count));
+    }
 
     SymbolEntry const &entry = symbol_table.get(m_func->id());
     
@@ -670,12 +1136,13 @@ void CallNode::resolve_types(SymbolTable &symbol_table) {
         return;
     }
 
-    SymbolId candidates[3] = {};
-    bool multiple[3] = {};
+    SymbolId candidates[4] = {};
+    bool multiple[4] = {};
 
     for (auto const &id : symbol_table.callable(entry.id)) {
         CallableNode *node = dynamic_cast<CallableNode *>(symbol_table.get(id).definition);
-        TypeMatch match = node->is_matching_call(m_args->exprs());
+        TypeMatch match = node->is_matching_call(symbol_table.types(),
+                m_args->exprs());
         std::size_t index = static_cast<std::size_t>(match);
         if (candidates[index]) {
             multiple[index] = true;
@@ -685,13 +1152,13 @@ void CallNode::resolve_types(SymbolTable &symbol_table) {
         }
     }
     
-    for (std::size_t i = 3; i > 1; i--) {
-        std::size_t index = i - 1;
+    for (std::size_t index = 3; index > 0; index--) {
         if (candidates[index]) {
             if (multiple[index]) {
                 throw std::runtime_error("Multiple candidates for call");
             }
             m_overload_id = candidates[index];
+            break;
         }
     }
 
@@ -704,6 +1171,13 @@ void CallNode::resolve_types(SymbolTable &symbol_table) {
 }
 
 void CallNode::serialize(Serializer &serializer) const {
+    if (serializer.load_value(this)) {
+        return;
+    }
+    if (serializer.load_hoisted(this)) {
+        serializer.store_value(this);
+        return;
+    }
     SymbolEntry const &entry = serializer.symbol_table().get(m_func->id());
     IntrinsicEntry intrinsic;
     switch (entry.storage_type) {
@@ -721,24 +1195,131 @@ void CallNode::serialize(Serializer &serializer) const {
             break;
         default:
             m_args->serialize(serializer);
-            serializer.add_instr(OpCode::Push, m_args->exprs().size());
             m_func->serialize(serializer);
-            serializer.add_instr(OpCode::Call);
+            serializer.add_counted_instr(OpCode::Call, m_args->exprs().size());
+    }
+    serializer.store_value(this);
+}
+
+IrInstr *CallNode::lower(IrBuilder &builder) const {
+    SymbolTable const &symbol_table = builder.symbol_table();
+    SymbolEntry const &entry = symbol_table.get(m_func->id());
+    IntrinsicEntry intrinsic;
+    std::vector<IrInstr *> args;
+    switch (entry.storage_type) {
+        case StorageType::Callable:
+            if (m_overload_id == 0) {
+                throw std::runtime_error("No matching call found");
+            }
+            return dynamic_cast<CallableNode const *>(
+                    symbol_table.get(m_overload_id).definition)->lower_call(
+                    builder, m_args->exprs());
+        case StorageType::Intrinsic:
+            intrinsic = intrinsics[entry.value];
+            if (m_args->exprs().size() != intrinsic.n_args) {
+                throw std::runtime_error(
+                        "Invalid intrinsic invocation of " + intrinsic.symbol);
+            }
+            for (auto const &arg : m_args->exprs()) {
+                args.push_back(arg->lower(builder));
+            }
+            switch (intrinsic.opcode) {
+                case OpCode::Unary:
+                    return builder.emit(IrOp::Unary, intrinsic.funccode, 0, 
+                            args);
+                case OpCode::Binary:
+                    return builder.emit(IrOp::Binary, intrinsic.funccode, 0, 
+                            args);
+                case OpCode::Select:
+                    return builder.emit(IrOp::Select, FuncCode::Nop, 0, args);
+                default:
+                    return builder.emit(IrOp::SysCall, intrinsic.funccode, 0, 
+                            args);
+            }
+        default:
+            for (auto const &arg : m_args->exprs()) {
+                args.push_back(arg->lower(builder));
+            }
+            args.push_back(m_func->lower(builder));
+            return builder.emit(IrOp::CallDyn, FuncCode::Nop, 0, args);
+    }
+}
+
+bool CallNode::serialize_tail_recursion(Serializer &serializer) const {
+    if (m_overload_id == 0 || !serializer.is_tail_recursion(m_overload_id)) {
+        return false;
+    }
+    FunctionNode const *function = dynamic_cast<FunctionNode const *>(
+            serializer.symbol_table().get(m_overload_id).definition);
+    if (function == nullptr || function->writeback()) {
+        return false;
+    }
+    function->serialize_tail_recursion(serializer, m_args->exprs());
+    return true;
+}
+
+std::vector<BaseNode *> CallNode::children() const {
+    return {m_func, m_args};
+}
+
+bool CallNode::is_pure(SymbolTable const &symbol_table) const {
+    if (!BaseNode::is_pure(symbol_table)) {
+        return false;
+    }
+    SymbolEntry const &entry = symbol_table.get(m_func->id());
+    if (entry.storage_type == StorageType::Intrinsic) {
+        return intrinsics[entry.value].opcode != OpCode::SysCall;
     }
+    if (entry.storage_type != StorageType::Callable) {
+        return false;
+    }
+    SymbolEntry const &overload = symbol_table.get(m_overload_id);
+    FunctionNode const *function = 
+            dynamic_cast<FunctionNode const *>(overload.definition);
+    InlineNode const *inline_function = 
+            dynamic_cast<InlineNode const *>(overload.definition);
+    if (function != nullptr && function->writeback()) {
+        return false;
+    }
+    if (inline_function != nullptr && inline_function->writeback()) {
+        // Only writes back to the first argument, which may be a local
+        VariableNode const *target = 
+                dynamic_cast<VariableNode const *>(m_args->exprs().front());
+        if (target == nullptr || symbol_table.get(target->id()).storage_type 
+                != StorageType::Relative) {
+            return false;
+        }
+    }
+    if (function != nullptr) {
+        return overload.pure;
+    }
+    return overload.definition->is_pure(symbol_table);
+}
+
+SymbolId CallNode::overload_id() const {
+    return m_overload_id;
+}
+
+ExpressionNode *CallNode::func() const {
+    return m_func;
+}
+
+NodeList<ExpressionNode> CallNode::args() const {
+    return m_args->exprs();
 }
 
 void CallNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_func.get());
-    printer.last_child(m_args.get());
+    printer.next_child(m_func);
+    printer.last_child(m_args);
 }
 
-TernaryNode::TernaryNode(Token token, std::unique_ptr<ExpressionNode> cond, 
-        std::unique_ptr<ExpressionNode> case_true, 
-        std::unique_ptr<ExpressionNode> case_false)
-        : ExpressionNode(token), m_cond(std::move(cond)), 
-        m_case_true(std::move(case_true)), 
-        m_case_false(std::move(case_false)) {}
+TernaryNode::TernaryNode(Token token, ExpressionNode *cond, 
+        ExpressionNode *case_true, 
+        ExpressionNode *case_false)
+        : ExpressionNode(token), m_cond(cond), 
+        m_case_true(case_true), 
+        m_case_false(case_false) {}
 
 void TernaryNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -751,18 +1332,42 @@ void TernaryNode::resolve_types(SymbolTable &symbol_table) {
     m_cond->resolve_types(symbol_table);
     m_case_true->resolve_types(symbol_table);
     m_case_false->resolve_types(symbol_table);
-    if (m_case_true->type()->matching(m_case_false->type()) != TypeMatch::ExactMatch) {
+    TypeMatch match = symbol_table.types().matching(m_case_true->type(),
+            m_case_false->type());
+    if (match == TypeMatch::NoMatch) {
         throw std::runtime_error("Types in ternary do not match");
     }
-    m_type = m_case_true->type();
+    // Either arm may be the value, so an arm of any type makes it any type
+    m_type = match == TypeMatch::AnyMatch 
+            && dynamic_cast<AnyTypeNode const *>(m_case_false->type()) 
+            ? m_case_false->type() : m_case_true->type();
+}
+
+// Both arms are evaluated and one is selected without branching, when both 
+// are cheap and evaluating the other one does nothing
+bool TernaryNode::is_select(SymbolTable const &symbol_table) const {
+    std::optional<uint32_t> cost_true = 
+            speculation_cost(m_case_true, symbol_table, false);
+    std::optional<uint32_t> cost_false = 
+            speculation_cost(m_case_false, symbol_table, false);
+    return cost_true.has_value() && cost_false.has_value() 
+            && cost_true.value() <= select_max_cost 
+            && cost_false.value() <= select_max_cost;
 }
 
 void TernaryNode::serialize(Serializer &serializer) const {
+    if (serializer.passes().has(Pass::Select) 
+            && is_select(serializer.symbol_table())) {
+        m_cond->serialize(serializer);
+        m_case_true->serialize(serializer);
+        m_case_false->serialize(serializer);
+        serializer.add_instr(OpCode::Select);
+        return;
+    }
     Label label_false = serializer.get_label();
     Label label_end = serializer.get_label();
     
-    m_cond->serialize(serializer);
-    serializer.add_instr(OpCode::BrFalse, label_false, true);
+    m_cond->serialize_branch(serializer, label_false, false);
 
     m_case_true->serialize(serializer);
     serializer.add_instr(OpCode::Jump, label_end, true);
@@ -773,18 +1378,51 @@ void TernaryNode::serialize(Serializer &serializer) const {
     serializer.add_label(label_end);
 }
 
+IrInstr *TernaryNode::lower(IrBuilder &builder) const {
+    if (builder.passes().has(Pass::Select) 
+            && is_select(builder.symbol_table())) {
+        IrInstr *cond = m_cond->lower(builder);
+        IrInstr *value_true = m_case_true->lower(builder);
+        IrInstr *value_false = m_case_false->lower(builder);
+        return builder.emit(IrOp::Select, FuncCode::Nop, 0, 
+                {cond, value_true, value_false});
+    }
+    IrBlock *block_true = builder.new_block();
+    IrBlock *block_false = builder.new_block();
+    IrBlock *end = builder.new_block();
+    m_cond->lower_branch(builder, block_true, block_false);
+
+    builder.seal(block_true);
+    builder.set_block(block_true);
+    IrInstr *value_true = m_case_true->lower(builder);
+    builder.jump(end);
+
+    builder.seal(block_false);
+    builder.set_block(block_false);
+    IrInstr *value_false = m_case_false->lower(builder);
+    builder.jump(end);
+
+    builder.seal(end);
+    builder.set_block(end);
+    return builder.phi(end, {value_true, value_false});
+}
+
+std::vector<BaseNode *> TernaryNode::children() const {
+    return {m_cond, m_case_true, m_case_false};
+}
+
 void TernaryNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_cond.get());
-    printer.next_child(m_case_true.get());
-    printer.last_child(m_case_false.get());
+    printer.next_child(m_cond);
+    printer.next_child(m_case_true);
+    printer.last_child(m_case_false);
 }
 
 AttributeNode::AttributeNode(Token token, 
-        std::unique_ptr<ExpressionNode> object,
-        std::unique_ptr<VariableNode> attribute)
-        : ExpressionNode(token), m_object(std::move(object)), 
-        m_attribute(std::move(attribute)) {}
+        ExpressionNode *object,
+        VariableNode *attribute)
+        : ExpressionNode(token), m_object(object), 
+        m_attribute(attribute) {}
 
 void AttributeNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -802,26 +1440,30 @@ void AttributeNode::serialize(Serializer &serializer) const {
     serializer.add_instr(OpCode::Push, 42);
 }
 
+std::vector<BaseNode *> AttributeNode::children() const {
+    return {m_object};
+}
+
 void AttributeNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_object.get());
-    printer.last_child(m_attribute.get());
+    printer.next_child(m_object);
+    printer.last_child(m_attribute);
 }
 
 LambdaNode::LambdaNode(Token token, 
         CallableSignature signature, 
-        std::unique_ptr<StatementNode> body)
-        : ExpressionNode(token), m_body(std::move(body)),
-        m_signature(std::move(signature)) {}
+        StatementNode *body)
+        : ExpressionNode(token), m_body(body),
+        m_signature(signature) {}
 
 void LambdaNode::resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) {
-    uint32_t position = -3 - m_signature.params.size();
+    uint32_t position = -call_frame_size - m_signature.params.size();
 
     for (std::size_t i = 0; i < m_signature.params.size(); i++) {
         Token const &token = m_signature.params[i];
-        TypeNode *type = m_signature.type->param_types()->list()[i].get();
+        TypeNode *type = m_signature.type->param_types()->list()[i];
 
-        symbol_table.declare(scopes.current, token.data(), 
+        symbol_table.declare(scopes, token.atom(), 
                 this, type, StorageType::Relative, position);
 
         position++;
@@ -832,52 +1474,68 @@ void LambdaNode::resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes)
 
 void LambdaNode::resolve_types(SymbolTable &symbol_table) {
     m_body->resolve_types(symbol_table);
-    m_type = m_signature.type.get();
+    m_type = m_signature.type;
 }
 
 void LambdaNode::serialize(Serializer &serializer) const {
     SymbolId id = serializer.get_label();
-    serializer.add_job(id, m_body.get(), false);
+    serializer.add_job(id, m_body, false, m_signature.params.size());
+    serializer.mark_address_taken();
     serializer.add_instr(OpCode::Push, id, true);
 }
 
 void LambdaNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_signature.type.get());
-    printer.last_child(m_body.get());
+    printer.next_child(m_signature.type);
+    printer.last_child(m_body);
 }
 
 std::string LambdaNode::label() const {
-    return token().data() + " (" + 
+    return std::string(token().data()) + " (" + 
             tokenlist_to_string(m_signature.params) + ")";
 }
 
 CallableNode::CallableNode(Token token, Token ident, 
-        CallableSignature signature, std::unique_ptr<BaseNode> body)
-        : StatementNode(token), m_body(std::move(body)), m_ident(ident),
-        m_signature(std::move(signature)) {}
+        CallableSignature signature, BaseNode *body)
+        : StatementNode(token), m_body(body), m_ident(ident),
+        m_signature(signature) {}
 
+// The argument count of calls and returns is encoded in a byte
 void CallableNode::resolve_types(SymbolTable &symbol_table) {
+    if (n_params() > max_count) {
+        throw std::runtime_error("Too many parameters: " 
+                + std::to_string(n_params()) + ", at most " 
+                + std::to_string(max_count));
+    }
     m_body->resolve_types(symbol_table);
 }
 
-TypeMatch CallableNode::is_matching_call(
-        std::vector<std::unique_ptr<ExpressionNode>> const &args) const {
+TypeMatch CallableNode::is_matching_call(TypeTable &types,
+        NodeList<ExpressionNode> args) const {
     if (args.size() != n_params()) {
         return TypeMatch::NoMatch;
     }
     TypeMatch match = TypeMatch::ExactMatch;
     for (std::size_t i = 0; i < args.size(); i++) {
         auto const &param_type = m_signature.type->param_types()->list()[i];
-        match = weakest_match(match, param_type->matching(args[i]->type()));
+        match = weakest_match(match,
+                types.matching(param_type, args[i]->type()));
     }
     return match;
 }
 
+std::vector<BaseNode *> CallableNode::children() const {
+    return {m_body};
+}
+
+BaseNode *CallableNode::body() const {
+    return m_body;
+}
+
 Token const &CallableNode::ident() const {
     return m_ident;
 }
-std::vector<Token> const &CallableNode::params() const {
+std::span<Token const> CallableNode::params() const {
     return m_signature.params;
 }
 
@@ -890,27 +1548,27 @@ CallableSignature const &CallableNode::signature() const {
 }
 
 FunctionNode::FunctionNode(Token token, Token ident, 
-        CallableSignature signature, std::unique_ptr<BaseNode> body,
-        bool writeback)
-        : CallableNode(token, ident, std::move(signature), std::move(body)),
-        m_writeback(writeback) {}
+        CallableSignature signature, BaseNode *body,
+        bool writeback, bool memo)
+        : CallableNode(token, ident, signature, body),
+        m_writeback(writeback), m_memo(memo) {}
 
 void FunctionNode::resolve_globals(
-        SymbolTable &symbol_table, SymbolMap &symbol_map) {
-    set_id(symbol_table.declare_callable(ident().data(), 
-            symbol_map, this));
+        SymbolTable &symbol_table, ScopeTracker &scopes) {
+    set_id(symbol_table.declare_callable(ident().atom(), 
+            scopes, this));
 }
 
 void FunctionNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
     // todo replace by block: -> {{ fn (...) {...} }}
-    uint32_t position = -3 - n_params();
+    uint32_t position = -call_frame_size - n_params();
 
     for (std::size_t i = 0; i < n_params(); i++) {
         Token const &token = params()[i];
         
-        TypeNode *type = signature().type->param_types()->list()[i].get();
-        symbol_table.declare(scopes.current, token.data(), 
+        TypeNode *type = signature().type->param_types()->list()[i];
+        symbol_table.declare(scopes, token.atom(), 
                 this, type, StorageType::Relative, position);
         position++;
     }
@@ -921,17 +1579,144 @@ void FunctionNode::resolve_locals(SymbolTable &symbol_table,
     symbol_table.resolve_local_container();
 }
 
+// Whether an inline function may need the address of an argument, by 
+// assigning to or taking the address of a parameter
+static bool uses_arg_addresses(BaseNode const *node, 
+        SymbolTable const &symbol_table) {
+    if (dynamic_cast<AssignNode const *>(node) != nullptr 
+            || dynamic_cast<AddressOfNode const *>(node) != nullptr) {
+        return true;
+    }
+    if (auto call = dynamic_cast<CallNode const *>(node)) {
+        if (call->overload_id() != 0 && dynamic_cast<InlineNode const *>(
+                symbol_table.get(call->overload_id()).definition) != nullptr) {
+            return true;
+        }
+    }
+    for (BaseNode const *child : node->children()) {
+        if (uses_arg_addresses(child, symbol_table)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Locals whose address is needed by the code of a function body
+static void collect_addressed(BaseNode const *node, 
+        SymbolTable const &symbol_table, std::unordered_set<SymbolId> &ids) {
+    if (auto call = dynamic_cast<CallNode const *>(node)) {
+        BaseNode const *definition = call->overload_id() == 0 ? nullptr 
+                : symbol_table.get(call->overload_id()).definition;
+        auto function = dynamic_cast<FunctionNode const *>(definition);
+        auto inline_function = dynamic_cast<InlineNode const *>(definition);
+        bool writeback = (function != nullptr && function->writeback()) 
+                || (inline_function != nullptr && inline_function->writeback());
+        bool by_address = inline_function != nullptr 
+                && uses_arg_addresses(inline_function->body(), symbol_table);
+        for (auto const &arg : call->args()) {
+            auto variable = dynamic_cast<VariableNode const *>(arg);
+            if (variable != nullptr && (by_address 
+                    || (writeback && &arg == &call->args().front()))) {
+                ids.insert(variable->id());
+            }
+        }
+    }
+    for (BaseNode const *child : node->children()) {
+        collect_addressed(child, symbol_table, ids);
+    }
+}
+
+static void collect_declarations(BaseNode const *node, 
+        std::vector<VarDeclarationNode const *> &declarations) {
+    if (dynamic_cast<LambdaNode const *>(node) != nullptr) {
+        return;
+    }
+    if (auto declaration = dynamic_cast<VarDeclarationNode const *>(node)) {
+        declarations.push_back(declaration);
+    }
+    for (BaseNode const *child : node->children()) {
+        collect_declarations(child, declarations);
+    }
+}
+
+// Keeps the first scalar locals of a function whose address is never 
+// needed in the register window of its frame
+static void assign_registers(Serializer &serializer, BaseNode const *body, 
+        std::string const &name) {
+    SymbolTable const &symbol_table = serializer.symbol_table();
+    std::unordered_set<SymbolId> addressed;
+    collect_address_taken(body, addressed);
+    collect_addressed(body, symbol_table, addressed);
+    std::vector<VarDeclarationNode const *> declarations;
+    collect_declarations(body, declarations);
+    uint32_t index = 0;
+    for (VarDeclarationNode const *declaration : declarations) {
+        if (index == frame_registers) {
+            break;
+        }
+        SymbolEntry const &entry = symbol_table.get(declaration->id());
+        if (entry.storage_type != StorageType::Relative || entry.size != 1 
+                || addressed.count(entry.id) != 0) {
+            continue;
+        }
+        serializer.assign_register(entry.id, index, 
+                declaration->init_value() == nullptr);
+        index++;
+    }
+    if (index > 0) {
+        serializer.add_remark("kept " + std::to_string(index) 
+                + " locals of " + name + " in registers");
+    }
+}
+
 void FunctionNode::serialize(Serializer &serializer) const {
     if (id() == 0) {
         throw std::runtime_error("Unresolved name");
     }
-    serializer.add_instr(OpCode::AddSp, m_frame_size);
+    bool memo = serializer.is_memoized(this);
+    if (memo) {
+        serializer.add_remark("memoized '" + std::string(ident().data()) 
+                + "'");
+        serializer.add_counted_instr(OpCode::MemoLoad, n_params(), id());
+    }
+    serializer.open_frame(id(), m_frame_size, n_params(), memo);
+    IrFunction *ir = serializer.ir_function(id());
+    if (ir != nullptr) {
+        IrEmitter(serializer, *ir).emit();
+        serializer.close_frame();
+        return;
+    }
+    if (serializer.passes().has(Pass::Registers)) {
+        assign_registers(serializer, m_body, 
+                "'" + std::string(ident().data()) + "'");
+    }
+    uint32_t slots = 0;
+    if (serializer.passes().has(Pass::ValueNumbering)) {
+        ValueNumbering numbering(serializer.symbol_table(), m_body);
+        numbering.number(m_body);
+        slots = numbering.apply(serializer, 
+                "'" + std::string(ident().data()) + "'");
+    }
     m_body->serialize(serializer);
-    serializer.add_instr(OpCode::Ret, 0);
+    serializer.add_instr(OpCode::Push, 0);
+    serializer.add_return();
+    serializer.release_frame(slots);
+    serializer.clear_values();
+    serializer.close_frame();
 }
 
 void FunctionNode::serialize_call(Serializer &serializer, 
-        std::vector<std::unique_ptr<ExpressionNode>> const &args) const {
+        NodeList<ExpressionNode> args) const {
+    std::optional<uint32_t> value = serializer.evaluate_call(this, args);
+    if (value.has_value()) {
+        serializer.add_instr(OpCode::Push, value.value());
+        return;
+    }
+    if (serializer.should_inline(this)) {
+        serialize_inline(serializer, args);
+        return;
+    }
+    serializer.add_function_implementation(id());
     for (auto const &node : args) {
         if (m_writeback && &node == &args.front()) {
             node->serialize_load_address(serializer);
@@ -940,35 +1725,106 @@ void FunctionNode::serialize_call(Serializer &serializer,
             node->serialize(serializer);
         }
     }
-    serializer.add_instr(OpCode::Push, n_params());
-    serializer.add_instr(OpCode::Push, id(), true);
-    serializer.add_instr(OpCode::Call);
+    serializer.add_counted_instr(OpCode::Call, n_params(), id(), true);
     if (m_writeback) {
         serializer.add_instr(OpCode::Binary, FuncCode::Assign);
     }
 }
 
+IrInstr *FunctionNode::lower_call(IrBuilder &builder, 
+        NodeList<ExpressionNode> args) const {
+    std::optional<IrLvalue> target;
+    std::vector<IrInstr *> values;
+    for (auto const &node : args) {
+        if (m_writeback && &node == &args.front()) {
+            target = node->lower_lvalue(builder);
+            values.push_back(builder.load(target.value()));
+        } else {
+            values.push_back(node->lower(builder));
+        }
+    }
+    IrInstr *result = builder.emit(IrOp::Call, FuncCode::Nop, id(), values);
+    if (target.has_value()) {
+        builder.store(target.value(), result);
+    }
+    return result;
+}
+
+void FunctionNode::serialize_tail_recursion(Serializer &serializer, 
+        NodeList<ExpressionNode> args) const {
+    uint32_t position = -call_frame_size - n_params();
+    for (auto const &node : args) {
+        node->serialize(serializer);
+    }
+    // All arguments are evaluated before any parameter is overwritten
+    for (uint32_t i = n_params(); i > 0; i--) {
+        serializer.add_instr(OpCode::StoreRel, position + i - 1);
+    }
+    serializer.add_frame_reset();
+    serializer.add_instr(OpCode::Jump, id(), true);
+}
+
 void FunctionNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_signature.type.get());
-    printer.last_child(m_body.get());
+    printer.next_child(m_signature.type);
+    printer.last_child(m_body);
 }
 
 std::string FunctionNode::label() const {
-    return token().data() + " " + ident().data() + "(" 
-            + tokenlist_to_string(params()) + ")";
+    return std::string(token().data()) + " " + std::string(ident().data()) 
+            + "(" + tokenlist_to_string(params()) + ")";
+}
+
+uint32_t FunctionNode::frame_size() const {
+    return m_frame_size;
+}
+
+bool FunctionNode::writeback() const {
+    return m_writeback;
+}
+
+bool FunctionNode::memo() const {
+    return m_memo;
+}
+
+void FunctionNode::serialize_inline(Serializer &serializer, 
+        NodeList<ExpressionNode> args) const {
+    uint32_t size = n_params() + m_frame_size;
+    uint32_t base = serializer.reserve_frame(size);
+
+    // Arguments are evaluated in the enclosing context, in order
+    for (std::size_t i = 0; i < args.size(); i++) {
+        serializer.add_instr(OpCode::LoadAddrRel, base + i);
+        args[i]->serialize(serializer);
+        serializer.add_instr(OpCode::Binary, FuncCode::Assign);
+        serializer.add_instr(OpCode::Pop);
+    }
+    // Locals start zeroed, as they would in a fresh frame
+    for (uint32_t i = n_params(); i < size; i++) {
+        serializer.add_instr(OpCode::LoadAddrRel, base + i);
+        serializer.add_instr(OpCode::Push, 0);
+        serializer.add_instr(OpCode::Binary, FuncCode::Assign);
+        serializer.add_instr(OpCode::Pop);
+    }
+
+    serializer.open_inlined_call(id(), base, n_params());
+    m_body->serialize(serializer);
+    serializer.add_instr(OpCode::Push, 0);
+    serializer.close_inlined_call();
+
+    serializer.release_frame(size);
 }
 
 InlineNode::InlineNode(Token token, Token ident, 
-        CallableSignature signature, std::unique_ptr<BaseNode> body, 
+        CallableSignature signature, BaseNode *body, 
         bool writeback)
-        : CallableNode(token, ident, std::move(signature), std::move(body)), 
-        m_param_ids(), m_writeback(writeback) {}
+        : CallableNode(token, ident, signature, body), 
+        m_first_param_id(no_symbol), m_writeback(writeback) {}
 
 void InlineNode::resolve_globals(
-        SymbolTable &symbol_table, SymbolMap &symbol_map) {
-    set_id(symbol_table.declare_callable(ident().data(), 
-            symbol_map, this));
+        SymbolTable &symbol_table, ScopeTracker &scopes) {
+    set_id(symbol_table.declare_callable(ident().atom(), 
+            scopes, this));
 }
 
 void InlineNode::resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes) {
@@ -976,12 +1832,14 @@ void InlineNode::resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes)
 
     for (std::size_t i = 0; i < n_params(); i++) {
         Token const &token = params()[i];
-        TypeNode *type = signature().type->param_types()->list()[i].get();
+        TypeNode *type = signature().type->param_types()->list()[i];
 
-        SymbolId id = symbol_table.declare(scopes.current, 
-                token.data(), this, type, StorageType::InlineReference, 
+        SymbolId id = symbol_table.declare(scopes, 
+                token.atom(), this, type, StorageType::InlineReference, 
                 position);
-        m_param_ids.push_back(id);
+        if (i == 0) {
+            m_first_param_id = id;
+        }
 
         position++;
     }
@@ -991,28 +1849,60 @@ void InlineNode::resolve_locals(SymbolTable &symbol_table, ScopeTracker &scopes)
 
 void InlineNode::serialize(Serializer &) const {}
 
+IrInstr *InlineNode::lower(IrBuilder &) const {
+    return nullptr;
+}
+
 void InlineNode::serialize_call(Serializer &serializer, 
-        std::vector<std::unique_ptr<ExpressionNode>> const &args) const {
-    serializer.inline_frames().open_call(args, m_param_ids, m_writeback);
+        NodeList<ExpressionNode> args) const {
+    std::vector<SymbolId> ids = param_ids();
+    serializer.inline_frames().open_call(args, ids, m_writeback);
     m_body->serialize(serializer);
-    serializer.inline_frames().close_call(m_param_ids);
+    serializer.inline_frames().close_call(ids);
+}
+
+IrInstr *InlineNode::lower_call(IrBuilder &builder, 
+        NodeList<ExpressionNode> args) const {
+    std::optional<IrLvalue> target;
+    if (m_writeback) {
+        target = args.front()->lower_lvalue(builder);
+    }
+    auto saved = builder.open_inline_call(args, param_ids(), target);
+    IrInstr *value = m_body->lower(builder);
+    builder.close_inline_call(saved);
+    if (target.has_value()) {
+        builder.store(target.value(), value);
+    }
+    return value;
 }
 
 void InlineNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_signature.type.get());
-    printer.last_child(m_body.get());
+    printer.next_child(m_signature.type);
+    printer.last_child(m_body);
 }
 
 std::string InlineNode::label() const {
-    return token().data() + " " + ident().data() + "(" 
-            + tokenlist_to_string(params()) + ")";
+    return std::string(token().data()) + " " + std::string(ident().data()) 
+            + "(" + tokenlist_to_string(params()) + ")";
+}
+
+bool InlineNode::writeback() const {
+    return m_writeback;
+}
+
+std::vector<SymbolId> InlineNode::param_ids() const {
+    std::vector<SymbolId> ids;
+    for (std::size_t i = 0; i < n_params(); i++) {
+        ids.push_back(m_first_param_id + i);
+    }
+    return ids;
 }
 
 EmptyNode::EmptyNode()
         : StatementNode(Token::synthetic("<empty>")) {}
 
-void EmptyNode::resolve_globals(SymbolTable &, SymbolMap &) {}
+void EmptyNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
 
 void EmptyNode::resolve_locals(SymbolTable &, ScopeTracker &) {}
 
@@ -1020,18 +1910,22 @@ void EmptyNode::resolve_types(SymbolTable &) {}
 
 void EmptyNode::serialize(Serializer &) const {}
 
+IrInstr *EmptyNode::lower(IrBuilder &) const {
+    return nullptr;
+}
+
 void EmptyNode::print(TreePrinter &printer) const {
     printer.print_node(this);
 }
 
-BlockNode::BlockNode(std::vector<std::unique_ptr<StatementNode>> statements)
+BlockNode::BlockNode(NodeList<StatementNode> statements)
         : StatementNode(Token::synthetic("<block>")), 
-        m_statements(std::move(statements)), m_scope_map() {}
+        m_statements(statements) {}
 
 void BlockNode::resolve_globals(
-        SymbolTable &symbol_table, SymbolMap &symbol_map) {
+        SymbolTable &symbol_table, ScopeTracker &scopes) {
     for (auto const &stmt : m_statements) {
-        stmt->resolve_globals(symbol_table, symbol_map);
+        stmt->resolve_globals(symbol_table, scopes);
     }
 }
 
@@ -1043,45 +1937,58 @@ void BlockNode::resolve_locals(SymbolTable &symbol_table,
 }
 
 void BlockNode::serialize(Serializer &serializer) const {
-    for (std::unique_ptr<StatementNode> const &stmt : m_statements) {
+    for (StatementNode *stmt : m_statements) {
         stmt->serialize(serializer);
     }
 }
 
+IrInstr *BlockNode::lower(IrBuilder &builder) const {
+    for (StatementNode *stmt : m_statements) {
+        stmt->lower(builder);
+    }
+    return nullptr;
+}
+
 void BlockNode::resolve_types(SymbolTable &symbol_table) {
     for (auto const &stmt : m_statements) {
         stmt->resolve_types(symbol_table);
     }
 }
 
+std::vector<BaseNode *> BlockNode::children() const {
+    std::vector<BaseNode *> children;
+    for (auto const &stmt : m_statements) {
+        children.push_back(stmt);
+    }
+    return children;
+}
+
 void BlockNode::print(TreePrinter &printer) const {
     printer.print_node(this);
     for (std::size_t i = 0; i < m_statements.size(); i++) {
         if (i == m_statements.size() - 1) {
-            printer.last_child(m_statements[i].get());
+            printer.last_child(m_statements[i]);
         } else {
-            printer.next_child(m_statements[i].get());
+            printer.next_child(m_statements[i]);
         }
     }
 }
 
-ScopeNode::ScopeNode(std::unique_ptr<StatementNode> statement)
+ScopeNode::ScopeNode(StatementNode *statement)
         : StatementNode(Token::synthetic("<scope>")), 
-        m_statement(std::move(statement)) {}
+        m_statement(statement) {}
 
 void ScopeNode::resolve_globals(SymbolTable &symbol_table, 
-        SymbolMap &symbol_map) {
-    m_statement->resolve_globals(symbol_table, symbol_map);
+        ScopeTracker &scopes) {
+    m_statement->resolve_globals(symbol_table, scopes);
     symbol_table.add_job(this);
 }
 
 void ScopeNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
-    ScopeTracker block_scopes(scopes.global, scopes.enclosing, {});
-    for (auto const &entry : scopes.current) {
-        block_scopes.enclosing[entry.first] = entry.second;
-    }
-    m_statement->resolve_locals(symbol_table, block_scopes);
+    scopes.open_scope();
+    m_statement->resolve_locals(symbol_table, scopes);
+    scopes.close_scope();
 }
 
 void ScopeNode::resolve_types(SymbolTable &symbol_table) {
@@ -1092,19 +1999,27 @@ void ScopeNode::serialize(Serializer &serializer) const {
     m_statement->serialize(serializer);
 }
 
+IrInstr *ScopeNode::lower(IrBuilder &builder) const {
+    return m_statement->lower(builder);
+}
+
+std::vector<BaseNode *> ScopeNode::children() const {
+    return {m_statement};
+}
+
 void ScopeNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.last_child(m_statement.get());
+    printer.last_child(m_statement);
 }
 
 TypeDeclarationNode::TypeDeclarationNode(
-        Token token, std::unique_ptr<NamedTypeNode> ident)
-        : StatementNode(token), m_ident(std::move(ident)) {}
+        Token token, NamedTypeNode *ident)
+        : StatementNode(token), m_ident(ident) {}
 
 void TypeDeclarationNode::resolve_globals(
-        SymbolTable &symbol_table, SymbolMap &symbol_map) {
-    set_id(symbol_table.declare(symbol_map, 
-            m_ident->token().data(), this, nullptr, StorageType::Type));
+        SymbolTable &symbol_table, ScopeTracker &scopes) {
+    set_id(symbol_table.declare(scopes, 
+            m_ident->token().atom(), this, nullptr, StorageType::Type));
 }
 
 void TypeDeclarationNode::resolve_locals(SymbolTable &, ScopeTracker &) {}
@@ -1113,19 +2028,24 @@ void TypeDeclarationNode::resolve_types(SymbolTable &) {}
 
 void TypeDeclarationNode::serialize(Serializer &) const {}
 
+IrInstr *TypeDeclarationNode::lower(IrBuilder &) const {
+    return nullptr;
+}
+
 void TypeDeclarationNode::print(TreePrinter &printer) const {
     printer.print_node(this);
 }
 
 std::string TypeDeclarationNode::label() const {
-    return token().data() + " " + m_ident->token().data();
+    return std::string(token().data()) + " " 
+            + std::string(m_ident->token().data());
 }
 
 ExpressionListNode::ExpressionListNode(
-        Token token, std::vector<std::unique_ptr<ExpressionNode>> exprs)
-        : BaseNode(token), m_exprs(std::move(exprs)) {}
+        Token token, NodeList<ExpressionNode> exprs)
+        : BaseNode(token), m_exprs(exprs) {}
 
-void ExpressionListNode::resolve_globals(SymbolTable &, SymbolMap &) {}
+void ExpressionListNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
 
 void ExpressionListNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -1146,28 +2066,36 @@ void ExpressionListNode::serialize(Serializer &serializer) const {
     }
 }
 
+std::vector<BaseNode *> ExpressionListNode::children() const {
+    std::vector<BaseNode *> children;
+    for (auto const &expr : m_exprs) {
+        children.push_back(expr);
+    }
+    return children;
+}
+
 void ExpressionListNode::print(TreePrinter &printer) const {
     printer.print_node(this);
     for (std::size_t i = 0; i < m_exprs.size(); i++) {
         if (i == m_exprs.size() - 1) {
-            printer.last_child(m_exprs[i].get());
+            printer.last_child(m_exprs[i]);
         } else {
-            printer.next_child(m_exprs[i].get());
+            printer.next_child(m_exprs[i]);
         }
     }
 }
 
-std::vector<std::unique_ptr<ExpressionNode>> const &
+NodeList<ExpressionNode> 
         ExpressionListNode::exprs() {
     return m_exprs;
 }
 
-IfNode::IfNode(Token token, std::unique_ptr<ExpressionNode> cond, 
-        std::unique_ptr<StatementNode> case_true)
-        : StatementNode(token), m_cond(std::move(cond)), 
-        m_case_true(std::move(case_true)) {}
+IfNode::IfNode(Token token, ExpressionNode *cond, 
+        StatementNode *case_true)
+        : StatementNode(token), m_cond(cond), 
+        m_case_true(case_true) {}
 
-void IfNode::resolve_globals(SymbolTable &, SymbolMap &) {}
+void IfNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
 
 void IfNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -1182,27 +2110,45 @@ void IfNode::resolve_types(SymbolTable &symbol_table) {
 
 void IfNode::serialize(Serializer &serializer) const {
     Label label_end = serializer.get_label();
-    m_cond->serialize(serializer);
-    serializer.add_instr(OpCode::BrFalse, label_end, true);
+    m_cond->serialize_branch(serializer, label_end, false);
     m_case_true->serialize(serializer);
     serializer.add_label(label_end);
 }
 
+IrInstr *IfNode::lower(IrBuilder &builder) const {
+    IrBlock *block_true = builder.new_block();
+    IrBlock *end = builder.new_block();
+    m_cond->lower_branch(builder, block_true, end);
+
+    builder.seal(block_true);
+    builder.set_block(block_true);
+    m_case_true->lower(builder);
+    builder.jump(end);
+
+    builder.seal(end);
+    builder.set_block(end);
+    return nullptr;
+}
+
+std::vector<BaseNode *> IfNode::children() const {
+    return {m_cond, m_case_true};
+}
+
 void IfNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_cond.get());
-    printer.last_child(m_case_true.get());
+    printer.next_child(m_cond);
+    printer.last_child(m_case_true);
 }
 
 
-IfElseNode::IfElseNode(Token token, std::unique_ptr<ExpressionNode> cond, 
-        std::unique_ptr<StatementNode> case_true, 
-        std::unique_ptr<StatementNode> case_false)
-        : StatementNode(token), m_cond(std::move(cond)), 
-        m_case_true(std::move(case_true)), 
-        m_case_false(std::move(case_false)) {}
+IfElseNode::IfElseNode(Token token, ExpressionNode *cond, 
+        StatementNode *case_true, 
+        StatementNode *case_false)
+        : StatementNode(token), m_cond(cond), 
+        m_case_true(case_true), 
+        m_case_false(case_false) {}
 
-void IfElseNode::resolve_globals(SymbolTable &, SymbolMap &) {}
+void IfElseNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
 
 void IfElseNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -1221,8 +2167,7 @@ void IfElseNode::serialize(Serializer &serializer) const {
     Label label_false = serializer.get_label();
     Label label_end = serializer.get_label();
     
-    m_cond->serialize(serializer);
-    serializer.add_instr(OpCode::BrFalse, label_false, true);
+    m_cond->serialize_branch(serializer, label_false, false);
 
     m_case_true->serialize(serializer);
     serializer.add_instr(OpCode::Jump, label_end, true);
@@ -1233,23 +2178,162 @@ void IfElseNode::serialize(Serializer &serializer) const {
     serializer.add_label(label_end);
 }
 
+IrInstr *IfElseNode::lower(IrBuilder &builder) const {
+    IrBlock *block_true = builder.new_block();
+    IrBlock *block_false = builder.new_block();
+    IrBlock *end = builder.new_block();
+    m_cond->lower_branch(builder, block_true, block_false);
+
+    builder.seal(block_true);
+    builder.set_block(block_true);
+    m_case_true->lower(builder);
+    builder.jump(end);
+
+    builder.seal(block_false);
+    builder.set_block(block_false);
+    m_case_false->lower(builder);
+    builder.jump(end);
+
+    builder.seal(end);
+    builder.set_block(end);
+    return nullptr;
+}
+
+std::vector<BaseNode *> IfElseNode::children() const {
+    return {m_cond, m_case_true, m_case_false};
+}
+
 void IfElseNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_cond.get());
-    printer.next_child(m_case_true.get());
-    printer.last_child(m_case_false.get());
+    printer.next_child(m_cond);
+    printer.next_child(m_case_true);
+    printer.last_child(m_case_false);
+}
+
+SwitchCase::SwitchCase(std::span<int32_t const> values, StatementNode *body)
+        : values(values), body(body) {}
+
+SwitchNode::SwitchNode(Token token, ExpressionNode *value, 
+        std::span<SwitchCase const> cases, 
+        StatementNode *case_default)
+        : StatementNode(token), m_value(value), 
+        m_cases(cases), m_case_default(case_default) {}
+
+void SwitchNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
+
+void SwitchNode::resolve_locals(SymbolTable &symbol_table, 
+        ScopeTracker &scopes) {
+    m_value->resolve_locals(symbol_table, scopes);
+    for (SwitchCase const &switch_case : m_cases) {
+        switch_case.body->resolve_locals(symbol_table, scopes);
+    }
+    m_case_default->resolve_locals(symbol_table, scopes);
+}
+
+void SwitchNode::resolve_types(SymbolTable &symbol_table) {
+    m_value->resolve_types(symbol_table);
+    for (SwitchCase const &switch_case : m_cases) {
+        switch_case.body->resolve_types(symbol_table);
+    }
+    m_case_default->resolve_types(symbol_table);
+}
+
+void SwitchNode::serialize(Serializer &serializer) const {
+    Label label_default = serializer.get_label();
+    Label label_end = serializer.get_label();
+    std::vector<Label> labels;
+    std::vector<std::pair<int32_t, Label>> targets;
+    for (SwitchCase const &switch_case : m_cases) {
+        labels.push_back(serializer.get_label());
+        for (int32_t value : switch_case.values) {
+            targets.push_back({value, labels.back()});
+        }
+    }
+
+    m_value->serialize(serializer);
+    serializer.add_switch(targets, label_default);
+
+    for (std::size_t i = 0; i < m_cases.size(); i++) {
+        serializer.add_label(labels[i]);
+        m_cases[i].body->serialize(serializer);
+        serializer.add_instr(OpCode::Jump, label_end, true);
+    }
+    serializer.add_label(label_default);
+    m_case_default->serialize(serializer);
+
+    serializer.add_label(label_end);
+}
+
+IrInstr *SwitchNode::lower(IrBuilder &builder) const {
+    IrInstr *value = m_value->lower(builder);
+    IrBlock *block_default = builder.new_block();
+    IrBlock *end = builder.new_block();
+    std::vector<IrBlock *> blocks;
+    std::vector<std::pair<int32_t, IrBlock *>> targets;
+    for (SwitchCase const &switch_case : m_cases) {
+        blocks.push_back(builder.new_block());
+        for (int32_t case_value : switch_case.values) {
+            targets.push_back({case_value, blocks.back()});
+        }
+    }
+    builder.switch_on(value, block_default, targets);
+
+    for (std::size_t i = 0; i < m_cases.size(); i++) {
+        builder.seal(blocks[i]);
+        builder.set_block(blocks[i]);
+        m_cases[i].body->lower(builder);
+        builder.jump(end);
+    }
+    builder.seal(block_default);
+    builder.set_block(block_default);
+    m_case_default->lower(builder);
+    builder.jump(end);
+
+    builder.seal(end);
+    builder.set_block(end);
+    return nullptr;
+}
+
+std::vector<BaseNode *> SwitchNode::children() const {
+    std::vector<BaseNode *> children = {m_value};
+    for (SwitchCase const &switch_case : m_cases) {
+        children.push_back(switch_case.body);
+    }
+    children.push_back(m_case_default);
+    return children;
+}
+
+void SwitchNode::print(TreePrinter &printer) const {
+    printer.print_node(this);
+    printer.next_child(m_value);
+    for (SwitchCase const &switch_case : m_cases) {
+        printer.next_child(switch_case.body);
+    }
+    printer.last_child(m_case_default);
+}
+
+std::string SwitchNode::label() const {
+    std::string cases;
+    for (SwitchCase const &switch_case : m_cases) {
+        std::string values;
+        for (int32_t value : switch_case.values) {
+            values += (values.empty() ? "" : ", ") + std::to_string(value);
+        }
+        cases += values + "; ";
+    }
+    return std::string(token().data()) + " (" + cases + "default)";
 }
 
 ForLoopNode::ForLoopNode(Token token, 
-        std::unique_ptr<StatementNode> init, 
-        std::unique_ptr<ExpressionNode> cond, 
-        std::unique_ptr<StatementNode> post, 
-        std::unique_ptr<StatementNode> body)
+        StatementNode *init, 
+        ExpressionNode *cond, 
+        StatementNode *post, 
+        StatementNode *body)
         : StatementNode(token), 
-        m_init(std::move(init)), m_cond(std::move(cond)), 
-        m_post(std::move(post)), m_body(std::move(body)) {}
+        m_init(init), m_cond(cond), 
+        m_post(post), m_body(body) {}
 
-void ForLoopNode::resolve_globals(SymbolTable &, SymbolMap &) {}
+void ForLoopNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
 
 void ForLoopNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -1269,31 +2353,76 @@ void ForLoopNode::resolve_types(SymbolTable &symbol_table) {
 void ForLoopNode::serialize(Serializer &serializer) const {
     Label loop_body_label = serializer.get_label();
     Label cond_label = serializer.get_label();
+    std::vector<BaseNode const *> hoisted;
+    std::vector<std::pair<uint32_t, int32_t>> pointers;
+    uint32_t slots = 0;
+    uint32_t factor = 1;
+    std::optional<uint32_t> trip_count;
 
     m_init->serialize(serializer); // init: statement
-    serializer.add_instr(OpCode::Jump, cond_label, true);
+    if (serializer.current_function() != nullptr) {
+        slots += hoist_invariants(serializer, hoisted);
+        slots += hoist_induction_pointers(serializer, hoisted, pointers);
+        factor = unroll_factor(serializer, trip_count);
+    }
+    if (factor > 1) {
+        serialize_unrolled(serializer, factor, trip_count, pointers);
+    } else {
+        serializer.add_instr(OpCode::Jump, cond_label, true);
     
-    serializer.add_label(loop_body_label); // body and post: statements
-    m_body->serialize(serializer);
-    m_post->serialize(serializer);
+        serializer.add_label(loop_body_label); // body and post: statements
+        serialize_iteration(serializer, pointers);
+
+        serializer.add_label(cond_label);
+        // cond: expression
+        m_cond->serialize_branch(serializer, loop_body_label, true);
+    }
+
+    for (BaseNode const *node : hoisted) {
+        serializer.unhoist(node);
+    }
+    serializer.release_frame(slots);
+}
+
+IrInstr *ForLoopNode::lower(IrBuilder &builder) const {
+    m_init->lower(builder);
+    IrBlock *header = builder.new_block();
+    IrBlock *body = builder.new_block();
+    IrBlock *exit = builder.new_block();
+    builder.jump(header);
+
+    // The header is sealed once the back edge is known
+    builder.set_block(header);
+    m_cond->lower_branch(builder, body, exit);
+
+    builder.seal(body);
+    builder.set_block(body);
+    m_body->lower(builder);
+    m_post->lower(builder);
+    builder.jump(header);
+    builder.seal(header);
 
-    serializer.add_label(cond_label);
-    m_cond->serialize(serializer); // cond: expression
-    serializer.add_instr(OpCode::BrTrue, loop_body_label, true);
+    builder.seal(exit);
+    builder.set_block(exit);
+    return nullptr;
+}
+
+std::vector<BaseNode *> ForLoopNode::children() const {
+    return {m_init, m_cond, m_post, m_body};
 }
 
 void ForLoopNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_init.get());
-    printer.next_child(m_cond.get());
-    printer.next_child(m_post.get());
-    printer.last_child(m_body.get());
+    printer.next_child(m_init);
+    printer.next_child(m_cond);
+    printer.next_child(m_post);
+    printer.last_child(m_body);
 }
 
-ReturnNode::ReturnNode(Token token, std::unique_ptr<ExpressionNode> operand)
-        : StatementNode(token), m_operand(std::move(operand)) {}
+ReturnNode::ReturnNode(Token token, ExpressionNode *operand)
+        : StatementNode(token), m_operand(operand) {}
 
-void ReturnNode::resolve_globals(SymbolTable &, SymbolMap &) {}
+void ReturnNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
 
 void ReturnNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -1306,30 +2435,43 @@ void ReturnNode::resolve_types(SymbolTable &symbol_table) {
 
 void ReturnNode::serialize(Serializer &serializer) const {
     // todo: first push ret dest addr, then do store, then ret wo val
+    CallNode const *call = dynamic_cast<CallNode const *>(m_operand);
+    if (call != nullptr && call->serialize_tail_recursion(serializer)) {
+        return;
+    }
     m_operand->serialize(serializer);
-    serializer.add_instr(OpCode::Ret);
+    serializer.add_return();
+}
+
+IrInstr *ReturnNode::lower(IrBuilder &builder) const {
+    builder.ret(m_operand->lower(builder));
+    return nullptr;
+}
+
+std::vector<BaseNode *> ReturnNode::children() const {
+    return {m_operand};
 }
 
 void ReturnNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.last_child(m_operand.get());
+    printer.last_child(m_operand);
 }
 
 VarDeclarationNode::VarDeclarationNode(Token token, Token ident, 
-        std::unique_ptr<TypeNode> type,
-        std::unique_ptr<ExpressionNode> size, 
-        std::unique_ptr<ExpressionNode> init_value)
-        : StatementNode(token), m_ident(ident), m_type(std::move(type)),
-        m_size(std::move(size)), 
-        m_init_value(std::move(init_value)) {}
+        TypeNode *type,
+        ExpressionNode *size, 
+        ExpressionNode *init_value)
+        : StatementNode(token), m_ident(ident), m_type(type),
+        m_size(size), 
+        m_init_value(init_value) {}
 
 void VarDeclarationNode::resolve_globals(
-        SymbolTable &symbol_table, SymbolMap &current) {
+        SymbolTable &symbol_table, ScopeTracker &scopes) {
     if (m_init_value != nullptr) {
         throw std::runtime_error("not implemented");
     }
-    set_id(symbol_table.declare(current, m_ident.data(), 
-            this, m_type.get(), 
+    set_id(symbol_table.declare(scopes, m_ident.atom(), 
+            this, m_type, 
             m_size == nullptr ? 
                 StorageType::Absolute : StorageType::AbsoluteRef, 
             0, declared_size()));
@@ -1344,8 +2486,8 @@ void VarDeclarationNode::resolve_locals(SymbolTable &symbol_table,
     if (m_init_value != nullptr) {
         m_init_value->resolve_locals(symbol_table, scopes);
     }
-    set_id(symbol_table.declare(scopes.current, m_ident.data(), 
-            this, m_type.get(), 
+    set_id(symbol_table.declare(scopes, m_ident.atom(), 
+            this, m_type, 
             m_size == nullptr ? 
                 StorageType::Relative : StorageType::RelativeRef, 
             0, declared_size()));
@@ -1358,7 +2500,8 @@ void VarDeclarationNode::resolve_types(SymbolTable &symbol_table) {
     }
     if (m_init_value != nullptr) {
         m_init_value->resolve_types(symbol_table);
-        TypeMatch match = m_type->matching(m_init_value->type());
+        TypeMatch match = symbol_table.types().matching(m_type,
+                m_init_value->type());
         if (match == TypeMatch::NoMatch) {
             throw std::runtime_error("Type mismatch: " + to_string(token()));
         }
@@ -1368,21 +2511,51 @@ void VarDeclarationNode::resolve_types(SymbolTable &symbol_table) {
 void VarDeclarationNode::serialize(Serializer &serializer) const {
     if (m_init_value != nullptr) {
         SymbolEntry const &entry = serializer.symbol_table().get(id());
-        serializer.add_instr(OpCode::LoadAddrRel, entry.value);
+        if (entry.storage_type != StorageType::Relative) {
+            serializer.add_instr(OpCode::LoadAddrRel, 
+                    serializer.frame_offset(entry));
+            m_init_value->serialize(serializer);
+            serializer.add_instr(OpCode::Binary, FuncCode::Assign);
+            serializer.add_instr(OpCode::Pop);
+            return;
+        }
         m_init_value->serialize(serializer);
-        serializer.add_instr(OpCode::Binary, FuncCode::Assign);
-        serializer.add_instr(OpCode::Pop);
+        if (auto index = serializer.frame_register(id())) {
+            serializer.add_counted_instr(OpCode::StoreReg, index.value());
+        } else {
+            serializer.add_instr(OpCode::StoreRel, 
+                    serializer.frame_offset(entry));
+        }
+    }
+}
+
+IrInstr *VarDeclarationNode::lower(IrBuilder &builder) const {
+    if (m_init_value != nullptr) {
+        IrInstr *value = m_init_value->lower(builder);
+        builder.store(builder.variable_lvalue(id()), value);
     }
+    return nullptr;
+}
+
+std::vector<BaseNode *> VarDeclarationNode::children() const {
+    if (m_init_value == nullptr) {
+        return {};
+    }
+    return {m_init_value};
 }
 
 void VarDeclarationNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.next_child(m_size.get());
-    printer.last_child(m_init_value.get());
+    printer.next_child(m_size);
+    printer.last_child(m_init_value);
 }
 
 std::string VarDeclarationNode::label() const {
-    return token().data() + " " + m_ident.data();
+    return std::string(token().data()) + " " + std::string(m_ident.data());
+}
+
+ExpressionNode *VarDeclarationNode::init_value() const {
+    return m_init_value;
 }
 
 uint32_t VarDeclarationNode::declared_size() const {
@@ -1397,11 +2570,11 @@ uint32_t VarDeclarationNode::declared_size() const {
 }
 
 ExpressionStatementNode::ExpressionStatementNode(
-        std::unique_ptr<ExpressionNode> expr)
+        ExpressionNode *expr)
         : StatementNode(Token::synthetic("<expr-stmt>")), 
-        m_expr(std::move(expr)) {}
+        m_expr(expr) {}
 
-void ExpressionStatementNode::resolve_globals(SymbolTable &, SymbolMap &) {}
+void ExpressionStatementNode::resolve_globals(SymbolTable &, ScopeTracker &) {}
 
 void ExpressionStatementNode::resolve_locals(SymbolTable &symbol_table, 
         ScopeTracker &scopes) {
@@ -1417,7 +2590,20 @@ void ExpressionStatementNode::serialize(Serializer &serializer) const {
     serializer.add_instr(OpCode::Pop);
 }
 
+IrInstr *ExpressionStatementNode::lower(IrBuilder &builder) const {
+    m_expr->lower(builder);
+    return nullptr;
+}
+
+std::vector<BaseNode *> ExpressionStatementNode::children() const {
+    return {m_expr};
+}
+
+ExpressionNode *ExpressionStatementNode::expr() const {
+    return m_expr;
+}
+
 void ExpressionStatementNode::print(TreePrinter &printer) const {
     printer.print_node(this);
-    printer.last_child(m_expr.get());
+    printer.last_child(m_expr);
 }
@@ -5,9 +5,17 @@
 TreePrinter::TreePrinter(bool with_pointers, bool with_types, 
         bool with_symbol_ids)
         : m_prefixes(), with_pointers(with_pointers), with_types(with_types), 
-        with_symbol_ids(with_symbol_ids) {}
+        with_symbol_ids(with_symbol_ids), m_visitor() {}
+
+TreePrinter::TreePrinter(std::function<void(BaseNode const *)> visitor)
+        : m_prefixes(), with_pointers(false), with_types(false), 
+        with_symbol_ids(false), m_visitor(visitor) {}
 
 void TreePrinter::print_node(BaseNode const *node) {
+    if (m_visitor) {
+        m_visitor(node);
+        return;
+    }
     print_label_prefix();
     std::cout << node->label();
     if (with_pointers) {
@@ -55,6 +63,9 @@ void TreePrinter::print_label_prefix() {
 
 void TreePrinter::print_child(BaseNode const *child) {
     if (child == nullptr) {
+        if (m_visitor) {
+            return;
+        }
         print_label_prefix();
         std::cout << "(null)" << std::endl;
     } else {
@@ -0,0 +1,46 @@
+#include "typetable.hpp"
+#include "tree.hpp"
+
+// Any is interned first, so that the global node has the same id in every
+// table
+TypeTable::TypeTable()
+        : m_types(), m_ids(), m_matches() {
+    intern(&Any);
+}
+
+// The parts of a type are interned before it, as its key names them by id
+TypeId TypeTable::intern(TypeNode const *type) {
+    if (type->type_id() != no_type) {
+        return type->type_id();
+    }
+    auto [iter, inserted] = m_ids.emplace(type->type_key(*this),
+            m_types.size());
+    if (inserted) {
+        m_types.push_back(type);
+    }
+    type->set_type_id(iter->second);
+    return iter->second;
+}
+
+TypeNode const *TypeTable::get(TypeId id) const {
+    return m_types[id];
+}
+
+TypeMatch TypeTable::matching(TypeNode const *type, TypeNode const *other) {
+    if (other == nullptr) {
+        return type->matching(other);
+    }
+    TypeId id = intern(type);
+    TypeId other_id = intern(other);
+    if (id == other_id) {
+        return TypeMatch::ExactMatch;
+    }
+    uint64_t key = static_cast<uint64_t>(id) << 32 | other_id;
+    auto iter = m_matches.find(key);
+    if (iter != m_matches.end()) {
+        return iter->second;
+    }
+    TypeMatch match = m_types[id]->matching(m_types[other_id]);
+    m_matches.emplace(key, match);
+    return match;
+}
@@ -0,0 +1,571 @@
+#include "valuenumbering.hpp"
+#include "tree.hpp"
+#include "serializer.hpp"
+#include <algorithm>
+
+ValueNumbering::ValueNumbering(SymbolTable const &symbol_table,
+        BaseNode const *body)
+        : m_symbol_table(symbol_table), m_address_taken(), m_keys(),
+        m_kinds(), m_constant(), m_node_keys(), m_values(), m_duplicates(), 
+        m_available() {
+    collect_address_taken(body, m_address_taken);
+}
+
+SymbolTable const &ValueNumbering::symbol_table() const {
+    return m_symbol_table;
+}
+
+bool ValueNumbering::is_address_taken(SymbolId id) const {
+    return m_address_taken.count(id) != 0;
+}
+
+// Values are constant like is_constant() has it: literals, names of 
+// functions, and pure calls of constants. Calls are keyed only when pure.
+uint32_t ValueNumbering::intern(ValueKind kind, uint32_t id,
+        std::vector<uint32_t> operands) {
+    Key key = {static_cast<uint32_t>(kind), id};
+    key.insert(key.end(), operands.begin(), operands.end());
+    auto [iter, inserted] = m_keys.emplace(std::move(key), m_kinds.size());
+    if (inserted) {
+        bool constant = kind == ValueKind::Constant 
+                || (kind == ValueKind::Variable 
+                    && m_symbol_table.get(id).storage_type 
+                        == StorageType::Callable);
+        if (kind == ValueKind::Intrinsic || kind == ValueKind::Call) {
+            constant = std::all_of(operands.begin(), operands.end(), 
+                    [this](uint32_t operand) { 
+                        return m_constant[operand]; 
+                    });
+        }
+        m_kinds.push_back(kind);
+        m_constant.push_back(constant);
+    }
+    return iter->second;
+}
+
+std::optional<uint32_t> ValueNumbering::key(BaseNode const *node,
+        NumberedValue &value) {
+    auto iter = m_node_keys.find(node);
+    if (iter == m_node_keys.end()) {
+        NodeKey found;
+        found.number = node->value_key(*this, found.value);
+        iter = m_node_keys.emplace(node, std::move(found)).first;
+    }
+    NumberedValue const &found = iter->second.value;
+    value.locals.insert(found.locals.begin(), found.locals.end());
+    value.memory |= found.memory;
+    value.cost += found.cost;
+    return iter->second.number;
+}
+
+// Key of a node worth numbering: loads and calls that are not constant
+std::optional<uint32_t> ValueNumbering::value_key(BaseNode const *node,
+        NumberedValue &value) {
+    std::optional<uint32_t> number = key(node, value);
+    if (!number.has_value()
+            || m_kinds[number.value()] == ValueKind::Variable
+            || m_kinds[number.value()] == ValueKind::Constant
+            || m_constant[number.value()]) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+bool ValueNumbering::is_pure_callee(CallNode const *call) const {
+    SymbolEntry const &entry = m_symbol_table.get(call->func()->id());
+    if (entry.storage_type == StorageType::Intrinsic) {
+        return intrinsics[entry.value].opcode != OpCode::SysCall;
+    }
+    if (entry.storage_type != StorageType::Callable) {
+        return false;
+    }
+    SymbolEntry const &overload = m_symbol_table.get(call->overload_id());
+    if (auto function = dynamic_cast<FunctionNode const *>(
+            overload.definition)) {
+        return overload.pure && !function->writeback();
+    }
+    auto inline_function = dynamic_cast<InlineNode const *>(
+            overload.definition);
+    return inline_function != nullptr && !inline_function->writeback()
+            && inline_function->body()->is_pure(m_symbol_table);
+}
+
+// Indices of the arguments in the order they are evaluated. Inline functions
+// evaluate an argument where its parameter is used, which may be never.
+std::optional<std::vector<std::size_t>> ValueNumbering::arg_order(
+        CallNode const *call) const {
+    std::vector<std::size_t> order;
+    auto inline_function = dynamic_cast<InlineNode const *>(
+            call->overload_id() == 0 ? nullptr
+            : m_symbol_table.get(call->overload_id()).definition);
+    if (m_symbol_table.get(call->func()->id()).storage_type
+            != StorageType::Callable || inline_function == nullptr) {
+        for (std::size_t i = 0; i < call->args().size(); i++) {
+            order.push_back(i);
+        }
+        return order;
+    }
+    if (inline_function->writeback()
+            || !collect_arg_order(inline_function->body(), inline_function,
+                order)) {
+        return std::nullopt;
+    }
+    std::unordered_set<std::size_t> seen(order.begin(), order.end());
+    if (seen.size() != order.size()) {
+        return std::nullopt;
+    }
+    return order;
+}
+
+bool ValueNumbering::collect_arg_order(BaseNode const *node,
+        InlineNode const *callee, std::vector<std::size_t> &order) const {
+    if (auto variable = dynamic_cast<VariableNode const *>(node)) {
+        for (std::size_t i = 0; i < callee->n_params(); i++) {
+            if (variable->token().atom() == callee->params()[i].atom()) {
+                order.push_back(i);
+            }
+        }
+        return true;
+    }
+    if (dynamic_cast<LiteralNode const *>(node) != nullptr) {
+        return true;
+    }
+    auto call = dynamic_cast<CallNode const *>(node);
+    if (call == nullptr) {
+        return false;
+    }
+    std::optional<std::vector<std::size_t>> inner = arg_order(call);
+    if (!inner.has_value()) {
+        return false;
+    }
+    for (std::size_t i : inner.value()) {
+        if (!collect_arg_order(call->args()[i], callee, order)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether the arguments are pushed one right after the other, so an
+// argument equal to the preceding one may duplicate it
+bool ValueNumbering::args_adjacent(CallNode const *call) const {
+    if (m_symbol_table.get(call->func()->id()).storage_type
+            != StorageType::Callable) {
+        return true;
+    }
+    // Function calls may still be expanded inline
+    auto inline_function = dynamic_cast<InlineNode const *>(
+            m_symbol_table.get(call->overload_id()).definition);
+    if (inline_function == nullptr || inline_function->writeback()) {
+        return false;
+    }
+    auto body = dynamic_cast<CallNode const *>(inline_function->body());
+    if (body == nullptr || body->args().size() != inline_function->n_params()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < body->args().size(); i++) {
+        auto param = dynamic_cast<VariableNode const *>(body->args()[i]);
+        if (param == nullptr
+                || param->token().atom()
+                    != inline_function->params()[i].atom()) {
+            return false;
+        }
+    }
+    return args_adjacent(body);
+}
+
+void ValueNumbering::number(BaseNode const *node) {
+    NumberedValue value;
+    value.first = node;
+    std::optional<uint32_t> key = value_key(node, value);
+    if (key.has_value()) {
+        auto iter = m_available.find(key.value());
+        if (iter != m_available.end()) {
+            m_values[iter->second].reuses.push_back(node);
+            return;
+        }
+    }
+    node->number_values(*this);
+    if (key.has_value()) {
+        m_available[key.value()] = m_values.size();
+        m_values.push_back(std::move(value));
+    }
+}
+
+void ValueNumbering::number_children(BaseNode const *node) {
+    for (BaseNode const *child : node->children()) {
+        number(child);
+    }
+}
+
+void ValueNumbering::number_branch(BaseNode const *condition,
+        BaseNode const *branch) {
+    number(condition);
+    Available saved = m_available;
+    number(branch);
+    join(saved);
+}
+
+void ValueNumbering::number_branches(
+        std::vector<BaseNode *> const &children) {
+    // Values available after each of the branches
+    number(children[0]);
+    Available saved = m_available;
+    number(children[1]);
+    for (std::size_t i = 2; i < children.size(); i++) {
+        Available taken = m_available;
+        m_available = saved;
+        number(children[i]);
+        join(taken);
+    }
+}
+
+void ValueNumbering::number_loop(BaseNode const *init, BaseNode const *cond,
+        BaseNode const *post, BaseNode const *body) {
+    // The condition and body start at labels joining the back edge
+    number(init);
+    m_available.clear();
+    number(cond);
+    m_available.clear();
+    number(body);
+    number(post);
+    m_available.clear();
+}
+
+void ValueNumbering::number_address(BaseNode const *node) {
+    // Addresses of variables are constant
+    if (node->is_lvalue()) {
+        number_children(node);
+    }
+}
+
+void ValueNumbering::number_call(CallNode const *call) {
+    auto const &args = call->args();
+    BaseNode const *definition = call->overload_id() == 0 ? nullptr
+            : m_symbol_table.get(call->overload_id()).definition;
+    auto function = dynamic_cast<FunctionNode const *>(definition);
+    auto inline_function = dynamic_cast<InlineNode const *>(definition);
+    BaseNode const *target = nullptr;
+    if ((function != nullptr && function->writeback())
+            || (inline_function != nullptr && inline_function->writeback())) {
+        target = args.front();
+    }
+    std::optional<std::vector<std::size_t>> order = arg_order(call);
+    if (order.has_value()) {
+        bool adjacent = args_adjacent(call);
+        std::optional<uint32_t> previous;
+        for (std::size_t i : order.value()) {
+            BaseNode const *arg = args[i];
+            NumberedValue value;
+            std::optional<uint32_t> key = value_key(arg, value);
+            if (arg == target) {
+                number_address(arg);
+                key.reset();
+            } else if (adjacent && key.has_value() && key == previous) {
+                m_duplicates.push_back(arg);
+            } else {
+                number(arg);
+            }
+            previous = key;
+        }
+    } else {
+        // Values are only shared within an argument, which is evaluated
+        // at an unknown point of the call
+        for (auto const &arg : args) {
+            m_available.clear();
+            if (arg == target) {
+                number_address(arg);
+            } else {
+                number(arg);
+            }
+        }
+        m_available.clear();
+    }
+    if (!is_pure_callee(call)) {
+        forget_stores(std::nullopt);
+    }
+    if (target != nullptr) {
+        number_store(target, nullptr);
+    }
+}
+
+// Removes values a store may change. The value stored by an assignment is
+// known afterwards, unless its address depends on memory itself.
+void ValueNumbering::number_store(BaseNode const *target,
+        BaseNode const *store) {
+    NumberedValue value;
+    value.first = store;
+    std::optional<uint32_t> stored = key(target, value);
+    ValueKind kind = stored.has_value() ? m_kinds[stored.value()]
+            : ValueKind::Constant;
+    forget_stores(kind == ValueKind::Variable
+            ? std::optional<SymbolId>(target->id()) : std::nullopt);
+    if (store == nullptr || (kind != ValueKind::Subscript
+            && kind != ValueKind::Dereference)) {
+        return;
+    }
+    NumberedValue address;
+    for (BaseNode const *child : target->children()) {
+        key(child, address);
+    }
+    if (!address.memory) {
+        m_available[stored.value()] = m_values.size();
+        m_values.push_back(std::move(value));
+    }
+}
+
+void ValueNumbering::number_declaration(SymbolId id,
+        std::vector<BaseNode *> const &children) {
+    for (BaseNode const *child : children) {
+        number(child);
+    }
+    if (!children.empty()) {
+        forget_stores(id);
+    }
+}
+
+void ValueNumbering::forget() {
+    m_available.clear();
+}
+
+// Removes the values a store to the local, or to memory without one, may
+// change
+void ValueNumbering::forget_stores(std::optional<SymbolId> local) {
+    bool memory = !local.has_value()
+            || m_address_taken.count(local.value()) != 0
+            || m_symbol_table.get(local.value()).storage_type
+                != StorageType::Relative;
+    for (auto iter = m_available.begin(); iter != m_available.end();) {
+        NumberedValue const &value = m_values[iter->second];
+        if ((memory && value.memory)
+                || (local.has_value()
+                    && value.locals.count(local.value()) != 0)) {
+            iter = m_available.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+}
+
+void ValueNumbering::join(Available const &other) {
+    for (auto iter = m_available.begin(); iter != m_available.end();) {
+        auto found = other.find(iter->first);
+        if (found == other.end() || found->second != iter->second) {
+            iter = m_available.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+}
+
+uint32_t ValueNumbering::apply(Serializer &serializer,
+        std::string const &name) const {
+    std::vector<NumberedValue const *> kept;
+    std::size_t reused = m_duplicates.size();
+    for (NumberedValue const &value : m_values) {
+        // Keeping a copy takes a Dup and a StoreRel, each reuse saves all
+        // but a LoadRel
+        if ((value.cost - 1) * value.reuses.size() > 2) {
+            kept.push_back(&value);
+            reused += value.reuses.size();
+        }
+    }
+    uint32_t offset = serializer.reserve_frame(kept.size());
+    for (NumberedValue const *value : kept) {
+        serializer.number_value(value->first, ValueUse::Keep, offset);
+        for (BaseNode const *reuse : value->reuses) {
+            serializer.number_value(reuse, ValueUse::Reuse, offset);
+        }
+        offset++;
+    }
+    for (BaseNode const *duplicate : m_duplicates) {
+        serializer.number_value(duplicate, ValueUse::Dup, 0);
+    }
+    if (reused > 0) {
+        serializer.add_remark("reused " + std::to_string(reused)
+                + " computed values in " + name);
+    }
+    return kept.size();
+}
+
+// Hooks of the nodes. Nodes not numbered here end the block, as they may
+// have any effect.
+
+std::optional<uint32_t> BaseNode::value_key(ValueNumbering &,
+        NumberedValue &) const {
+    return std::nullopt;
+}
+
+void BaseNode::number_values(ValueNumbering &numbering) const {
+    numbering.forget();
+}
+
+std::optional<uint32_t> VariableNode::value_key(ValueNumbering &numbering,
+        NumberedValue &value) const {
+    switch (numbering.symbol_table().get(id()).storage_type) {
+        case StorageType::Relative:
+            value.locals.insert(id());
+            value.memory |= numbering.is_address_taken(id());
+            break;
+        case StorageType::Absolute:
+            value.memory = true;
+            break;
+        case StorageType::AbsoluteRef:
+        case StorageType::RelativeRef:
+        case StorageType::Callable:
+            break;
+        default:
+            return std::nullopt;
+    }
+    value.cost += 1;
+    return numbering.intern(ValueKind::Variable, id());
+}
+
+void VariableNode::number_values(ValueNumbering &) const {}
+
+std::optional<uint32_t> LiteralNode::value_key(ValueNumbering &numbering,
+        NumberedValue &) const {
+    // Constants mostly end up as immediates, so they cost nothing
+    std::optional<uint32_t> constant = get_constant_value();
+    if (!constant.has_value()) {
+        return std::nullopt;
+    }
+    return numbering.intern(ValueKind::Constant, constant.value());
+}
+
+void LiteralNode::number_values(ValueNumbering &) const {}
+
+void AddressOfNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_address(operand());
+}
+
+std::optional<uint32_t> DereferenceNode::value_key(
+        ValueNumbering &numbering, NumberedValue &value) const {
+    std::optional<uint32_t> address = numbering.key(operand(), value);
+    if (!address.has_value()) {
+        return std::nullopt;
+    }
+    value.memory = true;
+    value.cost += 1;
+    return numbering.intern(ValueKind::Dereference, 0, {address.value()});
+}
+
+void DereferenceNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_children(this);
+}
+
+void AssignNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_address(left());
+    numbering.number(right());
+    numbering.number_store(left(), this);
+}
+
+void AndNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_branch(left(), right());
+}
+
+void OrNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_branch(left(), right());
+}
+
+std::optional<uint32_t> SubscriptNode::value_key(ValueNumbering &numbering,
+        NumberedValue &value) const {
+    std::optional<uint32_t> base = numbering.key(left(), value);
+    std::optional<uint32_t> offset = numbering.key(right(), value);
+    if (!base.has_value() || !offset.has_value()) {
+        return std::nullopt;
+    }
+    value.memory = true;
+    value.cost += 2;
+    return numbering.intern(ValueKind::Subscript, 0,
+            {base.value(), offset.value()});
+}
+
+void SubscriptNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_children(this);
+}
+
+std::optional<uint32_t> CallNode::value_key(ValueNumbering &numbering,
+        NumberedValue &value) const {
+    if (!numbering.is_pure_callee(this)) {
+        return std::nullopt;
+    }
+    SymbolTable const &symbol_table = numbering.symbol_table();
+    ValueKind kind = ValueKind::Call;
+    SymbolId callee = m_overload_id;
+    if (symbol_table.get(m_func->id()).storage_type
+            == StorageType::Intrinsic) {
+        kind = ValueKind::Intrinsic;
+        callee = m_func->id();
+        value.cost += 1;
+    } else {
+        // Functions not expanded inline also push and pop a frame
+        value.cost += dynamic_cast<FunctionNode const *>(symbol_table.get(
+                m_overload_id).definition) != nullptr ? 8 : 1;
+    }
+    std::vector<uint32_t> operands;
+    for (auto const &arg : args()) {
+        std::optional<uint32_t> arg_key = numbering.key(arg, value);
+        if (!arg_key.has_value()) {
+            return std::nullopt;
+        }
+        operands.push_back(arg_key.value());
+    }
+    return numbering.intern(kind, callee, std::move(operands));
+}
+
+void CallNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_call(this);
+}
+
+void TernaryNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_branches(children());
+}
+
+void AttributeNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_children(this);
+}
+
+void LambdaNode::number_values(ValueNumbering &) const {}
+
+void EmptyNode::number_values(ValueNumbering &) const {}
+
+void BlockNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_children(this);
+}
+
+void ScopeNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_children(this);
+}
+
+void TypeDeclarationNode::number_values(ValueNumbering &) const {}
+
+void IfNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_branch(m_cond, m_case_true);
+}
+
+void IfElseNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_branches(children());
+}
+
+void SwitchNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_branches(children());
+}
+
+void ForLoopNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_loop(m_init, m_cond, m_post, m_body);
+}
+
+void ReturnNode::number_values(ValueNumbering &numbering) const {
+    numbering.number(m_operand);
+    numbering.forget();
+}
+
+void VarDeclarationNode::number_values(ValueNumbering &numbering) const {
+    numbering.number_declaration(id(), children());
+}
+
+void ExpressionStatementNode::number_values(
+        ValueNumbering &numbering) const {
+    numbering.number_children(this);
+}
@@ -13,5 +13,23 @@ inline <(x, y): __ilt__(x, y);
 inline <=(x, y): __ile__(x, y);
 inline >(x, y): __ilt__(y, x);
 inline >=(x, y): __ile__(y, x);
+inline ~(x): __inot__(x);
+inline &(x, y): __iand__(x, y);
+inline |(x, y): __ior__(x, y);
+inline ^(x, y): __ixor__(x, y);
+inline <<(x, y): __ishl__(x, y);
+inline >>(x, y): __ishr__(x, y);
 
 inline exit(x): __exit__(x);
+
+fn min(x, y) {
+    return __select__(x < y, x, y);
+}
+
+fn max(x, y) {
+    return __select__(x < y, y, x);
+}
+
+fn abs(x) {
+    return __select__(x < 0, -x, x);
+}
@@ -0,0 +1,17 @@
+include core;
+
+fn popcount(x) {
+    var n = 0;
+    while (x) {
+        n = n + (x & 1);
+        x = (x >> 1) & 2147483647;
+    }
+    return n;
+}
+
+fn main() {
+    var x = 12345;
+    var h = (x << 5) ^ (x >> 2) | 3;
+    var parts = (h & 255) % 16 + (h & 4095) / 64 + x * 8;
+    return (popcount(~0) + parts + (-17 >> 2) + (-17 / 4)) & 255;
+}
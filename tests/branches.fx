@@ -0,0 +1,35 @@
+include core;
+
+var calls;
+
+fn check(x) {
+    calls = calls + 1;
+    return x;
+}
+
+fn classify(c) {
+    if (c >= '0' && c <= '9' || c == '_') {
+        return 1;
+    }
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+        return 2;
+    }
+    return 0;
+}
+
+fn main() {
+    var i;
+    var total = 0;
+    for (i = 0; i < 128 && total < 1000; i = i + 1) {
+        total = total + classify(i);
+    }
+    var both = check(0) && check(1);
+    var either = check(1) || check(0);
+    if (check(1) && check(0) || check(1)) {
+        total = total + 100;
+    }
+    while (i > 0 && (i % 7 != 0 || i == 7)) {
+        i = i - 1;
+    }
+    return total + calls * 1000 + both + either * 10 + i;
+}
@@ -0,0 +1,113 @@
+#!/bin/sh
+# Usage: tests/check.sh
+# Compiles and runs the programs whose output or compile time is checked,
+# and reports those that fail
+cd "$(dirname "$0")/.."
+source=$(mktemp /tmp/flexul-test-XXXXXX.fx)
+trap 'rm -f "$source"' EXIT
+failed=0
+
+# check <seconds> <expected output line> <fx arguments...>
+check() {
+    seconds=$1
+    expected=$2
+    shift 2
+    if ! timeout "$seconds" ./fx "$@" 2>&1 | grep -qxF -- "$expected"; then
+        echo "FAILED: fx $* (expected '$expected' within ${seconds}s)"
+        failed=1
+        return 1
+    fi
+}
+
+# Operations that trap are not evaluated at compile time
+for level in 0 2; do
+    check 5 "Program finished with exit code 7 (7)" \
+            tests/evaltraps.fx -O$level
+done
+check 5 "    not evaluated 'modulo': Division by zero" \
+        tests/evaltraps.fx --remarks
+check 5 "    not evaluated 'divide': Division overflow" \
+        tests/evaltraps.fx --remarks
+check 5 "    not evaluated 'large': Stack limit exceeded" \
+        tests/evaltraps.fx --remarks
+
+# Evaluations share one budget, however many calls there are
+awk 'BEGIN {
+    print "include core;\n\nfn spin(x) {\n    var i = 0;"
+    print "    while (i < 100000000) {\n        i = i + 1;\n    }"
+    print "    return x;\n}\n\nfn main() {\n    var n = 0;\n    if (n) {"
+    for (i = 0; i < 50; i++) {
+        print "        n = n + spin(" i ");"
+    }
+    print "    }\n    return 5;\n}"
+}' > "$source"
+check 1 "Program finished with exit code 5 (5)" "$source" -O2
+
+# Expressions up to the limits of the parser compile, deeper ones are
+# reported: a sum of 10000 terms is 19999 nodes deep, and 1999 parentheses
+# nest 2000 expressions
+sum() {
+    awk -v n="$1" 'BEGIN {
+        printf "include core;\n\nfn main() {\n    return 1"
+        for (i = 1; i < n; i++) {
+            printf (i % 20 == 0) ? "\n        + 1" : " + 1"
+        }
+        print ";\n}"
+    }' > "$source"
+}
+nest() {
+    awk -v n="$1" 'BEGIN {
+        printf "include core;\n\nfn main() {\n    return 1"
+        for (i = 0; i < n; i++) {
+            printf (i % 16 == 15) ? " + (\n        1" : " + (1"
+        }
+        for (i = 0; i < n; i++) {
+            printf ")"
+        }
+        print ";\n}"
+    }' > "$source"
+}
+for level in 0 2; do
+    sum 10000
+    check 5 "Program finished with exit code 10000 (10000)" \
+            "$source" -O$level
+    nest 1999
+    check 5 "Program finished with exit code 2000 (2000)" \
+            "$source" -O$level
+done
+sum 10001
+check 5 "Error: $source:504:12: Expression too deep" "$source"
+nest 2000
+check 5 "Error: $source:129:9: Expression too deep" "$source"
+
+# Value numbering keys each node of a long expression once
+awk 'BEGIN {
+    printf "include core;\n\nfn sum(x) {\n    return x"
+    for (i = 1; i < 9500; i++) {
+        printf (i % 20 == 0) ? "\n        + x" : " + x"
+    }
+    print ";\n}\n\nfn main() {\n    return sum(1);\n}"
+}' > "$source"
+check 2 "Program finished with exit code 9500 (9500)" "$source" -O2
+
+# Both VMs raise errors for operations that trap, and grow memory only for
+# the frames of the functions called
+for vm in stack register; do
+    check 5 "Error: Division overflow" tests/divtrap.fx -O0 --vm=$vm
+    ( ulimit -v 300000 && check 5 "Program finished with exit code 7 (7)" \
+            tests/evaltraps.fx -O0 --vm=$vm ) || failed=1
+done
+awk 'BEGIN {
+    print "include core;\n\nfn modulo(x, y) {\n    return x % y;\n}\n"
+    print "fn main() {\n    var i;\n    var sum = 0;"
+    print "    for (i = 2; i >= 0; i = i - 1) {"
+    print "        sum = sum + modulo(5, i);\n    }\n    return sum;\n}"
+}' > "$source"
+for vm in stack register; do
+    check 5 "Error: Division by zero" "$source" -O0 --vm=$vm
+done
+
+if [ "$failed" -eq 0 ]; then
+    echo "All checks passed"
+fi
+exit "$failed"
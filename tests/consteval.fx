@@ -0,0 +1,18 @@
+include core;
+
+fn triangle(n) {
+    var sum = 0;
+    var i;
+    for (i = 1; i <= n; i = i + 1) {
+        sum = sum + i;
+    }
+    return sum;
+}
+
+fn fib(n) {
+    return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+fn main() {
+    return (triangle(1000) + fib(20)) % 256;
+}
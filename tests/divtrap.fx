@@ -0,0 +1,14 @@
+include core;
+
+fn divide(x, y) {
+    return x / y;
+}
+
+fn main() {
+    var sum = 0;
+    var i;
+    for (i = 0; i < 3; i = i + 1) {
+        sum = sum + divide(0 - 2147483647 - 1, i - 1);
+    }
+    return sum;
+}
@@ -0,0 +1,21 @@
+include core;
+
+fn modulo(x) {
+    return 5 % x;
+}
+
+fn divide(x, y) {
+    return x / y;
+}
+
+fn large(x) {
+    var a[100000000];
+    return x;
+}
+
+fn main() {
+    if (0) {
+        return modulo(0) + divide(0 - 2147483647 - 1, 0 - 1) + large(1);
+    }
+    return 7;
+}
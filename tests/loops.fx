@@ -0,0 +1,21 @@
+include core;
+
+var used[256];
+
+fn fill(n, scale) {
+    var i;
+    var total = 0;
+    for (i = 0; i < n - 1; i = i + 1) {
+        used[i] = used[i] + i * (scale + 1);
+        used[i] = used[i] - used[i] / 2 + used[i] % 3;
+    }
+    for (i = 0; i < n - 1; i = i + 1) {
+        total = total + used[i];
+    }
+    return total;
+}
+
+fn main() {
+    var n = 256;
+    return fill(n, 3) % 256;
+}
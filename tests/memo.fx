@@ -0,0 +1,13 @@
+include core;
+
+memo fn fib(n) {
+    if (n < 2) {
+        return n;
+    }
+    return fib(n - 1) + fib(n - 2);
+}
+
+fn main() {
+    var n = 40;
+    return fib(n) % 1000;
+}
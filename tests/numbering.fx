@@ -0,0 +1,33 @@
+include core;
+
+var data[16];
+
+fn bump(p) {
+    *p = *p + 1;
+    return 0;
+}
+
+fn square(i) {
+    return data[i] * data[i];
+}
+
+fn aliased(p, i) {
+    var a = data[i] + data[i];
+    *p = 10;
+    var b = data[i];
+    bump(&data[i]);
+    var c = data[i];
+    data[i] = c * 2;
+    if (data[i] > 20) {
+        c = c + data[i];
+    }
+    return a + b + c + data[i];
+}
+
+fn main() {
+    var i;
+    for (i = 0; i < 16; i = i + 1) {
+        data[i] = i;
+    }
+    return square(3) + aliased(&data[5], 5);
+}
@@ -0,0 +1,12 @@
+include core;
+
+fn main() {
+    var x = 6;
+    var y = 3;
+    var r = 1 + 2 * 3 - 8 / 4 % 3;
+    r = r + (x - y - 1) * 10 + (x << 1 + 1) - (64 >> 2 >> 1);
+    r = r + (x & 3 | y ^ 5) + (1 < 2 == 2 > 1) + (x == y == 0);
+    r = r + - - x + - ~y * 2 + (x > y && y > 0 || x < 0);
+    r = r + (x * y > 10 ? x - y : y - x);
+    return r & 255;
+}
@@ -0,0 +1,42 @@
+include core;
+
+fn set(p, v) {
+    *p = v;
+    return v;
+}
+
+fn apply(f, x, y) {
+    return f(x, y);
+}
+
+fn depth(n) {
+    var a = n;
+    var b = n * 2;
+    if (n == 0) {
+        return 0;
+    }
+    var c = depth(n - 1);
+    return a + b + c;
+}
+
+fn count(n, acc) {
+    var seen;
+    if (n == 0) {
+        return acc + seen;
+    }
+    seen = seen + 1;
+    return count(n - 1, acc + seen);
+}
+
+fn main() {
+    var a = 1;
+    var b = 2;
+    var c;
+    var d = 4;
+    var e = 5;
+    var f;
+    set(&f, 6);
+    c = a + b;
+    e = e + apply(lambda(x, y): x * y, c, d);
+    return a + b + c + d + e + f + depth(3) + count(4, 0);
+}
@@ -0,0 +1,24 @@
+include core;
+
+var scores[8];
+
+fn clamp(x, lo, hi) {
+    return max(lo, min(x, hi));
+}
+
+fn score(i) {
+    var s = scores[i];
+    return s > 50 ? s - 50 : 50 - s;
+}
+
+fn main() {
+    var i;
+    var total = 0;
+    for (i = 0; i < 8; i = i + 1) {
+        scores[i] = i * 17 % 100;
+    }
+    for (i = 0; i < 8; i = i + 1) {
+        total = total + score(i) + clamp(scores[i], 20, 80) + abs(i - 4);
+    }
+    return total;
+}
@@ -0,0 +1,39 @@
+include core;
+
+var data[8];
+
+fn swap_sum(n) {
+    var a = 1;
+    var b = 2;
+    var i;
+    for (i = 0; i < n; i = i + 1) {
+        var t = a;
+        a = b;
+        b = t + b * 0;
+    }
+    return a * 10 + b;
+}
+
+fn collatz(n) {
+    var steps;
+    for (steps = 0; n != 1; steps = steps + 1) {
+        if (n % 2 == 0) {
+            n = n / 2;
+        } else {
+            n = 3 * n + 1;
+        }
+    }
+    return steps;
+}
+
+fn through_memory(x) {
+    var y = x + 1;
+    var p = &y;
+    *p = *p * 2;
+    data[x] = y + x * 4 - x * 4;
+    return data[x] + data[x];
+}
+
+fn main() {
+    return swap_sum(5) + collatz(27) + through_memory(3);
+}
@@ -0,0 +1,50 @@
+include core;
+
+fn digit(c) {
+    switch (c) {
+        case '0': return 0;
+        case '1': return 1;
+        case '2': return 2;
+        case '3': return 3;
+        case '4': return 4;
+        case '5': return 5;
+        case '6', '7', '8', '9': return c - '0';
+        default: return -1;
+    }
+}
+
+fn sparse(x) {
+    var result = 0;
+    switch (x) {
+        case -100: result = 1;
+        case 3: result = 2;
+        case 17, 18: result = 3;
+        case 250: result = 4;
+        case 1000: result = 5;
+        case 65536: result = 6;
+    }
+    return result;
+}
+
+fn small(x) {
+    switch (x) {
+        case 1: { return 10; }
+        default: { return 20; }
+    }
+}
+
+fn main() {
+    var total = 0;
+    var i;
+    for (i = 0; i < 128; i = i + 1) {
+        total = total + digit(i);
+    }
+    for (i = -200; i < 70000; i = i + 1) {
+        total = total + sparse(i);
+    }
+    switch (3) {
+        case 3: total = total + 1000;
+        default: total = total + 1;
+    }
+    return total + small(1) + small(2) * 2;
+}
@@ -0,0 +1,33 @@
+include core;
+
+fn sum(n, acc) {
+    if (n == 0) {
+        return acc;
+    }
+    return sum(n - 1, acc + n);
+}
+
+fn is_even(n) {
+    if (n == 0) {
+        return 1;
+    }
+    return is_odd(n - 1);
+}
+
+fn is_odd(n) {
+    if (n == 0) {
+        return 0;
+    }
+    return is_even(n - 1);
+}
+
+fn apply(f, x) {
+    return f(x, 0);
+}
+
+fn main() {
+    if (is_even(100001)) {
+        return 1;
+    }
+    return apply(sum, 100000) % 1000;
+}
@@ -0,0 +1,27 @@
+include core;
+
+typedef Bool like true, false;
+
+fn pick(x: Int, y: Int) {
+    return 1;
+}
+
+fn pick(x: Bool, y: Int) {
+    return 2;
+}
+
+fn pick(x: Int, y: Bool) {
+    return 4;
+}
+
+fn pick(x, y: Bool) {
+    return 8;
+}
+
+fn main() {
+    var i: Int = 3;
+    var b: Bool = true;
+    var a = 5;
+    return pick(i, 0) + pick(b, i) + pick(0, false) + pick(a, b)
+            + pick(1, 2) + pick(true, 0) * 16;
+}
@@ -0,0 +1,9 @@
+include core;
+
+fn g(a, b) {
+    return a * 100 + b;
+}
+
+fn main() {
+    return g(2, ~5) + g(2, -8) * 1000;
+}
@@ -0,0 +1,26 @@
+include core;
+
+var table[64];
+
+fn fill(n) {
+    var i;
+    var sum = 0;
+    for (i = 0; i < 64; i = i + 1) {
+        table[i] = i * i;
+    }
+    for (i = 0; i < n; i = i + 1) {
+        sum = sum + table[i];
+    }
+    for (i = 0; i <= 2; i = i + 1) {
+        sum = sum + i;
+    }
+    for (i = 1; i < 60; i = i + 7) {
+        sum = sum - table[i];
+    }
+    return sum;
+}
+
+fn main() {
+    var n = 51;
+    return fill(n) % 256;
+}